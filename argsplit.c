@@ -0,0 +1,328 @@
+/*
+ * argsplit.c
+ *
+ * Running a command whose arguments are too big for one exec as
+ * several runs, in the way xargs does
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strlen
+#include <sys/wait.h>           // waitpid
+#include <unistd.h>             // sysconf
+
+#include "argsplit.h"
+#include "spawn.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+
+#define FALLBACK_ARG_MAX (128 * 1024)   // if sysconf() cannot say
+
+extern char **environ;
+
+static size_t arg_limit = 0;    // argsplit_limit(), once read
+
+
+/*
+ * Returns the bytes one string costs exec: itself, its NUL and its
+ * pointer
+ */
+static size_t string_bytes(const char *s)
+{
+  return strlen(s) + 1 + sizeof(char *);
+}
+
+
+/*
+ * Waits for a child
+ *
+ * Returns:
+ *   Its exit status, or 128 plus the signal that killed it
+ */
+static int wait_status(pid_t pid)
+{
+  int status;
+
+  while (waitpid(pid, &status, 0) == -1)
+    if (errno != EINTR)
+      return 127;
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the argsplit calls.  All documentation is in the
+ * argsplit.h file.
+ *
+ **********************************************************************/
+
+size_t argsplit_vector_bytes(char *const v[])
+{
+  size_t bytes = sizeof(char *);
+
+  for (int i=0; v && v[i]; i++)
+    bytes += string_bytes(v[i]);
+  return bytes;
+}
+
+
+size_t argsplit_limit()
+{
+  if (arg_limit == 0) {
+    long max = sysconf(_SC_ARG_MAX);
+    if (max <= 0)
+      max = FALLBACK_ARG_MAX;
+    arg_limit = max - ARGSPLIT_HEADROOM;
+  }
+  return arg_limit;
+}
+
+
+int argsplit_run(const char *path, char *const argv[], int lead, int trail,
+                 char *const envp[], int in_fd, int out_fd, int max_jobs)
+{
+  int argc = 0;
+  while (argv[argc])
+    argc++;
+
+  if (lead < 1 || trail < 0 || lead + trail > argc || max_jobs < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // the fixed arguments and the environment go into every batch
+  int first = lead;
+  int end = argc - trail;
+  size_t fixed = argsplit_vector_bytes(envp ? envp : environ) + sizeof(char *);
+  for (int i=0; i < argc; i++)
+    if (i < first || i >= end)
+      fixed += string_bytes(argv[i]);
+
+  size_t limit = argsplit_limit();
+  if (fixed >= limit) {
+    errno = E2BIG;
+    return -1;
+  }
+  size_t room = limit - fixed;
+
+  // every batch is planned before any runs, so that an argument too
+  // long for any batch stops the whole command
+  int *ends = malloc((end - first + 1) * sizeof(int));
+  if (!ends)
+    return -1;
+
+  int n_batches = 0;
+  for (int i=first; i < end; ) {
+    size_t used = 0;
+    int j = i;
+    while (j < end && used + string_bytes(argv[j]) <= room)
+      used += string_bytes(argv[j++]);
+    if (j == i) {
+      free(ends);
+      errno = E2BIG;
+      return -1;
+    }
+    ends[n_batches++] = j;
+    i = j;
+  }
+
+  // with nothing between the fixed arguments, the command runs once
+  if (n_batches == 0)
+    ends[n_batches++] = end;
+
+  char **batch = malloc((argc + 1) * sizeof(char *));
+  pid_t *pids = malloc(n_batches * sizeof(pid_t));
+  if (!batch || !pids) {
+    free(ends);
+    free(batch);
+    free(pids);
+    return -1;
+  }
+  memcpy(batch, argv, lead * sizeof(char *));
+
+  int status = 0;
+  int spawn_errno = 0;
+  int started = 0;
+  int reaped = 0;
+  while (reaped < n_batches) {
+    // starting batches until max_jobs are running; the spawn has
+    // exec'd by the time it returns, so batch can be reused at once
+    while (!spawn_errno && started < n_batches && started - reaped < max_jobs) {
+      int from = started == 0 ? first : ends[started - 1];
+      int n = ends[started] - from;
+      memcpy(batch + lead, argv + from, n * sizeof(char *));
+      memcpy(batch + lead + n, argv + end, trail * sizeof(char *));
+      batch[lead + n + trail] = NULL;
+
+      pid_t pid = spawn_process(path, batch, envp, in_fd, out_fd);
+      if (pid == -1)
+        spawn_errno = errno;
+      else
+        pids[started++] = pid;
+    }
+
+    // after a failed start, only the running batches are left
+    if (reaped == started)
+      break;
+
+    // the oldest batch is waited for first, so that the status kept
+    // is that of the first failure in argument order
+    int batch_status = wait_status(pids[reaped++]);
+    if (status == 0)
+      status = batch_status;
+  }
+
+  free(ends);
+  free(batch);
+  free(pids);
+
+  if (spawn_errno) {
+    errno = spawn_errno;
+    return -1;
+  }
+  return status;
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+/*
+ * Runs argv split with the given limit, output going to a temporary
+ * file
+ *
+ * Returns:
+ *   The status from argsplit_run(); the output is left in out, which
+ *   must have room for size bytes
+ */
+static int run_split(char *const argv[], int lead, int trail, size_t limit,
+                     int max_jobs, char *out, size_t size)
+{
+  char name[] = "/tmp/argsplit_XXXXXX";
+  int fd = mkstemp(name);
+  assert( fd != -1 );
+  unlink(name);
+
+  char *envp[] = {"ARGSPLIT=1", NULL};
+  arg_limit = limit;
+  int status = argsplit_run(argv[0], argv, lead, trail, envp, -1, fd, max_jobs);
+  arg_limit = 0;
+
+  ssize_t n = pread(fd, out, size - 1, 0);
+  assert( n >= 0 );
+  out[n] = '\0';
+  close(fd);
+  return status;
+}
+
+/*
+ * Returns the number of times c occurs in s
+ */
+static int count_char(const char *s, char c)
+{
+  int n = 0;
+  for (; *s; s++)
+    n += *s == c;
+  return n;
+}
+
+void test_argsplit()
+{
+  char out[4096];
+  char *envp[] = {"ARGSPLIT=1", NULL};
+
+  assert( argsplit_vector_bytes(NULL) == sizeof(char *) );
+  assert( argsplit_vector_bytes(envp) == 11 + 2 * sizeof(char *) );
+  assert( argsplit_limit() > ARGSPLIT_HEADROOM );
+
+  // twenty items between "echo" and "END", a few to a batch
+  char *argv[24];
+  char items[20][4];
+  argv[0] = "/bin/echo";
+  for (int i=0; i < 20; i++) {
+    snprintf(items[i], sizeof(items[i]), "a%02d", i);
+    argv[i + 1] = items[i];
+  }
+  argv[21] = "END";
+  argv[22] = NULL;
+
+  size_t fixed = argsplit_vector_bytes(envp) + sizeof(char *) + 10 + 4 + 2 * sizeof(char *);
+  size_t per_item = 4 + sizeof(char *);
+
+  // all in one, when it fits
+  assert( run_split(argv, 1, 1, argsplit_limit(), 1, out, sizeof(out)) == 0 );
+  assert( count_char(out, '\n') == 1 );
+  assert( strncmp(out, "a00 a01 ", 8) == 0 );
+  assert( strcmp(out + strlen(out) - 9, " a19 END\n") == 0 );
+
+  // three items to a batch: seven runs, in order, each with both ends
+  assert( run_split(argv, 1, 1, fixed + 3 * per_item, 1, out, sizeof(out)) == 0 );
+  assert( count_char(out, '\n') == 7 );
+  assert( strncmp(out, "a00 a01 a02 END\na03 a04 a05 END\n", 32) == 0 );
+  assert( strcmp(out + strlen(out) - 12, "a18 a19 END\n") == 0 );
+
+  // the same batches, several at a time
+  assert( run_split(argv, 1, 1, fixed + 3 * per_item, 4, out, sizeof(out)) == 0 );
+  assert( count_char(out, '\n') == 7 );
+  assert( count_char(out, 'E') == 7 );
+  assert( strstr(out, "a15 a16 a17 END\n") != NULL );
+
+  // no room for even one item
+  errno = 0;
+  assert( run_split(argv, 1, 1, fixed + per_item - 1, 1, out, sizeof(out)) == -1 );
+  assert( errno == E2BIG && out[0] == '\0' );
+
+  // nothing to split runs once
+  char *bare[] = {"/bin/echo", "only", NULL};
+  assert( run_split(bare, 2, 0, argsplit_limit(), 1, out, sizeof(out)) == 0 );
+  assert( strcmp(out, "only\n") == 0 );
+
+  // the status is that of the first batch to fail
+  char *sh[] = {"/bin/sh", "-c", "for a; do case $a in e*) exit ${a#e};; esac; done", "sh",
+                "ok", "ok", "e3", "ok", "e5", "ok", NULL};
+  size_t sh_fixed = argsplit_vector_bytes(envp) + sizeof(char *);
+  for (int i=0; i < 4; i++)
+    sh_fixed += strlen(sh[i]) + 1 + sizeof(char *);
+  assert( run_split(sh, 4, 0, sh_fixed + 2 * (3 + sizeof(char *)), 1, out, sizeof(out)) == 3 );
+  assert( run_split(sh, 4, 0, sh_fixed + 2 * (3 + sizeof(char *)), 3, out, sizeof(out)) == 3 );
+  assert( run_split(sh, 4, 0, argsplit_limit(), 1, out, sizeof(out)) == 3 );
+
+  // a batch killed by a signal
+  char *kill_sh[] = {"/bin/sh", "-c", "kill -TERM $$", "sh", "x", NULL};
+  assert( run_split(kill_sh, 4, 0, argsplit_limit(), 1, out, sizeof(out)) == 128 + 15 );
+
+  // a program that cannot be run starts nothing
+  char *missing[] = {"/does/not/exist", "a", "b", NULL};
+  errno = 0;
+  assert( run_split(missing, 1, 0, argsplit_limit(), 2, out, sizeof(out)) == -1 );
+  assert( errno == ENOENT );
+
+  // bad counts
+  errno = 0;
+  assert( argsplit_run(argv[0], argv, 0, 0, NULL, -1, -1, 1) == -1 && errno == EINVAL );
+  assert( argsplit_run(argv[0], argv, 20, 3, NULL, -1, -1, 1) == -1 && errno == EINVAL );
+  assert( argsplit_run(argv[0], argv, 1, 0, NULL, -1, -1, 0) == -1 && errno == EINVAL );
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_argsplit();
+  fprintf(stderr, "test_argsplit: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
@@ -0,0 +1,73 @@
+/*
+ * argsplit.h
+ *
+ * Running a command whose arguments are too big for one exec as
+ * several runs, in the way xargs does
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _ARGSPLIT_H_
+#define _ARGSPLIT_H_
+
+#include <stddef.h>
+
+/*
+ * Bytes kept free below sysconf(_SC_ARG_MAX), for what the kernel
+ * puts next to argv and envp on the new stack (the program's path,
+ * the auxiliary vector) and for the rounding it does
+ */
+#define ARGSPLIT_HEADROOM 2048
+
+/*
+ * Returns the number of bytes a NULL-terminated vector of strings
+ * takes up when passed to exec: every string with its NUL, and a
+ * pointer for each one and for the terminal NULL.
+ *
+ * Parameters:
+ *   v        The vector, or NULL for an empty one
+ *
+ * Returns:
+ *   The size in bytes
+ */
+size_t argsplit_vector_bytes(char *const v[]);
+
+/*
+ * Returns:
+ *   The most bytes argv and envp together may take up in one exec:
+ *   sysconf(_SC_ARG_MAX) less ARGSPLIT_HEADROOM, read once
+ */
+size_t argsplit_limit();
+
+/*
+ * Runs a command as a series of batches, each of which fits in
+ * argsplit_limit(). The first lead and the last trail arguments are
+ * fixed, and are passed to every batch; the arguments between them
+ * are split into runs taken in order, each as long as will fit. A
+ * single argument is never split, so one too long for any batch
+ * makes the command fail with E2BIG before anything is run.
+ *
+ * Up to max_jobs batches run at a time. All of them read from in_fd
+ * and write to out_fd, so the output of batches run together may be
+ * interleaved; with max_jobs of 1 it comes out in argument order.
+ *
+ * Parameters:
+ *   path      The path of the executable, as from pathcache_lookup()
+ *   argv      The full NULL-terminated argument vector
+ *   lead      The number of fixed arguments at the start, at least 1
+ *   trail     The number of fixed arguments at the end
+ *   envp      The environment of every batch, or NULL for environ
+ *   in_fd     File descriptor to become each batch's stdin, or -1
+ *   out_fd    File descriptor to become each batch's stdout, or -1
+ *   max_jobs  The most batches to have running at once, at least 1
+ *
+ * Returns:
+ *   The combined status: 0 if every batch exited with 0, otherwise the
+ *   status of the first batch, in argument order, that did not (128
+ *   plus the signal for one that was killed). -1 with errno set if a
+ *   batch could not be started, in which case no later batch is
+ *   started, but those already running are waited for.
+ */
+int argsplit_run(const char *path, char *const argv[], int lead, int trail,
+                 char *const envp[], int in_fd, int out_fd, int max_jobs);
+
+#endif /* _ARGSPLIT_H_ */
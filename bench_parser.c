@@ -0,0 +1,482 @@
+/*
+ * bench_parser.c
+ *
+ * Measures what read_word() and parse_input() cost per line over
+ * several corpora of command lines, what parse_input() costs per word
+ * for each kind of word, and how many commands per second the shell
+ * can parse, look up and run under each spawn backend.
+ *
+ * Usage: bench_parser [parse|word|exec] [recorded-corpus-file]
+ *
+ * A table is printed to stdout, and the same numbers are written as
+ * JSON to bench_output.txt, for comparing one run with another.
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "parser.h"
+#include "pathcache.h"
+#include "spawn.h"
+#include "vars.h"
+
+#define CORPUS_LINES 1000     // lines in each synthetic corpus
+#define LONG_ARGV_WORDS 500   // arguments on each long-argv line
+#define HUGE_LINE (4 << 20)   // bytes in each line of the multi-MB corpus
+#define BENCH_BYTES (8 << 20) // bytes each corpus is parsed for, in all
+#define EXEC_COMMANDS 2000    // commands run under each spawn backend
+#define BENCH_FILES 10        // files matched by the glob patterns
+#define BENCH_WORDS 100       // words in each per-word benchmark line
+#define BENCH_REPS 2000       // times each per-word line is parsed
+#define OUTPUT_FILE "bench_output.txt"
+#define RECORDED_CORPUS "bench_corpus.txt"
+
+
+/*
+ * A corpus: a set of lines, all parsed once per repetition
+ */
+typedef struct {
+  const char *name;
+  char **lines;
+  int n;
+  size_t bytes;           // total length of the lines
+} corpus_t;
+
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void corpus_add(corpus_t *corpus, const char *line)
+{
+  corpus->lines = realloc(corpus->lines, (corpus->n + 1) * sizeof(char *));
+  assert( corpus->lines );
+  assert( (corpus->lines[corpus->n++] = strdup(line)) );
+  corpus->bytes += strlen(line);
+}
+
+static void corpus_free(corpus_t *corpus)
+{
+  for (int i=0; i < corpus->n; i++)
+    free(corpus->lines[i]);
+  free(corpus->lines);
+}
+
+/*
+ * Builds the synthetic corpora. Each line differs a little from the
+ * next, so that nothing is parsed twice in a row.
+ */
+static void make_corpora(corpus_t *quote, corpus_t *variable, corpus_t *glob,
+                         corpus_t *long_argv)
+{
+  char line[LONG_ARGV_WORDS * 16];
+
+  for (int i=0; i < CORPUS_LINES; i++) {
+    snprintf(line, sizeof(line), "grep -e \"pattern %d\" \"two words\" "
+             "\"a \\\"quoted\\\" word\" one\\ two \"x|y\" file%d.log", i, i % 10);
+    corpus_add(quote, line);
+
+    snprintf(line, sizeof(line), "echo $HOME $BENCH_A-$BENCH_B \"$BENCH_A/%d\" "
+             "x$BENCH_B $PATH", i);
+    corpus_add(variable, line);
+
+    snprintf(line, sizeof(line), "ls *.log file?.log file[0-%d].log "
+             "{file1,file2}.log *.zz", i % 10);
+    corpus_add(glob, line);
+  }
+
+  // far fewer lines, since each one is so long
+  for (int i=0; i < CORPUS_LINES / 10; i++) {
+    int len = snprintf(line, sizeof(line), "cmd");
+    for (int w=0; w < LONG_ARGV_WORDS; w++)
+      len += snprintf(line + len, sizeof(line) - len, " arg%d_%d", i, w);
+    corpus_add(long_argv, line);
+  }
+}
+
+/*
+ * Builds lines of several megabytes each, as generated commands have:
+ * one quoted JSON payload, a list of paths, and words full of escapes.
+ * Each is parsed in one pass, however long its words are.
+ */
+static void make_huge_corpus(corpus_t *huge)
+{
+  char *line = malloc(HUGE_LINE + 64);
+  assert( line );
+
+  int len = sprintf(line, "curl -d \"");
+  for (int i=0; len < HUGE_LINE; i++)
+    len += sprintf(line + len, "{\\\"id\\\": %d, \\\"path\\\": \\\"/srv/data/%d\\\"}, ", i, i);
+  strcpy(line + len, "\"");
+  corpus_add(huge, line);
+
+  len = sprintf(line, "tar cf out.tar");
+  for (int i=0; len < HUGE_LINE; i++)
+    len += sprintf(line + len, " src/components/module%d/file%d.c", i / 100, i);
+  corpus_add(huge, line);
+
+  len = sprintf(line, "printf");
+  for (int i=0; len < HUGE_LINE; i++)
+    len += sprintf(line + len, " a\\ b\\t%d\\ c\\\"", i);
+  corpus_add(huge, line);
+
+  free(line);
+}
+
+/*
+ * Reads lines recorded from real sessions, skipping blank lines and
+ * comments
+ */
+static bool load_corpus(corpus_t *corpus, const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (!f)
+    return false;
+
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = '\0';
+    const char *p = line + strspn(line, " \t");
+    if (*p != '\0' && *p != '#')
+      corpus_add(corpus, line);
+  }
+  fclose(f);
+  return corpus->n > 0;
+}
+
+/*
+ * Returns how many times to go round a corpus for about BENCH_BYTES
+ */
+static int corpus_reps(const corpus_t *corpus)
+{
+  int reps = BENCH_BYTES / (corpus->bytes + 1);
+  return reps < 1 ? 1 : reps;
+}
+
+/*
+ * Splits every line of a corpus into words with read_word(), and
+ * returns the total time taken in nanoseconds. allocs is set to the
+ * number of command allocations made.
+ */
+static double bench_read_word(const corpus_t *corpus, int reps, unsigned int *allocs)
+{
+  // room for the longest word of any corpus
+  static char word[HUGE_LINE + 64];
+
+  unsigned int first = command_alloc_count();
+  double start = now_ns();
+  for (int r=0; r < reps; r++) {
+    for (int i=0; i < corpus->n; i++) {
+      const char *p = corpus->lines[i];
+      int n;
+      while ((n = read_word(p, word, sizeof(word))) > 0)
+        p += n;
+    }
+  }
+  double elapsed = now_ns() - start;
+  *allocs = command_alloc_count() - first;
+  return elapsed;
+}
+
+/*
+ * Parses every line of a corpus into a command, and returns the total
+ * time taken in nanoseconds. allocs is set to the number of command
+ * allocations made.
+ */
+static double bench_parse_input(const corpus_t *corpus, int reps, unsigned int *allocs)
+{
+  char err_msg[128];
+
+  unsigned int first = command_alloc_count();
+  double start = now_ns();
+  for (int r=0; r < reps; r++) {
+    for (int i=0; i < corpus->n; i++) {
+      command_t *cmd = parse_input(corpus->lines[i], err_msg, sizeof(err_msg));
+      if (!cmd) {
+        fprintf(stderr, "%s: %s: %s\n", corpus->name, corpus->lines[i], err_msg);
+        exit(1);
+      }
+      command_free(cmd);
+    }
+  }
+  double elapsed = now_ns() - start;
+  *allocs = command_alloc_count() - first;
+  return elapsed;
+}
+
+/*
+ * Prints one row of results, to the table and as a JSON object
+ */
+static void report_parse(FILE *json, bool first, const corpus_t *corpus,
+                         const char *function, int reps, double ns, unsigned int allocs)
+{
+  double lines = (double)corpus->n * reps;
+  double ns_per_line = ns / lines;
+  double bytes_per_sec = corpus->bytes * (double)reps / (ns / 1e9);
+  double allocs_per_line = allocs / lines;
+
+  printf("%-10s %-12s %8d %12.1f %10.1f %12.2f\n", corpus->name, function,
+         corpus->n, ns_per_line, bytes_per_sec / 1e6, allocs_per_line);
+  fprintf(json, "%s\n    {\"corpus\": \"%s\", \"function\": \"%s\", \"lines\": %d, "
+          "\"bytes\": %zu, \"reps\": %d, \"ns_per_line\": %.1f, \"bytes_per_sec\": %.0f, "
+          "\"allocs_per_line\": %.2f}", first ? "" : ",", corpus->name, function,
+          corpus->n, corpus->bytes, reps, ns_per_line, bytes_per_sec, allocs_per_line);
+}
+
+/*
+ * Runs the parser over every corpus
+ */
+static void bench_parse(FILE *json, const char *recorded)
+{
+  corpus_t corpora[6] = {{"quote"}, {"variable"}, {"glob"}, {"long-argv"}, {"multi-MB"},
+                         {"recorded"}};
+  int n_corpora = 5;
+
+  make_corpora(&corpora[0], &corpora[1], &corpora[2], &corpora[3]);
+  make_huge_corpus(&corpora[4]);
+  if (load_corpus(&corpora[5], recorded))
+    n_corpora++;
+  else
+    fprintf(stderr, "%s: no recorded lines, skipping that corpus\n", recorded);
+
+  printf("%-10s %-12s %8s %12s %10s %12s\n", "corpus", "function", "lines",
+         "ns/line", "MB/s", "allocs/line");
+  fprintf(json, "  \"parser\": [");
+  for (int c=0; c < n_corpora; c++) {
+    int reps = corpus_reps(&corpora[c]);
+    unsigned int allocs;
+    double ns = bench_read_word(&corpora[c], reps, &allocs);
+    report_parse(json, c == 0, &corpora[c], "read_word", reps, ns, allocs);
+    ns = bench_parse_input(&corpora[c], reps, &allocs);
+    report_parse(json, false, &corpora[c], "parse_input", reps, ns, allocs);
+  }
+  fprintf(json, "\n  ]");
+
+  for (int c=0; c < 6; c++)
+    corpus_free(&corpora[c]);
+}
+
+/*
+ * Builds a line of BENCH_WORDS copies of word, separated by spaces
+ */
+static char *make_line(const char *word)
+{
+  size_t len = strlen(word) + 1;
+  char *line = malloc(BENCH_WORDS * len + 1);
+  assert( line );
+
+  for (int i=0; i < BENCH_WORDS; i++) {
+    memcpy(line + i * len, word, len - 1);
+    line[i * len + len - 1] = ' ';
+  }
+  line[BENCH_WORDS * len] = '\0';
+  return line;
+}
+
+/*
+ * Returns the average cost in nanoseconds of parsing one word of a
+ * line made of copies of word
+ */
+static double bench_word_parse(const char *word)
+{
+  char err_msg[128];
+  char *line = make_line(word);
+
+  double start = now_ns();
+  for (int r=0; r < BENCH_REPS; r++) {
+    command_t *cmd = parse_input(line, err_msg, sizeof(err_msg));
+    assert( cmd );
+    command_free(cmd);
+  }
+  double elapsed = now_ns() - start;
+
+  free(line);
+  return elapsed / ((double)BENCH_REPS * BENCH_WORDS);
+}
+
+/*
+ * Returns the average cost in nanoseconds of one glob() call on word,
+ * which is what every word used to cost before literal words skipped
+ * glob()
+ */
+static double bench_word_glob(const char *word)
+{
+  glob_t globbuf;
+
+  double start = now_ns();
+  for (int r=0; r < BENCH_REPS * BENCH_WORDS / 10; r++) {
+    glob(word, GLOB_NOCHECK, NULL, &globbuf);
+    globfree(&globbuf);
+  }
+  return (now_ns() - start) / (BENCH_REPS * BENCH_WORDS / 10);
+}
+
+/*
+ * Writes s to a JSON file as a string, quoting any " or \ in it
+ */
+static void json_string(FILE *json, const char *s)
+{
+  fputc('"', json);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', json);
+    fputc(*s, json);
+  }
+  fputc('"', json);
+}
+
+/*
+ * Measures parse_input() per word, for each kind of word on its own,
+ * against one glob() call
+ */
+static void bench_words(FILE *json, bool first)
+{
+  const char *labels[] = {"literal: -l", "literal: file0.log", "quoted: \"a b\"",
+                          "variable: $HOME", "tilde: ~/x", "glob, no match: *.zz",
+                          "glob, 10 matches: *.log", NULL};
+  const char *words[] = {"-l", "file0.log", "\"a b\"", "$HOME", "~/x", "*.zz", "*.log"};
+
+  printf("\n%-28s %12s\n", "word", "ns/word");
+  fprintf(json, "%s  \"words\": [", first ? "" : ",\n");
+  for (int i=0; labels[i]; i++) {
+    double ns = bench_word_parse(words[i]);
+    printf("%-28s %12.1f\n", labels[i], ns);
+    fprintf(json, "%s\n    {\"word\": ", i == 0 ? "" : ",");
+    json_string(json, words[i]);
+    fprintf(json, ", \"ns_per_word\": %.1f}", ns);
+  }
+  double ns = bench_word_glob("file0.log");
+  printf("%-28s %12.1f\n", "glob() alone on file0.log", ns);
+  fprintf(json, ",\n    {\"word\": \"glob() alone on file0.log\", \"ns_per_word\": %.1f}", ns);
+  fprintf(json, "\n  ]");
+}
+
+/*
+ * Runs a true-like command over and over, the way the shell does:
+ * parse the line, find the command in PATH, build its environment,
+ * spawn it and wait for it. Returns the total time in nanoseconds.
+ */
+static double bench_run(const char *line, int n)
+{
+  char err_msg[128];
+  int status;
+
+  double start = now_ns();
+  for (int i=0; i < n; i++) {
+    command_t *cmd = parse_input(line, err_msg, sizeof(err_msg));
+    assert( cmd );
+    const char *path = pathcache_lookup(command_get_argv(cmd)[0]);
+    char **envp = vars_envp_with(command_get_assigns(cmd));
+    assert( path && envp );
+    pid_t pid = spawn_process(path, command_get_argv(cmd), envp, -1, -1);
+    assert( pid > 0 && waitpid(pid, &status, 0) == pid );
+    command_free(cmd);
+  }
+  return now_ns() - start;
+}
+
+/*
+ * Measures commands per second under each spawn backend, for a plain
+ * command and for one with a NAME=value prefix
+ */
+static void bench_exec(FILE *json, bool first)
+{
+  const char *lines[] = {"true", "BENCH_A=prefix true", NULL};
+  spawn_backend_t backends[] = {SPAWN_POSIX, SPAWN_VFORK, SPAWN_FORK};
+  spawn_backend_t old = spawn_get_backend();
+
+  printf("\n%-8s %-22s %8s %12s %12s\n", "backend", "command", "commands",
+         "commands/s", "us/command");
+  fprintf(json, "%s  \"exec\": [", first ? "" : ",\n");
+  for (int b=0; b < 3; b++) {
+    spawn_set_backend(backends[b]);
+    for (int l=0; lines[l]; l++) {
+      bench_run(lines[l], EXEC_COMMANDS / 20);     // warm up
+      double ns = bench_run(lines[l], EXEC_COMMANDS);
+      double per_sec = EXEC_COMMANDS / (ns / 1e9);
+      double us = ns / 1e3 / EXEC_COMMANDS;
+
+      printf("%-8s %-22s %8d %12.0f %12.1f\n", spawn_backend_name(backends[b]),
+             lines[l], EXEC_COMMANDS, per_sec, us);
+      fprintf(json, "%s\n    {\"backend\": \"%s\", \"command\": \"%s\", \"commands\": %d, "
+              "\"commands_per_sec\": %.0f, \"us_per_command\": %.1f}",
+              b + l == 0 ? "" : ",", spawn_backend_name(backends[b]), lines[l],
+              EXEC_COMMANDS, per_sec, us);
+    }
+  }
+  fprintf(json, "\n  ]");
+  spawn_set_backend(old);
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *mode = argc > 1 ? argv[1] : "all";
+  const char *recorded = argc > 2 ? argv[2] : RECORDED_CORPUS;
+  bool parse = strcmp(mode, "parse") == 0 || strcmp(mode, "all") == 0;
+  bool word = strcmp(mode, "word") == 0 || strcmp(mode, "all") == 0;
+  bool exec = strcmp(mode, "exec") == 0 || strcmp(mode, "all") == 0;
+  if (!parse && !word && !exec) {
+    fprintf(stderr, "usage: %s [parse|word|exec] [recorded-corpus-file]\n", argv[0]);
+    return 1;
+  }
+
+  // the recorded corpus and the output are relative to where we started
+  char *recorded_path = realpath(recorded, NULL);
+  FILE *json = fopen(OUTPUT_FILE, "w");
+  if (!json) {
+    perror(OUTPUT_FILE);
+    return 1;
+  }
+
+  // variables for the variable-heavy lines
+  assert( vars_set("BENCH_A", "alpha") == 0 );
+  assert( vars_set("BENCH_B", "beta") == 0 );
+
+  // a directory with a few files for the patterns to match
+  char tempdir[] = "/tmp/bench_parser_XXXXXX";
+  char path[64];
+  assert( mkdtemp(tempdir) );
+  char *old_cwd = getcwd(NULL, 0);
+  assert( chdir(tempdir) == 0 );
+  for (int i=0; i < BENCH_FILES; i++) {
+    snprintf(path, sizeof(path), "file%d.log", i);
+    close(open(path, O_CREAT | O_WRONLY, 0644));
+  }
+
+  fprintf(json, "{\n");
+  if (parse)
+    bench_parse(json, recorded_path ? recorded_path : recorded);
+  if (word)
+    bench_words(json, !parse);
+  if (exec)
+    bench_exec(json, !parse && !word);
+  fprintf(json, "\n}\n");
+  fclose(json);
+
+  for (int i=0; i < BENCH_FILES; i++) {
+    snprintf(path, sizeof(path), "file%d.log", i);
+    unlink(path);
+  }
+  assert( chdir(old_cwd) == 0 );
+  free(old_cwd);
+  free(recorded_path);
+  rmdir(tempdir);
+
+  printf("\nresults written to %s\n", OUTPUT_FILE);
+  return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * bench_startup.c
+ *
+ * Measures how long the shell takes to start: the time from exec to
+ * the first prompt on a terminal, and the time to run plaidsh -c true
+ * to completion, each next to /bin/true as the cost of starting any
+ * process at all.
+ *
+ * Usage: bench_startup [path-to-plaidsh]
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 200              // starts timed for each measurement
+#define PROMPT "#> "
+#define PROMPT_TIMEOUT_MS 5000
+
+extern char **environ;
+
+
+static double now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Prints the median, mean and minimum of n timings, sorting them
+ */
+static void report(const char *what, double *us, int n)
+{
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += us[i];
+  qsort(us, n, sizeof(us[0]), compare_double);
+  printf("%-28s %10.1f %10.1f %10.1f\n", what, us[n / 2], sum / n, us[0]);
+}
+
+/*
+ * Times running argv to completion, with stdin and stdout on /dev/null
+ *
+ * Returns:
+ *   The time in us, or -1 if the command could not be run
+ */
+static double time_run(char *const argv[])
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+  pid_t pid;
+  int status;
+  double start = now_us();
+  int err = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0 || waitpid(pid, &status, 0) == -1)
+    return -1;
+
+  return now_us() - start;
+}
+
+/*
+ * Times starting argv on a new terminal until it prints the prompt,
+ * then hangs up on it
+ *
+ * Returns:
+ *   The time in us, or -1 if no prompt was seen
+ */
+static double time_prompt(char *const argv[])
+{
+  int master;
+  char buf[4096];
+  size_t len = 0;
+  double elapsed = -1;
+
+  double start = now_us();
+  pid_t pid = forkpty(&master, NULL, NULL, NULL);
+  if (pid == -1)
+    return -1;
+
+  if (pid == 0) {
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  struct pollfd pfd = {master, POLLIN, 0};
+  while (poll(&pfd, 1, PROMPT_TIMEOUT_MS) == 1) {
+    ssize_t n = read(master, buf + len, sizeof(buf) - 1 - len);
+    if (n <= 0)
+      break;
+    len += n;
+    buf[len] = '\0';
+    if (strstr(buf, PROMPT) != NULL) {
+      elapsed = now_us() - start;
+      break;
+    }
+    if (len == sizeof(buf) - 1) {
+      // only the tail can hold the start of a prompt
+      memmove(buf, buf + len - strlen(PROMPT), strlen(PROMPT));
+      len = strlen(PROMPT);
+    }
+  }
+
+  close(master);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return elapsed;
+}
+
+/*
+ * Runs one measurement RUNS times, and reports it
+ */
+static int bench(const char *what, double (*timer)(char *const []), char *const argv[])
+{
+  double us[RUNS];
+
+  for (int i = 0; i < RUNS; i++) {
+    if ((us[i] = timer(argv)) < 0) {
+      fprintf(stderr, "%s: failed\n", what);
+      return -1;
+    }
+  }
+  report(what, us, RUNS);
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  char *shell = argc > 1 ? argv[1] : "./plaidsh";
+
+  char *true_argv[] = {"/bin/true", NULL};
+  char *c_true_argv[] = {shell, "-c", "true", NULL};
+  char *prompt_argv[] = {shell, NULL};
+
+  // the prompt must not depend on the user's readline setup
+  setenv("INPUTRC", "/dev/null", 1);
+  setenv("TERM", "dumb", 1);
+
+  printf("%d starts each of %s\n", RUNS, shell);
+  printf("%-28s %10s %10s %10s\n", "", "median us", "mean us", "min us");
+
+  int rc = 0;
+  rc |= bench("/bin/true", time_run, true_argv);
+  rc |= bench("plaidsh -c true", time_run, c_true_argv);
+  rc |= bench("plaidsh to first prompt", time_prompt, prompt_argv);
+
+  return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+/*
+ * builtins.h
+ *
+ * The hash over builtin names, shared by gen_builtins, which searches
+ * for a seed under which every name in builtins.def lands in its own
+ * slot, and the shell, which looks names up with that seed
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _BUILTINS_H_
+#define _BUILTINS_H_
+
+/*
+ * FNV-1a hash of a name, started from a seed instead of the usual
+ * offset basis, with the high bits folded into the low ones that
+ * pick the slot
+ *
+ * Parameters:
+ *   name     The NUL-terminated name
+ *   seed     The seed chosen by gen_builtins
+ *
+ * Returns:
+ *   The hash, to be masked down to the size of the slot table
+ */
+static inline unsigned int builtin_name_hash(const char *name, unsigned int seed)
+{
+  unsigned int h = seed;
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h ^ (h >> 16);
+}
+
+#endif /* _BUILTINS_H_ */
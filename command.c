@@ -14,14 +14,49 @@
 #include "command.h"
 
 //#define RUN_TESTS         // if defined, turns on all the testing code
+//#define RUN_BENCH         // if defined, builds the argv append benchmark
 
 #define INIT_ARGV_CAP 5     // When cmds are first created, what is the capacity?
+#define ARENA_INIT_SIZE 1024  // Bytes in the first chunk of an arena
+#define ARENA_ALIGN sizeof(void *)
+
+/*
+ * An arena is a chain of chunks that allocations are carved out of by
+ * bumping a pointer. Individual allocations are never freed; the
+ * whole chain goes away at once. Each chunk is twice the size of the
+ * previous one, so even a command with a huge argv needs only a
+ * handful of chunks.
+ */
+typedef struct arena_chunk_s {
+  struct arena_chunk_s *next;   // the previous (smaller) chunk
+  size_t size;                  // bytes available in data[]
+  size_t used;                  // bytes handed out so far
+  char data[];
+} arena_chunk_t;
 
 typedef struct command_s {
   char *in_file;      // if non-NULL, the filename to read input from
   char *out_file;     // if non-NULL, the filename to send output to
+  char *in_data;      // if non-NULL, the text of a here-document or
+  size_t in_data_len; //   here-string, read as input instead
+  char *heredoc;      // if non-NULL, the delimiter of a here-document
+  bool heredoc_expand;//   whose body is yet to be read, and whether
+                      //   the body's variables are to be expanded
+  int argc;           // number of arguments in argv
   int argv_cap;       // current length of argv; different from argc!
   char **argv;        // the actual argv vector
+  size_t arg_bytes;   // what argv costs an exec: every string, its NUL
+                      // and its pointer
+  int expand_first;   // the arguments that came from expansions are
+  int expand_end;     // from expand_first up to expand_end, or both -1
+  int n_assigns;      // number of NAME=value prefixes in assigns
+  int assigns_cap;    // current length of assigns, 0 until the first
+  char **assigns;     // the NAME=value prefixes, or NULL if none
+  struct command_s *next;   // the next stage of the pipeline, or NULL
+  bool background;          // run without waiting, as with a trailing &
+  struct command_s *owner;  // if non-NULL, the first stage, whose arena
+                            // all storage of this stage is carved from
+  arena_chunk_t *arena;     // the chunks of the arena, in the owner
 } command_t;
   
 
@@ -63,6 +98,19 @@ static char *cint_strdup(const char *s1)
   return str;
 }
 
+static char *cint_strndup(const char *s1, size_t n)
+{
+  n_malloc++;
+
+  char *str = strndup(s1, n);
+
+#ifdef DEBUG_MALLOC
+  printf("DEBUG_MALLOC %p: strndup(%.*s)\n", str, (int)n, s1);
+#endif
+  
+  return str;
+}
+
 static void cint_free(void *ptr)
 {
 #ifdef DEBUG_MALLOC
@@ -90,6 +138,85 @@ static void cint_assert_all_free()
 #endif   // RUN_TESTS
 
 
+/**********************************************************************
+ * 
+ * Storage for commands. A command either owns each of its strings and
+ * its argv vector as separate heap blocks, or it carves all of them
+ * out of an arena that is released in one go. Every stage of an
+ * arena-backed pipeline shares the arena of the first stage.
+ *
+ **********************************************************************/
+
+/*
+ * Adds a chunk with room for at least size bytes to the front of the
+ * arena chain. The chunk holding the command_t itself stays at the
+ * end of the chain.
+ */
+static arena_chunk_t *arena_grow(command_t *cmd, size_t size)
+{
+  size_t chunk_size = cmd->arena->size * 2;
+  if (chunk_size < size)
+    chunk_size = size;
+
+  arena_chunk_t *chunk = cint_malloc(sizeof(arena_chunk_t) + chunk_size);
+  if (!chunk)
+    return NULL;
+
+  chunk->next = cmd->arena;
+  chunk->size = chunk_size;
+  chunk->used = 0;
+  cmd->arena = chunk;
+  return chunk;
+}
+
+static void *cmd_alloc(command_t *cmd, size_t size)
+{
+  if (!cmd->owner)
+    return cint_malloc(size);
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  arena_chunk_t *chunk = cmd->owner->arena;
+  if (chunk->size - chunk->used < size) {
+    chunk = arena_grow(cmd->owner, size);
+    if (!chunk)
+      return NULL;
+  }
+
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+static char *cmd_strndup(command_t *cmd, const char *s1, size_t n)
+{
+  if (!cmd->owner)
+    return cint_strndup(s1, n);
+
+  char *str = cmd_alloc(cmd, n + 1);
+  if (str) {
+    memcpy(str, s1, n);
+    str[n] = '\0';
+  }
+  return str;
+}
+
+static char *cmd_strdup(command_t *cmd, const char *s1)
+{
+  if (!cmd->owner)
+    return cint_strdup(s1);
+
+  return cmd_strndup(cmd, s1, strlen(s1));
+}
+
+static void cmd_release(command_t *cmd, void *ptr)
+{
+  // arena storage is only reclaimed by command_free()
+  if (!cmd->owner)
+    cint_free(ptr);
+}
+
+
 /**********************************************************************
  * 
  * Implementations for the command_t calls.  All documentation is in
@@ -103,7 +230,22 @@ command_t *command_new()
   if (cmd) {
     cmd->in_file = NULL;
     cmd->out_file = NULL;
-
+    cmd->in_data = NULL;
+    cmd->in_data_len = 0;
+    cmd->heredoc = NULL;
+    cmd->heredoc_expand = false;
+    cmd->next = NULL;
+    cmd->background = false;
+    cmd->owner = NULL;
+    cmd->arena = NULL;
+
+    cmd->n_assigns = 0;
+    cmd->assigns_cap = 0;
+    cmd->assigns = NULL;
+
+    cmd->argc = 0;
+    cmd->arg_bytes = 0;
+    cmd->expand_first = cmd->expand_end = -1;
     cmd->argv_cap = INIT_ARGV_CAP;
     cmd->argv = cint_malloc(cmd->argv_cap * sizeof(char *));
 
@@ -119,12 +261,134 @@ command_t *command_new()
 }
 
 
+command_t *command_new_arena()
+{
+  // the command and the first chunk of its arena share one allocation
+  size_t cmd_size = (sizeof(command_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  arena_chunk_t *chunk = cint_malloc(sizeof(arena_chunk_t) + ARENA_INIT_SIZE);
+  if (!chunk)
+    return NULL;
+
+  chunk->next = NULL;
+  chunk->size = ARENA_INIT_SIZE;
+  chunk->used = cmd_size;
+
+  command_t *cmd = (command_t *)chunk->data;
+  cmd->in_file = NULL;
+  cmd->out_file = NULL;
+  cmd->in_data = NULL;
+  cmd->in_data_len = 0;
+  cmd->heredoc = NULL;
+  cmd->heredoc_expand = false;
+  cmd->next = NULL;
+  cmd->background = false;
+  cmd->owner = cmd;
+  cmd->arena = chunk;
+  cmd->n_assigns = 0;
+  cmd->assigns_cap = 0;
+  cmd->assigns = NULL;
+
+  cmd->argc = 0;
+  cmd->arg_bytes = 0;
+  cmd->expand_first = cmd->expand_end = -1;
+  cmd->argv_cap = INIT_ARGV_CAP;
+  cmd->argv = cmd_alloc(cmd, cmd->argv_cap * sizeof(char *));
+  cmd->argv[0] = NULL;     // always fits in the first chunk
+
+  return cmd;
+}
+
+
+command_t *command_append_stage(command_t *cmd)
+{
+  if (!cmd)
+    return NULL;
+
+  command_t *last = cmd;
+  while (last->next)
+    last = last->next;
+
+  command_t *stage;
+  if (!cmd->owner) {
+    stage = command_new();
+  } else {
+    // carve the stage out of the first stage's arena
+    stage = cmd_alloc(cmd, sizeof(command_t));
+    if (stage) {
+      stage->in_file = NULL;
+      stage->out_file = NULL;
+      stage->in_data = NULL;
+      stage->in_data_len = 0;
+      stage->heredoc = NULL;
+      stage->heredoc_expand = false;
+      stage->next = NULL;
+      stage->background = false;
+      stage->owner = cmd->owner;
+      stage->arena = NULL;
+      stage->n_assigns = 0;
+      stage->assigns_cap = 0;
+      stage->assigns = NULL;
+      stage->argc = 0;
+      stage->arg_bytes = 0;
+      stage->expand_first = stage->expand_end = -1;
+      stage->argv_cap = INIT_ARGV_CAP;
+      stage->argv = cmd_alloc(cmd, stage->argv_cap * sizeof(char *));
+      if (!stage->argv)
+        return NULL;
+      stage->argv[0] = NULL;
+    }
+  }
+
+  last->next = stage;
+  return stage;
+}
+
+
+command_t *command_get_next(command_t *cmd)
+{
+  if (!cmd)
+    return NULL;
+  return cmd->next;
+}
+
+
+void command_set_background(command_t *cmd, bool background)
+{
+  if (cmd)
+    cmd->background = background;
+}
+
+
+bool command_is_background(command_t *cmd)
+{
+  if (!cmd)
+    return false;
+  return cmd->background;
+}
+
+
 void
 command_free(command_t *cmd)
 {
   if (!cmd)
     return;
 
+  if (cmd->owner) {
+    // the last chunk in the chain holds cmd itself, and every later
+    // stage lives in one of the chunks
+    assert(cmd->owner == cmd);
+    arena_chunk_t *chunk = cmd->arena;
+    while (chunk) {
+      arena_chunk_t *next = chunk->next;
+      cint_free(chunk);
+      chunk = next;
+    }
+    return;
+  }
+
+  command_free(cmd->next);
+  cmd->next = NULL;
+
   if (cmd->in_file) {
     cint_free(cmd->in_file);
     cmd->in_file = NULL;
@@ -135,7 +399,12 @@ command_free(command_t *cmd)
     cmd->out_file = NULL;
   }
 
-  for (int i=0; cmd->argv[i]; i++) {
+  if (cmd->in_data)
+    cint_free(cmd->in_data);
+  if (cmd->heredoc)
+    cint_free(cmd->heredoc);
+
+  for (int i=0; i < cmd->argc; i++) {
     cint_free(cmd->argv[i]);
     cmd->argv[i] = NULL;
   }
@@ -143,6 +412,12 @@ command_free(command_t *cmd)
   cint_free(cmd->argv);
   cmd->argv = NULL;
 
+  for (int i=0; i < cmd->n_assigns; i++)
+    cint_free(cmd->assigns[i]);
+  if (cmd->assigns)
+    cint_free(cmd->assigns);
+  cmd->assigns = NULL;
+
   cint_free(cmd);
 }
 
@@ -155,12 +430,12 @@ int command_set_input(command_t *cmd, const char *in_file)
 
   if (cmd->in_file) {
     // there was already an in_file file here; free and return -1
-    cint_free(cmd->in_file);
+    cmd_release(cmd, cmd->in_file);
     cmd->in_file = NULL;
     ret = -1;
   }
   if (in_file) {
-    cmd->in_file = cint_strdup(in_file);
+    cmd->in_file = cmd_strdup(cmd, in_file);
     if (cmd->in_file == NULL)
       ret = -1;
   }
@@ -178,12 +453,12 @@ int command_set_output(command_t *cmd, const char *out_file)
 
   if (cmd->out_file) {
     // there was already an out_file file here; free and return -1
-    cint_free(cmd->out_file);
+    cmd_release(cmd, cmd->out_file);
     cmd->out_file = NULL;
     ret = -1;
   }
   if (out_file) {
-    cmd->out_file = cint_strdup(out_file);
+    cmd->out_file = cmd_strdup(cmd, out_file);
     if (cmd->out_file == NULL)
       ret = -1;
   }
@@ -208,6 +483,68 @@ const char *command_get_output(command_t *cmd)
 }
 
 
+int command_set_input_data(command_t *cmd, const char *data, size_t len)
+{
+  if (!cmd || !data)
+    return -1;
+
+  // not strndup, which would stop at a NUL in the data
+  char *copy = cmd_alloc(cmd, len + 1);
+  if (!copy)
+    return -1;
+  memcpy(copy, data, len);
+  copy[len] = '\0';
+
+  if (cmd->in_data)
+    cmd_release(cmd, cmd->in_data);
+  cmd->in_data = copy;
+  cmd->in_data_len = len;
+
+  // the body of a here-document has now been read
+  if (cmd->heredoc) {
+    cmd_release(cmd, cmd->heredoc);
+    cmd->heredoc = NULL;
+  }
+  return 0;
+}
+
+
+const char *command_get_input_data(command_t *cmd, size_t *len)
+{
+  if (!cmd || !cmd->in_data)
+    return NULL;
+  *len = cmd->in_data_len;
+  return cmd->in_data;
+}
+
+
+int command_set_heredoc(command_t *cmd, const char *delim, bool expand)
+{
+  if (!cmd || !delim)
+    return -1;
+
+  char *copy = cmd_strdup(cmd, delim);
+  if (!copy)
+    return -1;
+
+  if (cmd->heredoc)
+    cmd_release(cmd, cmd->heredoc);
+  cmd->heredoc = copy;
+  cmd->heredoc_expand = expand;
+  return 0;
+}
+
+
+const char *command_get_heredoc(command_t *cmd, bool *expand)
+{
+  if (!cmd || !cmd->heredoc)
+    return NULL;
+  if (expand)
+    *expand = cmd->heredoc_expand;
+  return cmd->heredoc;
+}
+
+
 void command_dump(command_t *cmd)
 {
   if (!cmd) {
@@ -218,11 +555,24 @@ void command_dump(command_t *cmd)
   printf("Command at %p...\n", cmd);
   printf("  < %s\n", cmd->in_file ? cmd->in_file : "stdin");
   printf("  > %s\n", cmd->out_file ? cmd->out_file : "stdout");
+  if (cmd->heredoc)
+    printf("  << %s%s\n", cmd->heredoc, cmd->heredoc_expand ? "" : " (literal)");
+  if (cmd->in_data)
+    printf("  <<< %zu bytes\n", cmd->in_data_len);
+  for (int i=0; i < cmd->n_assigns; i++)
+    printf("  assign[%d] = %s\n", i, cmd->assigns[i]);
   printf("  argc=%d\n", command_get_argc(cmd));
 
-  for (int i=0; cmd->argv[i]; i++) 
+  for (int i=0; i < cmd->argc; i++) 
     printf("    argv[%d] = %s\n", i, cmd->argv[i]);
 
+  if (cmd->background)
+    printf("  & in the background\n");
+
+  if (cmd->next) {
+    printf("  | piped to\n");
+    command_dump(cmd->next);
+  }
 }
 
 
@@ -239,15 +589,31 @@ bool command_compare(command_t *cmd1, command_t *cmd2)
           cmd2->out_file ? cmd2->out_file : "null") != 0)
     return false;
 
-  int i;
-  for (i=0; cmd1->argv[i]; i++) 
-    if (cmd2->argv[i] == 0 || strcmp(cmd1->argv[i], cmd2->argv[i]) != 0)
+  if ((cmd1->in_data == NULL) != (cmd2->in_data == NULL)
+      || (cmd1->in_data && (cmd1->in_data_len != cmd2->in_data_len
+                            || memcmp(cmd1->in_data, cmd2->in_data, cmd1->in_data_len) != 0)))
+    return false;
+
+  if (strcmp(cmd1->heredoc ? cmd1->heredoc : "null",
+          cmd2->heredoc ? cmd2->heredoc : "null") != 0
+      || (cmd1->heredoc && cmd1->heredoc_expand != cmd2->heredoc_expand))
+    return false;
+
+  if (cmd1->argc != cmd2->argc || cmd1->background != cmd2->background)
+    return false;
+
+  for (int i=0; i < cmd1->argc; i++) 
+    if (strcmp(cmd1->argv[i], cmd2->argv[i]) != 0)
       return false;
 
-  if (cmd2->argv[i] != NULL)
+  if (cmd1->n_assigns != cmd2->n_assigns)
     return false;
 
-  return true;
+  for (int i=0; i < cmd1->n_assigns; i++)
+    if (strcmp(cmd1->assigns[i], cmd2->assigns[i]) != 0)
+      return false;
+
+  return command_compare(cmd1->next, cmd2->next);
 }
 
 bool command_is_empty(command_t *cmd)
@@ -255,10 +621,11 @@ bool command_is_empty(command_t *cmd)
   if (!cmd)
     return true;
 
-  if (cmd->in_file || cmd->out_file)
+  if (cmd->in_file || cmd->out_file || cmd->in_data || cmd->heredoc
+      || cmd->next || cmd->background || cmd->n_assigns)
     return false;
 
-  if (cmd->argv[0] == NULL)
+  if (cmd->argc == 0)
     return true;
 
   return false;
@@ -269,37 +636,149 @@ int command_get_argc(command_t *cmd)
   if (!cmd)
     return -1;
 
-  int cnt;
-  for (cnt = 0; cmd->argv[cnt]; cnt++)
-    ;
-
-  return cnt;
+  return cmd->argc;
 }
 
 int command_append_arg(command_t *cmd, const char *arg)
+{
+  if (!arg)
+    return -1;
+
+  return command_append_argn(cmd, arg, strlen(arg));
+}
+
+int command_reserve_args(command_t *cmd, int n)
+{
+  if (!cmd || n < 0)
+    return -1;
+
+  // leave room for the terminal NULL
+  if (cmd->argc + n < cmd->argv_cap)
+    return 0;
+
+  // grow geometrically, so that appending one argument at a time is
+  // amortized O(1)
+  int new_cap = cmd->argv_cap * 2;
+  if (new_cap < cmd->argc + n + 1)
+    new_cap = cmd->argc + n + 1;
+
+  char **argv;
+  if (cmd->owner) {
+    // arena blocks cannot be resized, so move to a bigger one
+    argv = cmd_alloc(cmd, new_cap * sizeof(char *));
+    if (!argv)
+      return -1;
+    memcpy(argv, cmd->argv, (cmd->argc + 1) * sizeof(char *));
+  } else {
+    argv = realloc(cmd->argv, new_cap * sizeof(char *));
+    if (!argv)
+      return -1;
+  }
+
+  cmd->argv = argv;
+  cmd->argv_cap = new_cap;
+  return 0;
+}
+
+int command_append_argn(command_t *cmd, const char *arg, size_t len)
 {
   if (!cmd || !arg)
     return -1;
 
-  // find the terminal NULL
-  int idx;
-  for (idx = 0; cmd->argv[idx]; idx++)
-    ;
+  if (command_reserve_args(cmd, 1) != 0)
+    return -1;
 
-  assert(idx < cmd->argv_cap);
+  char *copy = cmd_strndup(cmd, arg, len);
+  if (!copy)
+    return -1;
+
+  cmd->argv[cmd->argc++] = copy;
+  cmd->argv[cmd->argc] = NULL;
+  cmd->arg_bytes += len + 1 + sizeof(char *);
+
+  return 0;
+}
 
-  if (idx + 1 == cmd->argv_cap) {
-    // reallocate argv
-    cmd->argv_cap += INIT_ARGV_CAP;
-    cmd->argv = realloc(cmd->argv, cmd->argv_cap * sizeof(char*));
+int command_append_args(command_t *cmd, char * const *args, int n)
+{
+  if (!cmd || !args || n < 0)
+    return -1;
+
+  if (command_reserve_args(cmd, n) != 0)
+    return -1;
+
+  size_t bytes = 0;
+  for (int i=0; i < n; i++) {
+    char *copy = args[i] ? cmd_strdup(cmd, args[i]) : NULL;
+    if (!copy) {
+      // undo this call's appends, so the command is unchanged
+      while (i-- > 0)
+        cmd_release(cmd, cmd->argv[--cmd->argc]);
+      cmd->argv[cmd->argc] = NULL;
+      return -1;
+    }
+    cmd->argv[cmd->argc++] = copy;
+    bytes += strlen(copy) + 1 + sizeof(char *);
   }
-  cmd->argv[idx++] = cint_strdup(arg);
-  cmd->argv[idx] = NULL;
+  cmd->argv[cmd->argc] = NULL;
+  cmd->arg_bytes += bytes;
 
   return 0;
 }
 
 
+static int compare_args(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+void command_sort_args(command_t *cmd, int first)
+{
+  if (!cmd || first < 0 || first >= cmd->argc)
+    return;
+
+  // names read in order are often sorted already
+  int i = first + 1;
+  while (i < cmd->argc && strcmp(cmd->argv[i-1], cmd->argv[i]) <= 0)
+    i++;
+  if (i < cmd->argc)
+    qsort(cmd->argv + first, cmd->argc - first, sizeof(char *), compare_args);
+}
+
+
+size_t command_get_arg_bytes(command_t *cmd)
+{
+  if (!cmd)
+    return 0;
+
+  // the terminal NULL is passed too
+  return cmd->arg_bytes + sizeof(char *);
+}
+
+
+void command_mark_expansion(command_t *cmd, int first)
+{
+  if (!cmd || first < 0 || first >= cmd->argc)
+    return;
+
+  if (cmd->expand_first == -1 || first < cmd->expand_first)
+    cmd->expand_first = first;
+  cmd->expand_end = cmd->argc;
+}
+
+
+bool command_get_expansion(command_t *cmd, int *first, int *end)
+{
+  if (!cmd || cmd->expand_first == -1)
+    return false;
+
+  *first = cmd->expand_first;
+  *end = cmd->expand_end;
+  return true;
+}
+
+
 char * const * command_get_argv(command_t *cmd)
 {
   if (!cmd)
@@ -309,6 +788,61 @@ char * const * command_get_argv(command_t *cmd)
 }
 
 
+int command_append_assign(command_t *cmd, const char *assign, size_t len)
+{
+  if (!cmd || !assign || !memchr(assign, '=', len))
+    return -1;
+
+  // leave room for the terminal NULL
+  if (cmd->n_assigns + 1 >= cmd->assigns_cap) {
+    int new_cap = cmd->assigns_cap ? cmd->assigns_cap * 2 : INIT_ARGV_CAP;
+    char **assigns = cmd_alloc(cmd, new_cap * sizeof(char *));
+    if (!assigns)
+      return -1;
+    if (cmd->assigns) {
+      memcpy(assigns, cmd->assigns, cmd->n_assigns * sizeof(char *));
+      cmd_release(cmd, cmd->assigns);
+    }
+    cmd->assigns = assigns;
+    cmd->assigns_cap = new_cap;
+  }
+
+  char *copy = cmd_strndup(cmd, assign, len);
+  if (!copy)
+    return -1;
+
+  cmd->assigns[cmd->n_assigns++] = copy;
+  cmd->assigns[cmd->n_assigns] = NULL;
+  return 0;
+}
+
+
+int command_get_assignc(command_t *cmd)
+{
+  if (!cmd)
+    return -1;
+
+  return cmd->n_assigns;
+}
+
+
+char * const * command_get_assigns(command_t *cmd)
+{
+  static char *none[] = {NULL};
+
+  if (!cmd)
+    return NULL;
+
+  return cmd->assigns ? cmd->assigns : none;
+}
+
+
+unsigned int command_alloc_count()
+{
+  return n_malloc;
+}
+
+
 
 /**********************************************************************
  * 
@@ -317,12 +851,12 @@ char * const * command_get_argv(command_t *cmd)
  **********************************************************************/
 #ifdef RUN_TESTS
 
-void test_command()
+void test_command(command_t *(*new_cmd)())
 {
   command_t *cmd;
 
   
-  assert( (cmd = command_new()) );
+  assert( (cmd = new_cmd()) );
 
   // test initial conditions
   assert( command_get_input(cmd) == NULL );
@@ -369,6 +903,40 @@ void test_command()
   assert( argc == sizeof(test_args) / sizeof(test_args[0]) - 1 );
   assert( argv[argc] == NULL );
 
+  // append from a span that is not NUL-terminated
+  const char *line = "seven eight";
+  assert( command_append_argn(cmd, line, 5) == 0 );
+  assert( command_get_argc(cmd) == argc + 1 );
+  assert( strcmp(command_get_argv(cmd)[argc], "seven") == 0 );
+  assert( command_get_argv(cmd)[argc + 1] == NULL );
+
+  // bulk append, with and without a reservation ahead of time
+  char *more_args[] = {"nine", "ten", "eleven"};
+  assert( command_append_args(cmd, more_args, 3) == 0 );
+  assert( command_reserve_args(cmd, 100) == 0 );
+  assert( command_append_args(cmd, more_args, 3) == 0 );
+  assert( command_append_args(cmd, more_args, 0) == 0 );
+  argv = command_get_argv(cmd);
+  assert( command_get_argc(cmd) == argc + 7 );
+  for (int i=0; i<6; i++)
+    assert( strcmp(argv[argc + 1 + i], more_args[i % 3]) == 0 );
+  assert( argv[argc + 7] == NULL );
+
+  // a NULL in the middle fails, leaving the command unchanged
+  char *bad_args[] = {"twelve", NULL, "fourteen"};
+  assert( command_append_args(cmd, bad_args, 3) == -1 );
+  assert( command_get_argc(cmd) == argc + 7 );
+  assert( command_get_argv(cmd)[argc + 7] == NULL );
+
+  // sorting the tail leaves the arguments before it alone
+  command_sort_args(cmd, argc + 1);
+  argv = command_get_argv(cmd);
+  assert( strcmp(argv[argc], "seven") == 0 && strcmp(argv[argc - 1], "six") == 0 );
+  assert( strcmp(argv[argc + 1], "eleven") == 0 && strcmp(argv[argc + 2], "eleven") == 0 );
+  assert( strcmp(argv[argc + 5], "ten") == 0 && strcmp(argv[argc + 6], "ten") == 0 );
+  assert( argv[argc + 7] == NULL );
+  command_sort_args(cmd, argc + 7);
+
   assert( !command_is_empty(cmd) );
 
   // dump the command
@@ -380,11 +948,310 @@ void test_command()
 }
 
 
+void test_command_arena()
+{
+  command_t *cmd;
+  char arg[200];
+
+  // enough arguments and bytes to spill over several arena chunks
+  assert( (cmd = command_new_arena()) );
+  for (int i=0; i<1000; i++) {
+    snprintf(arg, sizeof(arg), "%0*d", 1 + i % 150, i);
+    assert( command_append_arg(cmd, arg) == 0 );
+  }
+  assert( command_set_input(cmd, "/tmp/in") == 0 );
+  assert( command_set_output(cmd, "/tmp/out") == 0 );
+  assert( command_set_output(cmd, "/tmp/out2") == -1 );
+
+  assert( command_get_argc(cmd) == 1000 );
+  for (int i=0; i<1000; i++) {
+    snprintf(arg, sizeof(arg), "%0*d", 1 + i % 150, i);
+    assert( strcmp(command_get_argv(cmd)[i], arg) == 0 );
+  }
+  assert( strcmp(command_get_input(cmd), "/tmp/in") == 0 );
+  assert( strcmp(command_get_output(cmd), "/tmp/out2") == 0 );
+
+  // far fewer blocks than one per string
+  assert( n_malloc - n_free < 20 );
+
+  command_free(cmd);
+  cint_assert_all_free();
+}
+
+
+void test_command_pipeline(command_t *(*new_cmd)())
+{
+  command_t *cmd, *cmd2, *stage;
+
+  assert( (cmd = new_cmd()) );
+  assert( command_get_next(cmd) == NULL );
+  assert( command_append_arg(cmd, "ls") == 0 );
+
+  // add two more stages, the second with a redirection
+  assert( (stage = command_append_stage(cmd)) );
+  assert( command_get_next(cmd) == stage );
+  assert( command_is_empty(stage) );
+  assert( !command_is_empty(cmd) );
+  assert( command_append_arg(stage, "grep") == 0 );
+  assert( command_append_arg(stage, "foo") == 0 );
+  assert( (stage = command_append_stage(cmd)) );
+  assert( command_get_next(command_get_next(cmd)) == stage );
+  assert( command_append_arg(stage, "wc") == 0 );
+  assert( command_set_output(stage, "/tmp/count") == 0 );
+  assert( command_get_next(stage) == NULL );
+  assert( command_get_argc(cmd) == 1 );
+  assert( command_get_argc(command_get_next(cmd)) == 2 );
+
+  // stages take part in comparisons
+  assert( (cmd2 = command_new()) );
+  assert( command_append_arg(cmd2, "ls") == 0 );
+  assert( !command_compare(cmd, cmd2) );
+  assert( (stage = command_append_stage(cmd2)) );
+  assert( command_append_arg(stage, "grep") == 0 );
+  assert( command_append_arg(stage, "foo") == 0 );
+  assert( (stage = command_append_stage(cmd2)) );
+  assert( command_append_arg(stage, "wc") == 0 );
+  assert( !command_compare(cmd, cmd2) );
+  assert( command_set_output(stage, "/tmp/count") == 0 );
+  assert( command_compare(cmd, cmd2) );
+
+  // so does running in the background
+  assert( !command_is_background(cmd) );
+  command_set_background(cmd, true);
+  assert( command_is_background(cmd) );
+  assert( !command_compare(cmd, cmd2) );
+  command_set_background(cmd2, true);
+  assert( command_compare(cmd, cmd2) );
+
+  command_dump(cmd);
+
+  // freeing the first stage frees them all
+  command_free(cmd);
+  command_free(cmd2);
+  cint_assert_all_free();
+}
+
+
+void test_command_assigns(command_t *(*new_cmd)())
+{
+  command_t *cmd, *cmd2;
+  char name[32];
+
+  assert( (cmd = new_cmd()) );
+  assert( command_get_assignc(cmd) == 0 );
+  assert( command_get_assigns(cmd)[0] == NULL );
+
+  // an assignment alone still makes the command non-empty
+  const char *line = "LANG=C sort";
+  assert( command_append_assign(cmd, line, 6) == 0 );
+  assert( !command_is_empty(cmd) );
+  assert( command_append_assign(cmd, "NOEQUALS", 8) == -1 );
+  assert( command_get_assignc(cmd) == 1 );
+  assert( strcmp(command_get_assigns(cmd)[0], "LANG=C") == 0 );
+  assert( command_get_assigns(cmd)[1] == NULL );
+  assert( command_get_argc(cmd) == 0 );
+
+  // enough to grow the vector
+  for (int i=0; i < 3 * INIT_ARGV_CAP; i++) {
+    snprintf(name, sizeof(name), "V%d=%d", i, i);
+    assert( command_append_assign(cmd, name, strlen(name)) == 0 );
+  }
+  assert( command_get_assignc(cmd) == 1 + 3 * INIT_ARGV_CAP );
+  assert( strcmp(command_get_assigns(cmd)[3], "V2=2") == 0 );
+  assert( command_get_assigns(cmd)[command_get_assignc(cmd)] == NULL );
+
+  // assignments take part in comparisons
+  assert( (cmd2 = new_cmd()) );
+  assert( !command_compare(cmd, cmd2) );
+  assert( command_append_assign(cmd2, "LANG=C", 6) == 0 );
+  for (int i=0; i < 3 * INIT_ARGV_CAP; i++) {
+    snprintf(name, sizeof(name), "V%d=%d", i, i + (i == 7));
+    assert( command_append_assign(cmd2, name, strlen(name)) == 0 );
+  }
+  assert( !command_compare(cmd, cmd2) );
+
+  command_free(cmd);
+  command_free(cmd2);
+  cint_assert_all_free();
+}
+
+
+void test_command_input_data(command_t *(*new_cmd)())
+{
+  command_t *cmd, *cmd2;
+  size_t len;
+  bool expand;
+
+  assert( (cmd = new_cmd()) );
+  assert( command_get_input_data(cmd, &len) == NULL );
+  assert( command_get_heredoc(cmd, &expand) == NULL );
+
+  // a here-document waiting for its body makes the command non-empty
+  assert( command_set_heredoc(cmd, "EOF", true) == 0 );
+  assert( !command_is_empty(cmd) );
+  assert( strcmp(command_get_heredoc(cmd, &expand), "EOF") == 0 && expand );
+  assert( command_set_heredoc(cmd, "END", false) == 0 );
+  assert( strcmp(command_get_heredoc(cmd, &expand), "END") == 0 && !expand );
+
+  assert( (cmd2 = new_cmd()) );
+  assert( !command_compare(cmd, cmd2) );
+  assert( command_set_heredoc(cmd2, "END", true) == 0 );
+  assert( !command_compare(cmd, cmd2) );
+
+  // setting the body resolves it; the data may hold NULs
+  assert( command_set_input_data(cmd, "one\0two\nxx", 8) == 0 );
+  assert( command_get_heredoc(cmd, NULL) == NULL );
+  assert( memcmp(command_get_input_data(cmd, &len), "one\0two\n", 9) == 0 );
+  assert( len == 8 );
+  assert( command_get_input_data(cmd, &len)[8] == '\0' );
+  assert( command_set_input_data(cmd2, "one\0twO\n", 8) == 0 );
+  assert( !command_compare(cmd, cmd2) );
+  assert( command_set_input_data(cmd2, "one\0two\n", 8) == 0 );
+  assert( command_compare(cmd, cmd2) );
+
+  assert( command_set_input_data(cmd, "", 0) == 0 );
+  assert( command_get_input_data(cmd, &len) != NULL && len == 0 );
+
+  command_free(cmd);
+  command_free(cmd2);
+  cint_assert_all_free();
+}
+
+
+void test_command_arg_bytes(command_t *(*new_cmd)())
+{
+  command_t *cmd;
+  char *args[] = {"a.c", "bb.c", "ccc.c"};
+  int first, end;
+
+  // only the terminal NULL, to begin with
+  assert( (cmd = new_cmd()) );
+  assert( command_get_arg_bytes(cmd) == sizeof(char *) );
+  assert( !command_get_expansion(cmd, &first, &end) );
+
+  assert( command_append_arg(cmd, "cc") == 0 );
+  assert( command_append_argn(cmd, "-cXXX", 2) == 0 );
+  assert( command_get_arg_bytes(cmd) == 3 + 3 + 3 * sizeof(char *) );
+
+  // a single expansion
+  assert( command_append_args(cmd, args, 3) == 0 );
+  command_mark_expansion(cmd, 2);
+  assert( command_get_arg_bytes(cmd) == 6 + 4 + 5 + 6 + 6 * sizeof(char *) );
+  assert( command_get_expansion(cmd, &first, &end) );
+  assert( first == 2 && end == 5 );
+
+  // a second one takes in the literal word between them
+  assert( command_append_arg(cmd, "-o") == 0 );
+  assert( command_append_args(cmd, args, 2) == 0 );
+  command_mark_expansion(cmd, 6);
+  assert( command_get_expansion(cmd, &first, &end) );
+  assert( first == 2 && end == 8 );
+
+  // an expansion that matched nothing leaves the range as it was
+  command_mark_expansion(cmd, command_get_argc(cmd));
+  assert( command_get_expansion(cmd, &first, &end) );
+  assert( first == 2 && end == 8 );
+
+  // a failed bulk append changes nothing
+  size_t bytes = command_get_arg_bytes(cmd);
+  char *bad[] = {"x", NULL};
+  assert( command_append_args(cmd, bad, 2) == -1 );
+  assert( command_get_arg_bytes(cmd) == bytes );
+
+  command_free(cmd);
+  cint_assert_all_free();
+}
+
+
 int main(int argc, char *argv[])
 {
-  test_command();
+  test_command(command_new);
+  test_command(command_new_arena);
+  test_command_arena();
+  test_command_pipeline(command_new);
+  test_command_pipeline(command_new_arena);
+  test_command_assigns(command_new);
+  test_command_assigns(command_new_arena);
+  test_command_input_data(command_new);
+  test_command_input_data(command_new_arena);
+  test_command_arg_bytes(command_new);
+  test_command_arg_bytes(command_new_arena);
   fprintf(stderr, "test_command: All tests succeeded!\n");
   return 0;
 }
 
 #endif   // RUN_TESTS
+
+
+/**********************************************************************
+ * 
+ * Benchmark code below
+ *
+ **********************************************************************/
+#ifdef RUN_BENCH
+
+#include <time.h>
+
+#define BENCH_MAX_ARGC 1000000
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Builds commands of n arguments, one argument at a time or in a
+ * single bulk append, and returns the average cost of appending one
+ * argument in nanoseconds. Small commands are built repeatedly so
+ * that every row of the report covers about the same number of
+ * appends.
+ */
+static double bench_append(command_t *(*new_cmd)(), char **args, int n, bool bulk)
+{
+  int reps = BENCH_MAX_ARGC / n;
+  double total = 0;
+
+  for (int r=0; r < reps; r++) {
+    command_t *cmd = new_cmd();
+    double start = now_ns();
+
+    if (bulk)
+      command_append_args(cmd, args, n);
+    else
+      for (int i=0; i < n; i++)
+        command_append_arg(cmd, args[i]);
+
+    total += now_ns() - start;
+    assert( command_get_argc(cmd) == n );
+    command_free(cmd);
+  }
+
+  return total / ((double)reps * n);
+}
+
+
+int main(int argc, char *argv[])
+{
+  // argument strings like the ones a large glob produces
+  char **args = malloc(BENCH_MAX_ARGC * sizeof(char *));
+  char *names = malloc(BENCH_MAX_ARGC * 16);
+  for (int i=0; i < BENCH_MAX_ARGC; i++) {
+    args[i] = names + i * 16;
+    snprintf(args[i], 16, "file%07d.log", i);
+  }
+
+  printf("%10s %14s %14s %14s\n", "argc", "heap ns/arg", "arena ns/arg", "bulk ns/arg");
+  for (int n=10; n <= BENCH_MAX_ARGC; n *= 10)
+    printf("%10d %14.1f %14.1f %14.1f\n", n,
+        bench_append(command_new, args, n, false),
+        bench_append(command_new_arena, args, n, false),
+        bench_append(command_new_arena, args, n, true));
+
+  free(names);
+  free(args);
+  return 0;
+}
+
+#endif   // RUN_BENCH
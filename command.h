@@ -9,6 +9,7 @@
 #define _COMMAND_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct command_s command_t;
 
@@ -21,13 +22,71 @@ typedef struct command_s command_t;
 command_t *command_new();
 
 /*
- * Deletes a previously-allocated command_t object.
+ * Allocates and initializes a command_t object whose argv vector,
+ * arguments and redirection filenames are all carved out of a single
+ * growing arena, rather than allocated one by one. The command
+ * behaves exactly like one from command_new(), but command_free()
+ * releases all of its storage at once.
+ *
+ * Returns: A new command_t, which must be freed by calling
+ *    command_free().  If no memory is available, returns NULL.
+ */
+command_t *command_new_arena();
+
+/*
+ * Deletes a previously-allocated command_t object, along with every
+ * later stage of its pipeline.
  *
  * Parameters:
- *   cmd   The command to be freed
+ *   cmd   The command to be freed, which must be the first stage
+ *           of its pipeline
  */
 void command_free(command_t *cmd);
 
+/*
+ * Adds a new, empty command to the end of the pipeline that starts
+ * with cmd. The output of each stage of a pipeline feeds the input
+ * of the next. The new stage uses the same kind of storage as cmd,
+ * and is freed along with it.
+ *
+ * Parameters:
+ *   cmd    The first stage of the pipeline
+ *
+ * Returns:
+ *   The new stage, or NULL if no memory is available
+ */
+command_t *command_append_stage(command_t *cmd);
+
+/*
+ * Get the next stage of the pipeline
+ *
+ * Parameters:
+ *   cmd    A stage of a pipeline
+ *
+ * Returns:
+ *   The stage that cmd's output feeds, or NULL if cmd is the last
+ */
+command_t *command_get_next(command_t *cmd);
+
+/*
+ * Marks a pipeline to be run in the background, without the shell
+ * waiting for it, or to be waited for (the default)
+ *
+ * Parameters:
+ *   cmd          The first stage of the pipeline
+ *   background   True to run it in the background
+ */
+void command_set_background(command_t *cmd, bool background);
+
+/*
+ * Returns true if the pipeline starting with cmd is to be run in the
+ * background
+ *
+ * Parameters:
+ *   cmd    The first stage of the pipeline
+ */
+bool command_is_background(command_t *cmd);
+
 /*
  * Updates the command with a new input file, which should be either a
  * filename or NULL to set the input destination to stdin
@@ -71,6 +130,63 @@ int command_set_output(command_t *cmd, const char *output);
 const char *command_get_input(command_t *cmd);
 const char *command_get_output(command_t *cmd);
 
+/*
+ * Sets text to be read as the command's input, as for a here-document
+ * or a here-string, in place of stdin or an input file. The text is
+ * copied, and need not be NUL-terminated. A here-document waiting for
+ * its body (see command_set_heredoc()) is resolved by this call.
+ *
+ * Parameters:
+ *   cmd      The command to be updated
+ *   data     The text
+ *   len      The number of bytes of text
+ *
+ * Returns:
+ *   0 on success, -1 on failure (which could only be "out of memory")
+ */
+int command_set_input_data(command_t *cmd, const char *data, size_t len);
+
+/*
+ * Get the text set by command_set_input_data()
+ *
+ * Parameters:
+ *   cmd      The command
+ *   len      Set to the number of bytes of text, if there is any
+ *
+ * Returns:
+ *   The text, which is also NUL-terminated, or NULL if there is none
+ */
+const char *command_get_input_data(command_t *cmd, size_t *len);
+
+/*
+ * Records that the command's input is a here-document whose body has
+ * not been read yet: the lines after the command line, up to one that
+ * is exactly delim. The body is then given with
+ * command_set_input_data().
+ *
+ * Parameters:
+ *   cmd      The command to be updated
+ *   delim    The line that ends the body
+ *   expand   Whether $variables in the body are expanded, which is
+ *              the case unless the delimiter was quoted
+ *
+ * Returns:
+ *   0 on success, -1 on failure (which could only be "out of memory")
+ */
+int command_set_heredoc(command_t *cmd, const char *delim, bool expand);
+
+/*
+ * Get the delimiter of a here-document whose body is still to be read
+ *
+ * Parameters:
+ *   cmd      The command
+ *   expand   If non-NULL, set to whether the body is to be expanded
+ *
+ * Returns:
+ *   The delimiter, or NULL if there is no such here-document
+ */
+const char *command_get_heredoc(command_t *cmd, bool *expand);
+
 
 /*
  * Print the contents of a command to stdout
@@ -89,7 +205,9 @@ void command_dump(command_t *cmd);
  * Returns: True if the two commands match fully, and false
  *   otherwise. To "match fully", the two commands must have the same
  *   input, the same output, the same number of arguments, and all
- *   arguments must match.
+ *   arguments must match, as must their NAME=value assignments, both
+ *   or neither must run in the background, and the same must be true
+ *   of every later stage of their pipelines.
  */
 bool command_compare(command_t *cmd1, command_t *cmd2);
 
@@ -98,6 +216,9 @@ bool command_compare(command_t *cmd1, command_t *cmd2);
  *    input = stdin
  *    output = stdout
  *    no arguments
+ *    no assignments
+ *    no later pipeline stages
+ *    not to be run in the background
  *
  * Parameters:
  *   cmd          The command to evaluate
@@ -130,6 +251,103 @@ int command_get_argc(command_t *cmd);
  */
 int command_append_arg(command_t *cmd, const char *arg);
 
+/*
+ * Append a new argument to this command from a span of characters
+ * that need not be NUL-terminated, such as a word inside an input
+ * line.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   arg      The first character of the argument
+ *   len      The number of characters to copy from arg
+ * 
+ * Returns:
+ *   0 on success, -1 on failure (which could only be "out of memory")
+ */
+int command_append_argn(command_t *cmd, const char *arg, size_t len);
+
+/*
+ * Append several arguments to this command at once. Room for all of
+ * them is reserved up front, so argv is grown at most once.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   args     The arguments to append (which will be copied aside)
+ *   n        The number of arguments in args
+ * 
+ * Returns:
+ *   0 on success, -1 on failure (which could only be "out of memory").
+ *   On failure, none of the arguments are appended.
+ */
+int command_append_args(command_t *cmd, char * const *args, int n);
+
+/*
+ * Ensure that at least n more arguments can be appended to this
+ * command without growing argv. This is only a hint: appending
+ * beyond the reserved room still works.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   n        The number of arguments about to be appended
+ * 
+ * Returns:
+ *   0 on success, -1 on failure (which could only be "out of memory")
+ */
+int command_reserve_args(command_t *cmd, int n);
+
+/*
+ * Sort the arguments from index first to the end into strcmp() order,
+ * in place. Used to sort names that were appended as they were found.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   first    The index of the first argument to sort
+ */
+void command_sort_args(command_t *cmd, int first);
+
+/*
+ * Return the number of bytes this command's arguments take up when
+ * passed to exec, which the kernel limits to sysconf(_SC_ARG_MAX)
+ * together with the environment: every string with its NUL, and a
+ * pointer for each one and for the terminal NULL. It is kept up to
+ * date as arguments are appended, so it costs nothing to ask.
+ *
+ * Parameters:
+ *   cmd      The command
+ *
+ * Returns:
+ *   The size of argv in bytes, or 0 if cmd is NULL
+ */
+size_t command_get_arg_bytes(command_t *cmd);
+
+/*
+ * Record that the arguments from index first to the end were produced
+ * by expanding a pattern. If some already were, the recorded range
+ * grows to cover both, along with any literal words in between. Only
+ * the expanded arguments may be split across several runs of a command
+ * whose argv is too big for one.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   first    The index of the first argument of the expansion
+ */
+void command_mark_expansion(command_t *cmd, int first);
+
+/*
+ * Get the range of arguments that came from expansions, as recorded
+ * by command_mark_expansion()
+ *
+ * Parameters:
+ *   cmd      The command
+ *   first    Set to the index of the first expanded argument
+ *   end      Set to one past the index of the last one
+ *
+ * Returns:
+ *   true if there were any expansions, false (leaving first and end
+ *   unchanged) if not
+ */
+bool command_get_expansion(command_t *cmd, int *first, int *end);
+
 /*
  * Get a pointer to the NULL-terminated argv vector for this command
  *
@@ -143,5 +361,56 @@ int command_append_arg(command_t *cmd, const char *arg);
  */
 char * const * command_get_argv(command_t *cmd);
 
+/*
+ * Append a NAME=value assignment that came before the command's
+ * arguments, as in "LANG=C sort". The assignments of a command with
+ * arguments only apply to its own environment; a command with only
+ * assignments sets shell variables.
+ *
+ * Parameters:
+ *   cmd      The command
+ *   assign   The first character of the assignment, which must
+ *              contain '='
+ *   len      The number of characters to copy from assign
+ * 
+ * Returns:
+ *   0 on success, -1 on failure (out of memory, or no '=')
+ */
+int command_append_assign(command_t *cmd, const char *assign, size_t len);
+
+/*
+ * Return the count of NAME=value assignments on this command
+ *
+ * Parameters:
+ *   cmd    The command to examine
+ * 
+ * Returns:
+ *   The number of assignments, which could be 0
+ */
+int command_get_assignc(command_t *cmd);
+
+/*
+ * Get a pointer to the NULL-terminated vector of NAME=value
+ * assignments for this command, in the order they were given
+ *
+ * Parameters:
+ *   cmd     The command
+ * 
+ * Returns:
+ *   The vector, which is empty if there are none, and valid until a
+ *   subsequent call to command_append_assign() or command_free()
+ */
+char * const * command_get_assigns(command_t *cmd);
+
+/*
+ * Return the number of heap blocks allocated by the command calls so
+ * far, counting each arena chunk as one block. The difference between
+ * two calls is what the commands built in between cost in mallocs.
+ *
+ * Returns:
+ *   The count of mallocs and strdups since the program started
+ */
+unsigned int command_alloc_count();
+
 
 #endif /* _COMMAND_H_ */
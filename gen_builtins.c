@@ -0,0 +1,78 @@
+/*
+ * gen_builtins.c
+ *
+ * Build-time generator of the builtin lookup table. Reads the names
+ * in builtins.def, searches for a seed for builtin_name_hash() under
+ * which no two names share a slot, trying the smallest power-of-two
+ * table first, and writes the seed and slot table as C to stdout.
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <stdio.h>              // printf
+#include <string.h>             // memset
+
+#include "builtins.h"
+
+#define MAX_SLOTS 1024          // give up beyond this many slots
+#define MAX_SEEDS 1000000       // seeds tried for each table size
+
+#define BUILTIN(name, handler) #name,
+static const char *names[] = {
+#include "builtins.def"
+};
+#undef BUILTIN
+
+#define N_NAMES (int)(sizeof(names) / sizeof(names[0]))
+
+// the slot table holds each index in a signed char
+_Static_assert(sizeof(names) / sizeof(names[0]) < 128, "too many builtins");
+
+
+/*
+ * Fills slots for a seed and a table size
+ *
+ * Returns:
+ *   1 if every name has a slot of its own, 0 on a collision
+ */
+static int try_seed(unsigned int seed, int n_slots, int *slots)
+{
+  memset(slots, -1, n_slots * sizeof(int));
+  for (int i=0; i < N_NAMES; i++) {
+    int *slot = &slots[builtin_name_hash(names[i], seed) & (n_slots - 1)];
+    if (*slot != -1)
+      return 0;
+    *slot = i;
+  }
+  return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int slots[MAX_SLOTS];
+
+  int n_slots = 1;
+  while (n_slots < N_NAMES)
+    n_slots *= 2;
+
+  for (; n_slots <= MAX_SLOTS; n_slots *= 2) {
+    for (unsigned int seed=1; seed <= MAX_SEEDS; seed++) {
+      if (!try_seed(seed, n_slots, slots))
+        continue;
+
+      printf("/* Generated by gen_builtins from builtins.def; do not edit */\n");
+      printf("#define BUILTIN_HASH_SEED %uu\n", seed);
+      printf("#define BUILTIN_HASH_SLOTS %d\n\n", n_slots);
+      printf("// index into the builtins.def entries of the name in each slot, or -1\n");
+      printf("static const signed char builtin_slots[BUILTIN_HASH_SLOTS] = {");
+      for (int i=0; i < n_slots; i++)
+        printf("%s%d", i % 16 ? ", " : "\n  ", slots[i]);
+      printf("\n};\n");
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "gen_builtins: no perfect hash for %d names\n", N_NAMES);
+  return 1;
+}
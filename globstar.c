@@ -0,0 +1,587 @@
+/*
+ * globstar.c
+ *
+ * A parallel walk of a directory tree, for the ** component of glob
+ * patterns
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE             // getdents64
+
+#include <assert.h>             // assert
+#include <dirent.h>             // getdents64
+#include <errno.h>              // errno
+#include <fcntl.h>              // openat
+#include <fnmatch.h>            // fnmatch
+#include <pthread.h>            // pthread_create
+#include <stdbool.h>            // bool
+#include <stdio.h>              // printf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strcmp
+#include <sys/stat.h>           // fstatat
+#include <unistd.h>             // close
+
+#include "globstar.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+//#define RUN_BENCH         // if defined, builds the tree walk benchmark
+
+#define DENTS_BUF (256 << 10)   // bytes read by each getdents64()
+
+/*
+ * A directory waiting to be read
+ */
+typedef struct {
+  char *path;         // below the root
+  int depth;          // levels below the root
+} work_t;
+
+/*
+ * What one thread found in one directory
+ */
+typedef struct {
+  work_t *subs;       // directories to read next
+  int n_subs;
+  int subs_cap;
+  globstar_dir_t dir; // the matching names
+  size_t used;        // bytes of dir.block in use
+  size_t cap;
+} found_t;
+
+/*
+ * The state shared by the threads of one walk
+ */
+typedef struct {
+  int root_fd;
+  const char *leaf;
+  int max_depth;
+
+  pthread_mutex_t lock;   // guards everything below
+  pthread_cond_t more;    // work was queued, or the walk is over
+  work_t *queue;          // a stack, so the walk goes depth first
+  int n_queued;
+  int queue_cap;
+  int busy;               // directories being read right now
+  bool failed;            // out of memory
+  globstar_dir_t *dirs;   // what has been found
+  int n_dirs;
+  int dirs_cap;
+} walk_t;
+
+
+/*
+ * Makes room for need elements of the given size in *array
+ */
+static bool reserve(void **array, int *cap, int need, size_t size)
+{
+  if (need <= *cap)
+    return true;
+
+  int new_cap = *cap ? *cap * 2 : 16;
+  if (new_cap < need)
+    new_cap = need;
+  void *p = realloc(*array, new_cap * size);
+  if (!p)
+    return false;
+  *array = p;
+  *cap = new_cap;
+  return true;
+}
+
+
+static void free_found(found_t *f)
+{
+  for (int i=0; i < f->n_subs; i++)
+    free(f->subs[i].path);
+  free(f->subs);
+  free(f->dir.dir);
+  free(f->dir.names);
+  free(f->dir.block);
+}
+
+
+/*
+ * Adds a name to the matches of a directory
+ */
+static bool add_name(found_t *f, const char *name)
+{
+  size_t len = strlen(name) + 1;
+  if (f->used + len > f->cap) {
+    size_t cap = f->cap ? f->cap : 1024;
+    while (f->used + len > cap)
+      cap *= 2;
+    char *p = realloc(f->dir.block, cap);
+    if (!p)
+      return false;
+    f->dir.block = p;
+    f->cap = cap;
+  }
+  memcpy(f->dir.block + f->used, name, len);
+  f->used += len;
+  f->dir.n++;
+  return true;
+}
+
+
+/*
+ * Adds a subdirectory to those to be read next
+ */
+static bool add_sub(found_t *f, const work_t *item, const char *name)
+{
+  if (!reserve((void **)&f->subs, &f->subs_cap, f->n_subs + 1, sizeof(work_t)))
+    return false;
+
+  size_t len = strlen(item->path);
+  char *path = malloc(len + strlen(name) + 2);
+  if (!path)
+    return false;
+  if (len)
+    sprintf(path, "%s/%s", item->path, name);
+  else
+    strcpy(path, name);
+
+  f->subs[f->n_subs].path = path;
+  f->subs[f->n_subs].depth = item->depth + 1;
+  f->n_subs++;
+  return true;
+}
+
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/*
+ * Reads one directory: matches its entries against the leaf, and
+ * lists the subdirectories to read next. Returns false if out of
+ * memory; a directory that cannot be opened is simply empty.
+ */
+static bool read_dir(walk_t *w, const work_t *item, char *dents, found_t *f)
+{
+  struct stat sb;
+
+  int fd = openat(w->root_fd, item->path[0] ? item->path : ".",
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1)
+    return true;
+
+  bool descend = item->depth < w->max_depth;
+  bool ok = true;
+  ssize_t got;
+  while (ok && (got = getdents64(fd, dents, DENTS_BUF)) > 0) {
+    for (ssize_t off = 0; ok && off < got; ) {
+      struct dirent64 *ent = (struct dirent64 *)(dents + off);
+      off += ent->d_reclen;
+      const char *name = ent->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+
+      if (w->leaf && fnmatch(w->leaf, name, FNM_PERIOD) == 0)
+        ok = add_name(f, name);
+
+      // hidden directories and links to directories are not entered
+      if (!ok || !descend || name[0] == '.')
+        continue;
+      if (ent->d_type == DT_DIR
+          || (ent->d_type == DT_UNKNOWN && fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+              && S_ISDIR(sb.st_mode)))
+        ok = add_sub(f, item, name);
+    }
+  }
+  close(fd);
+  if (!ok)
+    return false;
+
+  // only the directory's own matches need sorting here; the directories
+  // themselves are sorted once the walk is over
+  if (f->dir.n > 0) {
+    if (!(f->dir.names = malloc(f->dir.n * sizeof(char *))))
+      return false;
+    char *p = f->dir.block;
+    for (int i=0; i < f->dir.n; i++) {
+      f->dir.names[i] = p;
+      p += strlen(p) + 1;
+    }
+    qsort(f->dir.names, f->dir.n, sizeof(char *), compare_names);
+  }
+
+  if (!w->leaf || f->dir.n > 0)
+    return (f->dir.dir = strdup(item->path)) != NULL;
+  return true;
+}
+
+
+/*
+ * Hands what was found in one directory over to the walk. Called with
+ * the lock held.
+ */
+static bool publish(walk_t *w, found_t *f)
+{
+  if (!reserve((void **)&w->queue, &w->queue_cap, w->n_queued + f->n_subs, sizeof(work_t)))
+    return false;
+  if (f->dir.dir && !reserve((void **)&w->dirs, &w->dirs_cap, w->n_dirs + 1, sizeof(globstar_dir_t)))
+    return false;
+
+  memcpy(w->queue + w->n_queued, f->subs, f->n_subs * sizeof(work_t));
+  w->n_queued += f->n_subs;
+  if (f->dir.dir)
+    w->dirs[w->n_dirs++] = f->dir;
+
+  free(f->subs);
+  return true;
+}
+
+
+/*
+ * The body of each thread: reads directories off the queue until
+ * there are none left and no other thread can add more
+ */
+static void *worker(void *arg)
+{
+  walk_t *w = arg;
+  char *dents = malloc(DENTS_BUF);
+
+  pthread_mutex_lock(&w->lock);
+  if (!dents)
+    w->failed = true;
+
+  while (true) {
+    while (w->n_queued == 0 && w->busy > 0 && !w->failed)
+      pthread_cond_wait(&w->more, &w->lock);
+    if (w->n_queued == 0 || w->failed)
+      break;
+
+    work_t item = w->queue[--w->n_queued];
+    w->busy++;
+    pthread_mutex_unlock(&w->lock);
+
+    found_t f;
+    memset(&f, 0, sizeof(f));
+    bool ok = read_dir(w, &item, dents, &f);
+    free(item.path);
+
+    pthread_mutex_lock(&w->lock);
+    w->busy--;
+    if (!ok || !publish(w, &f)) {
+      free_found(&f);
+      w->failed = true;
+    }
+    pthread_cond_broadcast(&w->more);
+  }
+
+  // wake the others, so that they see the walk is over
+  pthread_cond_broadcast(&w->more);
+  pthread_mutex_unlock(&w->lock);
+  free(dents);
+  return NULL;
+}
+
+
+/*
+ * Orders directories so that each comes before the ones below it, and
+ * as if its path ended with a slash, which is how the paths of its
+ * entries continue; the root comes first
+ */
+static int compare_dirs(const void *a, const void *b)
+{
+  const unsigned char *p = (const unsigned char *)((const globstar_dir_t *)a)->dir;
+  const unsigned char *q = (const unsigned char *)((const globstar_dir_t *)b)->dir;
+
+  if (!*p || !*q)
+    return (*p != 0) - (*q != 0);
+
+  while (*p && *p == *q) {
+    p++;
+    q++;
+  }
+  if (*p == *q)
+    return 0;
+  int c = *p ? *p : '/';
+  int d = *q ? *q : '/';
+  if (c != d)
+    return c - d;
+  return *p ? 1 : -1;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the globstar calls.  All documentation is in
+ * the globstar.h file.
+ *
+ **********************************************************************/
+
+int globstar_walk(int root_fd, const char *leaf, int max_depth, int threads,
+                  globstar_dir_t **dirs)
+{
+  walk_t w;
+  memset(&w, 0, sizeof(w));
+  w.root_fd = root_fd;
+  w.leaf = leaf;
+  w.max_depth = max_depth;
+  pthread_mutex_init(&w.lock, NULL);
+  pthread_cond_init(&w.more, NULL);
+
+  // the root is the first piece of work
+  work_t root = {strdup(""), 0};
+  if (!root.path || !reserve((void **)&w.queue, &w.queue_cap, 1, sizeof(work_t))) {
+    free(root.path);
+    errno = ENOMEM;
+    return -1;
+  }
+  w.queue[w.n_queued++] = root;
+
+  // the calling thread is one of the workers
+  pthread_t tids[threads > 1 ? threads - 1 : 1];
+  int started = 0;
+  while (started < threads - 1 && pthread_create(&tids[started], NULL, worker, &w) == 0)
+    started++;
+  worker(&w);
+  for (int i=0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  pthread_mutex_destroy(&w.lock);
+  pthread_cond_destroy(&w.more);
+  for (int i=0; i < w.n_queued; i++)
+    free(w.queue[i].path);
+  free(w.queue);
+
+  if (w.failed) {
+    globstar_free(w.dirs, w.n_dirs);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  qsort(w.dirs, w.n_dirs, sizeof(globstar_dir_t), compare_dirs);
+  *dirs = w.dirs;
+  return w.n_dirs;
+}
+
+
+void globstar_free(globstar_dir_t *dirs, int n)
+{
+  for (int i=0; i < n; i++) {
+    free(dirs[i].dir);
+    free(dirs[i].names);
+    free(dirs[i].block);
+  }
+  free(dirs);
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+/*
+ * Creates an empty file, or a directory if the name ends with /
+ */
+static void make_entry(const char *name)
+{
+  size_t len = strlen(name);
+  if (name[len - 1] == '/') {
+    assert( mkdir(name, 0755) == 0 );
+    return;
+  }
+  int fd = open(name, O_CREAT | O_WRONLY, 0644);
+  assert( fd != -1 );
+  close(fd);
+}
+
+/*
+ * Walks the tree and flattens the result into "dir:name" strings
+ */
+static int walk_flat(int fd, const char *leaf, int max_depth, int threads, char out[][64])
+{
+  globstar_dir_t *dirs;
+  int n = globstar_walk(fd, leaf, max_depth, threads, &dirs);
+  assert( n >= 0 );
+
+  int k = 0;
+  for (int i=0; i < n; i++) {
+    if (!leaf)
+      snprintf(out[k++], 64, "%s", dirs[i].dir);
+    for (int j=0; j < dirs[i].n; j++)
+      snprintf(out[k++], 64, "%s:%s", dirs[i].dir, dirs[i].names[j]);
+  }
+  globstar_free(dirs, n);
+  return k;
+}
+
+void test_globstar()
+{
+  char tempdir[] = "/tmp/globstar_XXXXXX";
+  char out[32][64], out2[32][64];
+  const char *entries[] = {"a.c", "b.h", "d/", "d/x.c", "d/e/", "d/e/y.c", "d/e/f/",
+    "d/e/f/z.c", "d.b/", "d.b/w.c", ".hid/", ".hid/h.c", "d/.v.c", NULL};
+
+  assert( mkdtemp(tempdir) );
+  char *old_cwd = getcwd(NULL, 0);
+  assert( chdir(tempdir) == 0 );
+  for (int i=0; entries[i]; i++)
+    make_entry(entries[i]);
+  assert( symlink("d", "link") == 0 );
+  int fd = open(".", O_RDONLY | O_DIRECTORY);
+  assert( fd != -1 );
+
+  // every .c file outside hidden directories, in the same order
+  // whatever the number of threads
+  const char *expect[] = {":a.c", "d.b:w.c", "d:x.c", "d/e:y.c", "d/e/f:z.c"};
+  for (int threads=1; threads <= 4; threads++) {
+    assert( walk_flat(fd, "*.c", 100, threads, out) == 5 );
+    for (int i=0; i < 5; i++)
+      assert( strcmp(out[i], expect[i]) == 0 );
+  }
+
+  // the depth limit
+  assert( walk_flat(fd, "*.c", 0, 2, out) == 1 );
+  assert( walk_flat(fd, "*.c", 1, 2, out) == 3 );
+  assert( walk_flat(fd, "*.c", 2, 2, out) == 4 );
+
+  // without a leaf, every directory is listed, the root first, and
+  // hidden entries only match a leaf that starts with .
+  const char *expect_dirs[] = {"", "d.b", "d", "d/e", "d/e/f"};
+  assert( walk_flat(fd, NULL, 100, 3, out) == 5 );
+  for (int i=0; i < 5; i++)
+    assert( strcmp(out[i], expect_dirs[i]) == 0 );
+  assert( walk_flat(fd, ".*", 100, 3, out2) == 2 );
+  assert( strcmp(out2[0], ":.hid") == 0 && strcmp(out2[1], "d:.v.c") == 0 );
+  assert( walk_flat(fd, "*.z", 100, 3, out) == 0 );
+
+  // clean up
+  close(fd);
+  assert( unlink("link") == 0 );
+  for (int i=0; entries[i]; i++)
+    if (entries[i][strlen(entries[i]) - 1] != '/')
+      assert( unlink(entries[i]) == 0 );
+  for (int i = sizeof(entries) / sizeof(entries[0]) - 2; i >= 0; i--)
+    if (entries[i][strlen(entries[i]) - 1] == '/')
+      assert( rmdir(entries[i]) == 0 );
+  assert( chdir(old_cwd) == 0 );
+  free(old_cwd);
+  assert( rmdir(tempdir) == 0 );
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_globstar();
+  fprintf(stderr, "test_globstar: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
+
+
+
+/**********************************************************************
+ *
+ * Benchmark code below
+ *
+ **********************************************************************/
+#ifdef RUN_BENCH
+
+#include <time.h>               // clock_gettime
+
+#define BENCH_FILES 1000000     // files in the tree, unless given
+#define BENCH_TOP 10            // directories at the top of the tree
+#define BENCH_SUB 100           // directories in each of those
+#define BENCH_C_EVERY 10        // one file in this many is a .c file
+
+static double now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Creates or removes the tree below the cwd: BENCH_TOP directories,
+ * each holding BENCH_SUB directories, which share the files
+ */
+static void build_tree(int files, bool remove)
+{
+  char path[64];
+  int per_dir = files / (BENCH_TOP * BENCH_SUB);
+
+  for (int t=0; t < BENCH_TOP; t++) {
+    snprintf(path, sizeof(path), "t%d", t);
+    if (!remove)
+      assert( mkdir(path, 0755) == 0 );
+    for (int s=0; s < BENCH_SUB; s++) {
+      snprintf(path, sizeof(path), "t%d/s%d", t, s);
+      if (!remove)
+        assert( mkdir(path, 0755) == 0 );
+      for (int f=0; f < per_dir; f++) {
+        snprintf(path, sizeof(path), "t%d/s%d/f%d.%s", t, s, f, f % BENCH_C_EVERY ? "o" : "c");
+        if (remove)
+          unlink(path);
+        else
+          close(open(path, O_CREAT | O_WRONLY, 0644));
+      }
+      snprintf(path, sizeof(path), "t%d/s%d", t, s);
+      if (remove)
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "t%d", t);
+    if (remove)
+      rmdir(path);
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  char tempdir[] = "/tmp/bench_globstar_XXXXXX";
+  char cmd[128];
+  int files = argc > 1 ? atoi(argv[1]) : BENCH_FILES;
+
+  assert( mkdtemp(tempdir) );
+  char *old_cwd = getcwd(NULL, 0);
+  assert( chdir(tempdir) == 0 );
+  printf("building a tree of %d files in %d directories\n", files, BENCH_TOP * BENCH_SUB);
+  build_tree(files, false);
+  int fd = open(".", O_RDONLY | O_DIRECTORY);
+  assert( fd != -1 );
+
+  // find writing its matches to a temp file, as a shell script would
+  // use it, once to warm the inode cache and once to be measured
+  snprintf(cmd, sizeof(cmd), "find . -name '*.c' > %s.out", tempdir);
+  assert( system(cmd) == 0 );
+  double start = now_ms();
+  assert( system(cmd) == 0 );
+  printf("%-24s %10.1f ms\n", "find -name '*.c'", now_ms() - start);
+  snprintf(cmd, sizeof(cmd), "%s.out", tempdir);
+  unlink(cmd);
+
+  for (int threads=1; threads <= 8; threads *= 2) {
+    globstar_dir_t *dirs;
+    start = now_ms();
+    int n = globstar_walk(fd, "*.c", 64, threads, &dirs);
+    double elapsed = now_ms() - start;
+    assert( n >= 0 );
+
+    int matches = 0;
+    for (int i=0; i < n; i++)
+      matches += dirs[i].n;
+    globstar_free(dirs, n);
+    snprintf(cmd, sizeof(cmd), "**/*.c, %d thread%s", threads, threads > 1 ? "s" : "");
+    printf("%-24s %10.1f ms  (%d matches)\n", cmd, elapsed, matches);
+  }
+
+  close(fd);
+  build_tree(files, true);
+  assert( chdir(old_cwd) == 0 );
+  free(old_cwd);
+  rmdir(tempdir);
+  return 0;
+}
+
+#endif   // RUN_BENCH
@@ -0,0 +1,61 @@
+/*
+ * globstar.h
+ *
+ * A parallel walk of a directory tree, for the ** component of glob
+ * patterns
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _GLOBSTAR_H_
+#define _GLOBSTAR_H_
+
+/*
+ * One directory found by globstar_walk()
+ */
+typedef struct {
+  char *dir;          // path below the root, "" for the root itself
+  int n;              // number of names
+  char **names;       // the entries of dir that matched, sorted
+  char *block;        // storage for the names
+} globstar_dir_t;
+
+/*
+ * Walks the tree below a directory with a pool of threads, each of
+ * which reads whole directories with getdents64() through openat()
+ * relative to root_fd, and uses fstatat() only for entries whose type
+ * the file system does not report. Hidden directories (whose names
+ * start with .) and symbolic links to directories are not entered.
+ *
+ * The directories come back sorted by path, whatever order the
+ * threads happened to read them in.
+ *
+ * Parameters:
+ *   root_fd    An open directory to start from
+ *   leaf       A pattern to match the entries of each directory
+ *                against as for fnmatch() with FNM_PERIOD, or NULL to
+ *                only list the directories
+ *   max_depth  How many levels below the root to descend; 0 only
+ *                reads the root
+ *   threads    The number of threads to use, at least 1
+ *   dirs       Set to a new array of the directories, which must be
+ *                freed with globstar_free(). With a leaf, only
+ *                directories with matching entries are included.
+ *
+ * Returns:
+ *   The number of directories in dirs, or -1 with errno set if out of
+ *   memory or the threads could not be started. Directories that
+ *   cannot be read are skipped.
+ */
+int globstar_walk(int root_fd, const char *leaf, int max_depth, int threads,
+                  globstar_dir_t **dirs);
+
+/*
+ * Frees the directories returned by globstar_walk().
+ *
+ * Parameters:
+ *   dirs     The array
+ *   n        The number of directories in it
+ */
+void globstar_free(globstar_dir_t *dirs, int n);
+
+#endif /* _GLOBSTAR_H_ */
@@ -0,0 +1,408 @@
+/*
+ * jobs.c
+ *
+ * The table of pipelines running in the background, and the reaping
+ * of their processes as they exit
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <signal.h>             // sigprocmask
+#include <stdbool.h>            // bool
+#include <stdio.h>              // printf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strlen
+#include <sys/signalfd.h>       // signalfd
+#include <sys/wait.h>           // waitpid
+#include <unistd.h>             // read
+
+#include "jobs.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+
+/*
+ * One background pipeline
+ */
+typedef struct {
+  int id;             // the job number shown to the user
+  int n;              // number of stages
+  pid_t *pids;        // pid of each stage; -1 once reaped or never started
+  int *status;        // exit status of each stage, once reaped
+  int running;        // number of stages not yet reaped
+  char *text;         // the command line, for printing
+} job_t;
+
+static job_t *jobs = NULL;    // in the order they were started
+static int n_jobs = 0;
+static int jobs_cap = 0;
+
+static int sig_fd = -1;
+
+
+/*
+ * Converts a wait status to the number shown to the user
+ */
+static int exit_value(int status)
+{
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+
+/*
+ * Builds the text of a pipeline, as it would be typed
+ */
+static char *job_text(command_t *cmd)
+{
+  size_t len = 3;      // " &" and the NUL
+  for (command_t *stage = cmd; stage; stage = command_get_next(stage)) {
+    for (int i=0; i < command_get_assignc(stage); i++)
+      len += strlen(command_get_assigns(stage)[i]) + 1;
+    for (int i=0; i < command_get_argc(stage); i++)
+      len += strlen(command_get_argv(stage)[i]) + 1;
+    if (command_get_input(stage))
+      len += strlen(command_get_input(stage)) + 3;
+    if (command_get_output(stage))
+      len += strlen(command_get_output(stage)) + 3;
+    len += 3;
+  }
+
+  char *text = malloc(len);
+  if (!text)
+    return NULL;
+
+  char *p = text;
+  for (command_t *stage = cmd; stage; stage = command_get_next(stage)) {
+    if (stage != cmd)
+      p += sprintf(p, " | ");
+    for (int i=0; i < command_get_assignc(stage); i++)
+      p += sprintf(p, "%s ", command_get_assigns(stage)[i]);
+    for (int i=0; i < command_get_argc(stage); i++)
+      p += sprintf(p, i ? " %s" : "%s", command_get_argv(stage)[i]);
+    if (command_get_input(stage))
+      p += sprintf(p, " < %s", command_get_input(stage));
+    if (command_get_output(stage))
+      p += sprintf(p, " > %s", command_get_output(stage));
+  }
+  strcpy(p, " &");
+
+  return text;
+}
+
+
+/*
+ * Returns the index of job id in the table, or -1
+ */
+static int find_job(int id)
+{
+  for (int i=0; i < n_jobs; i++)
+    if (jobs[i].id == id)
+      return i;
+  return -1;
+}
+
+
+/*
+ * Frees the job at index i and closes the gap in the table
+ */
+static void remove_job(int i)
+{
+  free(jobs[i].pids);
+  free(jobs[i].status);
+  free(jobs[i].text);
+  memmove(&jobs[i], &jobs[i+1], (n_jobs - i - 1) * sizeof(job_t));
+  n_jobs--;
+}
+
+
+/*
+ * Records that stage s of job j is finished, with the exit value from
+ * exit_value(), or -1 if it has none
+ */
+static void stage_done(job_t *job, int s, int value)
+{
+  job->status[s] = value;
+  job->pids[s] = -1;
+  job->running--;
+}
+
+
+/*
+ * Prints one job's line of the jobs table
+ */
+static void print_job(FILE *out, const job_t *job)
+{
+  char state[32];
+  int last = job->status[job->n - 1];
+
+  if (job->running > 0)
+    snprintf(state, sizeof(state), "Running");
+  else if (last == 0)
+    snprintf(state, sizeof(state), "Done");
+  else
+    snprintf(state, sizeof(state), "Exit %d", last);
+
+  fprintf(out, "[%d]  %-10s %s\n", job->id, state, job->text);
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the jobs calls.  All documentation is in the
+ * jobs.h file.
+ *
+ **********************************************************************/
+
+int jobs_init()
+{
+  sigset_t mask;
+
+  if (sig_fd != -1)
+    return sig_fd;
+
+  // a blocked SIGCHLD stays pending for the signalfd, rather than
+  // interrupting whatever the shell is doing
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+    return -1;
+
+  sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  return sig_fd;
+}
+
+
+int jobs_add(command_t *cmd, const pid_t *pids, int n)
+{
+  if (n_jobs == jobs_cap) {
+    int cap = jobs_cap ? jobs_cap * 2 : 8;
+    job_t *p = realloc(jobs, cap * sizeof(job_t));
+    if (!p)
+      return -1;
+    jobs = p;
+    jobs_cap = cap;
+  }
+
+  job_t *job = &jobs[n_jobs];
+  job->id = n_jobs ? jobs[n_jobs - 1].id + 1 : 1;
+  job->n = n;
+  job->pids = malloc(n * sizeof(pid_t));
+  job->status = malloc(n * sizeof(int));
+  job->text = job_text(cmd);
+  if (!job->pids || !job->status || !job->text) {
+    free(job->pids);
+    free(job->status);
+    free(job->text);
+    return -1;
+  }
+
+  job->running = 0;
+  for (int i=0; i < n; i++) {
+    job->pids[i] = pids[i];
+    job->status[i] = -1;
+    if (pids[i] != -1)
+      job->running++;
+  }
+
+  n_jobs++;
+  return job->id;
+}
+
+
+void jobs_reap()
+{
+  struct signalfd_siginfo info;
+
+  // the signals themselves carry nothing we need, since several exits
+  // may be merged into one; drain them, then ask each process
+  if (sig_fd != -1)
+    while (read(sig_fd, &info, sizeof(info)) == sizeof(info))
+      ;
+
+  for (int j=0; j < n_jobs; j++) {
+    for (int s=0; s < jobs[j].n && jobs[j].running > 0; s++) {
+      int status;
+      if (jobs[j].pids[s] != -1 && waitpid(jobs[j].pids[s], &status, WNOHANG) == jobs[j].pids[s])
+        stage_done(&jobs[j], s, exit_value(status));
+    }
+  }
+}
+
+
+int jobs_current()
+{
+  return n_jobs ? jobs[n_jobs - 1].id : 0;
+}
+
+
+int jobs_wait(int id, const int **statuses)
+{
+  static int *last_status = NULL;
+
+  int j = find_job(id);
+  if (j == -1)
+    return -1;
+
+  job_t *job = &jobs[j];
+  for (int s=0; s < job->n; s++) {
+    int status;
+    pid_t pid;
+    if (job->pids[s] == -1)
+      continue;
+    while ((pid = waitpid(job->pids[s], &status, 0)) == -1 && errno == EINTR)
+      ;
+
+    // a process that cannot be waited for (ECHILD) leaves no status to
+    // decode, and is counted like a stage that never started
+    stage_done(job, s, pid == -1 ? -1 : exit_value(status));
+  }
+
+  // keep the statuses past the removal of the job
+  int n = job->n;
+  free(last_status);
+  last_status = job->status;
+  job->status = NULL;
+  *statuses = last_status;
+
+  remove_job(j);
+  return n;
+}
+
+
+void jobs_print(FILE *out)
+{
+  jobs_reap();
+  for (int j=0; j < n_jobs; j++)
+    print_job(out, &jobs[j]);
+
+  // a finished job has now been reported
+  jobs_notify(NULL);
+}
+
+
+void jobs_notify(FILE *out)
+{
+  for (int j=0; j < n_jobs; ) {
+    if (jobs[j].running > 0) {
+      j++;
+      continue;
+    }
+    if (out)
+      print_job(out, &jobs[j]);
+    remove_job(j);
+  }
+}
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+#include <poll.h>               // poll
+
+/*
+ * Forks a child that sleeps for ms milliseconds and exits with code
+ */
+static pid_t start_child(int ms, int code)
+{
+  pid_t pid = fork();
+  assert( pid != -1 );
+  if (pid == 0) {
+    usleep(ms * 1000);
+    _exit(code);
+  }
+  return pid;
+}
+
+void test_jobs()
+{
+  const int *statuses;
+  pid_t pids[3];
+  command_t *cmd;
+
+  int fd = jobs_init();
+  assert( fd != -1 );
+  assert( jobs_init() == fd );
+  assert( jobs_current() == 0 );
+  assert( jobs_wait(1, &statuses) == -1 );
+
+  // a two-stage job, whose text is rebuilt from the command
+  assert( (cmd = command_new()) );
+  assert( command_append_arg(cmd, "false") == 0 );
+  command_t *stage = command_append_stage(cmd);
+  assert( command_append_assign(stage, "LC_ALL=C", 8) == 0 );
+  assert( command_append_arg(stage, "wc") == 0 );
+  assert( command_append_arg(stage, "-l") == 0 );
+  assert( command_set_output(stage, "out") == 0 );
+  pids[0] = start_child(0, 1);
+  pids[1] = start_child(0, 0);
+  assert( jobs_add(cmd, pids, 2) == 1 );
+  assert( jobs_current() == 1 );
+
+  // the signalfd becomes readable once both have exited
+  struct pollfd pfd = {fd, POLLIN, 0};
+  for (int tries=0; tries < 100; tries++) {
+    assert( poll(&pfd, 1, 1000) == 1 );
+    jobs_reap();
+    if (jobs[0].running == 0)
+      break;
+  }
+  assert( jobs[0].running == 0 );
+  assert( strcmp(jobs[0].text, "false | LC_ALL=C wc -l > out &") == 0 );
+
+  // a job that is still running is not removed by jobs_notify()
+  pids[0] = start_child(200, 3);
+  pids[1] = -1;
+  assert( jobs_add(cmd, pids, 2) == 2 );
+  jobs_notify(stdout);
+  assert( n_jobs == 1 && jobs_current() == 2 );
+
+  // nor by jobs_print(), which does remove finished jobs
+  pids[0] = start_child(0, 0);
+  assert( jobs_add(cmd, pids, 1) == 3 );
+  usleep(50000);
+  jobs_print(stdout);
+  assert( n_jobs == 1 && jobs_current() == 2 );
+
+  // waiting collects the statuses, including those of stages that
+  // were never started
+  assert( jobs_wait(2, &statuses) == 2 );
+  assert( statuses[0] == 3 && statuses[1] == -1 );
+  assert( jobs_current() == 0 );
+
+  // numbers restart once the table is empty, and a killed stage
+  // reports 128 plus the signal
+  pids[0] = start_child(10000, 0);
+  assert( jobs_add(cmd, pids, 1) == 1 );
+  pids[0] = start_child(0, 0);
+  assert( jobs_add(cmd, pids, 1) == 2 );
+  kill(jobs[0].pids[0], SIGTERM);
+  assert( jobs_wait(1, &statuses) == 1 );
+  assert( statuses[0] == 128 + SIGTERM );
+  assert( jobs_wait(2, &statuses) == 1 && statuses[0] == 0 );
+
+  // a process that is not our child cannot be waited for
+  pids[0] = getppid();
+  pids[1] = start_child(0, 4);
+  assert( jobs_add(cmd, pids, 2) == 1 );
+  assert( jobs_wait(1, &statuses) == 2 );
+  assert( statuses[0] == -1 && statuses[1] == 4 );
+
+  command_free(cmd);
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_jobs();
+  fprintf(stderr, "test_jobs: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
@@ -0,0 +1,94 @@
+/*
+ * jobs.h
+ *
+ * The table of pipelines running in the background, and the reaping
+ * of their processes as they exit
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "command.h"
+
+/*
+ * Blocks SIGCHLD and creates a signalfd that becomes readable when a
+ * child changes state, so that the shell can wait for input and for
+ * finished jobs at the same time, and reap them without polling. Must
+ * be called before any child is started.
+ *
+ * Returns:
+ *   The signalfd, which is non-blocking, or -1 on error. Jobs still
+ *   work without it, but are only reaped when jobs_reap() is called.
+ */
+int jobs_init();
+
+/*
+ * Adds a pipeline that has been started in the background.
+ *
+ * Parameters:
+ *   cmd      The first stage of the pipeline, used to describe the job
+ *   pids     The pid of each stage, or -1 for a stage that could not
+ *              be started
+ *   n        The number of stages
+ *
+ * Returns:
+ *   The job number, which is at least 1, or -1 if out of memory
+ */
+int jobs_add(command_t *cmd, const pid_t *pids, int n);
+
+/*
+ * Collects every background process that has exited, without
+ * blocking. Drains the signalfd, if there is one.
+ */
+void jobs_reap();
+
+/*
+ * Returns:
+ *   The number of the most recently started job, or 0 if there are
+ *   no jobs
+ */
+int jobs_current();
+
+/*
+ * Waits until every process of a job has exited, and removes it from
+ * the table.
+ *
+ * Parameters:
+ *   id         The job number
+ *   statuses   Set to the exit status of each stage of the job, which
+ *                is 128 plus the signal number for a stage killed by a
+ *                signal, and -1 for a stage that was never started
+ *                or could not be waited for.
+ *                Valid until the next call to a jobs function.
+ *
+ * Returns:
+ *   The number of stages, or -1 if there is no such job
+ */
+int jobs_wait(int id, const int **statuses);
+
+/*
+ * Prints every job and whether it is still running, in the style of
+ * the jobs builtin of other shells, then removes the finished ones:
+ *    [1]  Running    sleep 10 &
+ *    [2]  Exit 1     false | false &
+ *
+ * Parameters:
+ *   out      Where to print the jobs
+ */
+void jobs_print(FILE *out);
+
+/*
+ * Prints, and removes from the table, every job that has finished
+ * since the last call.
+ *
+ * Parameters:
+ *   out      Where to print the finished jobs, or NULL to remove them
+ *              silently
+ */
+void jobs_notify(FILE *out);
+
+#endif /* _JOBS_H_ */
@@ -0,0 +1,494 @@
+/*
+ * parallel.c
+ *
+ * Running one command over many arguments, several at a time
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE             // pipe2
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <fcntl.h>              // open
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strstr
+#include <sys/epoll.h>          // epoll_create1
+#include <sys/syscall.h>        // SYS_pidfd_open
+#include <sys/wait.h>           // waitpid
+#include <unistd.h>             // read, write
+
+#include "parallel.h"
+#include "pathcache.h"
+#include "spawn.h"
+#include "vars.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+
+#define READ_SIZE (64 * 1024)   // bytes read from a pipe at a time
+#define MAX_EVENTS 64           // events taken from epoll at a time
+#define MAX_FAILED 101          // the largest status returned
+
+/*
+ * One run of the command, for one argument
+ */
+typedef struct {
+  const char *arg;    // the argument
+  pid_t pid;          // the child, or -1 once reaped or if never started
+  int out_fd;         // read end of the child's stdout, or -1 at EOF
+  int pid_fd;         // readable once the child exits, or -1
+  char *buf;          // output read but not yet written
+  size_t len;         // bytes in buf
+  size_t cap;         // size of buf
+  int status;         // exit status, once reaped
+  bool finished;      // output at EOF, and child reaped
+} run_t;
+
+// epoll data is the run's index, shifted, with this bit for the pidfd
+#define EV_PIDFD 1
+
+
+/*
+ * Writes all of buf to stdout
+ */
+static void write_all(const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(STDOUT_FILENO, buf, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return;
+    buf += n;
+    len -= n;
+  }
+}
+
+
+/*
+ * Appends data to a run's buffer of output not yet written
+ */
+static bool buffer_output(run_t *run, const char *data, size_t len)
+{
+  if (run->len + len > run->cap) {
+    size_t cap = run->cap ? run->cap : READ_SIZE;
+    while (cap < run->len + len)
+      cap *= 2;
+    char *p = realloc(run->buf, cap);
+    if (!p)
+      return false;
+    run->buf = p;
+    run->cap = cap;
+  }
+
+  memcpy(run->buf + run->len, data, len);
+  run->len += len;
+  return true;
+}
+
+
+/*
+ * In tag mode, writes each complete line in a run's buffer, prefixed
+ * by its argument; at the end of the output, any last partial line
+ * too, with a newline added
+ */
+static void write_tagged(run_t *run, bool at_end)
+{
+  size_t pos = 0;
+  size_t arg_len = strlen(run->arg);
+
+  while (pos < run->len) {
+    char *nl = memchr(run->buf + pos, '\n', run->len - pos);
+    if (!nl && !at_end)
+      break;
+
+    size_t end = nl ? (size_t)(nl - run->buf) : run->len;
+    write_all(run->arg, arg_len);
+    write_all("\t", 1);
+    write_all(run->buf + pos, end - pos);
+    write_all("\n", 1);
+    pos = nl ? end + 1 : end;
+  }
+
+  memmove(run->buf, run->buf + pos, run->len - pos);
+  run->len -= pos;
+}
+
+
+/*
+ * Frees an argv from build_argv(), or one it built the first cmd_argc
+ * words of
+ */
+static void free_argv(char **argv, char *const *cmd, int cmd_argc)
+{
+  for (int i=0; i < cmd_argc && argv[i]; i++)
+    if (argv[i] != cmd[i])
+      free(argv[i]);
+  free(argv);
+}
+
+
+/*
+ * Builds the argv of one run: {} is replaced by arg inside each word,
+ * or arg is appended if no word contains {}. Words that were rewritten
+ * are newly allocated; the others point into cmd. Returns NULL if out
+ * of memory, having freed any words already built.
+ */
+static char **build_argv(char *const *cmd, int cmd_argc, const char *arg)
+{
+  char **argv = malloc((cmd_argc + 2) * sizeof(char *));
+  if (!argv)
+    return NULL;
+
+  bool replaced = false;
+  size_t arg_len = strlen(arg);
+
+  for (int i=0; i < cmd_argc; i++) {
+    const char *brace = strstr(cmd[i], "{}");
+    if (!brace) {
+      argv[i] = cmd[i];
+      continue;
+    }
+
+    // every {} in the word is replaced
+    int count = 0;
+    for (const char *p = brace; p; p = strstr(p + 2, "{}"))
+      count++;
+
+    char *word = malloc(strlen(cmd[i]) + count * arg_len + 1);
+    if (!word) {
+      free_argv(argv, cmd, i);
+      return NULL;
+    }
+
+    char *w = word;
+    const char *from = cmd[i];
+    for (const char *p = brace; p; p = strstr(from, "{}")) {
+      memcpy(w, from, p - from);
+      w += p - from;
+      memcpy(w, arg, arg_len);
+      w += arg_len;
+      from = p + 2;
+    }
+    strcpy(w, from);
+
+    argv[i] = word;
+    replaced = true;
+  }
+
+  argv[cmd_argc] = replaced ? NULL : (char *)arg;
+  argv[cmd_argc + 1] = NULL;
+  return argv;
+}
+
+
+/*
+ * Starts one run, with its stdout going to a pipe that is watched
+ * along with its pidfd. Returns false if it could not be started.
+ */
+static bool start_run(run_t *run, int index, int epfd, int in_fd,
+                      char *const *cmd, int cmd_argc)
+{
+  int fds[2];
+  bool ok = false;
+
+  char **argv = build_argv(cmd, cmd_argc, run->arg);
+  if (!argv) {
+    fprintf(stderr, "parallel: %s\n", strerror(ENOMEM));
+    goto out;
+  }
+
+  const char *path = pathcache_lookup(argv[0]);
+  if (!path) {
+    if (errno == ENOENT)
+      fprintf(stderr, "Command not found: '%s'\n", argv[0]);
+    else
+      fprintf(stderr, "Command failed: '%s': %s\n", argv[0], strerror(errno));
+    goto out;
+  }
+
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "parallel: pipe: %s\n", strerror(errno));
+    goto out;
+  }
+
+  run->pid = spawn_process(path, argv, vars_envp(), in_fd, fds[1]);
+  close(fds[1]);
+  if (run->pid == -1) {
+    fprintf(stderr, "Command failed: '%s': %s\n", argv[0], strerror(errno));
+    close(fds[0]);
+    goto out;
+  }
+
+  struct epoll_event ev = {.events = EPOLLIN};
+  run->out_fd = fds[0];
+  ev.data.u64 = (uint64_t)index << 1;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, run->out_fd, &ev);
+
+  // without pidfds (before Linux 5.3) the child is waited for at EOF
+  run->pid_fd = syscall(SYS_pidfd_open, run->pid, 0);
+  if (run->pid_fd != -1) {
+    fcntl(run->pid_fd, F_SETFD, FD_CLOEXEC);
+    ev.data.u64 = ((uint64_t)index << 1) | EV_PIDFD;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, run->pid_fd, &ev);
+  }
+  ok = true;
+
+ out:
+  if (argv)
+    free_argv(argv, cmd, cmd_argc);
+  return ok;
+}
+
+
+/*
+ * Collects the exit status of a run's child, if it has exited. With
+ * block set, waits for it.
+ */
+static void reap_run(run_t *run, int epfd, bool block)
+{
+  int status;
+
+  if (run->pid == -1)
+    return;
+  if (waitpid(run->pid, &status, block ? 0 : WNOHANG) != run->pid)
+    return;
+
+  run->status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+  run->pid = -1;
+  if (run->pid_fd != -1) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, run->pid_fd, NULL);
+    close(run->pid_fd);
+    run->pid_fd = -1;
+  }
+}
+
+
+/**********************************************************************
+ *
+ * Implementation for the parallel call.  All documentation is in the
+ * parallel.h file.
+ *
+ **********************************************************************/
+
+int parallel_run(char *const *cmd, int cmd_argc, char *const *args, int n_args,
+                 int max_jobs, bool tag)
+{
+  struct epoll_event events[MAX_EVENTS];
+  static char data[READ_SIZE];
+  int next_start = 0;     // the next argument to start a run for
+  int next_emit = 0;      // in order mode, the run whose output is written next
+  int in_flight = 0;
+  int n_finished = 0;
+  int failed = 0;
+
+  if (n_args == 0)
+    return 0;
+
+  run_t *runs = calloc(n_args, sizeof(run_t));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  int in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (!runs || epfd == -1 || in_fd == -1) {
+    fprintf(stderr, "parallel: %s\n", strerror(errno ? errno : ENOMEM));
+    free(runs);
+    if (epfd != -1)
+      close(epfd);
+    if (in_fd != -1)
+      close(in_fd);
+    return 1;
+  }
+
+  // the runs' output must come after anything the shell has printed
+  fflush(stdout);
+
+  while (n_finished < n_args) {
+    // keeping max_jobs runs in flight
+    while (in_flight < max_jobs && next_start < n_args) {
+      run_t *run = &runs[next_start];
+      run->arg = args[next_start];
+      run->pid = run->out_fd = run->pid_fd = -1;
+      if (start_run(run, next_start, epfd, in_fd, cmd, cmd_argc))
+        in_flight++;
+      else {
+        run->status = -1;
+        run->finished = true;
+        n_finished++;
+      }
+      next_start++;
+    }
+
+    // in order mode, writing every finished run at the head of the
+    // line, and whatever the first unfinished one has so far
+    while (!tag && next_emit < next_start) {
+      run_t *run = &runs[next_emit];
+      write_all(run->buf, run->len);
+      run->len = 0;
+      if (!run->finished)
+        break;
+      next_emit++;
+    }
+
+    if (in_flight == 0)
+      continue;
+
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1) {
+      fprintf(stderr, "parallel: epoll_wait: %s\n", strerror(errno));
+      break;
+    }
+
+    for (int e=0; e < n; e++) {
+      int index = events[e].data.u64 >> 1;
+      run_t *run = &runs[index];
+
+      if (events[e].data.u64 & EV_PIDFD)
+        reap_run(run, epfd, false);
+      else {
+        ssize_t got = read(run->out_fd, data, sizeof(data));
+        if (got == -1 && errno == EINTR)
+          continue;
+
+        if (got > 0) {
+          // the head of the line in order mode has nothing to wait for
+          if (!tag && index == next_emit)
+            write_all(data, got);
+          else if (!buffer_output(run, data, got))
+            fprintf(stderr, "parallel: %s: output lost: %s\n", run->arg, strerror(ENOMEM));
+          else if (tag)
+            write_tagged(run, false);
+        } else {
+          epoll_ctl(epfd, EPOLL_CTL_DEL, run->out_fd, NULL);
+          close(run->out_fd);
+          run->out_fd = -1;
+          if (run->pid_fd == -1)
+            reap_run(run, epfd, true);
+        }
+      }
+
+      if (!run->finished && run->out_fd == -1 && run->pid == -1) {
+        if (tag)
+          write_tagged(run, true);
+        run->finished = true;
+        n_finished++;
+        in_flight--;
+      }
+    }
+  }
+
+  // the rest of the output, in order
+  for (; !tag && next_emit < n_args; next_emit++)
+    write_all(runs[next_emit].buf, runs[next_emit].len);
+
+  for (int i=0; i < n_args; i++) {
+    if (runs[i].status != 0)
+      failed++;
+    free(runs[i].buf);
+  }
+
+  free(runs);
+  close(epfd);
+  close(in_fd);
+  return failed > MAX_FAILED ? MAX_FAILED : failed;
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+/*
+ * Runs parallel_run() with stdout sent to a file, and returns what
+ * was written, which the caller must free
+ */
+static char *capture(char *const *cmd, int cmd_argc, char *const *args, int n_args,
+                     int max_jobs, bool tag, int *ret)
+{
+  char path[] = "/tmp/parallel_XXXXXX";
+  int fd = mkstemp(path);
+  assert( fd != -1 );
+  unlink(path);
+
+  int saved = dup(STDOUT_FILENO);
+  dup2(fd, STDOUT_FILENO);
+  *ret = parallel_run(cmd, cmd_argc, args, n_args, max_jobs, tag);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  off_t len = lseek(fd, 0, SEEK_END);
+  char *out = malloc(len + 1);
+  assert( out && pread(fd, out, len, 0) == len );
+  out[len] = '\0';
+  close(fd);
+  return out;
+}
+
+void test_parallel()
+{
+  int ret;
+  char *out;
+
+  // later arguments finish first, but the output is in order
+  char *sleep_cmd[] = {"sh", "-c", "sleep 0.{}; echo {}"};
+  char *sleep_args[] = {"3", "2", "1", "0"};
+  out = capture(sleep_cmd, 3, sleep_args, 4, 4, false, &ret);
+  assert( ret == 0 );
+  assert( strcmp(out, "3\n2\n1\n0\n") == 0 );
+  free(out);
+
+  // tagged, so in the order of finishing
+  out = capture(sleep_cmd, 3, sleep_args, 4, 4, true, &ret);
+  assert( ret == 0 );
+  assert( strcmp(out, "0\t0\n1\t1\n2\t2\n3\t3\n") == 0 );
+  free(out);
+
+  // no {}, so the argument is appended; more arguments than jobs
+  char *echo_cmd[] = {"echo", "arg"};
+  char *args[] = {"a", "b", "c", "d", "e"};
+  out = capture(echo_cmd, 2, args, 5, 2, false, &ret);
+  assert( ret == 0 );
+  assert( strcmp(out, "arg a\narg b\narg c\narg d\narg e\n") == 0 );
+  free(out);
+
+  // failures are counted, including a command that does not exist
+  char *test_cmd[] = {"test", "{}", "=", "b"};
+  out = capture(test_cmd, 4, args, 5, 3, false, &ret);
+  assert( ret == 4 );
+  free(out);
+  char *missing_cmd[] = {"/does/not/exist"};
+  out = capture(missing_cmd, 1, args, 2, 1, false, &ret);
+  assert( ret == 2 && *out == '\0' );
+  free(out);
+
+  // output larger than a pipe holds, from a run that is not first
+  char *big_cmd[] = {"head", "-c", "{}", "/dev/zero"};
+  char *big_args[] = {"10", "1000000"};
+  out = capture(big_cmd, 4, big_args, 2, 2, false, &ret);
+  assert( ret == 0 );
+  free(out);
+
+  // a partial last line is still tagged
+  char *printf_cmd[] = {"sh", "-c", "printf 'x\\ny'"};
+  char *one_arg[] = {"t"};
+  out = capture(printf_cmd, 3, one_arg, 1, 1, true, &ret);
+  assert( strcmp(out, "t\tx\nt\ty\n") == 0 );
+  free(out);
+
+  assert( parallel_run(echo_cmd, 2, args, 0, 1, false) == 0 );
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_parallel();
+  fprintf(stderr, "test_parallel: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
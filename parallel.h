@@ -0,0 +1,43 @@
+/*
+ * parallel.h
+ *
+ * Running one command over many arguments, several at a time
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <stdbool.h>
+
+/*
+ * Runs a command once for each argument in args, with up to max_jobs
+ * copies running at a time. In each run, every {} inside the command's
+ * words is replaced by the argument; if there is no {}, the argument
+ * is appended to the command instead.
+ *
+ * The stdout of every run is captured through a pipe, and all of the
+ * pipes are read as data arrives, so that a run never stalls on a
+ * full pipe. The output is then written to the shell's stdout either
+ * in the order of args, whatever order the runs finish in, or, with
+ * tag, line by line as it arrives with each line prefixed by its
+ * argument and a tab. Each run reads from /dev/null, and its stderr
+ * is not captured.
+ *
+ * Parameters:
+ *   cmd        The command and its arguments
+ *   cmd_argc   The number of words in cmd
+ *   args       The arguments to run the command over
+ *   n_args     The number of arguments
+ *   max_jobs   The most runs to have in flight at once, at least 1
+ *   tag        Whether to tag lines by argument, rather than keep
+ *                the output in order
+ *
+ * Returns:
+ *   0 if every run exited with status 0; otherwise the number of runs
+ *   that failed or could not be started, at most 101
+ */
+int parallel_run(char *const *cmd, int cmd_argc, char *const *args, int n_args,
+                 int max_jobs, bool tag);
+
+#endif /* _PARALLEL_H_ */
@@ -9,222 +9,660 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <assert.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stddef.h>
-#include <glob.h>
+#include <pwd.h>
 
 #include "parser.h"
 #include "command.h"
+#include "pglob.h"
+#include "vars.h"
+#include "scan.h"
+#include "subst.h"
+
+/*
+ * Byte classes used by the tokenizer. The table is indexed by the
+ * unsigned value of each input byte, so classification never depends
+ * on the current locale the way isspace()/isalnum() do.
+ */
+enum
+{
+  CC_OTHER = 0, // ordinary word character
+  CC_SPACE,     // ' ', \t, \n, \v, \f, \r
+  CC_QUOTE,     // "
+  CC_ESCAPE,    // backslash
+  CC_DOLLAR,    // $
+  CC_REDIR,     // < or >
+  CC_OPERATOR,  // | or &, which is a word by itself
+  CC_NUL,       // end of input
+  CC_COUNT
+};
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CC_NUL,
+    ['\t'] = CC_SPACE,
+    ['\n'] = CC_SPACE,
+    ['\v'] = CC_SPACE,
+    ['\f'] = CC_SPACE,
+    ['\r'] = CC_SPACE,
+    [' '] = CC_SPACE,
+    ['"'] = CC_QUOTE,
+    ['\\'] = CC_ESCAPE,
+    ['$'] = CC_DOLLAR,
+    ['<'] = CC_REDIR,
+    ['>'] = CC_REDIR,
+    ['|'] = CC_OPERATOR,
+    ['&'] = CC_OPERATOR,
+};
+
+// THE TOKEN FLAG FOR EACH OPERATOR CHARACTER
+static const unsigned operator_flag[256] = {
+    ['|'] = TOK_PIPE,
+    ['&'] = TOK_BACKGROUND,
+};
+
+// CHARACTERS ALLOWED IN A VARIABLE NAME: LETTERS, DIGITS AND UNDERSCORE
+static const bool is_varname[256] = {
+    ['0' ... '9'] = true,
+    ['A' ... 'Z'] = true,
+    ['a' ... 'z'] = true,
+    ['_'] = true,
+};
+
+// TRANSLATION OF EACH LEGAL ESCAPE SEQUENCE; 0 MEANS ILLEGAL
+static const char escape_char[256] = {
+    ['n'] = '\n',
+    ['t'] = '\t',
+    ['r'] = '\r',
+    [' '] = ' ',
+    ['"'] = '"',
+    ['\\'] = '\\',
+    ['$'] = '$',
+    ['<'] = '<',
+    ['>'] = '>',
+    ['|'] = '|',
+    ['&'] = '&',
+};
+
+/*
+ * Tokenizer states and actions. Each step looks up the class of the
+ * current byte in the transition table for the current state, performs
+ * the action and moves to the next state; every byte of input is
+ * examined exactly once. Inside a word or quotes, the run of ordinary
+ * bytes after a copied one is found by scan_span(), 16 or 32 bytes at
+ * a time, and copied with it.
+ */
+enum
+{
+  ST_LEAD,  // skipping leading whitespace
+  ST_WORD,  // inside an unquoted word
+  ST_QUOTE, // inside double quotes
+  ST_REDIR, // after a redirection character, waiting for the filename
+  ST_COUNT
+};
+
+enum
+{
+  ACT_SKIP,      // consume the byte without output
+  ACT_COPY,      // copy the byte to the word
+  ACT_ESCAPE,    // translate an escape sequence
+  ACT_VARIABLE,  // expand a $variable
+  ACT_OPERATOR,  // copy the byte, which forms a word by itself
+  ACT_END,       // the word is complete; do not consume the byte
+  ACT_ERR_QUOTE, // unterminated quote
+  ACT_ERR_REDIR, // redirection without filename
+  ACT_REDIR_MORE,// a < right after <, making << or <<<
+};
+
+typedef struct
+{
+  unsigned char action;
+  unsigned char next;
+} transition_t;
+
+static const transition_t transitions[ST_COUNT][CC_COUNT] = {
+    [ST_LEAD] = {
+        [CC_OTHER] = {ACT_COPY, ST_WORD},
+        [CC_SPACE] = {ACT_SKIP, ST_LEAD},
+        [CC_QUOTE] = {ACT_SKIP, ST_QUOTE},
+        [CC_ESCAPE] = {ACT_ESCAPE, ST_WORD},
+        [CC_DOLLAR] = {ACT_VARIABLE, ST_WORD},
+        [CC_REDIR] = {ACT_COPY, ST_REDIR},
+        [CC_OPERATOR] = {ACT_OPERATOR, ST_WORD},
+        [CC_NUL] = {ACT_END, ST_LEAD},
+    },
+    [ST_WORD] = {
+        [CC_OTHER] = {ACT_COPY, ST_WORD},
+        [CC_SPACE] = {ACT_END, ST_WORD},
+        [CC_QUOTE] = {ACT_SKIP, ST_QUOTE},
+        [CC_ESCAPE] = {ACT_ESCAPE, ST_WORD},
+        [CC_DOLLAR] = {ACT_VARIABLE, ST_WORD},
+        [CC_REDIR] = {ACT_END, ST_WORD},
+        [CC_OPERATOR] = {ACT_END, ST_WORD},
+        [CC_NUL] = {ACT_END, ST_WORD},
+    },
+    [ST_QUOTE] = {
+        [CC_OTHER] = {ACT_COPY, ST_QUOTE},
+        [CC_SPACE] = {ACT_COPY, ST_QUOTE},
+        [CC_QUOTE] = {ACT_SKIP, ST_WORD},
+        [CC_ESCAPE] = {ACT_ESCAPE, ST_QUOTE},
+        [CC_DOLLAR] = {ACT_VARIABLE, ST_QUOTE},
+        [CC_REDIR] = {ACT_COPY, ST_QUOTE},
+        [CC_OPERATOR] = {ACT_COPY, ST_QUOTE},
+        [CC_NUL] = {ACT_ERR_QUOTE, ST_QUOTE},
+    },
+    [ST_REDIR] = {
+        [CC_OTHER] = {ACT_COPY, ST_WORD},
+        [CC_SPACE] = {ACT_SKIP, ST_REDIR},
+        [CC_QUOTE] = {ACT_SKIP, ST_QUOTE},
+        [CC_ESCAPE] = {ACT_ESCAPE, ST_WORD},
+        [CC_DOLLAR] = {ACT_VARIABLE, ST_WORD},
+        [CC_REDIR] = {ACT_REDIR_MORE, ST_REDIR},
+        [CC_OPERATOR] = {ACT_ERR_REDIR, ST_REDIR},
+        [CC_NUL] = {ACT_ERR_REDIR, ST_REDIR},
+    },
+};
+
+// CHARACTERS THAT MAKE A WORD A GLOB PATTERN (~ ONLY COUNTS AT THE START)
+static const bool is_globchar[256] = {
+    ['*'] = true,
+    ['?'] = true,
+    ['['] = true,
+    ['{'] = true,
+};
+
+/*
+ * Where a translated word is written: a caller's fixed buffer, or one
+ * that starts on the stack and moves to the heap, doubling, when a word
+ * outgrows it, so that a word of any length costs linear time
+ */
+typedef struct
+{
+  char *buf;
+  size_t cap;    // size of buf
+  bool grows;    // buf may be replaced by a bigger one
+  bool on_heap;  // buf was allocated here, and must be freed
+} word_buf_t;
+
+#define WORD_BUF_INIT(stack_buf) {stack_buf, sizeof(stack_buf), true, false}
+
+/*
+ * Makes room for n more bytes and a NUL after *w in out, moving *w
+ * along if the buffer moves.
+ *
+ * Returns:
+ *   false if the buffer is fixed and too small, or out of memory
+ */
+static bool word_room(word_buf_t *out, char **w, size_t n)
+{
+  size_t used = *w - out->buf;
+  if (n < out->cap - used)
+    return true;
+  if (!out->grows)
+    return false;
+
+  size_t cap = out->cap * 2;
+  if (cap < used + n + 1)
+    cap = used + n + 1;
+  char *buf = out->on_heap ? realloc(out->buf, cap) : malloc(cap);
+  if (buf == NULL)
+    return false;
+  if (!out->on_heap)
+    memcpy(buf, out->buf, used);
+
+  out->buf = buf;
+  out->cap = cap;
+  out->on_heap = true;
+  *w = buf + used;
+  return true;
+}
+
+static void word_buf_free(word_buf_t *out)
+{
+  if (out->on_heap)
+    free(out->buf);
+}
+
+/*
+ * Appends n bytes of a word to its glob pattern at *pw. Bytes that were
+ * quoted or escaped get a backslash before each glob character or
+ * backslash, so that the pattern matches them as they are.
+ *
+ * Returns:
+ *   false if out of memory
+ */
+static bool pattern_append(word_buf_t *pattern, char **pw, const unsigned char *src, size_t n, bool literal)
+{
+  if (!word_room(pattern, pw, literal ? 2 * n : n))
+    return false;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (literal && (is_globchar[src[i]] || src[i] == '\\'))
+      *(*pw)++ = '\\';
+    *(*pw)++ = src[i];
+  }
+  return true;
+}
+
+// RUNS THE COMMAND OF A $(...) SUBSTITUTION; SET BY parse_set_subst_runner()
+static int (*subst_runner)(const char *line) = NULL;
 
 /*
  * Documented in .h file
  */
+void parse_set_subst_runner(int (*run)(const char *line))
+{
+  subst_runner = run;
+}
 
-// bring in the read_word function
-int read_word(const char *input, char *word, size_t word_len)
+/*
+ * Finds the ) that closes the $( whose ( is at open. Parentheses nest,
+ * and those inside double quotes or after a backslash do not count.
+ *
+ * Returns:
+ *   A pointer to the closing ), or NULL if there is none
+ */
+static const unsigned char *find_subst_end(const unsigned char *open)
 {
-  assert(input);
-  assert(word);
+  const unsigned char *p = open + 1;
+  int depth = 1;
+  bool quoted = false;
 
-  const char *inpt = input;
-  char *w = word;
-  bool insideQuotes = false;
+  for (; *p; p++)
+  {
+    if (*p == '\\' && p[1] != '\0')
+      p++;
+    else if (*p == '"')
+      quoted = !quoted;
+    else if (quoted)
+      continue;
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')' && --depth == 0)
+      return p;
+  }
+  return NULL;
+}
+
+/*
+ * Runs the command between the parentheses of a $(...), reading its
+ * output into a buffer that is kept from one substitution to the next.
+ *
+ * Returns:
+ *   The output, less trailing newlines, or NULL with a message in msg
+ */
+static const subst_buf_t *substitute(const unsigned char *open, const unsigned char *close,
+                                     char *msg, size_t msg_len)
+{
+  static subst_buf_t output = SUBST_BUF_INIT;
 
-  // SKIP THROUGH ANY LEADING WHITESPACE
-  while (isspace(*inpt))
+  if (subst_runner == NULL)
   {
-    // check if its the end of the input and stop
-    if (*inpt == '\0')
-      break;
-    else
-      inpt++;
+    snprintf(msg, msg_len, "Command substitution not available");
+    return NULL;
   }
 
-  while (*inpt)
+  size_t line_len = close - open - 1;
+  char *line = malloc(line_len + 1);
+  if (line == NULL)
   {
-    // IF WE ARE BETWEEN QUOTES
-    if (*inpt == '"')
-    {
-      // COUNT THE NUMBER OF QUOTES FROM THE FIRST, AND CHECK IF IT IS ODD OR EVEN
-      int quotCount = 0;
+    snprintf(msg, msg_len, "Out of memory");
+    return NULL;
+  }
+  memcpy(line, open + 1, line_len);
+  line[line_len] = '\0';
 
-      for (int i = 0; i < strlen(input); i++)
-      {
-        if (*(input + i - 1) != '\\' && *(input + i) == '"')
-          quotCount++;
-      }
+  int status = subst_capture(line, subst_runner, &output);
+  free(line);
+  if (status == -1)
+  {
+    snprintf(msg, msg_len, "Command substitution failed: %s", strerror(errno));
+    return NULL;
+  }
+  return &output;
+}
 
-      // IF IT IS ODD, THEN IT IS NOT TERMINATED
-      if (quotCount % 2 != 0)
-      {
-        sprintf(word, "Unterminated quote");
-        return -1;
-      }
-    }
+/*
+ * The tokenizer behind read_word(), read_token() and token_expand().
+ * Scans the first word of input, recording its span and flags in tok.
+ * If out is non-NULL the translated word is also written there, with
+ * variables expanded; otherwise only the span is computed and
+ * variables are not looked up. If pattern is also non-NULL, the word
+ * is written there a second time as a glob pattern, in which what was
+ * quoted or escaped is matched literally.
+ *
+ * Returns the number of characters consumed, or -1 with an error
+ * message in msg.
+ */
+static int scan_word(const char *input, token_t *tok, word_buf_t *out, word_buf_t *pattern,
+                     char *msg, size_t msg_len)
+{
+  const unsigned char *inpt = (const unsigned char *)input;
+  const unsigned char *start = inpt;
+  char *w = out ? out->buf : NULL;
+  char *pw = pattern ? pattern->buf : NULL;
+  int state = ST_LEAD;
+  unsigned flags = 0;
+  unsigned redir_flag = 0;
+  bool appending = false;
 
-    // IF WE ARE NOT BETWEEN QUOTES AND WE ENCOUNTER A SPACE, THEN WE ARE DONE
-    if (isspace(*inpt) && !insideQuotes)
-      break;
+  while (1)
+  {
+    const transition_t *t = &transitions[state][char_class[*inpt]];
 
-    // IF WE ENCOUNTER A QUOTE, HANDLE IT BY TOGGLING THE BETWEEN QUOTES FLAG(IN & OUT)
-    else if (*inpt == '"')
+    // THE SPAN STARTS WHERE WE LEAVE THE LEADING WHITESPACE, AND AGAIN
+    // WHERE THE FILENAME OF A REDIRECTION STARTS
+    if ((state == ST_LEAD || state == ST_REDIR) && (t->next != state || t->action == ACT_END))
     {
-      insideQuotes = !insideQuotes;
-      inpt++;
+      start = inpt;
+      if (state == ST_REDIR)
+        flags |= redir_flag;
+      else if (t->next == ST_REDIR)
+        redir_flag = (*inpt == '<') ? TOK_REDIR_IN : TOK_REDIR_OUT;
+      else if (*inpt == '~')
+        flags |= TOK_TILDE;
     }
 
-    // HANDLING SPECIAL CHARACTERS
-    else if (*inpt == '\\')
+    switch (t->action)
     {
-      switch (*(inpt + 1))
-      {
-      case 'n':
-        *w++ = '\n';
-        break;
+    case ACT_SKIP:
+      if (*inpt == '"')
+        flags |= TOK_QUOTED;
+      inpt++;
+      break;
 
-      case 'r':
-        *w++ = '\r';
-        break;
+    case ACT_COPY:
+    {
+      // A GLOB CHARACTER INSIDE DOUBLE QUOTES IS JUST A CHARACTER
+      if (is_globchar[*inpt] && state != ST_QUOTE)
+        flags |= TOK_GLOB;
 
-      case 't':
-        *w++ = '\t';
-        break;
+      // THE BYTES AFTER IT THAT NEED NO ACTION OF THEIR OWN ARE FOUND
+      // MANY AT A TIME, AND COPIED IN ONE GO
+      size_t run = 1;
+      if (t->next == ST_WORD || t->next == ST_QUOTE)
+        run += scan_span((const char *)inpt + 1, t->next == ST_WORD ? SCAN_WORD : SCAN_QUOTED);
+      if (out)
+      {
+        if (!word_room(out, &w, run))
+          goto too_long;
+        memcpy(w, inpt, run);
+        w += run;
+      }
+      if (pattern && !pattern_append(pattern, &pw, inpt, run, state == ST_QUOTE))
+        goto too_long;
+      inpt += run;
+      break;
+    }
 
-      case '\\':
-        *w++ = '\\';
-        break;
+    case ACT_ESCAPE:
+      // TRANSLATE THE CHARACTER FOLLOWING THE BACKSLASH
+      if (escape_char[inpt[1]] == 0)
+      {
+        snprintf(msg, msg_len, "Illegal escape character: %c", inpt[1]);
+        return -1;
+      }
+      flags |= TOK_ESCAPED;
+      if (out)
+      {
+        if (!word_room(out, &w, 1))
+          goto too_long;
+        *w++ = escape_char[inpt[1]];
+      }
+      if (pattern && !pattern_append(pattern, &pw, (const unsigned char *)&escape_char[inpt[1]], 1, true))
+        goto too_long;
+      inpt += 2;
+      break;
 
-      case ' ':
-        *w++ = ' ';
-        break;
+    case ACT_VARIABLE:
+    {
+      // $(...) IS REPLACED WITH THE OUTPUT OF THE COMMAND INSIDE IT
+      if (inpt[1] == '(')
+      {
+        const unsigned char *open = inpt + 1;
+        const unsigned char *close = find_subst_end(open);
+        if (close == NULL)
+        {
+          snprintf(msg, msg_len, "Unterminated $(");
+          return -1;
+        }
 
-      case '$':
-        *w++ = '$';
-        break;
+        flags |= TOK_VARIABLE;
+        inpt = close + 1;
+        if (!out)
+          break;
 
-      case '"':
-        *w++ = '\"';
+        // THE OUTPUT IS PART OF THE WORD, AS A VARIABLE'S VALUE IS, AND
+        // IS NOT SPLIT INTO WORDS
+        const subst_buf_t *output = substitute(open, close, msg, msg_len);
+        if (output == NULL)
+          return -1;
+        if (!word_room(out, &w, output->len))
+          goto too_long;
+        memcpy(w, output->buf, output->len);
+        w += output->len;
+        if (pattern && !pattern_append(pattern, &pw, (const unsigned char *)output->buf, output->len, state == ST_QUOTE))
+          goto too_long;
         break;
+      }
 
-      case '<':
-        *w++ = '<';
-        break;
+      // THE NAME RUNS OVER LETTERS, DIGITS AND UNDERSCORES AFTER THE $
+      const unsigned char *name = ++inpt;
+      while (is_varname[*inpt])
+        inpt++;
 
-      case '>':
-        *w++ = '>';
+      flags |= TOK_VARIABLE;
+      if (!out)
         break;
 
-      default:
-        sprintf(word, "Illegal escape character: %c", *(inpt + 1));
+      // LOOKING THE NAME UP IN PLACE, WITHOUT COPYING IT OUT OF THE INPUT
+      const char *value = vars_getn((const char *)name, inpt - name);
+      if (value == NULL)
+      {
+        snprintf(msg, msg_len, "Undefined variable: '%.*s'", (int)(inpt - name), name);
         return -1;
       }
-      inpt += 2;
-    }
 
-    // SUPPORTING VARIABLE SUBSTITUTION IF THE WORD BEGINS WITH $
-    else if (*inpt == '$')
-    {
-      int count = 0;
-      char *varContainter = malloc(strlen(inpt) * sizeof(char));
+      size_t value_len = strlen(value);
+      if (!word_room(out, &w, value_len))
+        goto too_long;
+      memcpy(w, value, value_len);
+      w += value_len;
+      if (pattern && !pattern_append(pattern, &pw, (const unsigned char *)value, value_len, state == ST_QUOTE))
+        goto too_long;
+      break;
+    }
 
-      // CHECK IF THE VARIABLE NAME IS ALPHANUMERIC
-      while (isalnum(*(inpt + 1)))
+    case ACT_OPERATOR:
+      flags |= operator_flag[*inpt];
+      if (out)
       {
-        *(varContainter + count) = *(inpt + 1);
-        inpt++;
-        count++;
+        if (!word_room(out, &w, 1))
+          goto too_long;
+        *w++ = *inpt;
       }
+      if (pattern && !pattern_append(pattern, &pw, inpt, 1, false))
+        goto too_long;
+      inpt++;
+      // FALL THROUGH: THE OPERATOR IS THE WHOLE WORD
 
-      *(varContainter + count) = '\0';
+    case ACT_END:
+      if (out)
+        *w = '\0';
+      if (pattern)
+        *pw = '\0';
+      tok->offset = (const char *)start - input;
+      tok->length = inpt - start;
+      tok->flags = flags;
+      return (const char *)inpt - input;
 
-      // GETTING THE VALUE OF THE VARIABLE FROM THE ENVIRONMENT
-      char *actValue = getenv(varContainter);
+    case ACT_ERR_QUOTE:
+      snprintf(msg, msg_len, "Unterminated quote");
+      return -1;
 
-      // IF THE VARIABLE - varContainter - IS NOT DEFINED, RETURN AN ERROR
-      if (actValue == NULL)
+    case ACT_REDIR_MORE:
+      // >> IS THE SAME REDIRECTION AS >, SINCE OUTPUT FILES ARE ALWAYS
+      // OPENED FOR APPENDING
+      if (*inpt == '>' && inpt[-1] == '>' && redir_flag == TOK_REDIR_OUT && !appending)
       {
-        sprintf(word, "Undefined variable: \'%s\'", varContainter);
+        appending = true;
+        inpt++;
+        break;
+      }
+
+      // << AND <<< ARE SINGLE OPERATORS, WITH NOTHING BETWEEN THEIR <s;
+      // ANY OTHER REDIRECTION CHARACTER WHERE A FILENAME BELONGS IS AN ERROR
+      if (*inpt != '<' || inpt[-1] != '<' || redir_flag == TOK_HERESTRING)
+      {
+        snprintf(msg, msg_len, "Redirection without filename");
         return -1;
       }
+      redir_flag = (redir_flag == TOK_REDIR_IN) ? TOK_HEREDOC : TOK_HERESTRING;
+      if (out)
+      {
+        if (!word_room(out, &w, 1))
+          goto too_long;
+        *w++ = '<';
+      }
+      if (pattern && !pattern_append(pattern, &pw, inpt, 1, false))
+        goto too_long;
+      inpt++;
+      break;
 
-      // COPY THE VALUE OF THE VARIABLE TO THE WORD
-      strcpy(w, actValue);
+    case ACT_ERR_REDIR:
+      snprintf(msg, msg_len, "Redirection without filename");
+      return -1;
+    }
 
+    state = t->next;
+  }
 
-      // MOVE THE POINTER TO THE END OF THE VALUE
-      w += strlen(actValue);
+too_long:
+  snprintf(msg, msg_len, out->grows ? "Out of memory" : "Word too long");
+  return -1;
+}
 
-      // FREE THE MEMORY ALLOCATED FOR THE VARIABLE
-      free(varContainter);
+/*
+ * Documented in .h file
+ */
+int read_word(const char *input, char *word, size_t word_len)
+{
+  assert(input);
+  assert(word);
 
-      // MOVE THE POINTER TO THE NEXT CHARACTER
-      inpt++;
-    }
+  token_t tok;
+  word_buf_t out = {word, word_len, false, false};
+  return scan_word(input, &tok, &out, NULL, word, word_len);
+}
 
-    // SUPPORTING GLOB PATTERN EXPANSION FOR <, >, >>
-    else if (*inpt == '<' || *inpt == '>' || (*inpt == '>' && *(inpt + 1) == '>'))
-    {
-      // IF WE ARE BETWEEN QUOTES, THEN < OR > ARE NOT REDIRECTION OPERATORS, SO COPY THEM TO THE WORD
-      if (insideQuotes)
-      {
-        *w++ = *inpt++;
-        continue;
-      }
+/*
+ * Documented in .h file
+ */
+int read_token(const char *input, token_t *tok, char *err_msg, size_t err_msg_len)
+{
+  assert(input);
+  assert(tok);
 
-      // IF SPACE BEFORE OR AFTER REDIRECTION, OR RED.. IS 1st IN THE INPUT, COPY IT
-      if (isspace(*(inpt - 1)) || isspace(*(inpt + 1)) || inpt == input)
-      {
-        *w++ = *inpt++;
+  return scan_word(input, tok, NULL, NULL, err_msg, err_msg_len);
+}
 
-        // SKIP WHITESPACES
-        while (isspace(*inpt))
-          inpt++;
+/*
+ * Documented in .h file
+ */
+int token_expand(const char *input, const token_t *tok, char *word, size_t word_len)
+{
+  assert(input);
+  assert(tok);
+  assert(word);
 
-        // IF THE REDIRECTION OPERATOR IS THE LAST CHARACTER IN THE INPUT, THEN RETURN AN ERROR
-        if (*inpt == '\0')
-        {
-          strcpy(word, "Redirection without filename");
-          return -1;
-        }
-      }
+  token_t span;
+  word_buf_t out = {word, word_len, false, false};
+  if (scan_word(input + tok->offset, &span, &out, NULL, word, word_len) == -1)
+    return -1;
 
-      // IF THE REDIRECTION OPERATOR IS THE ONLY CHARACTER IN THE INPUT, RETURN AN ERROR ALSO
-      else if (*(inpt + 1) == '\0')
-      {
-        strcpy(word, "Redirection without filename");
-        return -1;
-      }
+  return strlen(word);
+}
 
-      
-      // IF THE REDIRECTION OPERATOR IS NOT PRECEDED BY A SPACE, THEN IT IS NOT A REDIRECTION OPERATOR
-      else
-        break;
-    }
+/*
+ * Replaces a leading ~ or ~user in word with the home directory, as
+ * the shell does before globbing. A ~ with no known home directory is
+ * left alone.
+ *
+ * Returns:
+ *   The length of the expanded word in out, or -1 if out of memory
+ */
+static ssize_t expand_tilde(const char *word, size_t word_len, word_buf_t *out)
+{
+  // THE USER NAME RUNS UP TO THE FIRST /
+  size_t name_len = strcspn(word + 1, "/");
+  const char *home = NULL;
 
-    // COPY THE CHARACTER TO THE WORD
-    else
-      *w++ = *inpt++;
+  if (name_len == 0)
+    home = vars_get("HOME");
+  else
+  {
+    char name[name_len + 1];
+    memcpy(name, word + 1, name_len);
+    name[name_len] = '\0';
+    struct passwd *pw = getpwnam(name);
+    if (pw != NULL)
+      home = pw->pw_dir;
+  }
 
-    // WHEN THE WORD IS TOO LONG, COPY Word too long AND RETURN -1
-    if (w >= word + word_len)
-    {
-      strcpy(word, "Word too long");
-      return -1;
-    }
+  if (home == NULL)
+  {
+    home = "~";
+    name_len = 0;
   }
 
-  // NULL TERMINATE THE WORD
-  *w = '\0';
+  size_t home_len = strlen(home);
+  size_t rest_len = word_len - 1 - name_len;
+  char *w = out->buf;
+  if (!word_room(out, &w, home_len + rest_len))
+    return -1;
+
+  memcpy(w, home, home_len);
+  memcpy(w + home_len, word + 1 + name_len, rest_len);
+  w[home_len + rest_len] = '\0';
+  return home_len + rest_len;
+}
+
+/*
+ * Returns true if a word as typed starts with NAME=, where NAME is a
+ * letter or _ followed by letters, digits and _, with no quoting
+ */
+static bool is_assignment(const char *word, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    char c = word[i];
+    if (c == '=')
+      return i > 0;
 
-  // RETURN THE NUMBER OF CHARACTERS PROCESSED
-  return inpt - input;
+    // LIKE THE TOKENIZER, THIS DOES NOT DEPEND ON THE LOCALE
+    bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    if (!letter && !(i > 0 && c >= '0' && c <= '9'))
+      return false;
+  }
+  return false;
+}
+
+/*
+ * Returns true if a stage already has its input redirected, from a
+ * file, a here-document or a here-string
+ */
+static bool has_input(command_t *stage)
+{
+  size_t len;
+  return command_get_input(stage) != NULL || command_get_heredoc(stage, NULL) != NULL
+      || command_get_input_data(stage, &len) != NULL;
 }
 
 /*
@@ -233,110 +671,410 @@ int read_word(const char *input, char *word, size_t word_len)
 command_t *parse_input(const char *input, char *err_msg, size_t err_msg_len)
 {
   int chars_read = 0;
-  char word[512];
+  token_t tok;
 
-  // ALLOCATE MEMORY FOR THE NEW COMMAND
-  command_t *cmd = command_new();
+  // WORDS ARE TRANSLATED INTO STACK BUFFERS, WHICH MOVE TO THE HEAP AND
+  // GROW ONLY FOR A WORD TOO LONG FOR THEM
+  char word_stack[512];
+  char home_stack[512];
+  char pattern_stack[512];
+  word_buf_t word = WORD_BUF_INIT(word_stack);
+  word_buf_t home_word = WORD_BUF_INIT(home_stack);
+  word_buf_t pattern_word = WORD_BUF_INIT(pattern_stack);
 
-  // IF THE INPUT IS FINISHED OR NULL, RETURN THE COMMAND
-  while (1)
+  // ALLOCATE THE NEW COMMAND; ALL OF ITS STRINGS SHARE ONE ARENA
+  command_t *cmd = command_new_arena();
+  if (cmd == NULL)
   {
-    // READ THE WORDS FROM THE INPUT
-    chars_read = read_word(input, word, sizeof(word));
-    input += chars_read;
+    strncpy(err_msg, "Out of memory", err_msg_len);
+    return NULL;
+  }
+
+  // THE PIPELINE STAGE THAT WORDS ARE CURRENTLY ADDED TO
+  command_t *stage = cmd;
 
-    // IF THERE IS AN ERROR, FREE THE MEMORY ALLOCATED FOR THE COMMAND AND RETURN NULL
+  while (1)
+  {
+    // FIND THE NEXT WORD IN PLACE
+    chars_read = read_token(input, &tok, err_msg, err_msg_len);
     if (chars_read == -1)
+      goto error;
+
+    if (tok.length == 0) // end of input string
+      break;
+
+    // A PIPE ENDS THE CURRENT STAGE AND STARTS THE NEXT ONE
+    if (tok.flags & TOK_PIPE)
     {
-      command_free(cmd);
-      strncpy(err_msg, word, err_msg_len);
-      return NULL;
+      input += chars_read;
+      if (command_get_argc(stage) == 0)
+      {
+        strncpy(err_msg, "Missing command", err_msg_len);
+        goto error;
+      }
+      if ((stage = command_append_stage(cmd)) == NULL)
+      {
+        strncpy(err_msg, "Out of memory", err_msg_len);
+        goto error;
+      }
+      continue;
     }
 
-    if (chars_read == 0) // end of input string
+    // A & RUNS THE WHOLE LINE IN THE BACKGROUND, SO NOTHING MAY FOLLOW IT
+    if (tok.flags & TOK_BACKGROUND)
+    {
+      input += chars_read;
+      if (command_get_argc(stage) == 0)
+      {
+        strncpy(err_msg, "Missing command", err_msg_len);
+        goto error;
+      }
+      if (read_token(input, &tok, err_msg, err_msg_len) == -1 || tok.length != 0)
+      {
+        strncpy(err_msg, "& must end the command", err_msg_len);
+        goto error;
+      }
+      command_set_background(cmd, true);
       break;
+    }
 
-    if (*word == '\0') // whitespace only
-      continue;
+    // PLAIN WORDS ARE USED STRAIGHT FROM THE INPUT; ONLY WORDS WITH
+    // QUOTES, ESCAPES, VARIABLES, GLOBS OR REDIRECTION ARE TRANSLATED
+    const char *raw = input + tok.offset;
+    const char *text = raw;
+    size_t text_len = tok.length;
+    const char *pattern = NULL;
+    bool translated = (tok.flags & (TOK_NEEDS_EXPANSION | TOK_GLOB | TOK_TILDE | TOK_REDIR_IN | TOK_REDIR_OUT | TOK_HEREDOC | TOK_HERESTRING)) != 0;
 
-    // IF THE FIRST CHARACTER OF THE WORD IS < OR >
-    if (*word == '<' || *word == '>' || (*word == '>' && *(word + 1) == '>'))
+    if (translated)
     {
-      // ALREADY A VALUE FOR IN_FILE OR OUT_FILE, COPY ERROR - “Multiple redirections not allowed”
-      if ((*word == '<' && command_get_input(cmd) != NULL) || (*word == '>' && command_get_output(cmd) != NULL) || (*word == '>' && *(word + 1) == '>' && command_get_output(cmd) != NULL))
+      token_t span;
+      // A GLOB WORD ALSO GETS ITS PATTERN, WRITTEN IN THE SAME PASS SO
+      // THAT ANY $(...) IN IT RUNS ONCE
+      word_buf_t *pattern_out = (tok.flags & TOK_GLOB) ? &pattern_word : NULL;
+      if (scan_word(raw, &span, &word, pattern_out, err_msg, err_msg_len) == -1)
+        goto error;
+      text = word.buf;
+      text_len = strlen(word.buf);
+      pattern = pattern_word.buf;
+    }
+    input += chars_read;
+
+    // A QUOTED OR ESCAPED WORD STARTING WITH < OR > IS ALSO A REDIRECTION
+    char redir = 0;
+    if (tok.flags & TOK_REDIR_IN)
+      redir = '<';
+    else if (tok.flags & TOK_REDIR_OUT)
+      redir = '>';
+    else if (translated && !(tok.flags & (TOK_HEREDOC | TOK_HERESTRING)) && (*text == '<' || *text == '>'))
+    {
+      redir = *text++;
+      text_len--;
+    }
+
+    // A HERE-DOCUMENT ONLY NAMES ITS DELIMITER HERE, AND ITS BODY IS READ
+    // LATER BY parse_heredocs(); A HERE-STRING'S WORD IS THE INPUT ITSELF
+    if (tok.flags & (TOK_HEREDOC | TOK_HERESTRING))
+    {
+      if (has_input(stage))
       {
         strncpy(err_msg, "Multiple redirections not allowed", err_msg_len);
-        return NULL;
+        goto error;
       }
 
-      // OTHERWISE, PASS THE PROVIDED FILENAME, STARTING AT *(word + 1)
-      if (*word == '<')
-        command_set_input(cmd, word + 1);
+      int set;
+      if (tok.flags & TOK_HEREDOC)
+        set = command_set_heredoc(stage, text, !(tok.flags & (TOK_QUOTED | TOK_ESCAPED)));
+      else
+      {
+        // THE WORD IS FOLLOWED BY A NEWLINE, AS IF IT WERE A ONE-LINE FILE
+        char *w = word.buf + text_len;
+        set = -1;
+        if (word_room(&word, &w, 1))
+        {
+          *w = '\n';
+          set = command_set_input_data(stage, word.buf, text_len + 1);
+        }
+      }
+      if (set == -1)
+      {
+        strncpy(err_msg, "Out of memory", err_msg_len);
+        goto error;
+      }
+    }
+    else if (redir)
+    {
+      if (text_len == 0)
+      {
+        strncpy(err_msg, "Redirection without filename", err_msg_len);
+        goto error;
+      }
 
-      else if (*word == '>' && *(word + 1) == '>')
-        // append to file - THIS IS CORRECT
-        command_set_output(cmd, word + 2);
+      // ALREADY A VALUE FOR IN_FILE OR OUT_FILE, COPY ERROR - “Multiple redirections not allowed”
+      if ((redir == '<' && has_input(stage)) || (redir == '>' && command_get_output(stage) != NULL))
+      {
+        strncpy(err_msg, "Multiple redirections not allowed", err_msg_len);
+        goto error;
+      }
 
+      if (redir == '<')
+        command_set_input(stage, text);
       else
-        command_set_output(cmd, word + 1);
+        command_set_output(stage, text);
+    }
+    // NAME=value BEFORE THE COMMAND NAME IS AN ASSIGNMENT, WHOSE VALUE IS
+    // NOT GLOBBED; IT APPLIES TO THIS STAGE ONLY, OR TO THE SHELL IF THERE
+    // IS NO COMMAND
+    else if (command_get_argc(stage) == 0 && is_assignment(raw, tok.length))
+    {
+      if (command_append_assign(stage, text, text_len) == -1)
+      {
+        strncpy(err_msg, "Out of memory", err_msg_len);
+        goto error;
+      }
+      continue;
     }
+    else if (text_len == 0) // empty quotes
+      continue;
     else
     {
-      // INITIALIZE THE GLOB
-      glob_t globbuf;
-
-      // GLOB THE WORD
-      glob(word, GLOB_NOCHECK, NULL, &globbuf);
+      // A LEADING ~ IS EXPANDED FIRST, SO IT APPLIES EVEN WHERE NOTHING MATCHES
+      if (tok.flags & TOK_TILDE)
+      {
+        ssize_t len = expand_tilde(text, text_len, &home_word);
+        if (len == -1)
+        {
+          strncpy(err_msg, "Out of memory", err_msg_len);
+          goto error;
+        }
+        text = home_word.buf;
+        text_len = len;
 
-      // GETTING THE HOME DIRECTORY FROM THE ENVIRONMENT
-      char *homeDir = getenv("HOME");
-      char *expanded_word = malloc(sizeof(char) * (strlen(word) + strlen(homeDir) + 1));
+        // THE WORD BUFFER IS FREE NOW, AND TAKES THE PATTERN'S EXPANSION
+        if ((tok.flags & TOK_GLOB) && expand_tilde(pattern, strlen(pattern), &word) == -1)
+        {
+          strncpy(err_msg, "Out of memory", err_msg_len);
+          goto error;
+        }
+        pattern = word.buf;
+      }
 
-      // HANDLING THE EXPANSIONS
-      switch (*word)
+      // LITERAL WORDS GO STRAIGHT INTO ARGV
+      if (!(tok.flags & TOK_GLOB))
       {
-      case '~':
-        // TILDE EXTENSION - REPLACE ~ WITH THE HOME DIRECTORY
-        strcpy(expanded_word, word);
-        glob(expanded_word, GLOB_TILDE_CHECK, NULL, &globbuf);
-        free(expanded_word);
-        break;
+        if (command_append_argn(stage, text, text_len) == -1)
+        {
+          strncpy(err_msg, "Out of memory", err_msg_len);
+          goto error;
+        }
+      }
+      else
+      {
+        // ONE EXPANSION PASS COVERS WILDCARDS AND BRACES, AGAINST CACHED
+        // DIRECTORY LISTINGS; A PATTERN THAT MATCHES NOTHING IS KEPT AS IT
+        // IS, LESS ITS QUOTES
+        int first = command_get_argc(stage);
+        int matches = pglob_expand(pattern, stage, 0);
+        if (matches == -1 || (matches == 0 && command_append_argn(stage, text, text_len) == -1))
+        {
+          strncpy(err_msg, "Out of memory", err_msg_len);
+          goto error;
+        }
 
-      case '{':
-        // BRACE EXTENSION - eg: REPLACE {a,b,c} WITH a b c
-        glob(word, GLOB_BRACE, NULL, &globbuf);
-        break;
+        // ONLY THE MATCHES MAY BE SPLIT ACROSS RUNS IF ARGV GETS TOO BIG
+        if (matches > 0)
+          command_mark_expansion(stage, first);
+      }
+    }
 
-      case '?':
-      case '*':
-        // WILDCARD ? AND * - REPLACE ? AND * WITH THE FILENAMES THAT MATCH THE PATTERN
-        glob(word, GLOB_NOCHECK, NULL, &globbuf);
-        break;
+    // IF THERE IS NO COMMAND BEFORE THE REDIRECTION, RETURN AN ERROR
+    if (command_get_argc(stage) == 0)
+    {
+      strncpy(err_msg, "Missing command", err_msg_len);
+      goto error;
+    }
+  }
 
-      // OTHERWISE, DO NOTHING
-      default:
-        break;
+  // A PIPE MUST BE FOLLOWED BY A COMMAND
+  if (stage != cmd && command_get_argc(stage) == 0)
+  {
+    strncpy(err_msg, "Missing command", err_msg_len);
+    goto error;
+  }
+
+  word_buf_free(&word);
+  word_buf_free(&home_word);
+  word_buf_free(&pattern_word);
+  return cmd;
+
+error:
+  word_buf_free(&word);
+  word_buf_free(&home_word);
+  word_buf_free(&pattern_word);
+  command_free(cmd);
+  return NULL;
+}
+/*
+ * Finds the body of a here-document: the lines of input from *pos up
+ * to one that is exactly delim. *pos is moved past that line, or to
+ * the end of input if there is none.
+ *
+ * Returns true if the delimiter was found, with the body's span in
+ * body and body_len (if not NULL); false if the body runs to the end
+ * of input.
+ */
+static bool find_heredoc(const char *input, size_t len, size_t *pos, const char *delim,
+                         size_t *body, size_t *body_len)
+{
+  size_t delim_len = strlen(delim);
+  size_t start = *pos;
+  size_t line = start;
+
+  while (line < len)
+  {
+    const char *nl = memchr(input + line, '\n', len - line);
+    size_t end = (nl != NULL) ? (size_t)(nl - input) : len;
+
+    if (end - line == delim_len && memcmp(input + line, delim, delim_len) == 0)
+    {
+      if (body != NULL)
+      {
+        *body = start;
+        *body_len = line - start;
       }
+      *pos = (nl != NULL) ? end + 1 : end;
+      return true;
+    }
+    line = (nl != NULL) ? end + 1 : end;
+  }
+
+  if (body != NULL)
+  {
+    *body = start;
+    *body_len = len - start;
+  }
+  *pos = len;
+  return false;
+}
 
-      // PROCESSING THE MATCHING GLOB RESULTS - ADDING THEM TO THE COMMAND
-      for (int i = 0; i < globbuf.gl_pathc; i++)
+/*
+ * Gives a stage the body of its here-document, expanding $variables
+ * and the escapes \$ and \\ in it if asked; any other backslash is
+ * kept as it is. A body with nothing to expand is set without copying
+ * it first.
+ *
+ * Returns 0 on success, or -1 with an error message in err_msg.
+ */
+static int set_heredoc_body(command_t *stage, const char *body, size_t len, bool expand,
+                            char *err_msg, size_t err_msg_len)
+{
+  const char *p = body;
+  const char *end = body + len;
 
-        // IF THE WORD ENDS WITH /, ADD IT AS IT IS
-        if (*(word + strlen(word) - 1) == '/')
-          command_append_arg(cmd, word);
-        else
-          command_append_arg(cmd, globbuf.gl_pathv[i]);
+  if (expand)
+  {
+    while (p < end && *p != '$' && *p != '\\')
+      p++;
+  }
+  if (!expand || p == end)
+  {
+    if (command_set_input_data(stage, body, len) == -1)
+      goto out_of_memory;
+    return 0;
+  }
 
-      globfree(&globbuf);
+  // THE TEXT BEFORE THE FIRST $ OR \ GOES OVER IN ONE COPY
+  char stack_buf[512];
+  word_buf_t out = WORD_BUF_INIT(stack_buf);
+  char *w = out.buf;
+  if (!word_room(&out, &w, p - body))
+    goto out_of_memory_free;
+  memcpy(w, body, p - body);
+  w += p - body;
+
+  while (p < end)
+  {
+    const char *from = p;
+    size_t n = 1;
+
+    if (*p == '\\' && p + 1 < end && (p[1] == '$' || p[1] == '\\'))
+    {
+      from = p + 1;
+      p += 2;
+    }
+    else if (*p == '$' && p + 1 < end && is_varname[(unsigned char)p[1]])
+    {
+      const char *name = ++p;
+      while (p < end && is_varname[(unsigned char)*p])
+        p++;
+      from = vars_getn(name, p - name);
+      if (from == NULL)
+      {
+        snprintf(err_msg, err_msg_len, "Undefined variable: '%.*s'", (int)(p - name), name);
+        word_buf_free(&out);
+        return -1;
+      }
+      n = strlen(from);
     }
+    else
+      p++;
 
-    // IF THERE IS NO COMMAND BEFORE THE REDIRECTION, RETURN AN ERROR
-    if (command_get_argc(cmd) == 0)
+    if (!word_room(&out, &w, n))
+      goto out_of_memory_free;
+    memcpy(w, from, n);
+    w += n;
+  }
+
+  int set = command_set_input_data(stage, out.buf, w - out.buf);
+  word_buf_free(&out);
+  if (set == -1)
+    goto out_of_memory;
+  return 0;
+
+out_of_memory_free:
+  word_buf_free(&out);
+out_of_memory:
+  strncpy(err_msg, "Out of memory", err_msg_len);
+  return -1;
+}
+
+/*
+ * Documented in .h file
+ */
+int parse_heredocs(command_t *cmd, const char *input, size_t len, bool final,
+                   size_t *used, char *err_msg, size_t err_msg_len)
+{
+  size_t pos = 0;
+  *used = 0;
+
+  // EVERY BODY IS FOUND BEFORE ANY IS SET, SO THAT A COMMAND WAITING
+  // FOR MORE INPUT IS LEFT AS IT WAS
+  if (!final)
+  {
+    for (command_t *stage = cmd; stage != NULL; stage = command_get_next(stage))
     {
-      strncpy(err_msg, "Missing command", err_msg_len);
-      return NULL;
+      const char *delim = command_get_heredoc(stage, NULL);
+      if (delim != NULL && !find_heredoc(input, len, &pos, delim, NULL, NULL))
+        return PARSE_MORE_INPUT;
     }
+    pos = 0;
   }
 
-  return cmd;
-}
\ No newline at end of file
+  // THE BODIES FOLLOW THE LINE ONE AFTER ANOTHER, IN THE ORDER OF THE <<s
+  int ret = 0;
+  for (command_t *stage = cmd; stage != NULL; stage = command_get_next(stage))
+  {
+    bool expand;
+    size_t body, body_len;
+    const char *delim = command_get_heredoc(stage, &expand);
+    if (delim == NULL)
+      continue;
+
+    find_heredoc(input, len, &pos, delim, &body, &body_len);
+    if (ret == 0 && set_heredoc_body(stage, input + body, body_len, expand, err_msg, err_msg_len) == -1)
+      ret = -1;
+  }
+
+  *used = pos;
+  return ret;
+}
@@ -23,8 +23,10 @@
  * word, it is possible to read the next word by calling read_word
  * again with the pointer input+return_value.
  * 
- * Normally, a word ends with unescaped whitespace or one of the
- * redirection characters ('<' or '>').
+ * Normally, a word ends with unescaped whitespace, one of the
+ * redirection characters ('<' or '>'), the pipe character ('|'), or
+ * the background character ('&'). An unescaped and unquoted '|' or
+ * '&' is returned as a word by itself.
  * 
  * However, if an unescaped double quote is encountered, then the
  * characters from that double quote up to the next double quote are
@@ -35,10 +37,22 @@
  * 
  * Variables follow the form $varname, where varname is any
  * combination of letters, numbers, or underscores. Variables are
- * expanded via a call to getenv() as they are read. Expansion occurs
- * both inside and outside double quotes. If a variable is not found
- * in the environment, the error message "Undefined variable:
- * '<varname>'" is returned.
+ * expanded through vars_getn() as they are read, which looks the name
+ * up in the shell's variable table without copying it. Expansion
+ * occurs both inside and outside double quotes. If a variable is not
+ * found, the error message "Undefined variable: '<varname>'" is
+ * returned.
+ *
+ * $(line) is a command substitution: line, which runs to the matching
+ * unquoted and unescaped ), is run by the function given to
+ * parse_set_subst_runner(), and is replaced by its output with
+ * trailing newlines removed. Like a variable's value, the output is
+ * part of the word and is not split at whitespace, inside or outside
+ * double quotes. A $( with no ) is the error "Unterminated $(", one
+ * with no runner set is the error "Command substitution not
+ * available", and one whose command could not be started is the
+ * error "Command substitution failed: <reason>". The status of the
+ * command is not checked.
  * 
  * The function converts escape sequences as follows:
  *    \n        newline
@@ -50,6 +64,8 @@
  *    \$        a literal dollar sign (does not start a variable)
  *    \<        a literal less-than symbol (does not indicate redirection)
  *    \>        a literal greater-than symbol (does not indicate redirection)
+ *    \|        a literal vertical bar (does not indicate a pipe)
+ *    \&        a literal ampersand (does not run in the background)
  *
  * If an escape sequence other than those listed is encountered, the
  * function places the error message “Illegal escape character:
@@ -57,10 +73,12 @@
  * 
  * If the input begins with a '>' or '<' character, then read_word
  * will return a word consisting of the redirection character
- * immediately followed by a filename. If a filename cannot be read
- * following a redirection character, the function places the error
- * message "Redirection without filename" in the word buffer and
- * returns -1.
+ * immediately followed by a filename; >> is read as >, since output
+ * files are always appended to. Likewise, << and <<< are
+ * returned followed by a here-document's delimiter or a here-string's
+ * word. If a filename cannot be read following a redirection
+ * character, the function places the error message "Redirection
+ * without filename" in the word buffer and returns -1.
  * 
  * In the case that the word buffer is not long enough, read_word
  * places the error message “Word too long” into the buffer and
@@ -74,7 +92,7 @@
  *   '"New York"'       -> 'New York', returns 10
  *   ' New\ York'       -> 'New York', returns 10
  *   '"echo"'           -> 'echo', returns 6
- *   '$SCHOOL'          -> the value of getenv("SCHOOL"), returns 7
+ *   '$SCHOOL'          -> the value of vars_get("SCHOOL"), returns 7
  *   '< /from/file'     -> '</from/file', returns 12
  *   '>/to/a/file'      -> '</to/a/file', returns 11
  *
@@ -94,6 +112,99 @@
 int read_word(const char *input, char *word, size_t word_len);
 
 
+/*
+ * Sets the function that runs the command line of a $(...)
+ * substitution, in a child whose stdout is a pipe that the parser
+ * reads (see subst_capture()). The shell sets this to its own way of
+ * running a line, so that the command inside $(...) runs as if typed.
+ *
+ * Parameters:
+ *   run      Runs a line and returns its exit status, or NULL to make
+ *              $(...) an error
+ */
+void parse_set_subst_runner(int (*run)(const char *line));
+
+
+/*
+ * Flags describing a token found by read_token()
+ */
+#define TOK_QUOTED     0x01   // contains double quotes
+#define TOK_ESCAPED    0x02   // contains backslash escape sequences
+#define TOK_VARIABLE   0x04   // contains $variable references
+#define TOK_GLOB       0x08   // contains unquoted glob characters: * ? [ {
+#define TOK_REDIR_IN   0x10   // the token is the filename following <
+#define TOK_REDIR_OUT  0x20   // the token is the filename following >
+#define TOK_PIPE       0x40   // the token is a | between pipeline stages
+#define TOK_BACKGROUND 0x80   // the token is a & ending the line
+#define TOK_TILDE      0x100  // starts with ~, for a home directory
+#define TOK_HEREDOC    0x200  // the token is the delimiter following <<
+#define TOK_HERESTRING 0x400  // the token is the word following <<<
+
+// A token with any of these flags must go through token_expand()
+#define TOK_NEEDS_EXPANSION  (TOK_QUOTED | TOK_ESCAPED | TOK_VARIABLE)
+
+/*
+ * A span of raw, untranslated characters within an input line
+ */
+typedef struct {
+  size_t offset;     // offset of the first character of the token
+  size_t length;     // number of raw characters in the token
+  unsigned flags;    // bitwise OR of the TOK_* flags
+} token_t;
+
+/*
+ * Finds the first word in input without copying it. This follows the
+ * same rules as read_word(), but instead of translating the word into
+ * a buffer, it describes where the word lies in input and what it
+ * contains, so that the caller can use the characters in place when
+ * the word needs no translation.
+ *
+ * For a redirection, the span covers only the filename, and the flags
+ * include TOK_REDIR_IN or TOK_REDIR_OUT.
+ *
+ * Variables are not looked up, so an undefined variable is not
+ * detected until the token is passed to token_expand(). Likewise,
+ * the command of a $(...) is not run.
+ *
+ * Some examples:
+ *
+ *   '   echo'          -> offset 3, length 4, flags 0, returns 7
+ *   ' "a b" c'         -> offset 1, length 5, TOK_QUOTED, returns 6
+ *   '< /from/file'     -> offset 2, length 10, TOK_REDIR_IN, returns 12
+ *   '*.c'              -> offset 0, length 3, TOK_GLOB, returns 3
+ *
+ * Parameters:
+ *   input        Unprocessed input line, which must be null terminated
+ *   tok          Filled in with the span of the token. At the end of
+ *                  input, the length is 0.
+ *   err_msg      In case of error, an error message will be returned 
+ *                  in this string
+ *   err_msg_len  Length of the err_msg string
+ *
+ * Returns:
+ *   The number of characters from input that were consumed, exactly as
+ *   for read_word(), or -1 on error.
+ */
+int read_token(const char *input, token_t *tok, char *err_msg, size_t err_msg_len);
+
+/*
+ * Translates a token found by read_token() into a buffer, removing
+ * quotes, translating escapes and expanding variables. For a
+ * redirection, only the filename is translated.
+ *
+ * Parameters:
+ *   input     The same input that was passed to read_token()
+ *   tok       The token to translate
+ *   word      Buffer to be filled in with the translated word
+ *   word_len  Size of word buffer
+ *
+ * Returns:
+ *   The length of the translated word, or -1 on error, in which case
+ *   an error message is placed in the word buffer.
+ */
+int token_expand(const char *input, const token_t *tok, char *word, size_t word_len);
+
+
 
 /*
  * Parses an input line into a newly allocated command_t structure by
@@ -109,12 +220,39 @@ int read_word(const char *input, char *word, size_t word_len);
  * is parsed into a command with the four arguments "echo", "one",
  * "two three", and "four".
  *
- * Variables follow the form $varname. Variables are expanded as
- * described in the read_word() documentation.
+ * Variables follow the form $varname. Variables, and command
+ * substitutions of the form $(line), are expanded as described in the
+ * read_word() documentation.
  * 
  * A single backslash is an escape character and results in
  * substitutions as described in the read_word() documentation.
  *
+ * A word starting with ~ or ~user has that replaced with the home
+ * directory. A word containing any of * ? [ { outside double quotes
+ * is then expanded into the sorted list of matching filenames, with
+ * {a,b} alternatives, by pglob_expand(), which keeps directory
+ * listings cached between calls; a pattern that matches nothing is
+ * kept as it is, less its quotes. Inside double quotes, or after a
+ * backslash, those characters only match themselves, so "x*"*.c
+ * matches x*y.c but not xAy.c. Words with neither are copied into
+ * argv without touching the filesystem.
+ *
+ * An unescaped and unquoted | separates the stages of a pipeline; the
+ * words after it form a new command, linked to the previous one
+ * through command_get_next(), whose input is the output of the
+ * previous one. For instance, the line
+ *       ls -l | grep foo > out
+ * is parsed into a command "ls" "-l", followed by a second stage
+ * "grep" "foo" whose stdout is set to "out". Each stage may have its
+ * own redirections. A | with no command on either side is the error
+ * "Missing command".
+ *
+ * An unescaped and unquoted & at the end of the line marks the
+ * command to run in the background (see command_is_background()).
+ * A & with no command before it is the error "Missing command", and
+ * a & followed by anything but whitespace is the error "& must end
+ * the command".
+ *
  * If an unescaped and unquoted > or < is encountered, it will begin
  * the next word. Any whitespace is consumed, followed by a filename.
  * For instance, the following lines:
@@ -132,6 +270,27 @@ int read_word(const char *input, char *word, size_t word_len);
  *
  * is parsed into a command with stdout as its output, and the two
  * arguments "echo" and "thirty > twenty".
+ *
+ * <<DELIM starts a here-document: the stage reads the lines that
+ * follow the command line, up to one that is exactly DELIM. Only the
+ * delimiter is recorded here (see command_get_heredoc()); the caller
+ * gets the body from the following lines with parse_heredocs().
+ * <<<word is a here-string: the stage reads the word, translated like
+ * any other, followed by a newline. A stage may have only one of <,
+ * << and <<<, or it is the error "Multiple redirections not allowed".
+ *
+ * Words of the form NAME=value before the first argument of a stage,
+ * with NAME unquoted, are assignments rather than arguments: they are
+ * added with command_append_assign(), after quotes and variables in
+ * the value are translated, but without globbing. A line of nothing
+ * but assignments is a command with argc 0 and its assignments set.
+ *
+ * Unlike read_word(), parse_input() has no limit on the length of a
+ * word: a word that needs translating is written to a stack buffer
+ * that moves to the heap, doubling, only when a word outgrows it, so
+ * a line is parsed in one pass in time linear in its length, however
+ * long its words and variables are. The only length error is "Out of
+ * memory".
  * 
  * Parameters:
  *   input      Input line as typed by the user
@@ -156,4 +315,46 @@ int read_word(const char *input, char *word, size_t word_len);
  */
 command_t *parse_input(const char *input, char *err_msg, size_t err_msg_len);
 
+
+// Returned by parse_heredocs() when a body is not complete yet
+#define PARSE_MORE_INPUT (-2)
+
+/*
+ * Reads the bodies of the here-documents of a command returned by
+ * parse_input(), from the input that followed the command's line.
+ * Each stage with a <<DELIM redirection, in pipeline order, takes the
+ * lines after the previous body up to a line that is exactly DELIM,
+ * and has them set as its input with command_set_input_data().
+ *
+ * Unless the delimiter was quoted or escaped (as in <<"EOF"), $NAME
+ * in a body is expanded, as in read_word(), and \$ and \\ stand for
+ * $ and \; every other character, including any other backslash, is
+ * kept as it is. Quotes and globs in a body have no special meaning.
+ *
+ * A command without here-documents takes no input, so this can be
+ * called for every command.
+ *
+ * Parameters:
+ *   cmd          The command
+ *   input        The input following the command's line, which need
+ *                  not be NUL-terminated
+ *   len          The number of bytes of input
+ *   final        If true, there is no more input after this, and a
+ *                  body with no delimiter runs to the end of input;
+ *                  otherwise more input is asked for
+ *   used         Set to the number of bytes of input taken up by the
+ *                  bodies and their delimiters, including on error
+ *   err_msg      In case of error, an error message will be returned
+ *                  in this string
+ *   err_msg_len  Length of the err_msg string
+ *
+ * Returns:
+ *   0 on success; PARSE_MORE_INPUT if final is false and input ends
+ *   before the last delimiter, in which case cmd is unchanged and
+ *   nothing is used; or -1 on error (such as an undefined variable),
+ *   with a message in err_msg
+ */
+int parse_heredocs(command_t *cmd, const char *input, size_t len, bool final,
+                   size_t *used, char *err_msg, size_t err_msg_len);
+
 #endif /* _PARSER_H_ */
@@ -0,0 +1,427 @@
+/*
+ * pathcache.c
+ *
+ * A cache of where commands were found in PATH, so that the search
+ * is done once per command rather than on every execution
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <stdbool.h>            // bool
+#include <stdio.h>              // printf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strcmp
+#include <sys/stat.h>           // stat
+#include <unistd.h>             // access
+
+#include "pathcache.h"
+#include "vars.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+
+#define INIT_TABLE_CAP 64   // Slots in the hash table when first used
+#define DEFAULT_PATH "/bin:/usr/bin"   // What execvp() uses if PATH is unset
+
+/*
+ * One remembered command. A slot with a name but no path is a command
+ * that was not found; it is searched for again on every lookup.
+ */
+typedef struct {
+  char *name;               // command name, or NULL for an empty slot
+  char *path;               // where the executable was found, or NULL
+  const char *dir;          // the PATH directory it was found in
+  struct timespec mtime;    // modification time of dir when found
+  unsigned int hits;        // number of lookups for this name
+} path_entry_t;
+
+static path_entry_t *table = NULL;
+static size_t table_cap = 0;
+static size_t table_used = 0;
+
+static char *path_copy = NULL;   // PATH, with each ':' replaced by '\0'
+static const char **dirs = NULL; // pointers into path_copy
+static int n_dirs = 0;
+
+static char *candidate = NULL;   // scratch space for building paths
+static size_t candidate_cap = 0;
+
+
+/*
+ * FNV-1a hash of a command name
+ */
+static size_t hash_name(const char *name)
+{
+  size_t h = 14695981039346656037UL;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+    h = (h ^ *p) * 1099511628211UL;
+  return h;
+}
+
+
+/*
+ * Splits PATH into its directories, if that has not been done since
+ * the last pathcache_clear(). An empty element means the cwd.
+ */
+static bool load_dirs()
+{
+  if (path_copy)
+    return true;
+
+  const char *path = vars_get("PATH");
+  path_copy = strdup(path ? path : DEFAULT_PATH);
+  if (!path_copy)
+    return false;
+
+  n_dirs = 1;
+  for (char *p = path_copy; *p; p++)
+    if (*p == ':')
+      n_dirs++;
+
+  dirs = malloc(n_dirs * sizeof(char *));
+  if (!dirs) {
+    free(path_copy);
+    path_copy = NULL;
+    return false;
+  }
+
+  char *p = path_copy;
+  for (int i=0; i < n_dirs; i++) {
+    char *colon = strchr(p, ':');
+    if (colon)
+      *colon = '\0';
+    dirs[i] = (*p == '\0') ? "." : p;
+    p = colon + 1;
+  }
+
+  return true;
+}
+
+
+/*
+ * Makes the scratch buffer hold dir/name
+ */
+static const char *make_candidate(const char *dir, const char *name)
+{
+  size_t len = strlen(dir) + 1 + strlen(name) + 1;
+  if (len > candidate_cap) {
+    char *buf = realloc(candidate, len);
+    if (!buf)
+      return NULL;
+    candidate = buf;
+    candidate_cap = len;
+  }
+
+  sprintf(candidate, "%s/%s", dir, name);
+  return candidate;
+}
+
+
+/*
+ * Searches PATH for name. On success, the scratch buffer holds the
+ * path, *dir is the directory and *mtime is its modification time.
+ * On failure, returns false with errno set as for pathcache_lookup().
+ */
+static bool search_path(const char *name, const char **dir, struct timespec *mtime)
+{
+  int err = ENOENT;
+  struct stat sb;
+
+  if (!load_dirs())
+    return false;
+
+  for (int i=0; i < n_dirs; i++) {
+    // read the directory's mtime first, so that a change made while
+    // we search is noticed on the next lookup
+    if (stat(dirs[i], &sb) != 0)
+      continue;
+    *mtime = sb.st_mtim;
+
+    if (!make_candidate(dirs[i], name))
+      return false;
+
+    if (stat(candidate, &sb) != 0 || S_ISDIR(sb.st_mode))
+      continue;
+
+    if (access(candidate, X_OK) == 0) {
+      *dir = dirs[i];
+      return true;
+    }
+    err = EACCES;
+  }
+
+  errno = err;
+  return false;
+}
+
+
+/*
+ * Returns the slot for name: the slot holding it, or the empty slot
+ * where it belongs
+ */
+static path_entry_t *find_slot(const char *name)
+{
+  size_t i = hash_name(name) & (table_cap - 1);
+  while (table[i].name && strcmp(table[i].name, name) != 0)
+    i = (i + 1) & (table_cap - 1);
+  return &table[i];
+}
+
+
+/*
+ * Doubles the hash table, or creates it the first time
+ */
+static bool grow_table()
+{
+  size_t old_cap = table_cap;
+  path_entry_t *old = table;
+
+  table_cap = old_cap ? old_cap * 2 : INIT_TABLE_CAP;
+  table = calloc(table_cap, sizeof(path_entry_t));
+  if (!table) {
+    table = old;
+    table_cap = old_cap;
+    return false;
+  }
+
+  for (size_t i=0; i < old_cap; i++)
+    if (old[i].name)
+      *find_slot(old[i].name) = old[i];
+
+  free(old);
+  return true;
+}
+
+
+/*
+ * True if the directory the entry was found in has not changed since
+ */
+static bool entry_is_current(const path_entry_t *entry)
+{
+  struct stat sb;
+
+  return entry->path && stat(entry->dir, &sb) == 0
+    && sb.st_mtim.tv_sec == entry->mtime.tv_sec
+    && sb.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the pathcache calls.  All documentation is in
+ * the pathcache.h file.
+ *
+ **********************************************************************/
+
+const char *pathcache_lookup(const char *name)
+{
+  struct stat sb;
+
+  if (!name || !*name) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  // like execvp(), a name with a slash in it is not searched for
+  if (strchr(name, '/')) {
+    if (stat(name, &sb) != 0)
+      return NULL;
+    if (S_ISDIR(sb.st_mode) || access(name, X_OK) != 0) {
+      errno = EACCES;
+      return NULL;
+    }
+    return name;
+  }
+
+  if ((table_used + 1) * 2 > table_cap && !grow_table())
+    return NULL;
+
+  path_entry_t *entry = find_slot(name);
+  if (entry->name) {
+    entry->hits++;
+    if (entry_is_current(entry))
+      return entry->path;
+  }
+
+  const char *dir;
+  struct timespec mtime;
+  bool found = search_path(name, &dir, &mtime);
+  int search_errno = errno;
+
+  // a relative directory means something else after a cd, so such
+  // results are not remembered
+  if (found && *dir != '/')
+    return candidate;
+
+  if (!entry->name) {
+    if (!(entry->name = strdup(name)))
+      return NULL;
+    entry->hits = 1;
+    table_used++;
+  }
+
+  free(entry->path);
+  entry->path = NULL;
+  if (!found) {
+    errno = search_errno;
+    return NULL;
+  }
+
+  if (!(entry->path = strdup(candidate)))
+    return NULL;
+  entry->dir = dir;
+  entry->mtime = mtime;
+  return entry->path;
+}
+
+
+void pathcache_clear()
+{
+  for (size_t i=0; i < table_cap; i++) {
+    free(table[i].name);
+    free(table[i].path);
+  }
+  free(table);
+  table = NULL;
+  table_cap = 0;
+  table_used = 0;
+
+  free(dirs);
+  dirs = NULL;
+  n_dirs = 0;
+  free(path_copy);
+  path_copy = NULL;
+}
+
+
+void pathcache_dump(FILE *out)
+{
+  bool empty = true;
+
+  for (size_t i=0; i < table_cap; i++) {
+    if (!table[i].path)
+      continue;
+    if (empty)
+      fprintf(out, "hits\tcommand\n");
+    empty = false;
+    fprintf(out, "%4u\t%s\n", table[i].hits, table[i].path);
+  }
+
+  if (empty)
+    fprintf(out, "hash: hash table empty\n");
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+#include <fcntl.h>              // open
+
+/*
+ * Creates dir/name with the given permissions
+ */
+static void make_file(const char *dir, const char *name, mode_t mode)
+{
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  int fd = open(path, O_CREAT | O_WRONLY, mode);
+  assert( fd != -1 );
+  close(fd);
+}
+
+void test_pathcache()
+{
+  char dir1[] = "/tmp/pathcache1_XXXXXX";
+  char dir2[] = "/tmp/pathcache2_XXXXXX";
+  char path[256];
+  const char *found;
+
+  assert( mkdtemp(dir1) && mkdtemp(dir2) );
+  snprintf(path, sizeof(path), "%s:%s", dir1, dir2);
+  vars_set("PATH", path);
+  pathcache_clear();
+
+  make_file(dir1, "tool", 0755);
+  make_file(dir2, "other", 0755);
+  make_file(dir2, "data", 0644);
+
+  // found in the first and second directories
+  snprintf(path, sizeof(path), "%s/tool", dir1);
+  assert( (found = pathcache_lookup("tool")) && strcmp(found, path) == 0 );
+  assert( (found = pathcache_lookup("tool")) && strcmp(found, path) == 0 );
+  snprintf(path, sizeof(path), "%s/other", dir2);
+  assert( (found = pathcache_lookup("other")) && strcmp(found, path) == 0 );
+
+  // missing, not executable, and names with a slash
+  errno = 0;
+  assert( pathcache_lookup("missing") == NULL && errno == ENOENT );
+  assert( pathcache_lookup("data") == NULL && errno == EACCES );
+  assert( pathcache_lookup("") == NULL );
+  assert( strcmp(pathcache_lookup(path), path) == 0 );
+  assert( pathcache_lookup("/does/not/exist") == NULL );
+
+  // removing the executable changes the directory's mtime, which
+  // makes the cached entry stale
+  snprintf(path, sizeof(path), "%s/tool", dir1);
+  assert( unlink(path) == 0 );
+  assert( pathcache_lookup("tool") == NULL );
+  make_file(dir2, "tool", 0755);
+  snprintf(path, sizeof(path), "%s/tool", dir2);
+  assert( (found = pathcache_lookup("tool")) && strcmp(found, path) == 0 );
+
+  // a name added later is found without clearing the cache
+  make_file(dir1, "late", 0755);
+  assert( pathcache_lookup("late") != NULL );
+
+  // a new PATH takes effect once the cache is cleared
+  vars_set("PATH", dir1);
+  pathcache_clear();
+  assert( pathcache_lookup("other") == NULL );
+  assert( pathcache_lookup("late") != NULL );
+
+  // enough names to force the table to grow
+  for (int i=0; i < 3 * INIT_TABLE_CAP; i++) {
+    snprintf(path, sizeof(path), "cmd%d", i);
+    make_file(dir1, path, 0755);
+    assert( pathcache_lookup(path) != NULL );
+  }
+  for (int i=0; i < 3 * INIT_TABLE_CAP; i++) {
+    snprintf(path, sizeof(path), "cmd%d", i);
+    assert( pathcache_lookup(path) != NULL );
+  }
+  pathcache_dump(stdout);
+
+  // clean up
+  const char *names1[] = {"late", NULL};
+  const char *names2[] = {"tool", "other", "data", NULL};
+  for (int i=0; names1[i]; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir1, names1[i]);
+    unlink(path);
+  }
+  for (int i=0; i < 3 * INIT_TABLE_CAP; i++) {
+    snprintf(path, sizeof(path), "%s/cmd%d", dir1, i);
+    unlink(path);
+  }
+  for (int i=0; names2[i]; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir2, names2[i]);
+    unlink(path);
+  }
+  assert( rmdir(dir1) == 0 && rmdir(dir2) == 0 );
+  pathcache_clear();
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_pathcache();
+  fprintf(stderr, "test_pathcache: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
@@ -0,0 +1,51 @@
+/*
+ * pathcache.h
+ *
+ * A cache of where commands were found in PATH, so that the search
+ * is done once per command rather than on every execution
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _PATHCACHE_H_
+#define _PATHCACHE_H_
+
+#include <stdio.h>
+
+/*
+ * Resolves a command name to the path of an executable file, using
+ * the same search as execvp(): each directory in PATH is tried in
+ * turn, and a name containing a slash is used as is.
+ *
+ * Names found in an absolute PATH directory are remembered. A
+ * remembered name is searched for again once PATH has been changed
+ * through pathcache_clear(), or when the modification time of the
+ * directory it was found in changes, for instance because the
+ * executable was removed.
+ *
+ * Parameters:
+ *   name     The command name, as typed
+ *
+ * Returns:
+ *   The path of the executable, which is valid until the next call
+ *   to any pathcache function. If no executable was found, returns
+ *   NULL and sets errno to ENOENT, or to EACCES if a matching file
+ *   exists but is not executable.
+ */
+const char *pathcache_lookup(const char *name);
+
+/*
+ * Forgets every remembered command. Must be called whenever PATH
+ * changes.
+ */
+void pathcache_clear();
+
+/*
+ * Prints every remembered command along with the number of times it
+ * has been looked up, in the style of bash's "hash" builtin.
+ *
+ * Parameters:
+ *   out      Where to print the table
+ */
+void pathcache_dump(FILE *out);
+
+#endif /* _PATHCACHE_H_ */
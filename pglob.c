@@ -0,0 +1,1017 @@
+/*
+ * pglob.c
+ *
+ * Expansion of glob patterns into file names, matched against a cache
+ * of sorted directory listings
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE             // strchrnul
+
+#include <assert.h>             // assert
+#include <dirent.h>             // getdents64
+#include <errno.h>              // errno
+#include <fcntl.h>              // open
+#include <fnmatch.h>            // fnmatch
+#include <stdbool.h>            // bool
+#include <stdio.h>              // printf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strcmp
+#include <sys/stat.h>           // stat
+#include <time.h>               // clock_gettime
+#include <unistd.h>             // close
+
+#include "pglob.h"
+#include "globstar.h"
+#include "vars.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+//#define RUN_BENCH         // if defined, builds the glob expansion benchmark
+
+#define DEFAULT_CACHE_LIMIT (64UL << 20)   // bytes, if PLAIDSH_GLOB_CACHE is unset
+#define CACHE_BUCKETS 256                  // slots in the (dev, ino) hash table
+#define RACY_NS 1000000000L                // listings younger than this are not cached
+#define DENTS_BUF (256 << 10)              // bytes read by each getdents64()
+#define DEFAULT_GLOB_DEPTH 64              // levels below **, if PLAIDSH_GLOB_DEPTH is unset
+#define MAX_GLOB_THREADS 8                 // threads walking the tree below **
+
+/*
+ * The sorted entries of one directory. Each name is stored in one
+ * block, preceded by a byte holding its d_type.
+ */
+typedef struct listing_s {
+  dev_t dev;                      // the directory's identity ...
+  ino_t ino;
+  struct timespec mtime;          // ... and modification time when read
+  int n;                          // number of entries
+  char **names;                   // sorted with strcmp(), into block
+  char *block;                    // the type bytes and names
+  size_t bytes;                   // memory charged to the cache
+  int pins;                       // expansions using the listing now
+  bool cached;                    // whether it is in the cache
+  struct listing_s *hash_next;    // next in the same bucket
+  struct listing_s *lru_prev;     // next more recently used
+  struct listing_s *lru_next;     // next less recently used
+} listing_t;
+
+static listing_t *buckets[CACHE_BUCKETS];
+static listing_t *lru_head = NULL;   // most recently used
+static listing_t *lru_tail = NULL;   // least recently used
+static size_t cache_bytes = 0;
+static int cache_count = 0;
+static size_t cache_limit = DEFAULT_CACHE_LIMIT;
+static char *limit_env = NULL;       // PLAIDSH_GLOB_CACHE when last read
+
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+static unsigned long evictions = 0;
+
+static char *dents = NULL;           // getdents64() buffer, kept between expansions
+
+/*
+ * The state of one expansion
+ */
+typedef struct {
+  command_t *cmd;     // where the matches go
+  int flags;          // PGLOB_ flags
+  int n;              // number of matches so far
+  char *path;         // scratch space for the path being built
+  size_t path_cap;
+} expansion_t;
+
+
+/*
+ * Reads PLAIDSH_GLOB_CACHE again if it has changed since the last
+ * expansion, and shrinks the cache to fit a lower limit
+ */
+static void update_limit()
+{
+  const char *env = vars_get("PLAIDSH_GLOB_CACHE");
+
+  if ((env == NULL && limit_env == NULL) || (env && limit_env && strcmp(env, limit_env) == 0))
+    return;
+
+  free(limit_env);
+  limit_env = env ? strdup(env) : NULL;
+  cache_limit = DEFAULT_CACHE_LIMIT;
+  if (!env)
+    return;
+
+  char *end;
+  unsigned long long limit = strtoull(env, &end, 10);
+  if (end == env)
+    return;
+  switch (*end) {
+    case 'G': case 'g': limit <<= 10;   // fall through
+    case 'M': case 'm': limit <<= 10;   // fall through
+    case 'K': case 'k': limit <<= 10;
+  }
+  cache_limit = limit;
+}
+
+
+static listing_t **bucket(dev_t dev, ino_t ino)
+{
+  return &buckets[(ino ^ (dev * 31)) % CACHE_BUCKETS];
+}
+
+
+static void free_listing(listing_t *l)
+{
+  free(l->names);
+  free(l->block);
+  free(l);
+}
+
+
+/*
+ * Takes a listing out of the cache. It is freed now, or once the last
+ * expansion using it is done.
+ */
+static void cache_remove(listing_t *l)
+{
+  listing_t **p = bucket(l->dev, l->ino);
+  while (*p != l)
+    p = &(*p)->hash_next;
+  *p = l->hash_next;
+
+  if (l->lru_prev)
+    l->lru_prev->lru_next = l->lru_next;
+  else
+    lru_head = l->lru_next;
+  if (l->lru_next)
+    l->lru_next->lru_prev = l->lru_prev;
+  else
+    lru_tail = l->lru_prev;
+
+  cache_bytes -= l->bytes;
+  cache_count--;
+  l->cached = false;
+  if (l->pins == 0)
+    free_listing(l);
+}
+
+
+/*
+ * Drops the least recently used listings until extra more bytes fit
+ */
+static void cache_trim(size_t extra)
+{
+  while (lru_tail && cache_bytes + extra > cache_limit) {
+    cache_remove(lru_tail);
+    evictions++;
+  }
+}
+
+
+static void cache_insert(listing_t *l)
+{
+  cache_trim(l->bytes);
+
+  listing_t **p = bucket(l->dev, l->ino);
+  l->hash_next = *p;
+  *p = l;
+
+  l->lru_prev = NULL;
+  l->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = l;
+  lru_head = l;
+  if (!lru_tail)
+    lru_tail = l;
+
+  cache_bytes += l->bytes;
+  cache_count++;
+  l->cached = true;
+}
+
+
+/*
+ * Moves a cached listing to the front of the LRU list
+ */
+static void cache_touch(listing_t *l)
+{
+  if (l == lru_head)
+    return;
+
+  l->lru_prev->lru_next = l->lru_next;
+  if (l->lru_next)
+    l->lru_next->lru_prev = l->lru_prev;
+  else
+    lru_tail = l->lru_prev;
+
+  l->lru_prev = NULL;
+  l->lru_next = lru_head;
+  lru_head->lru_prev = l;
+  lru_head = l;
+}
+
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/*
+ * Makes sure the getdents64() buffer exists
+ */
+static bool reserve_dents()
+{
+  return dents || (dents = malloc(DENTS_BUF));
+}
+
+
+/*
+ * Reads every entry of a directory into a new listing, sorted. Returns
+ * NULL if the directory cannot be read, with errno set to ENOMEM if
+ * out of memory.
+ */
+static listing_t *read_listing(expansion_t *ex, const char *dir, const struct stat *sb)
+{
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+
+  listing_t *l = calloc(1, sizeof(listing_t));
+  size_t used = 0, cap = 4096;
+  char *block = malloc(cap);
+  if (!l || !block || !reserve_dents())
+    goto nomem;
+
+  // the type byte and name of each entry are packed into the block
+  ssize_t got;
+  while ((got = getdents64(fd, dents, DENTS_BUF)) > 0) {
+    for (ssize_t off = 0; off < got; ) {
+      struct dirent64 *ent = (struct dirent64 *)(dents + off);
+      off += ent->d_reclen;
+
+      size_t len = strlen(ent->d_name) + 2;
+      if (used + len > cap) {
+        while (used + len > cap)
+          cap *= 2;
+        char *p = realloc(block, cap);
+        if (!p)
+          goto nomem;
+        block = p;
+      }
+      block[used] = ent->d_type;
+      memcpy(block + used + 1, ent->d_name, len - 1);
+      used += len;
+      l->n++;
+    }
+  }
+  close(fd);
+  fd = -1;
+
+  // the names are only pointed to once the block has stopped moving
+  l->names = malloc((l->n ? l->n : 1) * sizeof(char *));
+  if (!l->names)
+    goto nomem;
+  char *p = block;
+  for (int i=0; i < l->n; i++) {
+    l->names[i] = p + 1;
+    p += strlen(p + 1) + 2;
+  }
+  qsort(l->names, l->n, sizeof(char *), compare_names);
+
+  l->block = block;
+  l->dev = sb->st_dev;
+  l->ino = sb->st_ino;
+  l->mtime = sb->st_mtim;
+  l->bytes = sizeof(listing_t) + cap + l->n * sizeof(char *);
+  l->pins = 1;
+  return l;
+
+nomem:
+  if (fd != -1)
+    close(fd);
+  if (l)
+    free(l->names);
+  free(l);
+  free(block);
+  errno = ENOMEM;
+  return NULL;
+}
+
+
+/*
+ * True if a directory changed so recently that a further change could
+ * leave its mtime as it is
+ */
+static bool is_racy(const struct stat *sb)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  long long age = (now.tv_sec - sb->st_mtim.tv_sec) * 1000000000LL
+    + (now.tv_nsec - sb->st_mtim.tv_nsec);
+  return age < RACY_NS;
+}
+
+
+/*
+ * Returns the cached listing of a directory if it is still current,
+ * pinned until release_listing(), or NULL
+ */
+static listing_t *cached_listing(const struct stat *sb)
+{
+  listing_t *l = *bucket(sb->st_dev, sb->st_ino);
+  while (l && (l->dev != sb->st_dev || l->ino != sb->st_ino))
+    l = l->hash_next;
+  if (!l)
+    return NULL;
+
+  if (l->mtime.tv_sec != sb->st_mtim.tv_sec || l->mtime.tv_nsec != sb->st_mtim.tv_nsec) {
+    cache_remove(l);
+    return NULL;
+  }
+
+  hits++;
+  cache_touch(l);
+  l->pins++;
+  return l;
+}
+
+
+static void release_listing(listing_t *l)
+{
+  if (--l->pins == 0 && !l->cached)
+    free_listing(l);
+}
+
+
+/*
+ * Makes room for len bytes in the path scratch space
+ */
+static bool reserve_path(expansion_t *ex, size_t len)
+{
+  if (len <= ex->path_cap)
+    return true;
+
+  size_t cap = ex->path_cap ? ex->path_cap : 256;
+  while (cap < len)
+    cap *= 2;
+  char *p = realloc(ex->path, cap);
+  if (!p)
+    return false;
+  ex->path = p;
+  ex->path_cap = cap;
+  return true;
+}
+
+
+/*
+ * True if a pattern component has a wildcard in it
+ */
+static bool has_wildcard(const char *p, size_t len)
+{
+  for (size_t i=0; i < len; i++)
+    if (p[i] == '*' || p[i] == '?' || p[i] == '[')
+      return true;
+  return false;
+}
+
+
+/*
+ * Returns the index of the first name of a listing that is not less
+ * than the first len characters of prefix
+ */
+static int lower_bound(const listing_t *l, const char *prefix, size_t len)
+{
+  int lo = 0, hi = l->n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strncmp(l->names[mid], prefix, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+static bool match_rest(expansion_t *ex, size_t len, const char *rest, bool verify);
+
+/*
+ * Adds a directory entry that matched a component to the path, and
+ * matches the rest of the pattern below it
+ */
+static bool match_entry(expansion_t *ex, size_t len, const char *name, unsigned char type,
+                        const char *rest)
+{
+  struct stat sb;
+
+  size_t name_len = strlen(name);
+  if (!reserve_path(ex, len + name_len + 1))
+    return false;
+  memcpy(ex->path + len, name, name_len + 1);
+
+  // only directories can have more components below them
+  if (*rest) {
+    if (type != DT_DIR && type != DT_UNKNOWN && type != DT_LNK)
+      return true;
+    if (type != DT_DIR && (stat(ex->path, &sb) != 0 || !S_ISDIR(sb.st_mode)))
+      return true;
+  }
+  return match_rest(ex, len + name_len, rest, false);
+}
+
+
+/*
+ * Matches the last component of a pattern against a directory while
+ * its entries are read, without keeping them
+ */
+static bool match_stream(expansion_t *ex, size_t len, const char *comp)
+{
+  int fd = open(len ? ex->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return true;
+
+  bool ok = reserve_dents();
+  ssize_t got;
+  while (ok && (got = getdents64(fd, dents, DENTS_BUF)) > 0) {
+    for (ssize_t off = 0; ok && off < got; ) {
+      struct dirent64 *ent = (struct dirent64 *)(dents + off);
+      off += ent->d_reclen;
+      if (fnmatch(comp, ent->d_name, FNM_PERIOD) == 0)
+        ok = match_entry(ex, len, ent->d_name, ent->d_type, "");
+    }
+  }
+
+  close(fd);
+  return ok;
+}
+
+
+/*
+ * Matches ** against the directory held in the first len bytes of the
+ * scratch space and every directory below it, then the rest of the
+ * pattern against each of them. When the rest is a single component,
+ * the threads of the walk match it as they read each directory.
+ */
+static bool match_globstar(expansion_t *ex, size_t len, const char *rest)
+{
+  const char *after = rest;
+  while (*after == '/')
+    after++;
+
+  // ** on its own matches everything below
+  const char *leaf = NULL;
+  if (*rest == '\0')
+    leaf = "*";
+  else if (*after && !strchr(after, '/'))
+    leaf = after;
+
+  const char *env = vars_get("PLAIDSH_GLOB_DEPTH");
+  int max_depth = env && *env ? atoi(env) : DEFAULT_GLOB_DEPTH;
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_GLOB_THREADS)
+    threads = MAX_GLOB_THREADS;
+
+  ex->path[len] = '\0';
+  int fd = open(len ? ex->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return true;
+  globstar_dir_t *dirs;
+  int n = globstar_walk(fd, leaf, max_depth, threads, &dirs);
+  close(fd);
+  if (n == -1)
+    return false;
+
+  bool ok = true;
+  for (int i=0; ok && i < n; i++) {
+    size_t dir_len = strlen(dirs[i].dir);
+    if (!reserve_path(ex, len + dir_len + 1)) {
+      ok = false;
+      break;
+    }
+    memcpy(ex->path + len, dirs[i].dir, dir_len);
+    size_t base = len + dir_len;
+    if (dir_len)
+      ex->path[base++] = '/';
+
+    if (!leaf)
+      ok = match_rest(ex, base, after, false);
+    for (int j=0; ok && j < dirs[i].n; j++)
+      ok = match_entry(ex, base, dirs[i].names[j], DT_UNKNOWN, "");
+  }
+
+  globstar_free(dirs, n);
+  return ok;
+}
+
+
+/*
+ * Matches the rest of a pattern below the path held in the first len
+ * bytes of the scratch space. If verify, the path came from the
+ * pattern rather than from a directory, so it must be checked to
+ * exist.
+ */
+static bool match_rest(expansion_t *ex, size_t len, const char *rest, bool verify)
+{
+  struct stat sb;
+
+  // separators are kept as they were typed
+  while (*rest == '/') {
+    if (!reserve_path(ex, len + 1))
+      return false;
+    ex->path[len++] = *rest++;
+  }
+
+  if (*rest == '\0') {
+    if (len == 0)
+      return true;
+    if (!reserve_path(ex, len + 1))
+      return false;
+    ex->path[len] = '\0';
+    if (verify && lstat(ex->path, &sb) != 0)
+      return true;
+    if (command_append_argn(ex->cmd, ex->path, len) == -1)
+      return false;
+    ex->n++;
+    return true;
+  }
+
+  const char *end = strchrnul(rest, '/');
+  size_t comp_len = end - rest;
+
+  // a component without wildcards is taken as it is, minus its quoting
+  if (!has_wildcard(rest, comp_len)) {
+    if (!reserve_path(ex, len + comp_len))
+      return false;
+    for (const char *p = rest; p < end; p++) {
+      if (*p == '\\' && p + 1 < end)
+        p++;
+      ex->path[len++] = *p;
+    }
+    return match_rest(ex, len, end, true);
+  }
+
+  if (!reserve_path(ex, len + 1))
+    return false;
+  if (comp_len == 2 && rest[0] == '*' && rest[1] == '*')
+    return match_globstar(ex, len, end);
+
+  // anything else is matched against the directory's entries
+  char comp[comp_len + 1];
+  memcpy(comp, rest, comp_len);
+  comp[comp_len] = '\0';
+
+  if (!reserve_path(ex, len + 1))
+    return false;
+  ex->path[len] = '\0';
+  const char *dir = len ? ex->path : ".";
+  if (stat(dir, &sb) != 0 || !S_ISDIR(sb.st_mode))
+    return true;
+
+  listing_t *l = cached_listing(&sb);
+  if (!l) {
+    misses++;
+    bool cacheable = cache_limit > 0 && !is_racy(&sb);
+
+    // a listing that would not be kept is not built at all when the
+    // entries can be matched as they are read
+    if (*end == '\0' && (!cacheable || (ex->flags & PGLOB_NOSORT)))
+      return match_stream(ex, len, comp);
+
+    if (!(l = read_listing(ex, dir, &sb)))
+      return errno != ENOMEM;
+    if (cacheable && l->bytes <= cache_limit)
+      cache_insert(l);
+  }
+
+  // only names starting with the component's literal prefix can match
+  size_t prefix = strcspn(comp, "*?[\\");
+  bool ok = true;
+  for (int i = lower_bound(l, comp, prefix); ok && i < l->n; i++) {
+    const char *name = l->names[i];
+    if (strncmp(name, comp, prefix) != 0)
+      break;
+    if (fnmatch(comp, name, FNM_PERIOD) == 0)
+      ok = match_entry(ex, len, name, name[-1], end);
+  }
+
+  release_listing(l);
+  return ok;
+}
+
+
+/*
+ * Expands the first {a,b} group of a pattern, then the next, and
+ * matches each resulting pattern in turn
+ */
+static bool match_braces(expansion_t *ex, const char *pattern)
+{
+  const char *open = NULL, *close = NULL;
+  int depth = 0;
+
+  // find the first { that has a matching }
+  for (const char *p = pattern; *p && !close; p++) {
+    if (*p == '\\' && p[1])
+      p++;
+    else if (*p == '{') {
+      if (depth++ == 0)
+        open = p;
+    }
+    else if (*p == '}' && depth > 0 && --depth == 0)
+      close = p;
+  }
+
+  if (!close) {
+    int first = command_get_argc(ex->cmd);
+    if (!match_rest(ex, 0, pattern, false))
+      return false;
+    if (!(ex->flags & PGLOB_NOSORT))
+      command_sort_args(ex->cmd, first);
+    return true;
+  }
+
+  // prefix, then one alternative, then everything after the }
+  size_t prefix_len = open - pattern;
+  size_t suffix_len = strlen(close + 1);
+  char buf[strlen(pattern) + 1];
+  memcpy(buf, pattern, prefix_len);
+
+  const char *alt = open + 1;
+  depth = 0;
+  for (const char *p = alt; p <= close; p++) {
+    if (*p == '\\' && p + 1 < close) {
+      p++;
+      continue;
+    }
+    if (*p == '{')
+      depth++;
+    else if (*p == '}' && depth > 0)
+      depth--;
+    else if ((*p == ',' && depth == 0) || p == close) {
+      memcpy(buf + prefix_len, alt, p - alt);
+      memcpy(buf + prefix_len + (p - alt), close + 1, suffix_len + 1);
+      if (!match_braces(ex, buf))
+        return false;
+      alt = p + 1;
+    }
+  }
+
+  return true;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the pglob calls.  All documentation is in the
+ * pglob.h file.
+ *
+ **********************************************************************/
+
+int pglob_expand(const char *pattern, command_t *cmd, int flags)
+{
+  expansion_t ex = {cmd, flags, 0, NULL, 0};
+
+  update_limit();
+  if (cache_bytes > cache_limit)
+    cache_trim(0);
+
+  bool ok = match_braces(&ex, pattern);
+  free(ex.path);
+
+  if (!ok) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return ex.n;
+}
+
+
+void pglob_cache_clear()
+{
+  while (lru_head)
+    cache_remove(lru_head);
+  hits = misses = evictions = 0;
+}
+
+
+void pglob_cache_dump(FILE *out)
+{
+  fprintf(out, "%d directories, %zu of %zu bytes\n", cache_count, cache_bytes, cache_limit);
+  fprintf(out, "%lu hits, %lu misses, %lu evictions\n", hits, misses, evictions);
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+#include <fcntl.h>              // open
+#include <glob.h>               // glob
+#include <unistd.h>             // chdir
+
+/*
+ * Creates an empty file, or a directory if the name ends with /
+ */
+static void make_entry(const char *name)
+{
+  size_t len = strlen(name);
+  if (name[len - 1] == '/') {
+    assert( mkdir(name, 0755) == 0 );
+    return;
+  }
+  int fd = open(name, O_CREAT | O_WRONLY, 0644);
+  assert( fd != -1 );
+  close(fd);
+}
+
+/*
+ * Sets a directory's mtime to t seconds after the epoch, so that its
+ * listing is old enough to be cached
+ */
+static void set_mtime(const char *dir, time_t t)
+{
+  struct timespec times[2] = {{t, 0}, {t, 0}};
+  assert( utimensat(AT_FDCWD, dir, times, 0) == 0 );
+}
+
+/*
+ * Checks that pglob_expand() gives what glob() does
+ */
+static void check_like_glob(const char *pattern)
+{
+  glob_t globbuf;
+  command_t *cmd = command_new();
+  assert( cmd );
+
+  int ret = glob(pattern, GLOB_BRACE, NULL, &globbuf);
+  int n = pglob_expand(pattern, cmd, 0);
+  if (ret == GLOB_NOMATCH)
+    assert( n == 0 );
+  else {
+    assert( ret == 0 && n == (int)globbuf.gl_pathc );
+    for (int i=0; i < n; i++)
+      assert( strcmp(command_get_argv(cmd)[i], globbuf.gl_pathv[i]) == 0 );
+  }
+  assert( command_get_argc(cmd) == n );
+
+  if (ret != GLOB_NOMATCH)
+    globfree(&globbuf);
+  command_free(cmd);
+}
+
+/*
+ * Checks that pglob_expand() gives exactly the NULL-terminated names
+ */
+static void check_expansion(const char *pattern, const char **names)
+{
+  command_t *cmd = command_new();
+  assert( cmd );
+
+  int n = 0;
+  while (names[n])
+    n++;
+  assert( pglob_expand(pattern, cmd, 0) == n );
+  for (int i=0; i < n; i++)
+    assert( strcmp(command_get_argv(cmd)[i], names[i]) == 0 );
+
+  command_free(cmd);
+}
+
+void test_pglob()
+{
+  char tempdir[] = "/tmp/pglob_XXXXXX";
+  const char *entries[] = {"one.c", "one.h", "two.c", "three.c", ".hidden.c",
+    "sub/", "sub/a.c", "sub/b.txt", "sub.d/", "sub.d/a.c", "x*y", "empty/", NULL};
+
+  assert( mkdtemp(tempdir) );
+  char *old_cwd = getcwd(NULL, 0);
+  assert( chdir(tempdir) == 0 );
+  for (int i=0; entries[i]; i++)
+    make_entry(entries[i]);
+  set_mtime(".", 1000);
+  set_mtime("sub", 1000);
+  set_mtime("sub.d", 1000);
+  set_mtime("empty", 1000);
+  pglob_cache_clear();
+
+  const char *patterns[] = {"*", "*.c", "*.[ch]", "o*", "t*.c", "*.z", ".*",
+    ".h*", "*/", "*/*.c", "s*/a.c", "sub*/*", "sub/*.c", "./*.h", "x\\*y",
+    "x\\**", "{one,two}.c", "{one,three}.[ch]", "{one,four}.c", "{t{wo,hree},one}.c",
+    "a{b", "{,o}*.h", "empty/*", "nodir/*.c", "*/nothing", "[", "sub/../*.h",
+    tempdir, NULL};
+  for (int i=0; patterns[i]; i++)
+    check_like_glob(patterns[i]);
+
+  // the same, reading each directory as a stream rather than a listing
+  vars_set("PLAIDSH_GLOB_CACHE", "0");
+  for (int i=0; patterns[i]; i++)
+    check_like_glob(patterns[i]);
+  vars_unset("PLAIDSH_GLOB_CACHE");
+
+  char abs_pattern[64];
+  snprintf(abs_pattern, sizeof(abs_pattern), "%s/*.c", tempdir);
+  check_like_glob(abs_pattern);
+
+  // the second time round, every listing comes from the cache
+  command_t *cmd = command_new();
+  pglob_cache_clear();
+  assert( pglob_expand("*/*.c", cmd, 0) == 2 );
+  assert( hits == 0 && misses == 4 && cache_count == 4 );
+  assert( pglob_expand("*/*.c", cmd, 0) == 2 );
+  assert( hits == 4 && misses == 4 );
+
+  // a new file changes the mtime, and the listing is read again; just
+  // modified, it is not kept in the cache
+  make_entry("four.c");
+  assert( pglob_expand("*.c", cmd, 0) == 4 );
+  assert( hits == 4 && misses == 5 && cache_count == 3 );
+  set_mtime(".", 2000);
+  assert( pglob_expand("*.c", cmd, 0) == 4 );
+  assert( pglob_expand("*.c", cmd, 0) == 4 );
+  assert( hits == 5 && misses == 6 && cache_count == 4 );
+
+  // a tiny limit evicts everything, and a limit of 0 turns caching off
+  vars_set("PLAIDSH_GLOB_CACHE", "1");
+  assert( pglob_expand("*.c", cmd, 0) == 4 );
+  assert( cache_count == 0 && cache_bytes == 0 && evictions == 4 );
+  vars_set("PLAIDSH_GLOB_CACHE", "0");
+  assert( pglob_expand("*.c", cmd, 0) == 4 );
+  assert( cache_count == 0 );
+  vars_set("PLAIDSH_GLOB_CACHE", "1k");
+  update_limit();
+  assert( cache_limit == 1024 );
+  vars_unset("PLAIDSH_GLOB_CACHE");
+  assert( pglob_expand("*.c", cmd, 0) == 4 );
+  assert( cache_limit == DEFAULT_CACHE_LIMIT && cache_count == 1 );
+  pglob_cache_dump(stdout);
+
+  // with room for one listing, each subdirectory evicts the one
+  // before it, including the top one while it is still being used
+  char limit[32];
+  snprintf(limit, sizeof(limit), "%zu", cache_bytes + 16);
+  vars_set("PLAIDSH_GLOB_CACHE", limit);
+  assert( pglob_expand("*/*.c", cmd, 0) == 2 );
+  assert( cache_count == 1 && evictions == 7 );
+  vars_unset("PLAIDSH_GLOB_CACHE");
+
+  // unsorted, the same names come back in directory order
+  command_free(cmd);
+  cmd = command_new();
+  assert( pglob_expand("*.[ch]", cmd, PGLOB_NOSORT) == 5 );
+  command_sort_args(cmd, 0);
+  char *const *argv = command_get_argv(cmd);
+  const char *sorted[] = {"four.c", "one.c", "one.h", "three.c", "two.c"};
+  for (int i=0; i < 5; i++)
+    assert( strcmp(argv[i], sorted[i]) == 0 );
+
+  // ** matches any number of directories, up to the depth limit
+  const char *star_c[] = {"four.c", "one.c", "sub.d/a.c", "sub/a.c", "three.c", "two.c", NULL};
+  check_expansion("**/*.c", star_c);
+  const char *star_a[] = {"sub.d/a.c", "sub/a.c", NULL};
+  check_expansion("**/a.c", star_a);
+  check_expansion("**/s*/*.c", star_a);
+  const char *star_dirs[] = {"empty/", "sub.d/", "sub/", NULL};
+  check_expansion("**/", star_dirs);
+  const char *star_sub[] = {"sub/a.c", "sub/b.txt", NULL};
+  check_expansion("sub/**", star_sub);
+  const char *star_none[] = {NULL};
+  check_expansion("**/*.z", star_none);
+  vars_set("PLAIDSH_GLOB_DEPTH", "0");
+  const char *star_top[] = {"four.c", "one.c", "three.c", "two.c", NULL};
+  check_expansion("**/*.c", star_top);
+  vars_unset("PLAIDSH_GLOB_DEPTH");
+
+  command_free(cmd);
+  pglob_cache_clear();
+
+  // clean up
+  assert( unlink("four.c") == 0 );
+  for (int i=0; entries[i]; i++)
+    if (entries[i][strlen(entries[i]) - 1] != '/')
+      assert( unlink(entries[i]) == 0 );
+  for (int i=0; entries[i]; i++)
+    if (entries[i][strlen(entries[i]) - 1] == '/')
+      assert( rmdir(entries[i]) == 0 );
+  assert( chdir(old_cwd) == 0 );
+  free(old_cwd);
+  assert( rmdir(tempdir) == 0 );
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_pglob();
+  fprintf(stderr, "test_pglob: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
+
+
+
+/**********************************************************************
+ *
+ * Benchmark code below
+ *
+ **********************************************************************/
+#ifdef RUN_BENCH
+
+#include <fcntl.h>              // open
+#include <glob.h>               // glob
+#include <unistd.h>             // chdir
+
+#define BENCH_FILES 100000      // entries in the benchmark directory
+#define BENCH_REPS 20           // expansions of each pattern
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Returns the average time in milliseconds of one glob() of pattern
+ */
+static double bench_glob(const char *pattern)
+{
+  glob_t globbuf;
+
+  double start = now_ns();
+  for (int r=0; r < BENCH_REPS; r++) {
+    assert( glob(pattern, GLOB_NOCHECK | GLOB_BRACE, NULL, &globbuf) == 0 );
+    globfree(&globbuf);
+  }
+  return (now_ns() - start) / BENCH_REPS / 1e6;
+}
+
+/*
+ * Returns the average time in milliseconds of one pglob_expand() of
+ * pattern, from a cold cache if cold
+ */
+static double bench_pglob(const char *pattern, bool cold, int flags)
+{
+  double elapsed = 0;
+
+  for (int r=0; r < BENCH_REPS; r++) {
+    command_t *cmd = command_new();
+    assert( cmd );
+    if (cold)
+      pglob_cache_clear();
+    double start = now_ns();
+    assert( pglob_expand(pattern, cmd, flags) > 0 );
+    elapsed += now_ns() - start;
+    command_free(cmd);
+  }
+  return elapsed / BENCH_REPS / 1e6;
+}
+
+
+int main(int argc, char *argv[])
+{
+  char tempdir[] = "/tmp/bench_pglob_XXXXXX";
+  char name[64];
+
+  assert( mkdtemp(tempdir) );
+  char *old_cwd = getcwd(NULL, 0);
+  assert( chdir(tempdir) == 0 );
+  for (int i=0; i < BENCH_FILES; i++) {
+    snprintf(name, sizeof(name), "file%d.log", i);
+    close(open(name, O_CREAT | O_WRONLY, 0644));
+  }
+
+  // an old mtime, so that the listing is cached
+  struct timespec times[2] = {{1000, 0}, {1000, 0}};
+  assert( utimensat(AT_FDCWD, ".", times, 0) == 0 );
+
+  const char *patterns[] = {"*.log", "file9999*", "*7.log", NULL};
+  printf("%d entries\n", BENCH_FILES);
+  printf("%-12s %10s %10s %10s %10s %10s\n", "pattern", "glob() ms", "cold ms",
+         "cached ms", "stream ms", "nosort ms");
+  for (int i=0; patterns[i]; i++) {
+    double glob_ms = bench_glob(patterns[i]);
+    double cold_ms = bench_pglob(patterns[i], true, 0);
+    double cached_ms = bench_pglob(patterns[i], false, 0);
+    vars_set("PLAIDSH_GLOB_CACHE", "0");
+    double stream_ms = bench_pglob(patterns[i], false, 0);
+    double nosort_ms = bench_pglob(patterns[i], false, PGLOB_NOSORT);
+    vars_unset("PLAIDSH_GLOB_CACHE");
+    printf("%-12s %10.2f %10.2f %10.2f %10.2f %10.2f\n", patterns[i], glob_ms, cold_ms,
+           cached_ms, stream_ms, nosort_ms);
+  }
+
+  for (int i=0; i < BENCH_FILES; i++) {
+    snprintf(name, sizeof(name), "file%d.log", i);
+    unlink(name);
+  }
+  assert( chdir(old_cwd) == 0 );
+  free(old_cwd);
+  rmdir(tempdir);
+  return 0;
+}
+
+#endif   // RUN_BENCH
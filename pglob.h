@@ -0,0 +1,84 @@
+/*
+ * pglob.h
+ *
+ * Expansion of glob patterns into file names, matched against a cache
+ * of sorted directory listings
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _PGLOB_H_
+#define _PGLOB_H_
+
+#include <stdio.h>
+
+#include "command.h"
+
+#define PGLOB_NOSORT  0x01   // leave the matches in directory order
+
+/*
+ * Expands a glob pattern and appends the names it matches to a
+ * command's arguments, as glob() would with GLOB_BRACE: * ? and [...]
+ * match within one path component, a leading . must be matched
+ * explicitly, and a backslash quotes the next character. {a,b}
+ * alternatives are expanded first; the matches of each alternative
+ * are sorted, unless PGLOB_NOSORT is given, and come after those of
+ * the alternatives before it.
+ *
+ * A component that is exactly ** matches any number of directories,
+ * including none, so a pattern of ** then / then *.c matches every .c
+ * file in and below the current directory; ** on its own matches
+ * every entry below it.
+ * Hidden directories and links to directories are not entered, and
+ * the walk goes at most PLAIDSH_GLOB_DEPTH levels down (64 if unset).
+ * The tree is read by a pool of threads, one per CPU up to 8 (see
+ * globstar_walk()), without going through the listing cache, and the
+ * matches are sorted into one order like any other.
+ *
+ * Directories are read with getdents64() in 256K batches. Each
+ * directory read is kept sorted in a cache, keyed by the device,
+ * inode and modification time of the directory, so that expanding
+ * again over an unchanged directory costs no system call beyond a
+ * stat(). A name prefix before the first wildcard is found by binary
+ * search. The cache holds at most PLAIDSH_GLOB_CACHE bytes of listings
+ * (a number with an optional K, M or G suffix, 64M if unset, 0 to turn
+ * caching off), and drops the least recently used listings first. A
+ * directory modified within the last second is not cached, since
+ * another change in the same tick of its mtime would go unnoticed.
+ *
+ * When the last component of the pattern is matched against a
+ * directory that is not going to be cached, or with PGLOB_NOSORT, its
+ * entries are matched batch by batch as they are read, and each match
+ * is appended straight to the command, then sorted in place there.
+ * The peak memory is then the final argv plus one batch buffer; a
+ * cached listing adds about 9 bytes per entry plus its names. glob()
+ * instead holds every match in its own vector, which the caller then
+ * copies into argv, so it peaks at about twice the final argv.
+ *
+ * Parameters:
+ *   pattern  The pattern, after quotes and ~ have been translated
+ *   cmd      The command to append the matches to
+ *   flags    0, or PGLOB_NOSORT
+ *
+ * Returns:
+ *   The number of names appended, 0 if nothing matched, or -1 with
+ *   errno set if out of memory, in which case some of the matches
+ *   may have been appended.
+ */
+int pglob_expand(const char *pattern, command_t *cmd, int flags);
+
+/*
+ * Drops every cached directory listing and zeroes the counters.
+ */
+void pglob_cache_clear();
+
+/*
+ * Prints the size of the cache and its hit and miss counters. A hit
+ * is an expansion step served from the cache, and a miss one that
+ * had to read the directory.
+ *
+ * Parameters:
+ *   out      Where to print the statistics
+ */
+void pglob_cache_dump(FILE *out);
+
+#endif /* _PGLOB_H_ */
@@ -7,6 +7,8 @@
  * Co-Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
  */
 
+#define _GNU_SOURCE             // pipe2
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <readline/readline.h>
@@ -15,11 +17,81 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "parser.h"
 #include "command.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "pglob.h"
+#include "vars.h"
+#include "redir.h"
+#include "argsplit.h"
+#include "builtins.h"
+#include "builtins_hash.h"
+
+#define READ_BLOCK (64 * 1024)   // bytes read at a time from a pipe of commands
+
+
+static bool pipefail = false;   // set -o pipefail
+
+// EVERY BUILTIN IS CALLED WITH ITS ARGUMENTS ALREADY LOOKED UP, AND THE
+// COMMAND ITSELF FOR ITS REDIRECTIONS; THEY ARE LISTED IN builtins.def
+typedef int (*builtin_fn)(int argc, char *const argv[], command_t *cmd);
+
+typedef struct
+{
+  const char *name;
+  builtin_fn handler;
+} builtin_t;
+
+// PIDS AND EXIT STATUSES OF THE STAGES OF THE LAST PIPELINE
+static pid_t *stage_pids = NULL;
+static int *stage_status = NULL;
+static int stage_cap = 0;
 
-#define MAX_ARGS 20
+// FOR THE -t FLAG, AND THE SHELL'S EXIT STATUS IN SCRIPTS
+static unsigned long commands_run = 0;
+static int last_status = 0;
+
+// THE SHELL ITSELF, AS OPPOSED TO A CHILD RUNNING A BUILTIN OR $(...)
+static pid_t shell_pid = 0;
+
+// ONE LINE OF A SCRIPT, COPIED OUT SO IT CAN BE NUL-TERMINATED
+static char *line_buf = NULL;
+static size_t line_cap = 0;
+
+// A SCRIPT'S COMMAND WAITING FOR THE REST OF ITS HERE-DOCUMENTS, KEPT
+// PARSED SO THAT ITS $(...) SUBSTITUTIONS RUN ONLY ONCE, AND THE BYTES
+// OF ITS LINE, WHICH run_lines() IS GIVEN AGAIN BUT DOES NOT PARSE AGAIN
+static command_t *pending_cmd = NULL;
+static size_t pending_line_len = 0;
+
+/* *************************************************************************************************** */
+/*
+ * Calls a builtin's handler with the arguments of a command, as the
+ * dispatcher does
+ *
+ * Parameters:
+ *   handler  The builtin
+ *   cmd      The command, whose argv[0] names the builtin
+ *
+ * Returns:
+ *   The builtin's status
+ */
+static int call_builtin(builtin_fn handler, command_t *cmd)
+{
+  return handler(command_get_argc(cmd), command_get_argv(cmd), cmd);
+}
 
 /* *************************************************************************************************** */
 /*
@@ -30,20 +102,18 @@
  *   argc     The length of the argv vector
  *   argv[]   The argument vector
  */
-int builtin_exit(command_t *cmd)
+int builtin_exit(int argc, char *const argv[], command_t *cmd)
 {
-  // ONE ARG AND IS exit OR quit
-  if (command_get_argc(cmd) == 1 && (strcmp(command_get_argv(cmd)[0], "exit") == 0 || strcmp(command_get_argv(cmd)[0], "quit") == 0))
-    return 0;
-
+  // THE DISPATCHER EXITS ONCE THIS RETURNS, SO THE TESTS CAN CALL IT
   return 0;
 }
 
+#ifdef RUN_TESTS
 // TEST FOR builtin_exit FUNCTION ONCE
 bool test_builtin_exit_once(command_t *cmd, int expected)
 {
   // CALL THE FUNCTION BUT DO NOT EXIT THE SHELL
-  int actualExit = builtin_exit(cmd);
+  int actualExit = call_builtin(builtin_exit, cmd);
 
   // IF THE EXIT CODE IS AS EXPECTED
   if (actualExit == expected)
@@ -71,6 +141,7 @@ bool test_builtin_exit()
 
   return passed == 2;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
 /*
@@ -84,25 +155,14 @@ bool test_builtin_exit()
  * Returns:
  *   0 on success, 1 on failure
  */
-int builtin_author(command_t *cmd)
+int builtin_author(int argc, char *const argv[], command_t *cmd)
 {
-  // THERE IS ONE ARG AND IS author
-  if (command_get_argc(cmd) == 1 && strcmp(command_get_argv(cmd)[0], "author") == 0)
+  // THERE IS ONE ARG
+  if (argc == 1)
   {
-    // DEFINE THE OUTPUT FILENAME
-    const char *outFile = command_get_output(cmd);
-
-    // IF FILE DEFINED, REDIRECT STDOUT TO FILE
-    if (outFile != NULL)
-      freopen(outFile, "a", stdout);
-
-    // ELSE PRINT TO STDOUT
+    // PRINT TO STDOUT, WHICH EXECUTION HAS ALREADY POINTED AT ANY > FILE
     printf("Niyomwungeri Parmenide ISHIMWE\n");
 
-    // IF FILE DEFINED, REDIRECT STDOUT BACK TO TERMINAL
-    if (outFile != NULL)
-      freopen("/dev/tty", "w", stdout);
-
     // SUCCESS
     return 0;
   }
@@ -111,10 +171,11 @@ int builtin_author(command_t *cmd)
   return 1;
 }
 
+#ifdef RUN_TESTS
 // TESTS ONE CASE OF THE builtin_author FUNCTION
 bool test_builtin_author_once(command_t *cmd, int expected)
 {
-  int actualAuthor = builtin_author(cmd);
+  int actualAuthor = call_builtin(builtin_author, cmd);
   if (actualAuthor != expected)
   {
     printf("builtin_author(%s) returned %d, expected %d  \n", command_get_argv(cmd)[0], actualAuthor, expected);
@@ -140,6 +201,7 @@ bool test_builtin_author()
 
   return passed == 2;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
 /*
@@ -153,18 +215,18 @@ bool test_builtin_author()
  *   0 on success, 1 on failure
  */
 
-int builtin_cd(command_t *cmd)
+int builtin_cd(int argc, char *const argv[], command_t *cmd)
 {
-  if (command_get_argc(cmd) == 1 && strcmp(command_get_argv(cmd)[0], "cd") == 0)
+  if (argc == 1)
   {
     // CHANGE DIRECTORY TO HOME IF NO ARG TO cd
-    if (chdir(getenv("HOME")) == 0)
+    if (chdir(vars_get("HOME")) == 0)
       return 0;
   }
-  else if (command_get_argc(cmd) == 2 && strcmp(command_get_argv(cmd)[0], "cd") == 0)
+  else if (argc == 2)
   {
     // CHANGE DIRECTORY TO ARG 1
-    if (chdir(command_get_argv(cmd)[1]) == 0)
+    if (chdir(argv[1]) == 0)
       return 0;
   }
 
@@ -172,10 +234,11 @@ int builtin_cd(command_t *cmd)
   return 1;
 }
 
+#ifdef RUN_TESTS
 // TESTS ONE CASE OF THE builtin_cd FUNCTION
 bool test_builtin_cd_once(command_t *cmd, int expected)
 {
-  int actualCd = builtin_cd(cmd);
+  int actualCd = call_builtin(builtin_cd, cmd);
   if (actualCd != expected)
   {
     printf("builtin_cd(%s) returned %d, expected %d  \n", command_get_argv(cmd)[0], actualCd, expected);
@@ -204,11 +267,11 @@ bool test_builtin_cd()
 
   return passed == 2;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
 /*
- * Handles the pwd builtin, by printing the cwd to the supplied file
- * descriptor
+ * Handles the pwd builtin, by printing the cwd to stdout
  *
  * Parameters (which are all ignored):
  *   argc     The length of the argv vector
@@ -217,41 +280,25 @@ bool test_builtin_cd()
  * Returns:
  *   Always returns 0, since it always succeeds
  */
-int builtin_pwd(command_t *cmd)
+int builtin_pwd(int argc, char *const argv[], command_t *cmd)
 {
-  // THERE IS ONE ARG AND IS THE pwd
-  if (command_get_argc(cmd) >= 1 && strcmp(command_get_argv(cmd)[0], "pwd") == 0)
-  {
-    char currentDir[1024];
-    // DEFINE THE OUTPUT FILENAME
-    const char *outFile = command_get_output(cmd);
-
-    // GET THE CURRENT WORKING DIRECTORY
-    getcwd(currentDir, sizeof(currentDir));
+  char currentDir[1024];
 
-    // IF FILE DEFINED, REDIRECT STDOUT TO FILE
-    if (outFile != NULL)
-      freopen(outFile, "a", stdout);
+  // GET THE CURRENT WORKING DIRECTORY
+  getcwd(currentDir, sizeof(currentDir));
 
-    // PRINT THE CURRENT WORKING DIRECTORY
-    printf("%s \n", currentDir);
-
-    // IF FILE DEFINED, REDIRECT STDOUT BACK TO TERMINAL
-    if (outFile != NULL)
-      freopen("/dev/tty", "w", stdout);
-
-    return 0;
-  }
+  // PRINT THE CURRENT WORKING DIRECTORY
+  printf("%s \n", currentDir);
 
-  // IF ERROR, RETURN 1
-  return 1;
+  return 0;
 }
 
 
+#ifdef RUN_TESTS
 // TESTS ONE CASE OF THE builtin_pwd FUNCTION
 bool test_builtin_pwd_once(command_t *cmd, int expected)
 {
-  int actualPwd = builtin_pwd(cmd);
+  int actualPwd = call_builtin(builtin_pwd, cmd);
   if (actualPwd != expected)
   {
     printf("builtin_pwd(%s) returned %d, expected %d  \n", command_get_argv(cmd)[0], actualPwd, expected);
@@ -278,43 +325,48 @@ bool test_builtin_pwd()
 
   return passed == 2;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
 /*
  * Handles the builtin environment setting, by setting the variable varname to value
- * by using the setenv() function.
+ * in the shell's variable table and exporting it to later commands.
  *
  * Parameters:
- *   varname     The variable name to set
- *   value       The value for the variable
+ *   argc     The length of the argv vector, which must be 3
+ *   argv[]   The argument vector: setenv, the variable name and its value
  *
  * Returns:
  *   Returns 0 on success, 1 on error
  */
-int builtin_setenv(command_t *cmd)
+int builtin_setenv(int argc, char *const argv[], command_t *cmd)
 {
   // ILLEGAL NUMBER OF ARGS
-  if (command_get_argc(cmd) != 3 && strcmp(command_get_argv(cmd)[0], "setenv") == 0)
+  if (argc != 3)
   {
-    fprintf(stderr, "usage: setenv varname value (%d args provided, expected 3)\n", command_get_argc(cmd));
+    fprintf(stderr, "usage: setenv varname value (%d args provided, expected 3)\n", argc);
     return 1;
   }
 
-  // THERE IS THREE ARGS AND IS THE setenv - SET THE ENVIRONMENT VARIABLE TO THE THIRD ARG
-  else if (command_get_argc(cmd) == 3 && strcmp(command_get_argv(cmd)[0], "setenv") == 0)
+  // THERE ARE THREE ARGS - SET THE ENVIRONMENT VARIABLE TO THE THIRD ARG,
+  // WHICH CHANGES THE ENVIRONMENT OF LATER COMMANDS
+  if (vars_export(argv[1], argv[2]) == -1)
   {
-    // SET THE ENVIRONMENT VARIABLE
-    setenv(command_get_argv(cmd)[1], command_get_argv(cmd)[2], 1);
-    return 0;
+    fprintf(stderr, "setenv: %s: %s\n", argv[1], strerror(errno));
+    return 1;
   }
 
+  // A NEW PATH MAKES EVERY REMEMBERED COMMAND LOCATION SUSPECT
+  if (strcmp(argv[1], "PATH") == 0)
+    pathcache_clear();
   return 0;
 }
 
+#ifdef RUN_TESTS
 // TESTS ONE CASE OF THE builtin_setenv FUNCTION
 bool test_builtin_setenv_once(command_t *cmd, int expected)
 {
-  int actualSetenv = builtin_setenv(cmd);
+  int actualSetenv = call_builtin(builtin_setenv, cmd);
   if (actualSetenv != expected)
   {
     printf("builtin_setenv(%s, %s) returned %d, expected %d  \n", command_get_argv(cmd)[1], command_get_argv(cmd)[2], actualSetenv, expected);
@@ -344,240 +396,1981 @@ bool test_builtin_setenv()
 
   return passed == 2;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
 /*
- * Process an external (non built-in) command, by forking and execing
- * a child process, and waiting for the child to terminate
+ * Sets the shell variable named by a NAME=value string, as typed on its
+ * own or before a command
  *
  * Parameters:
- *   argc      The length of the argv vector
- *   argv[]    The argument vector
+ *   assign   The NAME=value string
+ *   export   True to also export the variable, as "export NAME=value" does
  *
  * Returns:
- *   The child's exit value, or -1 on error
+ *   0 on success, -1 with errno set on a bad name or if out of memory
  */
-int forkexec_external_cmd(command_t *cmd)
+static int assign_variable(const char *assign, bool export)
 {
-  
-  // FORKING THE PROCESS
-  pid_t pid = fork();
-  int status;
+  const char *eq = strchr(assign, '=');
+  size_t name_len = eq ? (size_t)(eq - assign) : strlen(assign);
+  char name[name_len + 1];
+  memcpy(name, assign, name_len);
+  name[name_len] = '\0';
+
+  int ret;
+  if (export)
+    ret = vars_export(name, eq ? eq + 1 : NULL);
+  else
+    ret = vars_set(name, eq ? eq + 1 : "");
 
-  // IF PARENT PROCESS - EXECUTE IT
-  if (pid == 0)
-  {
+  // A NEW PATH MAKES EVERY REMEMBERED COMMAND LOCATION SUSPECT
+  if (ret == 0 && strcmp(name, "PATH") == 0)
+    pathcache_clear();
+  return ret;
+}
 
-    // DEFINING stdin TO THE INPUT FILE WHEN NOT GIVEN
-    if (command_get_input(cmd) != NULL)
-      freopen(command_get_input(cmd), "r", stdin);
+/* *************************************************************************************************** */
+/*
+ * Handles the export builtin, which puts shell variables into the
+ * environment of later commands:
+ *    export               prints the exported variables
+ *    export NAME...       exports each variable, keeping its value
+ *    export NAME=value... sets and exports each variable
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "export"
+ *
+ * Returns:
+ *   0 on success, 1 if any name was not valid
+ */
+int builtin_export(int argc, char *const argv[], command_t *cmd)
+{
 
-    // DEFINING stdin TO THE INPUT FILE WHEN NOT GIVEN
-    if (command_get_output(cmd) != NULL)
-      freopen(command_get_output(cmd), "a", stdout);
+  // NO ARGS - PRINT THE ENVIRONMENT THAT COMMANDS GET
+  if (argc == 1)
+  {
+    char **envp = vars_envp();
+    for (int i = 0; envp != NULL && envp[i] != NULL; i++)
+      printf("export %s\n", envp[i]);
+    return 0;
+  }
 
-    // EXECUTE THE COMMAND IF IT EXISTS
-    if (execvp(command_get_argv(cmd)[0], command_get_argv(cmd)) == -1)
+  int status = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (*argv[i] == '=' || assign_variable(argv[i], true) == -1)
     {
-      fprintf(stderr, "Command not found: '%s'\n", command_get_argv(cmd)[0]);
-      exit(-1);
+      fprintf(stderr, "export: %s: %s\n", argv[i], strerror(*argv[i] == '=' ? EINVAL : errno));
+      status = 1;
     }
+  }
+  return status;
+}
 
-    // EXIT
-    exit(0);
+/* *************************************************************************************************** */
+/*
+ * Handles the hash builtin, which manages the table of remembered
+ * command locations:
+ *    hash           prints the table
+ *    hash -r        forgets every remembered command
+ *    hash name...   looks up each name and remembers where it is
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "hash"
+ *
+ * Returns:
+ *   0 on success, 1 if a name could not be found
+ */
+int builtin_hash(int argc, char *const argv[], command_t *cmd)
+{
+  int ret = 0;
+
+  // NO ARGS - PRINT THE TABLE
+  if (argc == 1)
+  {
+    fflush(stdout);
+    pathcache_dump(stdout);
+    return 0;
   }
 
-  // IF CHILD PROCESS, WAIT FOR IT TO FINISH
-  else if (pid > 0)
+  for (int i = 1; i < argc; i++)
   {
-    // WAIT FOR THE CHILD PROCESS TO TERMINATE
-    waitpid(pid, &status, 0);
+    // -r FORGETS EVERYTHING
+    if (strcmp(argv[i], "-r") == 0)
+      pathcache_clear();
+    else if (pathcache_lookup(argv[i]) == NULL)
+    {
+      fprintf(stderr, "hash: %s: not found\n", argv[i]);
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
 
-    // IF THE CHILD PROCESS DID NOT EXIT SUCCESSFULLY, PRINT THE ERROR & RETURN STATUS CODE
-    if (WEXITSTATUS(status) != 0)
-      printf("Child %d exited with status %d \n", pid, WEXITSTATUS(status));
+/* *************************************************************************************************** */
+/*
+ * Handles the globcache builtin, which manages the cache of directory
+ * listings used to expand glob patterns:
+ *    globcache      prints the size of the cache and its hits and misses
+ *    globcache -r   drops every cached listing
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "globcache"
+ *
+ * Returns:
+ *   0 on success, 1 on an unknown argument
+ */
+int builtin_globcache(int argc, char *const argv[], command_t *cmd)
+{
 
-    return WEXITSTATUS(status);
+  // NO ARGS - PRINT THE STATISTICS
+  if (argc == 1)
+  {
+    fflush(stdout);
+    pglob_cache_dump(stdout);
+    return 0;
   }
 
-  // IF ERROR, COMMAND FAILED - RETURN -1
-  else
+  if (argc == 2 && strcmp(argv[1], "-r") == 0)
   {
-    fprintf(stdout, "Command failed \n");
-    return -1;
+    pglob_cache_clear();
+    return 0;
   }
+
+  fprintf(stderr, "Usage: globcache [-r]\n");
+  return 1;
 }
 
-// Tests one test case of the forkexec_external_cmd function
-bool test_forkexec_external_cmd_once(command_t *cmd, int expected)
+/* *************************************************************************************************** */
+/*
+ * Handles the set builtin, which turns shell options on and off:
+ *    set -o pipefail   a pipeline fails if any of its stages fails
+ *    set +o pipefail   a pipeline has the status of its last stage
+ *    set -o            prints the options and their values
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "set"
+ *
+ * Returns:
+ *   0 on success, 1 on an unknown option
+ */
+int builtin_set(int argc, char *const argv[], command_t *cmd)
 {
-  int actualForkExec = forkexec_external_cmd(cmd);
-  if (actualForkExec != expected)
+
+  // NO OPTION NAME - PRINT THE OPTIONS
+  if (argc == 2 && (strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "+o") == 0))
   {
-    printf("forkexec_external_cmd(%s) returned %d, expected %d  \n", command_get_argv(cmd)[0], actualForkExec, expected);
-    return false;
+    printf("pipefail\t%s\n", pipefail ? "on" : "off");
+    return 0;
   }
 
-  return true;
+  if (argc == 3 && strcmp(argv[2], "pipefail") == 0)
+  {
+    if (strcmp(argv[1], "-o") == 0)
+    {
+      pipefail = true;
+      return 0;
+    }
+    if (strcmp(argv[1], "+o") == 0)
+    {
+      pipefail = false;
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "usage: set [-o|+o] [pipefail]\n");
+  return 1;
 }
 
-// Tests the forkexec_external_cmd function
-bool test_forkexec_external_cmd()
+#ifdef RUN_TESTS
+// TESTS THE set FUNCTION
+bool test_builtin_set()
 {
   int passed = 0;
   command_t *cmd = command_new();
-  command_append_arg(cmd, "ls");
-  command_append_arg(cmd, "-l");
-  if (test_forkexec_external_cmd_once(cmd, 0))
+  command_append_arg(cmd, "set");
+  command_append_arg(cmd, "-o");
+  command_append_arg(cmd, "pipefail");
+  if (call_builtin(builtin_set, cmd) == 0 && pipefail)
     passed++;
 
   command_t *cmd1 = command_new();
-  command_append_arg(cmd1, "grep");
-  command_append_arg(cmd1, "pattern");
-  command_append_arg(cmd1, "notesists.txt");
-  if (test_forkexec_external_cmd_once(cmd1, 2))
+  command_append_arg(cmd1, "set");
+  command_append_arg(cmd1, "+o");
+  command_append_arg(cmd1, "pipefail");
+  if (call_builtin(builtin_set, cmd1) == 0 && !pipefail)
     passed++;
 
-  return passed == 2;
+  command_t *cmd2 = command_new();
+  command_append_arg(cmd2, "set");
+  command_append_arg(cmd2, "-o");
+  command_append_arg(cmd2, "nosuchoption");
+  if (call_builtin(builtin_set, cmd2) == 1 && !pipefail)
+    passed++;
+
+  command_free(cmd);
+  command_free(cmd1);
+  command_free(cmd2);
+  return passed == 3;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
 /*
- * Parses one input line, and executes it
+ * Works out the status of a whole pipeline from the status of each of
+ * its stages, and keeps the stages' statuses in the PIPESTATUS
+ * variable, space separated
  *
  * Parameters:
- *   argc     The length of the argv vector, which must be >= 1
- *   argv[]   The argument vector
+ *   statuses  The exit status of each stage
+ *   n         The number of stages
+ *
+ * Returns:
+ *   The status of the last stage, or with "set -o pipefail", the
+ *   status of the rightmost stage that did not exit with 0
  */
-void execute_command(command_t *cmd)
+static int pipeline_status(const int *statuses, int n)
 {
+  char pipestatus[12 * n + 1];
+  size_t len = 0;
+  for (int i = 0; i < n; i++)
+    len += sprintf(pipestatus + len, i == 0 ? "%d" : " %d", statuses[i]);
+  vars_set("PIPESTATUS", pipestatus);
+
+  if (pipefail)
+    for (int i = n - 1; i >= 0; i--)
+      if (statuses[i] != 0)
+        return statuses[i];
+
+  return statuses[n - 1];
+}
 
-  // IF THERE IS AT LEAST ONE ARGUMENT
-  if (command_get_argc(cmd) >= 1)
-  {
+/* *************************************************************************************************** */
+/*
+ * Reads a job number, written as either N or %N
+ *
+ * Returns:
+ *   The job number, or -1 if spec is not a job number
+ */
+static int parse_job_spec(const char *spec)
+{
+  char *end;
 
-    // EXECUTING THE exit, quit COMMAND
-    if (strcmp(command_get_argv(cmd)[0], "exit") == 0 || strcmp(command_get_argv(cmd)[0], "quit") == 0)
-    {
-      builtin_exit(cmd);
-      exit(0);
-    }
-    // EXECUTING THE author COMMAND
-    else if (strcmp(command_get_argv(cmd)[0], "author") == 0)
-      builtin_author(cmd);
+  if (*spec == '%')
+    spec++;
+  long id = strtol(spec, &end, 10);
+  if (*spec == '\0' || *end != '\0' || id < 1 || id > INT_MAX)
+    return -1;
 
-    // EXECUTING cd COMMAND
-    else if (strcmp(command_get_argv(cmd)[0], "cd") == 0)
-      builtin_cd(cmd);
+  return id;
+}
+
+/*
+ * Handles the jobs builtin, by printing every background job and
+ * whether it is still running
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "jobs"
+ *
+ * Returns:
+ *   Always returns 0
+ */
+int builtin_jobs(int argc, char *const argv[], command_t *cmd)
+{
+  fflush(stdout);
+  jobs_print(stdout);
+  return 0;
+}
 
-    // EXECUTING THE pwd COMMAND
-    else if (strcmp(command_get_argv(cmd)[0], "pwd") == 0)
-      builtin_pwd(cmd);
+/*
+ * Handles the wait builtin:
+ *    wait             waits for every background job
+ *    wait %N...       waits for the given jobs
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "wait"
+ *
+ * Returns:
+ *   The status of the last job waited for, as for a pipeline run in
+ *   the foreground, or 127 if a job does not exist
+ */
+int builtin_wait(int argc, char *const argv[], command_t *cmd)
+{
+  const int *statuses;
+  int status = 0;
+  int n;
 
-    // EXECUTING THE setenv COMMAND
-    else if (strcmp(command_get_argv(cmd)[0], "setenv") == 0)
-      builtin_setenv(cmd);
+  // NO ARGS - WAIT FOR EVERY JOB, NEWEST FIRST
+  if (argc == 1)
+  {
+    while (jobs_current() != 0)
+      if ((n = jobs_wait(jobs_current(), &statuses)) > 0)
+        status = pipeline_status(statuses, n);
+    return status;
+  }
 
-    // EXECUTING EXTERNAL COMMANDS (NOT BUILT-IN)
+  for (int i = 1; i < argc; i++)
+  {
+    int id = parse_job_spec(argv[i]);
+    if (id == -1 || (n = jobs_wait(id, &statuses)) == -1)
+    {
+      fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+      status = 127;
+    }
     else
-      forkexec_external_cmd(cmd);
+      status = pipeline_status(statuses, n);
   }
 
-  else
-    fprintf(stderr, "Error: Undefined variable \"  \"!\n");
-}
-
-bool test_execute_command_once(command_t *cmd)
-{
-  execute_command(cmd);
-  return true;
+  return status;
 }
 
-static bool test_execute_command()
+/*
+ * Handles the fg builtin, by waiting for a background job as if it had
+ * been run in the foreground. Jobs are not stopped and continued, so
+ * this differs from wait only in taking at most one job, and in
+ * defaulting to the most recent one.
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "fg", and argv[1] the job
+ *
+ * Returns:
+ *   The status of the job, or 1 if there is no such job
+ */
+int builtin_fg(int argc, char *const argv[], command_t *cmd)
 {
-  int passed = 0;
-
-  // Test external command
-  command_t *cmd = command_new();
-  command_append_arg(cmd, "ls");
-  command_append_arg(cmd, "-l");
-  if (test_execute_command_once(cmd))
-    passed++;
+  const int *statuses;
+  int id = jobs_current();
+  int n;
 
-  // Test another external command
-  command_t *cmd1 = command_new();
-  command_append_arg(cmd1, "grep");
-  command_append_arg(cmd1, "pattern");
-  command_append_arg(cmd1, "file.txt");
-  if (test_execute_command_once(cmd1))
-    passed++;
+  if (argc > 2)
+  {
+    fprintf(stderr, "usage: fg [%%job]\n");
+    return 1;
+  }
+  if (argc == 2)
+    id = parse_job_spec(argv[1]);
 
-  // Test built-in command
-  command_t *cmd2 = command_new();
-  command_append_arg(cmd2, "author");
-  if (test_execute_command_once(cmd2))
-    passed++;
+  if (id <= 0 || (n = jobs_wait(id, &statuses)) == -1)
+  {
+    fprintf(stderr, "fg: %s: no such job\n", argc == 2 ? argv[1] : "current");
+    return 1;
+  }
 
-  return passed == 3;
+  return pipeline_status(statuses, n);
 }
 
 /* *************************************************************************************************** */
 /*
- * The main loop for the shell.
+ * Handles the parallel builtin, which runs a command once for each
+ * argument after :::, several at a time:
+ *    parallel [-j N] [--tag] command [args...] ::: arg...
+ *
+ * Each {} in the command is replaced by the argument, which is
+ * otherwise appended. Up to N runs are in flight at once (by default,
+ * one per CPU). Their output is written in the order of the arguments,
+ * or with --tag, line by line as it arrives, each line prefixed by
+ * its argument.
+ *
+ * Parameters:
+ *   argc     The length of the argv vector
+ *   argv[]   The argument vector, whose argv[0] is "parallel"
+ *
+ * Returns:
+ *   0 if every run succeeded, otherwise the number of runs that failed
+ *   (at most 101), or 255 on a usage error
  */
-void mainloop()
+int builtin_parallel(int argc, char *const argv[], command_t *cmd)
 {
+  long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  bool tag = false;
+  bool bad = false;
+  int i = 1;
 
-  char argv[MAX_ARGS];
-  char *inp = NULL;
+  // READING THE OPTIONS
+  for (; i < argc && argv[i][0] == '-' && !bad; i++)
+  {
+    char *end;
+    if (strcmp(argv[i], "--tag") == 0)
+      tag = true;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      max_jobs = strtol(argv[++i], &end, 10);
+      bad = (*end != '\0' || max_jobs < 1);
+    }
+    else
+      bad = true;
+  }
 
-  // PRINTING THE WELCOME MESSAGE AND PROMPT TO THE USER ON THE SCREEN
-  fprintf(stdout, "Welcome to Plaid Shell!\n");
-  const char *userInput = "#> ";
+  // FINDING THE ::: BETWEEN THE COMMAND AND ITS ARGUMENTS
+  int sep = i;
+  while (sep < argc && strcmp(argv[sep], ":::") != 0)
+    sep++;
 
-  // CONNECTING THE readline, read_word, AND parse_input IN A LOOP
-  while (1)
+  if (bad || sep == i || sep == argc)
   {
+    fprintf(stderr, "usage: parallel [-j N] [--tag] command [args...] ::: arg...\n");
+    return 255;
+  }
 
-    // GETTING THE INPUT FROM THE USER
-    inp = readline(userInput);
-
-    // SAVING THE INPUT TO HISTORY
-    add_history(inp);
+  if (max_jobs < 1)
+    max_jobs = 1;
 
-    // IF NO INPUT, KEEP PROMPTING
-    if (inp == NULL)
-      exit(0);
+  return parallel_run(argv + i, sep - i, argv + sep + 1, argc - sep - 1, max_jobs, tag);
+}
 
-    if (*inp == '\0')
-      continue;
+#ifdef RUN_TESTS
+// TESTS THE parallel FUNCTION
+bool test_builtin_parallel()
+{
+  int passed = 0;
+  const char *ok_words[] = {"parallel", "-j", "2", "true", ":::", "a", "b", "c", NULL};
+  const char *fail_words[] = {"parallel", "test", "{}", "=", "b", ":::", "a", "b", "c", NULL};
+  const char *bad_words[] = {"parallel", "-j", "0", "true", ":::", "a", NULL};
+  const char **words[] = {ok_words, fail_words, bad_words};
+  int expected[] = {0, 2, 255};
 
-    // GETTING AND PARSING THE INPUT, EXECUTING THE COMMAND
-    execute_command(parse_input(inp, argv, sizeof(argv)));
+  for (int t = 0; t < 3; t++)
+  {
+    command_t *cmd = command_new();
+    for (int i = 0; words[t][i] != NULL; i++)
+      command_append_arg(cmd, words[t][i]);
+    if (call_builtin(builtin_parallel, cmd) == expected[t])
+      passed++;
+    command_free(cmd);
   }
+
+  return passed == 3;
 }
+#endif // RUN_TESTS
 
 /* *************************************************************************************************** */
-int main(int argc, char *argv[])
+/*
+ * The builtins, in the order of builtins.def, whose slot in the table
+ * generated by gen_builtins gives the index of the only name that can
+ * match. A lookup is then one hash and one strcmp, however many
+ * builtins there are.
+ */
+static const builtin_t builtins[] = {
+#define BUILTIN(name, handler) {#name, handler},
+#include "builtins.def"
+#undef BUILTIN
+};
+
+/*
+ * Finds a builtin by name
+ *
+ * Returns:
+ *   The builtin, or NULL if name is not one
+ */
+static const builtin_t *find_builtin(const char *name)
 {
+  int i = builtin_slots[builtin_name_hash(name, BUILTIN_HASH_SEED) & (BUILTIN_HASH_SLOTS - 1)];
+  if (i < 0 || strcmp(builtins[i].name, name) != 0)
+    return NULL;
 
-  printf("RUNNING TESTS FOR BUILTIN FUNCTIONS - IN plaidsh.c\n\n");
-  int success = 1;
+  return &builtins[i];
+}
 
-  success &= test_builtin_author();
-  success &= test_builtin_cd();
-  success &= test_builtin_pwd();
+static bool is_builtin(const char *name)
+{
+  return find_builtin(name) != NULL;
+}
+
+/*
+ * Runs a builtin
+ *
+ * Returns:
+ *   The builtin's status, unless it is exit or quit
+ */
+static int dispatch_builtin(const builtin_t *builtin, command_t *cmd)
+{
+  int status = call_builtin(builtin->handler, cmd);
+
+  // exit AND quit LEAVE THE SHELL ONCE THE BUILTIN HAS RUN; IN A CHILD
+  // (A PIPELINE STAGE, OR $(...)) ONLY THE CHILD LEAVES, WITHOUT RUNNING
+  // THE SHELL'S atexit HANDLERS, SUCH AS THE -t STATISTICS
+  if (builtin->handler == builtin_exit)
+  {
+    if (getpid() != shell_pid)
+    {
+      fflush(stdout);
+      _exit(0);
+    }
+    exit(0);
+  }
+
+  return status;
+}
+
+/*
+ * Runs a builtin with its NAME=value prefixes, on whatever stdin and
+ * stdout the shell has at the time
+ *
+ * Parameters:
+ *   builtin  The builtin
+ *   cmd      The command, whose first argument names the builtin
+ *
+ * Returns:
+ *   The builtin's status, or 1 if a prefix could not be set
+ */
+static int run_builtin(const builtin_t *builtin, command_t *cmd)
+{
+  int status = 1;
+  int n_assigns = command_get_assignc(cmd);
+  if (n_assigns == 0)
+    return dispatch_builtin(builtin, cmd);
+
+  // NAME=value BEFORE A BUILTIN HOLDS ONLY WHILE IT RUNS, SO THE OLD
+  // VALUES ARE SET ASIDE AND PUT BACK AFTERWARDS
+  char *const *assigns = command_get_assigns(cmd);
+  char *saved[n_assigns];
+  bool was_set[n_assigns];
+  for (int i = 0; i < n_assigns; i++)
+  {
+    size_t name_len = strchr(assigns[i], '=') - assigns[i];
+    char name[name_len + 1];
+    memcpy(name, assigns[i], name_len);
+    name[name_len] = '\0';
+
+    const char *old = vars_get(name);
+    was_set[i] = (old != NULL);
+    saved[i] = old ? strdup(old) : NULL;
+    if ((old != NULL && saved[i] == NULL) || assign_variable(assigns[i], false) == -1)
+    {
+      fprintf(stderr, "%s: %s\n", assigns[i], strerror(errno));
+      free(saved[i]);
+      saved[i] = NULL;
+      n_assigns = i;
+      break;
+    }
+  }
+
+  if (n_assigns == command_get_assignc(cmd))
+    status = dispatch_builtin(builtin, cmd);
+
+  for (int i = n_assigns - 1; i >= 0; i--)
+  {
+    size_t name_len = strchr(assigns[i], '=') - assigns[i];
+    char name[name_len + 1];
+    memcpy(name, assigns[i], name_len);
+    name[name_len] = '\0';
+
+    if (was_set[i])
+      vars_set(name, saved[i]);
+    else
+      vars_unset(name);
+    free(saved[i]);
+    if (strcmp(name, "PATH") == 0)
+      pathcache_clear();
+  }
+
+  return status;
+}
+
+/*
+ * Opens the < and > files of a command, or for a here-document or
+ * here-string a pipe or memfd holding its text, reporting any error
+ * to stderr
+ *
+ * Parameters:
+ *   cmd      The command, or one stage of a pipeline
+ *   in_fd    Set to the open input, or -1 if there is none
+ *   out_fd   Set to the open output, or -1 if there is none
+ *
+ * Returns:
+ *   0 on success, or -1, in which case nothing is left open
+ */
+static int open_redirections(command_t *cmd, int *in_fd, int *out_fd)
+{
+  size_t in_len;
+  const char *failed;
+  const char *in_data = command_get_input_data(cmd, &in_len);
+
+  if (redir_open(command_get_input(cmd), command_get_output(cmd), in_fd, out_fd, &failed) == -1)
+  {
+    fprintf(stderr, "%s: %s\n", failed, strerror(errno));
+    return -1;
+  }
+
+  // THE PARSER NEVER GIVES A STAGE BOTH AN INPUT FILE AND TEXT
+  if (in_data != NULL && (*in_fd = redir_open_data(in_data, in_len)) == -1)
+  {
+    fprintf(stderr, "here-document: %s\n", strerror(errno));
+    if (*out_fd != -1)
+      close(*out_fd);
+    *out_fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Runs cmd in the shell itself if it is a builtin. Its < and >
+ * redirections, or the text of its here-document, are opened once and
+ * put over the shell's stdin and stdout while it runs, then the
+ * shell's own are put back.
+ *
+ * Parameters:
+ *   cmd      The command, which must have at least one argument
+ *   status   Set to the builtin's return value
+ *
+ * Returns:
+ *   true if cmd was a builtin, false if it is an external command
+ */
+static bool execute_builtin(command_t *cmd, int *status)
+{
+  const builtin_t *builtin = find_builtin(command_get_argv(cmd)[0]);
+  if (builtin == NULL)
+    return false;
+
+  // THE COMMON CASE HAS NO REDIRECTION, AND COSTS NO SYSTEM CALL
+  size_t in_len;
+  const char *in_file = command_get_input(cmd);
+  const char *out_file = command_get_output(cmd);
+  const char *in_data = command_get_input_data(cmd, &in_len);
+  if (in_file == NULL && out_file == NULL && in_data == NULL)
+  {
+    *status = run_builtin(builtin, cmd);
+    return true;
+  }
+
+  int in_fd, out_fd;
+  redir_t redir;
+  if (open_redirections(cmd, &in_fd, &out_fd) == -1)
+  {
+    *status = 1;
+    return true;
+  }
+
+  if (redir_apply(&redir, in_fd, out_fd) == -1)
+  {
+    fprintf(stderr, "%s: %s\n", command_get_argv(cmd)[0], strerror(errno));
+    *status = 1;
+  }
+  else
+  {
+    *status = run_builtin(builtin, cmd);
+    redir_restore(&redir);
+  }
+
+  if (in_fd != -1)
+    close(in_fd);
+  if (out_fd != -1)
+    close(out_fd);
+
+  return true;
+}
+
+/* *************************************************************************************************** */
+/*
+ * Returns the number of batches of a split command that may run at
+ * once: PLAIDSH_SPLIT_JOBS if it is a positive number, otherwise 1,
+ * which keeps the output in argument order
+ */
+static int split_jobs()
+{
+  const char *env = vars_get("PLAIDSH_SPLIT_JOBS");
+  char *end;
+
+  if (env == NULL)
+    return 1;
+  long jobs = strtol(env, &end, 10);
+  if (end == env || *end != '\0' || jobs < 1 || jobs > INT_MAX)
+    return 1;
+  return jobs;
+}
+
+/*
+ * Runs a stage whose arguments and environment are too big for one
+ * exec, as xargs would: the words before and after the expanded
+ * arguments are kept, and the expanded ones are split across as many
+ * runs as they need. The runs are made by a forked copy of the shell,
+ * which stands for all of them in the pipeline and exits with their
+ * combined status.
+ *
+ * Parameters:
+ *   stage    The stage
+ *   path     The executable
+ *   envp     The environment
+ *   first    The index of the first expanded argument
+ *   end      One past the index of the last one
+ *   in_fd    Where the runs read from, or -1
+ *   out_fd   Where the runs write to, or -1
+ *
+ * Returns:
+ *   The pid of the child, or -1 if it could not be started
+ */
+static pid_t start_split_stage(command_t *stage, const char *path, char **envp,
+                               int first, int end, int in_fd, int out_fd)
+{
+  char *const *argv = command_get_argv(stage);
+  int argc = command_get_argc(stage);
+
+  // THE COMMAND NAME ITSELF IS NEVER SPLIT OFF, EVEN IF IT WAS EXPANDED
+  if (first == 0)
+    first = 1;
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    int status = argsplit_run(path, argv, first, argc - end, envp, in_fd, out_fd, split_jobs());
+    if (status == -1)
+    {
+      fprintf(stderr, "Command failed: '%s': %s\n", argv[0], strerror(errno));
+      status = errno == ENOENT ? 127 : 126;
+    }
+    _exit(status);
+  }
+  if (pid == -1)
+    fprintf(stderr, "Command failed: '%s': %s\n", argv[0], strerror(errno));
+  return pid;
+}
+
+/* *************************************************************************************************** */
+/*
+ * Starts one stage of a pipeline, without waiting for it. The stage
+ * reads from in_fd and writes to out_fd (-1 meaning the shell's own
+ * stdin/stdout), unless it has its own < or > redirection, which wins
+ * over the pipe. A builtin runs in a forked copy of the shell, so that
+ * it can run alongside the other stages.
+ *
+ * Parameters:
+ *   stage    The stage to start
+ *   in_fd    Where the stage reads from, or -1
+ *   out_fd   Where the stage writes to, or -1
+ *   status   If the stage could not be started, set to its status, as
+ *              in POSIX shells: 127 if the command was not found, and 1
+ *              for any other failure, such as a redirection
+ *
+ * Returns:
+ *   The pid of the child, or -1 if it could not be started
+ */
+static pid_t start_stage(command_t *stage, int in_fd, int out_fd, int *status)
+{
+  int file_in = -1;
+  int file_out = -1;
+  pid_t pid = -1;
+  const char *name = command_get_argv(stage)[0];
+  const char *path = NULL;
+  char **envp = NULL;
+  int expand_first, expand_end;
+
+  *status = 1;
+
+  // FINDING THE EXECUTABLE IN THE SHELL, SO AN UNKNOWN COMMAND COSTS NO CHILD
+  if (!is_builtin(name) && (path = pathcache_lookup(name)) == NULL)
+  {
+    if (errno == ENOENT)
+    {
+      fprintf(stderr, "Command not found: '%s'\n", name);
+      *status = 127;
+    }
+    else
+      fprintf(stderr, "Command failed: '%s': %s\n", name, strerror(errno));
+    return -1;
+  }
+
+  // THE ENVIRONMENT IS THE EXPORTED VARIABLES, ONLY REBUILT AFTER ONE
+  // CHANGES, PLUS THIS STAGE'S OWN NAME=value PREFIXES
+  if (path != NULL && (envp = vars_envp_with(command_get_assigns(stage))) == NULL)
+  {
+    fprintf(stderr, "Command failed: '%s': %s\n", name, strerror(ENOMEM));
+    return -1;
+  }
+
+  // OPENING THE INPUT AND OUTPUT FILES, IF GIVEN, THE OUTPUT FOR APPENDING,
+  // OR THE TEXT OF A HERE-DOCUMENT OR HERE-STRING AS THE INPUT
+  if (open_redirections(stage, &file_in, &file_out) == -1)
+    return -1;
+
+  if (file_in != -1)
+    in_fd = file_in;
+  if (file_out != -1)
+    out_fd = file_out;
+
+  if (path == NULL)
+  {
+    // RUNNING THE BUILTIN IN A CHILD, WHICH MUST NOT INHERIT UNFLUSHED OUTPUT
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+      int status = 1;
+      redir_t redir;
+      if (redir_apply(&redir, in_fd, out_fd) == 0)
+        status = run_builtin(find_builtin(name), stage);
+      fflush(stdout);
+      _exit(status);
+    }
+    if (pid == -1)
+      fprintf(stderr, "Command failed: '%s': %s\n", name, strerror(errno));
+  }
+  else if (command_get_expansion(stage, &expand_first, &expand_end)
+           && command_get_arg_bytes(stage) + argsplit_vector_bytes(envp) > argsplit_limit())
+  {
+    // AN EXPANSION TOO BIG FOR ONE EXEC IS SPLIT ACROSS SEVERAL RUNS
+    pid = start_split_stage(stage, path, envp, expand_first, expand_end, in_fd, out_fd);
+  }
+  else
+  {
+    // SPAWNING THE CHILD, WHICH KEEPS ITS OWN COPIES OF THE FILES
+    pid = spawn_process(path, command_get_argv(stage), envp, in_fd, out_fd);
+    if (pid == -1 && errno == ENOENT)
+    {
+      fprintf(stderr, "Command not found: '%s'\n", name);
+      *status = 127;
+    }
+    else if (pid == -1)
+      fprintf(stderr, "Command failed: '%s': %s\n", name, strerror(errno));
+  }
+
+  if (file_in != -1)
+    close(file_in);
+  if (file_out != -1)
+    close(file_out);
+
+  return pid;
+}
+
+/* *************************************************************************************************** */
+/*
+ * Process an external (non built-in) command, or a pipeline of
+ * commands joined with |. Every stage is started before any is waited
+ * for, with a pipe between each stage and the next, and then every
+ * stage is reaped. Redirection files are opened here in the shell, so
+ * a missing input file is reported without creating a child.
+ *
+ * The exit status of each stage is kept in the PIPESTATUS variable.
+ * A stage that could not be started has the status a POSIX shell
+ * gives it: 127 for a command that was not found, and 1 for any other
+ * failure, such as a redirection file that cannot be opened. A stage
+ * that was started but cannot be waited for has -1.
+ *
+ * A pipeline marked to run in the background (with a trailing &) is
+ * not waited for. Its first stage reads from /dev/null unless it has
+ * its own < redirection, so that it does not compete with the shell
+ * for the terminal.
+ *
+ * Parameters:
+ *   cmd       The command to run, which is the first stage of the pipeline
+ *
+ * Returns:
+ *   The exit value of the last stage. With "set -o pipefail", the exit value of the rightmost stage that
+ *   did not exit with 0 instead. A pipeline started in the background
+ *   returns 0 at once, and is added to the job table.
+ */
+int forkexec_external_cmd(command_t *cmd)
+{
+  int n_stages = 0;
+  for (command_t *stage = cmd; stage != NULL; stage = command_get_next(stage))
+    n_stages++;
+
+  // GROWING THE PER-STAGE ARRAYS, WHICH ARE KEPT BETWEEN COMMANDS
+  if (n_stages > stage_cap)
+  {
+    pid_t *pids = realloc(stage_pids, n_stages * sizeof(pid_t));
+    if (pids != NULL)
+      stage_pids = pids;
+    int *statuses = realloc(stage_status, n_stages * sizeof(int));
+    if (statuses != NULL)
+      stage_status = statuses;
+    if (pids == NULL || statuses == NULL)
+    {
+      fprintf(stderr, "Command failed: %s\n", strerror(ENOMEM));
+      return 1;
+    }
+    stage_cap = n_stages;
+  }
+
+  // FLUSHING OUR OWN OUTPUT, SO IT COMES BEFORE THE CHILDREN'S
+  fflush(stdout);
+
+  // STARTING EVERY STAGE, EACH READING FROM THE PIPE LEFT BY THE ONE BEFORE
+  int prev_read = -1;
+  bool background = command_is_background(cmd);
+  if (background && command_get_input(cmd) == NULL)
+    prev_read = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+  int i = 0;
+  for (command_t *stage = cmd; stage != NULL; stage = command_get_next(stage), i++)
+  {
+    int fds[2] = {-1, -1};
+    if (command_get_next(stage) != NULL && pipe2(fds, O_CLOEXEC) == -1)
+    {
+      fprintf(stderr, "Command failed: pipe: %s\n", strerror(errno));
+      for (; i < n_stages; i++)
+      {
+        stage_pids[i] = -1;
+        stage_status[i] = 1;
+      }
+      break;
+    }
+
+    stage_pids[i] = start_stage(stage, prev_read, fds[1], &stage_status[i]);
+
+    // THE SHELL KEEPS NO PIPE ENDS, SO EACH READER SEES EOF WHEN ITS WRITER EXITS
+    if (prev_read != -1)
+      close(prev_read);
+    if (fds[1] != -1)
+      close(fds[1]);
+    prev_read = fds[0];
+  }
+  if (prev_read != -1)
+    close(prev_read);
+
+  // A BACKGROUND PIPELINE IS REAPED LATER, THROUGH THE JOB TABLE
+  if (background)
+  {
+    int id = jobs_add(cmd, stage_pids, n_stages);
+    if (id != -1)
+    {
+      printf("[%d] %d\n", id, stage_pids[n_stages - 1]);
+      return 0;
+    }
+    fprintf(stderr, "Command failed: %s, waiting for it instead\n", strerror(ENOMEM));
+  }
+
+  // REAPING EVERY STAGE
+  for (i = 0; i < n_stages; i++)
+  {
+    int status;
+    pid_t pid;
+    if (stage_pids[i] == -1)
+      continue;
+
+    // A STAGE THAT CANNOT BE WAITED FOR HAS NO STATUS, AND GETS -1
+    while ((pid = waitpid(stage_pids[i], &status, 0)) == -1 && errno == EINTR)
+      ;
+    if (pid == -1)
+    {
+      stage_status[i] = -1;
+      continue;
+    }
+
+    // A STAGE KILLED BY A SIGNAL (SUCH AS SIGPIPE) REPORTS 128 + THE SIGNAL
+    if (WIFSIGNALED(status))
+      stage_status[i] = 128 + WTERMSIG(status);
+    else
+    {
+      stage_status[i] = WEXITSTATUS(status);
+
+      // IF THE CHILD PROCESS DID NOT EXIT SUCCESSFULLY, PRINT THE ERROR, ON stderr SO $(...) DOES NOT CAPTURE IT
+      if (stage_status[i] != 0)
+        fprintf(stderr, "Child %d exited with status %d \n", stage_pids[i], stage_status[i]);
+    }
+  }
+
+  return pipeline_status(stage_status, n_stages);
+}
+
+#ifdef RUN_TESTS
+// Tests one test case of the forkexec_external_cmd function
+bool test_forkexec_external_cmd_once(command_t *cmd, int expected)
+{
+  int actualForkExec = forkexec_external_cmd(cmd);
+  if (actualForkExec != expected)
+  {
+    printf("forkexec_external_cmd(%s) returned %d, expected %d  \n", command_get_argv(cmd)[0], actualForkExec, expected);
+    return false;
+  }
+
+  return true;
+}
+
+// Tests the forkexec_external_cmd function
+bool test_forkexec_external_cmd()
+{
+  int passed = 0;
+  command_t *cmd = command_new();
+  command_append_arg(cmd, "ls");
+  command_append_arg(cmd, "-l");
+  if (test_forkexec_external_cmd_once(cmd, 0))
+    passed++;
+
+  command_t *cmd1 = command_new();
+  command_append_arg(cmd1, "grep");
+  command_append_arg(cmd1, "pattern");
+  command_append_arg(cmd1, "notesists.txt");
+  if (test_forkexec_external_cmd_once(cmd1, 2))
+    passed++;
+
+  // A PIPELINE HAS THE STATUS OF ITS LAST STAGE, UNLESS pipefail IS SET
+  command_t *cmd2 = command_new();
+  command_append_arg(cmd2, "false");
+  command_append_arg(command_append_stage(cmd2), "true");
+  if (test_forkexec_external_cmd_once(cmd2, 0) && strcmp(vars_get("PIPESTATUS"), "1 0") == 0)
+    passed++;
+
+  pipefail = true;
+  if (test_forkexec_external_cmd_once(cmd2, 1))
+    passed++;
+  pipefail = false;
+
+  // EVERY STAGE RUNS, SO THE BUILTIN'S OUTPUT REACHES wc
+  command_t *cmd3 = command_new();
+  command_append_arg(cmd3, "pwd");
+  command_t *stage = command_append_stage(cmd3);
+  command_append_arg(stage, "wc");
+  command_append_arg(stage, "-l");
+  stage = command_append_stage(stage);
+  command_append_arg(stage, "grep");
+  command_append_arg(stage, "-q");
+  command_append_arg(stage, "1");
+  if (test_forkexec_external_cmd_once(cmd3, 0) && strcmp(vars_get("PIPESTATUS"), "0 0 0") == 0)
+    passed++;
+
+  // A STAGE THAT CANNOT START HAS 127 IF IT WAS NOT FOUND, AND 1 OTHERWISE
+  command_t *cmd4 = command_new();
+  command_append_arg(cmd4, "plaidsh_no_such_cmd");
+  if (test_forkexec_external_cmd_once(cmd4, 127) && strcmp(vars_get("PIPESTATUS"), "127") == 0)
+    passed++;
+
+  command_t *cmd5 = command_new();
+  command_append_arg(cmd5, "cat");
+  command_set_input(cmd5, "/does/not/exist/in");
+  command_append_arg(command_append_stage(cmd5), "true");
+  if (test_forkexec_external_cmd_once(cmd5, 0) && strcmp(vars_get("PIPESTATUS"), "1 0") == 0)
+    passed++;
+
+  command_free(cmd2);
+  command_free(cmd3);
+  command_free(cmd4);
+  command_free(cmd5);
+  return passed == 7;
+}
+
+// TESTS THE export FUNCTION, AND THAT ONLY EXPORTED VARIABLES REACH A COMMAND
+bool test_builtin_export()
+{
+  int passed = 0;
+  vars_unset("PLAIDSH_T5");
+  vars_set("PLAIDSH_T5", "5");
+
+  command_t *cmd = command_new();
+  command_append_arg(cmd, "sh");
+  command_append_arg(cmd, "-c");
+  command_append_arg(cmd, "exit ${PLAIDSH_T5:-0}");
+  if (forkexec_external_cmd(cmd) == 0)
+    passed++;
+
+  command_t *cmd1 = command_new();
+  command_append_arg(cmd1, "export");
+  command_append_arg(cmd1, "PLAIDSH_T5");
+  command_append_arg(cmd1, "PLAIDSH_T6=six");
+  if (call_builtin(builtin_export, cmd1) == 0 && forkexec_external_cmd(cmd) == 5 && strcmp(vars_get("PLAIDSH_T6"), "six") == 0)
+    passed++;
+
+  // A NAME=value PREFIX ONLY CHANGES THAT COMMAND'S ENVIRONMENT
+  command_append_assign(cmd, "PLAIDSH_T5=7", strlen("PLAIDSH_T5=7"));
+  if (forkexec_external_cmd(cmd) == 7 && strcmp(vars_get("PLAIDSH_T5"), "5") == 0 && getenv("PLAIDSH_T5") == NULL)
+    passed++;
+
+  command_t *cmd2 = command_new();
+  command_append_arg(cmd2, "export");
+  command_append_arg(cmd2, "=bad");
+  if (call_builtin(builtin_export, cmd2) == 1)
+    passed++;
+
+  command_free(cmd);
+  command_free(cmd1);
+  command_free(cmd2);
+  return passed == 4;
+}
+#endif // RUN_TESTS
+
+/* *************************************************************************************************** */
+/*
+ * Executes one parsed command line
+ *
+ * Parameters:
+ *   cmd      The command, which should have at least one argument, or
+ *              only NAME=value assignments to set shell variables
+ *
+ * Returns:
+ *   The status of the command
+ */
+int execute_command(command_t *cmd)
+{
+  int status = 1;
+
+  // IF THERE IS AT LEAST ONE ARGUMENT
+  if (command_get_argc(cmd) >= 1)
+  {
+
+    // A BUILTIN ON ITS OWN RUNS IN THE SHELL ITSELF, SO cd AND setenv STICK
+    if (command_get_next(cmd) != NULL || command_is_background(cmd) || !execute_builtin(cmd, &status))
+
+      // EXECUTING EXTERNAL COMMANDS (NOT BUILT-IN) AND PIPELINES
+      status = forkexec_external_cmd(cmd);
+  }
+
+  // ONLY NAME=value ASSIGNMENTS - SET SHELL VARIABLES, WHICH ARE NOT EXPORTED
+  else if (command_get_assignc(cmd) > 0)
+  {
+    status = 0;
+    for (int i = 0; i < command_get_assignc(cmd); i++)
+    {
+      if (assign_variable(command_get_assigns(cmd)[i], false) == -1)
+      {
+        fprintf(stderr, "%s: %s\n", command_get_assigns(cmd)[i], strerror(errno));
+        status = 1;
+      }
+    }
+  }
+
+  else
+    fprintf(stderr, "Error: Undefined variable \"  \"!\n");
+
+  return status;
+}
+
+#ifdef RUN_TESTS
+bool test_execute_command_once(command_t *cmd)
+{
+  execute_command(cmd);
+  return true;
+}
+
+static bool test_execute_command()
+{
+  int passed = 0;
+
+  // Test external command
+  command_t *cmd = command_new();
+  command_append_arg(cmd, "ls");
+  command_append_arg(cmd, "-l");
+  if (test_execute_command_once(cmd))
+    passed++;
+
+  // Test another external command
+  command_t *cmd1 = command_new();
+  command_append_arg(cmd1, "grep");
+  command_append_arg(cmd1, "pattern");
+  command_append_arg(cmd1, "file.txt");
+  if (test_execute_command_once(cmd1))
+    passed++;
+
+  // Test built-in command
+  command_t *cmd2 = command_new();
+  command_append_arg(cmd2, "author");
+  if (test_execute_command_once(cmd2))
+    passed++;
+
+  return passed == 3;
+}
+
+// TESTS THAT A BUILTIN RUN IN THE SHELL WRITES TO ITS > FILE, AND THAT
+// THE SHELL'S OWN STDOUT IS PUT BACK AFTERWARDS
+static bool test_builtin_redirection()
+{
+  int passed = 0;
+  char out_name[] = "/tmp/plaidsh_redir_XXXXXX";
+  char expected[PATH_MAX + 4];
+  char actual[PATH_MAX + 4] = "";
+  struct stat before, after;
+
+  int fd = mkstemp(out_name);
+  if (fd == -1)
+    return false;
+  close(fd);
+  fstat(STDOUT_FILENO, &before);
+
+  command_t *cmd = command_new();
+  command_append_arg(cmd, "pwd");
+  command_set_output(cmd, out_name);
+  if (execute_command(cmd) == 0)
+    passed++;
+
+  fstat(STDOUT_FILENO, &after);
+  if (after.st_dev == before.st_dev && after.st_ino == before.st_ino)
+    passed++;
+
+  // THE OUTPUT WENT TO THE FILE, AND NOWHERE ELSE
+  getcwd(expected, PATH_MAX);
+  strcat(expected, " \n");
+  FILE *fp = fopen(out_name, "r");
+  if (fp != NULL)
+  {
+    size_t n = fread(actual, 1, sizeof(actual) - 1, fp);
+    actual[n] = '\0';
+    fclose(fp);
+  }
+  if (strcmp(actual, expected) == 0)
+    passed++;
+  else
+    printf("pwd > file wrote '%s', expected '%s'\n", actual, expected);
+
+  // A FILE THAT CANNOT BE OPENED FAILS THE BUILTIN
+  command_t *cmd1 = command_new();
+  command_append_arg(cmd1, "author");
+  command_set_output(cmd1, "/does/not/exist/out");
+  if (execute_command(cmd1) == 1)
+    passed++;
+
+  command_free(cmd);
+  command_free(cmd1);
+  unlink(out_name);
+  return passed == 4;
+}
+#endif // RUN_TESTS
+
+/* *************************************************************************************************** */
+/*
+ * Executes a parsed command, unless it is empty, and frees it
+ *
+ * Returns:
+ *   The status of the command
+ */
+static int run_command(command_t *cmd)
+{
+  int status = 0;
+  if (!command_is_empty(cmd))
+  {
+    status = execute_command(cmd);
+    commands_run++;
+  }
+
+  command_free(cmd);
+  return status;
+}
+
+/*
+ * Gives cmd the bodies of its here-documents from buf, which holds
+ * the input after the command's line, reporting any error to stderr
+ *
+ * Parameters:
+ *   cmd      The command, which is freed on error
+ *   buf      The input after the command's line
+ *   len      The number of bytes in buf
+ *   final    If true, no more input follows buf
+ *   used     Set to the number of bytes of buf taken by the bodies
+ *
+ * Returns:
+ *   0 if cmd is ready to run, PARSE_MORE_INPUT if more input is needed
+ *   (cmd is kept), or -1 on error
+ */
+static int read_heredocs(command_t *cmd, const char *buf, size_t len, bool final, size_t *used)
+{
+  char err_msg[256];
+
+  int ret = parse_heredocs(cmd, buf, len, final, used, err_msg, sizeof(err_msg));
+  if (ret == -1)
+  {
+    fprintf(stderr, "Error: %s\n", err_msg);
+    command_free(cmd);
+  }
+  return ret;
+}
+
+/*
+ * Parses one input line and executes it, reporting any parse error
+ * to stderr. A here-document on the line gets an empty body.
+ *
+ * Parameters:
+ *   line     The input line, without its newline
+ *
+ * Returns:
+ *   The status of the command, or 1 if the line could not be parsed
+ */
+int run_line(const char *line)
+{
+  char err_msg[256];
+
+  command_t *cmd = parse_input(line, err_msg, sizeof(err_msg));
+  if (cmd == NULL)
+  {
+    fprintf(stderr, "Error: %s\n", err_msg);
+    return 1;
+  }
+
+  return run_command(cmd);
+}
+
+/*
+ * Reads the next line of buf into line_buf and parses it, skipping it
+ * if it is blank, a comment or cannot be parsed
+ *
+ * Parameters:
+ *   buf, len, final, seek_fd, seek_base   As for run_lines()
+ *   pos      The offset of the line in buf; moved past it and its
+ *              newline, and left as it is if buf holds no whole line
+ *
+ * Returns:
+ *   The parsed command, or NULL if there is none to run
+ */
+static command_t *next_command(const char *buf, size_t len, bool final, int seek_fd, off_t seek_base, size_t *pos)
+{
+  const char *nl = memchr(buf + *pos, '\n', len - *pos);
+  if (nl == NULL && !final)
+    return NULL;
+
+  size_t end = (nl != NULL) ? (size_t)(nl - buf) : len;
+  size_t line_len = end - *pos;
+
+  // GROWING THE LINE BUFFER TO HOLD THE LINE AND ITS NUL
+  if (line_len + 1 > line_cap)
+  {
+    size_t cap = line_cap ? line_cap : 256;
+    while (cap < line_len + 1)
+      cap *= 2;
+    char *p = realloc(line_buf, cap);
+    if (p == NULL)
+    {
+      fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+      exit(1);
+    }
+    line_buf = p;
+    line_cap = cap;
+  }
+  memcpy(line_buf, buf + *pos, line_len);
+  line_buf[line_len] = '\0';
+  *pos = (nl != NULL) ? end + 1 : end;
+
+  if (seek_fd != -1)
+    lseek(seek_fd, seek_base + *pos, SEEK_SET);
+
+  // SKIPPING BLANK LINES AND COMMENTS
+  const char *p = line_buf + strspn(line_buf, " \t\r");
+  if (*p == '\0' || *p == '#')
+    return NULL;
+
+  // COLLECTING BACKGROUND JOBS THAT HAVE FINISHED; THEY STAY IN THE
+  // TABLE, WITH THEIR STATUS, UNTIL WAITED FOR
+  jobs_reap();
+
+  char err_msg[256];
+  command_t *cmd = parse_input(line_buf, err_msg, sizeof(err_msg));
+  if (cmd == NULL)
+  {
+    fprintf(stderr, "Error: %s\n", err_msg);
+    last_status = 1;
+  }
+  return cmd;
+}
+
+/*
+ * Runs every complete line in buf, copying each into line_buf so that
+ * it can be handed to parse_input() as a string. Blank lines and lines
+ * starting with # (such as a #! line) are skipped.
+ *
+ * Parameters:
+ *   buf        The input, which need not be NUL-terminated
+ *   len        The number of bytes in buf
+ *   final      If true, the input ends with buf, so a last line without
+ *                a newline is run too
+ *   seek_fd    If not -1, the file offset of seek_fd is moved past each
+ *                line before it runs, so that a command reading the same
+ *                file starts after the line, and reading resumes from
+ *                wherever the command left the offset
+ *   seek_base  The file offset of buf[0] in seek_fd
+ *
+ * A command whose here-documents are not all in buf is kept, parsed, and
+ * its line is left unused; the next call, which is given that line
+ * again, skips it and reads the bodies for the kept command.
+ *
+ * Returns:
+ *   The number of bytes of buf that were used
+ */
+static size_t run_lines(const char *buf, size_t len, bool final, int seek_fd, off_t seek_base)
+{
+  size_t pos = 0;
+
+  while (pos < len || pending_cmd != NULL)
+  {
+    size_t line_start = pos;
+    command_t *cmd;
+
+    // A COMMAND KEPT FOR ITS HERE-DOCUMENTS PICKS UP AFTER ITS LINE,
+    // WITHOUT PARSING IT, OR RUNNING ITS SUBSTITUTIONS, AGAIN
+    if (pending_cmd != NULL)
+    {
+      cmd = pending_cmd;
+      pending_cmd = NULL;
+      pos += pending_line_len;
+    }
+    else if ((cmd = next_command(buf, len, final, seek_fd, seek_base, &pos)) == NULL)
+    {
+      if (pos == line_start)   // NO WHOLE LINE YET
+        break;
+      continue;
+    }
+
+    // A HERE-DOCUMENT'S BODY IS THE LINES AFTER ITS COMMAND, WHICH ARE
+    // SKIPPED EVEN IF IT CANNOT BE READ; A BODY NOT ALL IN buf YET IS
+    // READ ONCE THERE IS MORE INPUT, FOR THE COMMAND KEPT UNTIL THEN
+    size_t used;
+    int ret = read_heredocs(cmd, buf + pos, len - pos, final, &used);
+    if (ret == PARSE_MORE_INPUT)
+    {
+      pending_cmd = cmd;
+      pending_line_len = pos - line_start;
+      pos = line_start;
+      break;
+    }
+    pos += used;
+    if (seek_fd != -1 && used > 0)
+      lseek(seek_fd, seek_base + pos, SEEK_SET);
+
+    last_status = (ret == 0) ? run_command(cmd) : 1;
+
+    // CONTINUING FROM WHEREVER THE COMMAND LEFT THE SHARED FILE OFFSET
+    if (seek_fd != -1)
+    {
+      off_t now = lseek(seek_fd, 0, SEEK_CUR);
+      if (now >= seek_base + (off_t)pos && now <= seek_base + (off_t)len)
+        pos = now - seek_base;
+    }
+  }
+
+  return pos;
+}
+
+/* *************************************************************************************************** */
+/*
+ * Runs every line read from fd, without readline or history. A regular
+ * file is mapped into memory and scanned in place; anything else, such
+ * as a pipe, is read in large blocks.
+ *
+ * Parameters:
+ *   fd       The file to read commands from
+ *   is_stdin True if fd is the shell's stdin, which the commands share
+ *
+ * Returns:
+ *   The status of the last command
+ */
+int run_file(int fd, bool is_stdin)
+{
+  struct stat sb;
+
+  if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+  {
+    // AN EMPTY FILE CANNOT BE MAPPED, AND HAS NOTHING TO RUN
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start == -1)
+      start = 0;
+    if (sb.st_size <= start)
+      return last_status;
+
+    char *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      madvise(map, sb.st_size, MADV_SEQUENTIAL);
+      run_lines(map + start, sb.st_size - start, true, is_stdin ? fd : -1, start);
+      munmap(map, sb.st_size);
+      return last_status;
+    }
+  }
+
+  // READING IN BLOCKS, CARRYING ANY PARTIAL LINE OVER TO THE NEXT BLOCK
+  size_t cap = READ_BLOCK;
+  size_t len = 0;
+  char *buf = malloc(cap);
+  if (buf == NULL)
+  {
+    fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+    return 1;
+  }
+
+  while (1)
+  {
+    if (cap - len < READ_BLOCK / 2)
+    {
+      char *p = realloc(buf, cap * 2);
+      if (p == NULL)
+      {
+        fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+        break;
+      }
+      buf = p;
+      cap *= 2;
+    }
+
+    ssize_t n = read(fd, buf + len, cap - len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      fprintf(stderr, "Error: %s\n", strerror(errno));
+    if (n <= 0)
+    {
+      run_lines(buf, len, true, -1, 0);
+      break;
+    }
+
+    len += n;
+    size_t used = run_lines(buf, len, false, -1, 0);
+    memmove(buf, buf + used, len - used);
+    len -= used;
+  }
+
+  free(buf);
+  return last_status;
+}
+
+#ifdef RUN_TESTS
+// TESTS THAT run_lines() RUNS EVERY LINE, SKIPS COMMENTS, AND KEEPS A PARTIAL LINE FOR LATER
+bool test_run_lines()
+{
+  int passed = 0;
+  const char *script = "setenv PLAIDSH_T1 one\n\n  # setenv PLAIDSH_T1 comment\nsetenv PLAIDSH_T2 two\nsetenv PLAIDSH_T3 three";
+
+  vars_unset("PLAIDSH_T3");
+  size_t used = run_lines(script, strlen(script), false, -1, 0);
+  if (used == strlen(script) - strlen("setenv PLAIDSH_T3 three") && vars_get("PLAIDSH_T3") == NULL)
+    passed++;
+
+  if (strcmp(vars_get("PLAIDSH_T1"), "one") == 0 && strcmp(vars_get("PLAIDSH_T2"), "two") == 0)
+    passed++;
+
+  used = run_lines(script, strlen(script), true, -1, 0);
+  if (used == strlen(script) && vars_get("PLAIDSH_T3") != NULL && strcmp(vars_get("PLAIDSH_T3"), "three") == 0)
+    passed++;
+
+  return passed == 3;
+}
+
+// TESTS THAT A HERE-DOCUMENT'S BODY IS FED TO ITS COMMAND, NOT RUN, AND WAITED FOR IF INCOMPLETE
+bool test_run_lines_heredoc()
+{
+  int passed = 0;
+  char out_name[] = "/tmp/plaidsh_heredoc_XXXXXX";
+  char script[256];
+  char buf[64];
+
+  int fd = mkstemp(out_name);
+  if (fd == -1)
+    return false;
+  close(fd);
+  unlink(out_name);
+
+  snprintf(script, sizeof(script), "cat <<EOF >%s\nsetenv PLAIDSH_T6 body\nEOF\nsetenv PLAIDSH_T7 after\n", out_name);
+  vars_unset("PLAIDSH_T6");
+  vars_unset("PLAIDSH_T7");
+
+  // WITH THE BODY CUT SHORT, NOTHING RUNS YET
+  size_t used = run_lines(script, strlen(script) - strlen("EOF\nsetenv PLAIDSH_T7 after\n"), false, -1, 0);
+  if (used == 0 && access(out_name, F_OK) == -1)
+    passed++;
+
+  used = run_lines(script, strlen(script), false, -1, 0);
+  if (used == strlen(script) && vars_get("PLAIDSH_T6") == NULL && vars_get("PLAIDSH_T7") != NULL)
+    passed++;
+
+  fd = open(out_name, O_RDONLY);
+  ssize_t n = (fd == -1) ? -1 : read(fd, buf, sizeof(buf) - 1);
+  if (n == 23 && memcmp(buf, "setenv PLAIDSH_T6 body\n", 23) == 0)
+    passed++;
+  if (fd != -1)
+    close(fd);
+  unlink(out_name);
+
+  return passed == 3;
+}
+
+static const char *exit_note = NULL;   // WHERE note_exit() WRITES, IF ANYWHERE
+
+// AN atexit HANDLER THAT LEAVES A MARK IN exit_note
+static void note_exit()
+{
+  if (exit_note != NULL)
+  {
+    int fd = open(exit_note, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd != -1)
+    {
+      write(fd, "x", 1);
+      close(fd);
+    }
+  }
+}
+
+// TESTS THAT exit IN A PIPELINE STAGE OR IN $(...) LEAVES ONLY THE CHILD, WITHOUT THE SHELL'S atexit HANDLERS
+bool test_run_lines_child_exit()
+{
+  int passed = 0;
+  char note_name[] = "/tmp/plaidsh_exit_XXXXXX";
+  const char *script = "setenv PLAIDSH_T12 x$(exit)y\nexit | cat\n";
+  struct stat sb;
+
+  int fd = mkstemp(note_name);
+  if (fd == -1)
+    return false;
+  close(fd);
+
+  atexit(note_exit);
+  exit_note = note_name;
+  run_lines(script, strlen(script), true, -1, 0);
+  exit_note = NULL;
+
+  if (vars_get("PLAIDSH_T12") != NULL && strcmp(vars_get("PLAIDSH_T12"), "xy") == 0)
+    passed++;
+  if (stat(note_name, &sb) == 0 && sb.st_size == 0)
+    passed++;
+  unlink(note_name);
+
+  return passed == 2;
+}
+
+// TESTS THAT THE $(...) ON A HERE-DOCUMENT'S LINE RUNS ONCE, HOWEVER MANY READS ITS BODY TAKES
+bool test_run_lines_heredoc_subst()
+{
+  int passed = 0;
+  char count_name[] = "/tmp/plaidsh_subst_XXXXXX";
+  char script[256];
+  char buf[64];
+
+  int fd = mkstemp(count_name);
+  if (fd == -1)
+    return false;
+  close(fd);
+
+  snprintf(script, sizeof(script), "cat <<EOF >/dev/null$(/bin/sh -c \"echo x >> %s\")\nbody\nEOF\n", count_name);
+  size_t line_len = strchr(script, '\n') + 1 - script;
+
+  // THE LINE ALONE, THEN WITH PART OF THE BODY, THEN ALL OF IT
+  size_t used = run_lines(script, line_len, false, -1, 0);
+  if (used == 0)
+    passed++;
+  used = run_lines(script, line_len + strlen("body\n"), false, -1, 0);
+  if (used == 0)
+    passed++;
+  used = run_lines(script, strlen(script), false, -1, 0);
+  if (used == strlen(script))
+    passed++;
+
+  fd = open(count_name, O_RDONLY);
+  ssize_t n = (fd == -1) ? -1 : read(fd, buf, sizeof(buf));
+  if (n == 2 && memcmp(buf, "x\n", 2) == 0)
+    passed++;
+  if (fd != -1)
+    close(fd);
+  unlink(count_name);
+
+  return passed == 4;
+}
+
+// TESTS THAT $(...) RUNS ITS COMMAND IN A COPY OF THE SHELL, WHOSE BUILTINS DO NOT CHANGE THIS ONE
+bool test_run_lines_subst()
+{
+  int passed = 0;
+  const char *script = "setenv PLAIDSH_T8 \"[$(author | cat)]$(setenv PLAIDSH_T9 inner)\"\n"
+                       "setenv PLAIDSH_T10 $(echo a   b)$(/bin/echo -n $(echo nested))\n"
+                       "setenv PLAIDSH_T13 \"[$(grep -q x /dev/null)]\"\n";
+
+  vars_unset("PLAIDSH_T9");
+  run_lines(script, strlen(script), true, -1, 0);
+
+  // author IS A BUILTIN, AND ITS OUTPUT IS CAPTURED ALL THE SAME
+  if (vars_get("PLAIDSH_T8") != NULL && strcmp(vars_get("PLAIDSH_T8"), "[Niyomwungeri Parmenide ISHIMWE]") == 0)
+    passed++;
+  if (vars_get("PLAIDSH_T9") == NULL)
+    passed++;
+
+  // THE OUTPUT IS ONE WORD, NOT SPLIT AT ITS SPACES
+  if (vars_get("PLAIDSH_T10") != NULL && strcmp(vars_get("PLAIDSH_T10"), "a bnested") == 0)
+    passed++;
+
+  // A COMMAND THAT FAILS ADDS NOTHING, NOT EVEN THE SHELL'S NOTE OF ITS STATUS
+  if (vars_get("PLAIDSH_T13") != NULL && strcmp(vars_get("PLAIDSH_T13"), "[]") == 0)
+    passed++;
+
+  return passed == 4;
+}
+#endif // RUN_TESTS
+
+#ifndef RUN_TESTS
+static struct timespec start_time;   // WHEN THE SHELL STARTED, FOR THE -t FLAG
+
+/*
+ * Prints how many commands were run, and how quickly, for the -t flag
+ */
+static void print_stats()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double secs = (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9;
+
+  fprintf(stderr, "plaidsh: %lu commands in %.3f s (%.1f commands/sec)\n", commands_run, secs, secs > 0 ? commands_run / secs : 0.0);
+}
+
+#define PROMPT "#> "
+#define HEREDOC_PROMPT "> "      // WHILE A HERE-DOCUMENT'S BODY IS TYPED
+
+static command_t *heredoc_cmd = NULL;   // A COMMAND WAITING FOR ITS HERE-DOCUMENTS
+static char *heredoc_buf = NULL;        // THE LINES TYPED FOR THEM SO FAR
+static size_t heredoc_len = 0;
+static size_t heredoc_cap = 0;
+
+/*
+ * Adds a line typed for a here-document, and runs the command once
+ * every body is complete, or at EOF when final is set
+ */
+static void heredoc_line(const char *inp, bool final)
+{
+  size_t len = strlen(inp);
+  if (heredoc_len + len + 1 > heredoc_cap)
+  {
+    size_t cap = heredoc_cap ? heredoc_cap : 256;
+    while (cap < heredoc_len + len + 1)
+      cap *= 2;
+    char *p = realloc(heredoc_buf, cap);
+    if (p == NULL)
+    {
+      fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+      exit(1);
+    }
+    heredoc_buf = p;
+    heredoc_cap = cap;
+  }
+  if (!final)
+  {
+    memcpy(heredoc_buf + heredoc_len, inp, len);
+    heredoc_buf[heredoc_len + len] = '\n';
+    heredoc_len += len + 1;
+  }
+
+  size_t used;
+  int ret = read_heredocs(heredoc_cmd, heredoc_buf, heredoc_len, final, &used);
+  if (ret == PARSE_MORE_INPUT)
+    return;
+
+  command_t *cmd = heredoc_cmd;
+  heredoc_cmd = NULL;
+  heredoc_len = 0;
+  rl_set_prompt(PROMPT);
+  last_status = (ret == 0) ? run_command(cmd) : 1;
+}
+
+/* *************************************************************************************************** */
+/*
+ * Called by readline with each line the user enters, or NULL at EOF
+ */
+static void handle_line(char *inp)
+{
+  // IF NO INPUT, EXIT THE SHELL, AFTER RUNNING A COMMAND STILL WAITING
+  // FOR ITS HERE-DOCUMENT
+  if (inp == NULL)
+  {
+    if (heredoc_cmd != NULL)
+      heredoc_line("", true);
+    rl_callback_handler_remove();
+    exit(0);
+  }
+
+  // SAVING THE INPUT TO HISTORY
+  add_history(inp);
+
+  // A LINE OF A HERE-DOCUMENT'S BODY
+  if (heredoc_cmd != NULL)
+  {
+    heredoc_line(inp, false);
+    free(inp);
+    return;
+  }
+
+  // GETTING AND PARSING THE INPUT, EXECUTING THE COMMAND, UNLESS IT
+  // HAS A HERE-DOCUMENT, WHOSE BODY COMES ON THE NEXT LINES
+  char err_msg[256];
+  size_t used;
+  command_t *cmd = NULL;
+  if (*inp != '\0' && (cmd = parse_input(inp, err_msg, sizeof(err_msg))) == NULL)
+  {
+    fprintf(stderr, "Error: %s\n", err_msg);
+    last_status = 1;
+  }
+  free(inp);
+
+  if (cmd != NULL && read_heredocs(cmd, "", 0, false, &used) == PARSE_MORE_INPUT)
+  {
+    heredoc_cmd = cmd;
+    rl_set_prompt(HEREDOC_PROMPT);
+    return;
+  }
+  if (cmd != NULL)
+    last_status = run_command(cmd);
+
+  // REPORTING JOBS THAT FINISHED, JUST BEFORE THE NEXT PROMPT
+  jobs_reap();
+  fflush(stdout);
+  jobs_notify(stdout);
+}
+
+/*
+ * The main loop for the shell. Readline is driven a character at a
+ * time, so that the shell can wait for keystrokes and for background
+ * jobs to exit at once; finished jobs are reaped as soon as they exit,
+ * even while the user is typing.
+ */
+void mainloop()
+{
+  // PRINTING THE WELCOME MESSAGE AND PROMPT TO THE USER ON THE SCREEN
+  fprintf(stdout, "Welcome to Plaid Shell!\n");
+
+  // CONNECTING THE readline, read_word, AND parse_input IN A LOOP
+  struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {jobs_init(), POLLIN, 0}};
+  rl_callback_handler_install(PROMPT, handle_line);
+
+  while (1)
+  {
+    // A NEGATIVE fd (NO signalfd) IS IGNORED BY poll()
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      exit(1);
+    }
+
+    if (fds[1].revents & POLLIN)
+      jobs_reap();
+
+    // GETTING THE INPUT FROM THE USER
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+      rl_callback_read_char();
+  }
+}
+
+/* *************************************************************************************************** */
+/*
+ * Usage:
+ *   plaidsh [-t]               interactive, or reads commands from stdin if it is not a terminal
+ *   plaidsh [-t] script        runs the commands in script
+ *   plaidsh [-t] -c commands   runs the given commands
+ *
+ * -t prints the number of commands run, and commands/sec, on exit.
+ * In the non-interactive modes the exit status is that of the last command.
+ */
+int main(int argc, char *argv[])
+{
+  const char *commands = NULL;
+  int opt;
+
+  shell_pid = getpid();
+  while ((opt = getopt(argc, argv, "+c:t")) != -1)
+  {
+    if (opt == 'c')
+      commands = optarg;
+    else if (opt == 't')
+    {
+      clock_gettime(CLOCK_MONOTONIC, &start_time);
+      atexit(print_stats);
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [-t] [-c commands | script]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // SELECTING HOW EXTERNAL COMMANDS ARE STARTED: posix (DEFAULT), vfork OR fork
+  const char *backend = getenv("PLAIDSH_SPAWN");
+  if (backend != NULL)
+  {
+    if (spawn_backend_from_name(backend) == -1)
+      fprintf(stderr, "Unknown PLAIDSH_SPAWN '%s', using %s\n", backend, spawn_backend_name(spawn_get_backend()));
+    else
+      spawn_set_backend(spawn_backend_from_name(backend));
+  }
+
+  // FROM HERE ON, EXITED CHILDREN ARE ANNOUNCED THROUGH A signalfd
+  jobs_init();
+
+  // THE VARIABLE TABLE STARTS AS A COPY OF THE ENVIRONMENT
+  if (vars_init() == -1)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  // THE COMMAND OF A $(...) RUNS IN A COPY OF THE SHELL, AS IF TYPED
+  parse_set_subst_runner(run_line);
+
+  // RUNNING THE -c COMMANDS, WHICH MAY SPAN SEVERAL LINES
+  if (commands != NULL)
+  {
+    run_lines(commands, strlen(commands), true, -1, 0);
+    return last_status;
+  }
+
+  // RUNNING A SCRIPT FILE
+  if (optind < argc)
+  {
+    int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+      return 127;
+    }
+    run_file(fd, false);
+    close(fd);
+    return last_status;
+  }
+
+  // READING COMMANDS FROM A PIPE OR FILE ON STDIN
+  if (!isatty(STDIN_FILENO))
+    return run_file(STDIN_FILENO, true);
+
+  // ONLY A TERMINAL GETS readline, WHICH IS SET UP BY THE FIRST PROMPT
+  mainloop();
+  return 0;
+}
+#endif // RUN_TESTS
+
+
+
+/* *************************************************************************************************** */
+/*
+ * RUNS EVERY TEST IN THIS FILE. BUILT AS test_plaidsh BY make test,
+ * SO THAT THE SHELL ITSELF STARTS WITHOUT RUNNING THEM.
+ */
+#ifdef RUN_TESTS
+int main(int argc, char *argv[])
+{
+  shell_pid = getpid();
+  jobs_init();
+  if (vars_init() == -1)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  parse_set_subst_runner(run_line);
+
+  printf("RUNNING TESTS FOR BUILTIN FUNCTIONS - IN plaidsh.c\n\n");
+  int success = 1;
+
+  success &= test_builtin_author();
+  success &= test_builtin_cd();
+  success &= test_builtin_pwd();
   success &= test_builtin_setenv();
+  success &= test_builtin_export();
+  success &= test_builtin_set();
+  success &= test_builtin_parallel();
   success &= test_forkexec_external_cmd();
   success &= test_execute_command();
+  success &= test_builtin_redirection();
+  success &= test_run_lines();
+  success &= test_run_lines_heredoc();
+  success &= test_run_lines_subst();
+  success &= test_run_lines_heredoc_subst();
+  success &= test_run_lines_child_exit();
   success &= test_builtin_exit();
 
+  fflush(stdout);
   if (success)
-    printf("EXCELLENT WORK! ALL plaidsh.c TESTS SUCCEEDED!\n\n\n");
+    fprintf(stderr, "test_plaidsh: All tests succeeded!\n");
 
   else
-    printf("NOTE: FAILURES OCCURRED IN plaidsh.c\n\n\n");
+    fprintf(stderr, "test_plaidsh: FAILURES OCCURRED IN plaidsh.c\n");
 
-  mainloop();
-  return 0;
+  return success ? 0 : 1;
 }
+#endif // RUN_TESTS
@@ -0,0 +1,343 @@
+/*
+ * redir.c
+ *
+ * Redirection of the shell's own stdin and stdout at the file
+ * descriptor level, for builtins that run inside the shell
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE             // pipe2, memfd_create
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <fcntl.h>              // open
+#include <limits.h>             // PIPE_BUF
+#include <stdio.h>              // fflush
+#include <stdlib.h>             // mkstemp
+#include <string.h>             // strcmp
+#include <sys/mman.h>           // memfd_create
+#include <sys/stat.h>           // fstat
+#include <unistd.h>             // dup2
+
+#include "redir.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+
+#define SAVED_FD_MIN 10     // saved fds go above those a user might name
+
+
+/*
+ * Saves a copy of fd, then makes new_fd take its place
+ *
+ * Returns:
+ *   The copy, or -1 with errno set and fd unchanged
+ */
+static int save_and_replace(int fd, int new_fd)
+{
+  int saved = fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+  if (saved == -1)
+    return -1;
+
+  if (dup2(new_fd, fd) == -1) {
+    int dup_errno = errno;
+    close(saved);
+    errno = dup_errno;
+    return -1;
+  }
+  return saved;
+}
+
+
+/*
+ * Puts a saved copy back over fd, and closes the copy
+ */
+static void put_back(int fd, int saved)
+{
+  if (saved == -1)
+    return;
+  dup2(saved, fd);
+  close(saved);
+}
+
+
+/*
+ * Writes all of data to fd
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set
+ */
+static int write_all(int fd, const char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the redir calls.  All documentation is in the
+ * redir.h file.
+ *
+ **********************************************************************/
+
+int redir_open(const char *in_file, const char *out_file, int *in_fd, int *out_fd,
+               const char **failed)
+{
+  *in_fd = -1;
+  *out_fd = -1;
+
+  if (in_file && (*in_fd = open(in_file, O_RDONLY | O_CLOEXEC)) == -1) {
+    *failed = in_file;
+    return -1;
+  }
+
+  if (out_file && (*out_fd = open(out_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                  0666)) == -1) {
+    int open_errno = errno;
+    if (*in_fd != -1)
+      close(*in_fd);
+    *in_fd = -1;
+    *failed = out_file;
+    errno = open_errno;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int redir_open_data(const char *data, size_t len)
+{
+  int fd;
+
+  if (len <= PIPE_BUF) {
+    // the whole text fits in the pipe, so the write end can be closed
+    // before anyone reads
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+      return -1;
+    if (write_all(fds[1], data, len) == -1) {
+      int write_errno = errno;
+      close(fds[0]);
+      close(fds[1]);
+      errno = write_errno;
+      return -1;
+    }
+    close(fds[1]);
+    return fds[0];
+  }
+
+  if ((fd = memfd_create("plaidsh-heredoc", MFD_CLOEXEC)) == -1)
+    return -1;
+  if (write_all(fd, data, len) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+    int write_errno = errno;
+    close(fd);
+    errno = write_errno;
+    return -1;
+  }
+  return fd;
+}
+
+
+int redir_apply(redir_t *r, int in_fd, int out_fd)
+{
+  r->saved_in = -1;
+  r->saved_out = -1;
+
+  if (in_fd != -1 && (r->saved_in = save_and_replace(STDIN_FILENO, in_fd)) == -1)
+    return -1;
+
+  if (out_fd != -1) {
+    fflush(stdout);
+    if ((r->saved_out = save_and_replace(STDOUT_FILENO, out_fd)) == -1) {
+      int dup_errno = errno;
+      put_back(STDIN_FILENO, r->saved_in);
+      r->saved_in = -1;
+      errno = dup_errno;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+void redir_restore(redir_t *r)
+{
+  if (r->saved_out != -1) {
+    fflush(stdout);
+    clearerr(stdout);
+    put_back(STDOUT_FILENO, r->saved_out);
+  }
+  if (r->saved_in != -1) {
+    clearerr(stdin);
+    put_back(STDIN_FILENO, r->saved_in);
+  }
+  r->saved_in = -1;
+  r->saved_out = -1;
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+/*
+ * Returns the inode of the file open on fd
+ */
+static ino_t fd_inode(int fd)
+{
+  struct stat st;
+  assert( fstat(fd, &st) == 0 );
+  return st.st_ino;
+}
+
+void test_redir()
+{
+  char out_name[] = "/tmp/redir_out_XXXXXX";
+  char in_name[] = "/tmp/redir_in_XXXXXX";
+  char buf[64];
+  const char *failed = NULL;
+  int in_fd, out_fd;
+  redir_t r;
+
+  int fd = mkstemp(out_name);
+  assert( fd != -1 );
+  close(fd);
+  assert( (fd = mkstemp(in_name)) != -1 );
+  assert( write(fd, "from the file\n", 14) == 14 );
+  close(fd);
+
+  ino_t stdin_ino = fd_inode(STDIN_FILENO);
+  ino_t stdout_ino = fd_inode(STDOUT_FILENO);
+
+  // output appends to the file, and stdout comes back afterwards,
+  // even with something left in the stdio buffer beforehand
+  printf("to the old stdout ");
+  assert( redir_open(NULL, out_name, &in_fd, &out_fd, &failed) == 0 );
+  assert( in_fd == -1 && out_fd != -1 );
+  assert( fcntl(out_fd, F_GETFD) & FD_CLOEXEC );
+  assert( redir_apply(&r, in_fd, out_fd) == 0 );
+  close(out_fd);
+  assert( fd_inode(STDOUT_FILENO) != stdout_ino );
+  assert( r.saved_out >= SAVED_FD_MIN && (fcntl(r.saved_out, F_GETFD) & FD_CLOEXEC) );
+  printf("first\n");
+  redir_restore(&r);
+  assert( fd_inode(STDOUT_FILENO) == stdout_ino );
+  assert( r.saved_in == -1 && r.saved_out == -1 );
+  printf("back\n");
+
+  assert( redir_open(NULL, out_name, &in_fd, &out_fd, &failed) == 0 );
+  assert( redir_apply(&r, in_fd, out_fd) == 0 );
+  close(out_fd);
+  printf("second\n");
+  redir_restore(&r);
+
+  // input comes from the file
+  assert( redir_open(in_name, NULL, &in_fd, &out_fd, &failed) == 0 );
+  assert( in_fd != -1 && out_fd == -1 );
+  assert( redir_apply(&r, in_fd, out_fd) == 0 );
+  close(in_fd);
+  assert( read(STDIN_FILENO, buf, sizeof(buf)) == 14 );
+  assert( memcmp(buf, "from the file\n", 14) == 0 );
+  redir_restore(&r);
+  assert( fd_inode(STDIN_FILENO) == stdin_ino );
+
+  // the file was appended to, once per redirection
+  assert( (fd = open(out_name, O_RDONLY)) != -1 );
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  assert( n == 13 );
+  buf[n] = '\0';
+  assert( strcmp(buf, "first\nsecond\n") == 0 );
+
+  // a file that cannot be opened is named, and nothing is left open
+  errno = 0;
+  assert( redir_open("/does/not/exist", out_name, &in_fd, &out_fd, &failed) == -1 );
+  assert( errno == ENOENT && strcmp(failed, "/does/not/exist") == 0 );
+  assert( in_fd == -1 && out_fd == -1 );
+  assert( redir_open(in_name, "/does/not/exist/out", &in_fd, &out_fd, &failed) == -1 );
+  assert( strcmp(failed, "/does/not/exist/out") == 0 && in_fd == -1 );
+
+  // nothing to do
+  assert( redir_apply(&r, -1, -1) == 0 );
+  redir_restore(&r);
+  assert( fd_inode(STDOUT_FILENO) == stdout_ino );
+
+  unlink(out_name);
+  unlink(in_name);
+}
+
+
+/*
+ * Reads everything from fd, checking that it is text, and closes fd
+ */
+static void check_data_fd(int fd, const char *text, size_t len)
+{
+  char *buf = malloc(len + 1);
+  size_t got = 0;
+  ssize_t n;
+
+  assert( buf != NULL );
+  assert( fcntl(fd, F_GETFD) & FD_CLOEXEC );
+  while ((n = read(fd, buf + got, len + 1 - got)) > 0)
+    got += n;
+  assert( n == 0 && got == len );
+  assert( memcmp(buf, text, len) == 0 );
+  close(fd);
+  free(buf);
+}
+
+void test_redir_data()
+{
+  struct stat st;
+  int fd;
+
+  // short text goes through a pipe
+  assert( (fd = redir_open_data("hello\n", 6)) != -1 );
+  assert( fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) );
+  check_data_fd(fd, "hello\n", 6);
+
+  assert( (fd = redir_open_data("", 0)) != -1 );
+  check_data_fd(fd, "", 0);
+
+  // exactly as much as a pipe is sure to hold
+  char *text = malloc(1 << 20);
+  assert( text != NULL );
+  for (int i=0; i < (1 << 20); i++)
+    text[i] = 'a' + i % 26;
+  assert( (fd = redir_open_data(text, PIPE_BUF)) != -1 );
+  assert( fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) );
+  check_data_fd(fd, text, PIPE_BUF);
+
+  // anything longer goes into a memfd, read from the start
+  assert( (fd = redir_open_data(text, 1 << 20)) != -1 );
+  assert( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == (1 << 20) );
+  check_data_fd(fd, text, 1 << 20);
+
+  free(text);
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_redir();
+  test_redir_data();
+  fprintf(stderr, "test_redir: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
@@ -0,0 +1,86 @@
+/*
+ * redir.h
+ *
+ * Redirection of the shell's own stdin and stdout at the file
+ * descriptor level, for builtins that run inside the shell
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _REDIR_H_
+#define _REDIR_H_
+
+#include <stddef.h>
+
+/*
+ * What redir_apply() did, so that redir_restore() can undo it
+ */
+typedef struct {
+  int saved_in;       // the shell's own stdin while redirected, or -1
+  int saved_out;      // the shell's own stdout while redirected, or -1
+} redir_t;
+
+/*
+ * Opens the files of a command's < and > redirections, each once.
+ * The input is opened for reading, and the output for appending,
+ * created if needed. Both are opened with O_CLOEXEC, so a child
+ * keeps only what it is handed as its stdin or stdout.
+ *
+ * Parameters:
+ *   in_file    The file to read from, or NULL
+ *   out_file   The file to write to, or NULL
+ *   in_fd      Set to the open input, or -1 if there is none
+ *   out_fd     Set to the open output, or -1 if there is none
+ *   failed     On failure, set to the name of the file that could
+ *                not be opened
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set, in which case neither file
+ *   is left open
+ */
+int redir_open(const char *in_file, const char *out_file, int *in_fd, int *out_fd,
+               const char **failed);
+
+/*
+ * Opens the text of a here-document or here-string for reading, with
+ * no file on disk. Text of up to PIPE_BUF bytes is written into a
+ * pipe, which always has room for that much, so nothing waits for a
+ * reader; longer text goes into an anonymous memfd_create() file,
+ * which is then rewound. Either way the descriptor has O_CLOEXEC set,
+ * as with redir_open().
+ *
+ * Parameters:
+ *   data     The text
+ *   len      The number of bytes of text
+ *
+ * Returns:
+ *   The descriptor to read from, or -1 with errno set
+ */
+int redir_open_data(const char *data, size_t len);
+
+/*
+ * Makes in_fd the shell's stdin and out_fd its stdout, keeping
+ * close-on-exec copies of the originals to restore later. Buffered
+ * output is flushed first, so it goes where it was meant to. Nothing
+ * is reopened, so this works the same with or without a terminal.
+ *
+ * Parameters:
+ *   r        Filled in with what to restore
+ *   in_fd    The new stdin, or -1 to leave stdin alone
+ *   out_fd   The new stdout, or -1 to leave stdout alone
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set, in which case stdin and
+ *   stdout are as they were
+ */
+int redir_apply(redir_t *r, int in_fd, int out_fd);
+
+/*
+ * Puts back the stdin and stdout saved by redir_apply(), after
+ * flushing anything written to the redirected stdout.
+ *
+ * Parameters:
+ *   r        As filled in by redir_apply()
+ */
+void redir_restore(redir_t *r);
+
+#endif /* _REDIR_H_ */
@@ -0,0 +1,483 @@
+/*
+ * scan.c
+ *
+ * Finding the next byte the tokenizer has to look at, many bytes at a
+ * time
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "scan.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+//#define RUN_BENCH         // if defined, builds the scanning benchmark
+
+static const char *kernel_names[] = {
+  [SCAN_SCALAR] = "scalar",
+  [SCAN_SSE2] = "sse2",
+  [SCAN_AVX2] = "avx2",
+};
+
+// the bytes each span stops at, for the scalar kernel; the vector
+// kernels below must agree with this table
+static const bool is_stop[2][256] = {
+  [SCAN_WORD] = {
+    ['\0'] = true,
+    ['\t'] = true, ['\n'] = true, ['\v'] = true, ['\f'] = true, ['\r'] = true,
+    [' '] = true,
+    ['"'] = true, ['\\'] = true, ['$'] = true,
+    ['<'] = true, ['>'] = true, ['|'] = true, ['&'] = true,
+    ['*'] = true, ['?'] = true, ['['] = true, ['{'] = true,
+  },
+  [SCAN_QUOTED] = {
+    ['\0'] = true,
+    ['"'] = true, ['\\'] = true, ['$'] = true,
+  },
+};
+
+
+static size_t span_scalar(const char *s, scan_set_t set)
+{
+  const unsigned char *p = (const unsigned char *)s;
+  const bool *stop = is_stop[set];
+
+  while (!stop[*p])
+    p++;
+  return (const char *)p - s;
+}
+
+
+#ifdef SCAN_X86
+
+/*
+ * The vector kernels load aligned blocks, starting with the one that
+ * holds s, and ignore the bytes of the first block that come before
+ * s. An aligned block never straddles a page, and the block that holds
+ * the NUL is the last one read, so nothing past the end of the page of
+ * the NUL is touched. Those bytes are still outside the string, so
+ * AddressSanitizer is told not to check these loads.
+ */
+#define NO_ASAN __attribute__((no_sanitize_address))
+
+// one bit per byte of v that both sets stop at
+#define STOPS_COMMON(EQ, OR, v)                                     \
+  OR(OR(EQ(v, 0), EQ(v, '"')), OR(EQ(v, '\\'), EQ(v, '$')))
+
+#define SSE2_EQ(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+#define SSE2_OR(a, b) _mm_or_si128((a), (b))
+
+static inline __m128i stops_sse2(__m128i v, scan_set_t set)
+{
+  __m128i stops = STOPS_COMMON(SSE2_EQ, SSE2_OR, v);
+  if (set == SCAN_QUOTED)
+    return stops;
+
+  // \t \n \v \f \r are 9 to 13: (v - 9) is at most 4, unsigned
+  __m128i off = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i space = _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8(4)), off);
+  __m128i other = SSE2_OR(SSE2_OR(SSE2_EQ(v, ' '), SSE2_EQ(v, '<')),
+                          SSE2_OR(SSE2_EQ(v, '>'), SSE2_OR(SSE2_EQ(v, '|'), SSE2_EQ(v, '&'))));
+  __m128i glob = SSE2_OR(SSE2_OR(SSE2_EQ(v, '*'), SSE2_EQ(v, '?')),
+                         SSE2_OR(SSE2_EQ(v, '['), SSE2_EQ(v, '{')));
+  return SSE2_OR(SSE2_OR(stops, glob), SSE2_OR(space, other));
+}
+
+static inline __attribute__((always_inline)) NO_ASAN size_t span_sse2_set(const char *s, scan_set_t set)
+{
+  const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+  unsigned skip = s - p;
+  unsigned mask = _mm_movemask_epi8(stops_sse2(_mm_load_si128((const __m128i *)p), set));
+
+  mask = (mask >> skip) << skip;
+  while (mask == 0) {
+    p += 16;
+    mask = _mm_movemask_epi8(stops_sse2(_mm_load_si128((const __m128i *)p), set));
+  }
+  return p + __builtin_ctz(mask) - s;
+}
+
+static NO_ASAN size_t span_sse2(const char *s, scan_set_t set)
+{
+  // each set gets its own loop, with the set folded in
+  return set == SCAN_WORD ? span_sse2_set(s, SCAN_WORD) : span_sse2_set(s, SCAN_QUOTED);
+}
+
+
+/*
+ * AVX2 has a byte shuffle, so a byte can be classified by its two
+ * nibbles with two table lookups instead of one compare per stop byte.
+ * Each stop byte sets a bit in the table of its high nibble and the
+ * same bit in the table of its low nibble; a byte is a stop if the
+ * two entries it picks share a bit. Bytes with the top bit set pick
+ * a zero high-nibble entry.
+ *
+ *   bit   high nibble   low nibbles   bytes
+ *   0x01  0             0 9-d         NUL, \t \n \v \f \r
+ *   0x02  2             0 2 4 6 a     space " $ & *
+ *   0x04  3             c e f         < > ?
+ *   0x08  5             b c           [ backslash
+ *   0x10  7             b c           { |
+ */
+#define NIBBLE_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+static inline __attribute__((target("avx2"), always_inline))
+__m256i stops_avx2(__m256i v, scan_set_t set)
+{
+  __m256i lo_table, hi_table;
+
+  if (set == SCAN_WORD) {
+    lo_table = NIBBLE_TABLE(0x03, 0, 0x02, 0, 0x02, 0, 0x02, 0,
+                            0, 0x01, 0x03, 0x19, 0x1d, 0x01, 0x04, 0x04);
+    hi_table = NIBBLE_TABLE(0x01, 0, 0x02, 0x04, 0, 0x08, 0, 0x10,
+                            0, 0, 0, 0, 0, 0, 0, 0);
+  }
+  else {
+    // NUL, " $ and backslash only
+    lo_table = NIBBLE_TABLE(0x01, 0, 0x02, 0, 0x02, 0, 0, 0,
+                            0, 0, 0, 0, 0x08, 0, 0, 0);
+    hi_table = NIBBLE_TABLE(0x01, 0, 0x02, 0x04, 0, 0x08, 0, 0x10,
+                            0, 0, 0, 0, 0, 0, 0, 0);
+  }
+
+  __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble));
+  __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  __m256i hits = _mm256_and_si256(lo, hi);
+  return _mm256_xor_si256(_mm256_cmpeq_epi8(hits, _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+}
+
+static inline __attribute__((target("avx2"), always_inline)) NO_ASAN
+size_t span_avx2_set(const char *s, scan_set_t set)
+{
+  const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+  unsigned skip = s - p;
+  unsigned mask = _mm256_movemask_epi8(stops_avx2(_mm256_load_si256((const __m256i *)p), set));
+
+  mask = (mask >> skip) << skip;
+  while (mask == 0) {
+    p += 32;
+    mask = _mm256_movemask_epi8(stops_avx2(_mm256_load_si256((const __m256i *)p), set));
+  }
+  return p + __builtin_ctz(mask) - s;
+}
+
+static __attribute__((target("avx2"))) NO_ASAN size_t span_avx2(const char *s, scan_set_t set)
+{
+  return set == SCAN_WORD ? span_avx2_set(s, SCAN_WORD) : span_avx2_set(s, SCAN_QUOTED);
+}
+
+#endif   // SCAN_X86
+
+
+static size_t span_resolve(const char *s, scan_set_t set);
+
+static size_t (*const kernels[SCAN_N_KERNELS])(const char *, scan_set_t) = {
+  [SCAN_SCALAR] = span_scalar,
+#ifdef SCAN_X86
+  [SCAN_SSE2] = span_sse2,
+  [SCAN_AVX2] = span_avx2,
+#endif
+};
+
+// the first call picks the kernel, then replaces itself with it
+static size_t (*span_fn)(const char *, scan_set_t) = span_resolve;
+static scan_kernel_t current_kernel = SCAN_SCALAR;
+
+
+/*
+ * Returns true if this CPU can run a kernel
+ */
+static bool kernel_supported(scan_kernel_t kernel)
+{
+  if (kernel < 0 || kernel >= SCAN_N_KERNELS || kernels[kernel] == NULL)
+    return false;
+
+#ifdef SCAN_X86
+  if (kernel == SCAN_AVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return true;
+}
+
+
+/*
+ * Chooses the fastest kernel this CPU supports
+ */
+static void choose_kernel()
+{
+  current_kernel = SCAN_SCALAR;
+  for (int k = SCAN_N_KERNELS - 1; k > SCAN_SCALAR; k--) {
+    if (kernel_supported(k)) {
+      current_kernel = k;
+      break;
+    }
+  }
+  span_fn = kernels[current_kernel];
+}
+
+
+static size_t span_resolve(const char *s, scan_set_t set)
+{
+  choose_kernel();
+  return span_fn(s, set);
+}
+
+
+
+/**********************************************************************
+ *
+ * Implementations for the scan calls.  All documentation is in the
+ * scan.h file.
+ *
+ **********************************************************************/
+
+size_t scan_span(const char *s, scan_set_t set)
+{
+  return span_fn(s, set);
+}
+
+
+int scan_set_kernel(scan_kernel_t kernel)
+{
+  if (!kernel_supported(kernel)) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  current_kernel = kernel;
+  span_fn = kernels[kernel];
+  return 0;
+}
+
+
+scan_kernel_t scan_get_kernel()
+{
+  if (span_fn == span_resolve)
+    choose_kernel();
+  return current_kernel;
+}
+
+
+const char *scan_kernel_name(scan_kernel_t kernel)
+{
+  return kernel_names[kernel];
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Checks every supported kernel against the scalar one, for a span
+ * starting at each offset of s
+ */
+static void check_all_kernels(const char *s, scan_set_t set)
+{
+  size_t len = strlen(s);
+
+  for (size_t start = 0; start <= len; start++) {
+    size_t expected = span_scalar(s + start, set);
+    for (int k = 0; k < SCAN_N_KERNELS; k++) {
+      if (scan_set_kernel(k) == -1)
+        continue;
+      size_t actual = scan_span(s + start, set);
+      if (actual != expected) {
+        printf("%s kernel: span of '%s' at %zu is %zu, expected %zu\n",
+               kernel_names[k], s, start, actual, expected);
+        assert( actual == expected );
+      }
+    }
+  }
+}
+
+void test_scan()
+{
+  char buf[300];
+
+  // the scalar kernel is always there, and choosing is remembered
+  assert( scan_set_kernel(SCAN_SCALAR) == 0 );
+  assert( scan_get_kernel() == SCAN_SCALAR );
+  assert( strcmp(scan_kernel_name(SCAN_AVX2), "avx2") == 0 );
+  errno = 0;
+  assert( scan_set_kernel(SCAN_N_KERNELS) == -1 && errno == ENOTSUP );
+  assert( scan_get_kernel() == SCAN_SCALAR );
+
+  assert( scan_span("", SCAN_WORD) == 0 );
+  assert( scan_span("abc def", SCAN_WORD) == 3 );
+  assert( scan_span("abc def", SCAN_QUOTED) == 7 );
+  assert( scan_span("a<b>c|d", SCAN_QUOTED) == 7 );
+  assert( scan_span("a<b", SCAN_WORD) == 1 );
+  assert( scan_span("main.c", SCAN_WORD) == 6 );
+  assert( scan_span("*.c", SCAN_WORD) == 0 );
+  assert( scan_span("*.c", SCAN_QUOTED) == 3 );
+
+  // every stop byte, and its neighbours, at each position of a span
+  // longer than two blocks of the widest kernel
+  for (int c = 1; c < 256; c++) {
+    for (int at = 0; at < 70; at += 3) {
+      memset(buf, 'x', 80);
+      buf[80] = '\0';
+      buf[at] = c;
+      check_all_kernels(buf, SCAN_WORD);
+      check_all_kernels(buf, SCAN_QUOTED);
+    }
+  }
+
+  // high bytes, as in UTF-8, are never stops
+  memset(buf, 0xc3, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  check_all_kernels(buf, SCAN_WORD);
+
+  // a string that ends at the very end of a page, before one that
+  // cannot be read, is scanned without a fault
+  long page = sysconf(_SC_PAGESIZE);
+  char *pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert( pages != MAP_FAILED );
+  assert( mprotect(pages + page, page, PROT_NONE) == 0 );
+  for (int len = 0; len < 100; len++) {
+    char *s = pages + page - 1 - len;
+    memset(s, 'y', len);
+    s[len] = '\0';
+    check_all_kernels(s, SCAN_WORD);
+    check_all_kernels(s, SCAN_QUOTED);
+  }
+  munmap(pages, 2 * page);
+
+  // with no choice made, the best kernel is picked
+  for (int k = 0; k < SCAN_N_KERNELS; k++)
+    printf("%s: %s\n", kernel_names[k], kernel_supported(k) ? "supported" : "not supported");
+  choose_kernel();
+  assert( kernel_supported(scan_get_kernel()) );
+#ifdef SCAN_X86
+  assert( scan_get_kernel() != SCAN_SCALAR );
+#endif
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_scan();
+  fprintf(stderr, "test_scan: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
+
+
+
+/**********************************************************************
+ *
+ * Benchmark code below
+ *
+ **********************************************************************/
+#ifdef RUN_BENCH
+
+#include <time.h>
+
+#include "parser.h"
+
+#define BENCH_LINE_BYTES (256 * 1024)   // the size of each long line
+#define BENCH_BYTES (256 << 20)         // bytes scanned for each kernel
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Returns the MB/s at which read_word() gets through every word of line
+ */
+static double bench_read_word(const char *line, size_t len, char *word)
+{
+  int reps = BENCH_BYTES / len;
+
+  double start = now_ns();
+  for (int r = 0; r < reps; r++) {
+    const char *p = line;
+    int n;
+    while ((n = read_word(p, word, len + 1)) > 0 && *word != '\0')
+      p += n;
+    assert( n != -1 );
+  }
+  return (double)len * reps / ((now_ns() - start) / 1e9) / (1 << 20);
+}
+
+
+int main(int argc, char *argv[])
+{
+  char *lines[3];
+  const char *names[] = {
+    "include paths, 40B words",
+    "object files, 12B words",
+    "one quoted literal",
+  };
+  char *word = malloc(BENCH_LINE_BYTES + 1);
+  assert( word );
+
+  // lines as a build system emits them, almost all literal bytes
+  for (int l = 0; l < 3; l++) {
+    lines[l] = malloc(BENCH_LINE_BYTES + 64);
+    assert( lines[l] );
+  }
+
+  size_t len = 0;
+  for (int i = 0; len < BENCH_LINE_BYTES - 64; i++)
+    len += sprintf(lines[0] + len, "-I/usr/src/project/components/module%05d ", i);
+
+  len = 0;
+  for (int i = 0; len < BENCH_LINE_BYTES - 64; i++)
+    len += sprintf(lines[1] + len, "obj/f%05d.o ", i);
+
+  len = 0;
+  lines[2][len++] = '"';
+  while (len < BENCH_LINE_BYTES - 64)
+    len += sprintf(lines[2] + len, "--define=NAME_%zu/value with spaces, ", len);
+  lines[2][len++] = '"';
+  lines[2][len] = '\0';
+
+  printf("read_word() over %d KB lines, MB/s\n", BENCH_LINE_BYTES / 1024);
+  printf("%-28s", "");
+  for (int k = 0; k < SCAN_N_KERNELS; k++)
+    printf(" %10s", kernel_names[k]);
+  printf("\n");
+
+  for (int l = 0; l < 3; l++) {
+    printf("%-28s", names[l]);
+    for (int k = 0; k < SCAN_N_KERNELS; k++) {
+      if (scan_set_kernel(k) == -1)
+        printf(" %10s", "-");
+      else
+        printf(" %10.1f", bench_read_word(lines[l], strlen(lines[l]), word));
+    }
+    printf("\n");
+    free(lines[l]);
+  }
+
+  free(word);
+  return 0;
+}
+
+#endif   // RUN_BENCH
@@ -0,0 +1,80 @@
+/*
+ * scan.h
+ *
+ * Finding the next byte the tokenizer has to look at, many bytes at a
+ * time
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stddef.h>
+
+/*
+ * The ways a span can be found. All give the same answer; the vector
+ * kernels test 16 or 32 bytes per step instead of one.
+ */
+typedef enum {
+  SCAN_SCALAR,    // one byte at a time, through a table; works anywhere
+  SCAN_SSE2,      // 16 bytes at a time; any x86-64 CPU
+  SCAN_AVX2,      // 32 bytes at a time; x86-64 CPUs with AVX2
+} scan_kernel_t;
+
+#define SCAN_N_KERNELS 3
+
+/*
+ * The sets of bytes a span stops at. Both include NUL, " $ and
+ * backslash.
+ */
+typedef enum {
+  SCAN_WORD,      // in an unquoted word: also whitespace, < > | &, and
+                  //   the glob characters * ? [ {, which the tokenizer flags
+  SCAN_QUOTED,    // inside double quotes
+} scan_set_t;
+
+/*
+ * Returns the length of the longest prefix of s that holds no byte
+ * of the given set, that is, the offset of the first byte that is.
+ * s must be NUL-terminated. The vector kernels read whole aligned
+ * blocks, so they may read up to 31 bytes past the NUL, but never
+ * into another page.
+ *
+ * The kernel is the best the CPU supports, found on the first call,
+ * unless one has been chosen with scan_set_kernel().
+ *
+ * Parameters:
+ *   s        The string to scan
+ *   set      The bytes to stop at
+ *
+ * Returns:
+ *   The length of the span
+ */
+size_t scan_span(const char *s, scan_set_t set);
+
+/*
+ * Selects the kernel used by scan_span().
+ *
+ * Parameters:
+ *   kernel   The kernel to use from now on
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set to ENOTSUP if this CPU (or the
+ *   architecture the shell was built for) cannot run that kernel, in
+ *   which case the kernel in use is unchanged
+ */
+int scan_set_kernel(scan_kernel_t kernel);
+
+/*
+ * Returns:
+ *   The kernel used by scan_span(), choosing it first if needed
+ */
+scan_kernel_t scan_get_kernel();
+
+/*
+ * Returns:
+ *   The name of a kernel: "scalar", "sse2" or "avx2"
+ */
+const char *scan_kernel_name(scan_kernel_t kernel);
+
+#endif /* _SCAN_H_ */
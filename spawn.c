@@ -0,0 +1,424 @@
+/*
+ * spawn.c
+ *
+ * Launching of external commands as child processes
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE             // pipe2, execvpe
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <signal.h>             // sigprocmask
+#include <fcntl.h>              // O_CLOEXEC
+#include <spawn.h>              // posix_spawnp
+#include <stdio.h>              // printf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strcmp
+#include <sys/wait.h>           // waitpid
+#include <unistd.h>             // fork, vfork, dup2, execv
+
+#include "spawn.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+//#define RUN_BENCH         // if defined, builds the spawn latency benchmark
+
+extern char **environ;
+
+static spawn_backend_t current_backend = SPAWN_POSIX;
+
+static const char *backend_names[] = {
+  [SPAWN_POSIX] = "posix",
+  [SPAWN_VFORK] = "vfork",
+  [SPAWN_FORK] = "fork",
+};
+
+#define N_BACKENDS (sizeof(backend_names) / sizeof(backend_names[0]))
+
+
+/**********************************************************************
+ *
+ * Implementations for the spawn calls.  All documentation is in the
+ * spawn.h file.
+ *
+ **********************************************************************/
+
+void spawn_set_backend(spawn_backend_t backend)
+{
+  current_backend = backend;
+}
+
+
+spawn_backend_t spawn_get_backend()
+{
+  return current_backend;
+}
+
+
+int spawn_backend_from_name(const char *name)
+{
+  for (int i=0; i < N_BACKENDS; i++)
+    if (strcmp(name, backend_names[i]) == 0)
+      return i;
+
+  return -1;
+}
+
+
+const char *spawn_backend_name(spawn_backend_t backend)
+{
+  return backend_names[backend];
+}
+
+
+/*
+ * In a child, replaces the process image. Returns only on failure.
+ * The shell blocks some signals for itself (such as SIGCHLD, which it
+ * reads through a signalfd); the new program starts with none blocked.
+ */
+static void exec_argv(const char *path, char *const argv[], char *const envp[])
+{
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+
+  if (path)
+    execve(path, argv, envp);
+  else
+    execvpe(argv[0], argv, envp);
+}
+
+
+/*
+ * posix_spawn(): the redirections become file actions, which the
+ * library performs in the child between clone and exec. glibc reports
+ * a failed exec as the return value, so no child is left behind.
+ */
+static pid_t spawn_posix(const char *path, char *const argv[], char *const envp[],
+                         int in_fd, int out_fd)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t none;
+  pid_t pid;
+  int err;
+
+  // as in exec_argv(), the child starts with no signals blocked
+  sigemptyset(&none);
+  if ((err = posix_spawnattr_init(&attr)) != 0) {
+    errno = err;
+    return -1;
+  }
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setsigmask(&attr, &none);
+
+  if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+    posix_spawnattr_destroy(&attr);
+    errno = err;
+    return -1;
+  }
+
+  if (in_fd != -1)
+    err = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+  if (err == 0 && out_fd != -1)
+    err = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+  if (err == 0)
+    err = path ? posix_spawn(&pid, path, &actions, &attr, argv, envp)
+      : posix_spawnp(&pid, argv[0], &actions, &attr, argv, envp);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+
+/*
+ * vfork(): the parent is suspended until the child execs or exits,
+ * and the two share memory until then, so the child can hand back the
+ * errno of a failed exec through a plain variable.
+ */
+static pid_t spawn_vfork(const char *path, char *const argv[], char *const envp[],
+                         int in_fd, int out_fd)
+{
+  volatile int exec_errno = 0;
+
+  pid_t pid = vfork();
+  if (pid == 0) {
+    if ((in_fd == -1 || dup2(in_fd, STDIN_FILENO) != -1)
+        && (out_fd == -1 || dup2(out_fd, STDOUT_FILENO) != -1))
+      exec_argv(path, argv, envp);
+
+    exec_errno = errno;
+    _exit(127);
+  }
+
+  if (pid == -1)
+    return -1;
+
+  if (exec_errno != 0) {
+    waitpid(pid, NULL, 0);
+    errno = exec_errno;
+    return -1;
+  }
+  return pid;
+}
+
+
+/*
+ * fork(): the child gets a copy of the parent's memory, so a failed
+ * exec is reported back through a close-on-exec pipe, which reads
+ * as end-of-file once the exec succeeds.
+ */
+static pid_t spawn_fork(const char *path, char *const argv[], char *const envp[],
+                        int in_fd, int out_fd)
+{
+  int err_pipe[2];
+  if (pipe2(err_pipe, O_CLOEXEC) == -1)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(err_pipe[0]);
+    if ((in_fd == -1 || dup2(in_fd, STDIN_FILENO) != -1)
+        && (out_fd == -1 || dup2(out_fd, STDOUT_FILENO) != -1))
+      exec_argv(path, argv, envp);
+
+    int exec_errno = errno;
+    if (write(err_pipe[1], &exec_errno, sizeof(exec_errno)) < 0)
+      ;  // nothing more can be done in the child
+    _exit(127);
+  }
+
+  close(err_pipe[1]);
+  if (pid == -1) {
+    int fork_errno = errno;
+    close(err_pipe[0]);
+    errno = fork_errno;
+    return -1;
+  }
+
+  int exec_errno;
+  ssize_t n;
+  while ((n = read(err_pipe[0], &exec_errno, sizeof(exec_errno))) == -1 && errno == EINTR)
+    ;
+  close(err_pipe[0]);
+
+  if (n == sizeof(exec_errno)) {
+    waitpid(pid, NULL, 0);
+    errno = exec_errno;
+    return -1;
+  }
+  return pid;
+}
+
+
+pid_t spawn_process(const char *path, char *const argv[], char *const envp[],
+                    int in_fd, int out_fd)
+{
+  if (!argv || !argv[0]) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!envp)
+    envp = environ;
+
+  switch (current_backend) {
+  case SPAWN_VFORK:
+    return spawn_vfork(path, argv, envp, in_fd, out_fd);
+  case SPAWN_FORK:
+    return spawn_fork(path, argv, envp, in_fd, out_fd);
+  case SPAWN_POSIX:
+  default:
+    return spawn_posix(path, argv, envp, in_fd, out_fd);
+  }
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+/*
+ * Spawns argv and waits for it, returning its exit status, or -1 if
+ * it could not be started
+ */
+static int run(char *const argv[], int in_fd, int out_fd)
+{
+  int status;
+
+  pid_t pid = spawn_process(NULL, argv, NULL, in_fd, out_fd);
+  if (pid == -1)
+    return -1;
+
+  assert( waitpid(pid, &status, 0) == pid );
+  assert( WIFEXITED(status) );
+  return WEXITSTATUS(status);
+}
+
+void test_spawn(spawn_backend_t backend)
+{
+  char *true_argv[] = {"true", NULL};
+  char *false_argv[] = {"false", NULL};
+  char *missing_argv[] = {"/does/not/exist", NULL};
+  char *echo_argv[] = {"echo", "hello", NULL};
+  char *cat_argv[] = {"cat", NULL};
+  char buf[64];
+  int fds[2], fds2[2];
+
+  spawn_set_backend(backend);
+  assert( spawn_get_backend() == backend );
+  assert( spawn_backend_from_name(spawn_backend_name(backend)) == backend );
+
+  assert( run(true_argv, -1, -1) == 0 );
+  assert( run(false_argv, -1, -1) == 1 );
+
+  // an explicit path skips the PATH search
+  int status;
+  pid_t pid = spawn_process("/bin/true", false_argv, NULL, -1, -1);
+  assert( pid > 0 && waitpid(pid, &status, 0) == pid );
+  assert( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+
+  // a missing command is reported without leaving a child behind
+  errno = 0;
+  assert( run(missing_argv, -1, -1) == -1 );
+  assert( errno == ENOENT );
+  assert( waitpid(-1, NULL, WNOHANG) == -1 && errno == ECHILD );
+
+  // stdout to a pipe
+  assert( pipe2(fds, O_CLOEXEC) == 0 );
+  assert( run(echo_argv, -1, fds[1]) == 0 );
+  close(fds[1]);
+  assert( read(fds[0], buf, sizeof(buf)) == 6 );
+  assert( strncmp(buf, "hello\n", 6) == 0 );
+  close(fds[0]);
+
+  // a signal blocked in the shell is not blocked in the child, whose
+  // "kill -s USR1 $$" would otherwise leave it running
+  sigset_t usr1, old_mask;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &usr1, &old_mask);
+  char *kill_argv[] = {"sh", "-c", "kill -s USR1 $$; exit 3", NULL};
+  pid = spawn_process(NULL, kill_argv, NULL, -1, -1);
+  assert( pid > 0 && waitpid(pid, &status, 0) == pid );
+  assert( WIFSIGNALED(status) && WTERMSIG(status) == SIGUSR1 );
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  // the child gets the environment it is given, rather than the shell's
+  char *env_argv[] = {"sh", "-c", "test \"$PLAIDSH_SPAWN_VAR\" = given", NULL};
+  char *envp[] = {"PLAIDSH_SPAWN_VAR=given", NULL};
+  assert( (pid = spawn_process("/bin/sh", env_argv, envp, -1, -1)) > 0 );
+  assert( waitpid(pid, &status, 0) == pid && WEXITSTATUS(status) == 0 );
+  assert( (pid = spawn_process(NULL, env_argv, envp, -1, -1)) > 0 );
+  assert( waitpid(pid, &status, 0) == pid && WEXITSTATUS(status) == 0 );
+  assert( (pid = spawn_process(NULL, env_argv, NULL, -1, -1)) > 0 );
+  assert( waitpid(pid, &status, 0) == pid && WEXITSTATUS(status) == 1 );
+
+  // stdin and stdout both redirected
+  assert( pipe2(fds, O_CLOEXEC) == 0 );
+  assert( pipe2(fds2, O_CLOEXEC) == 0 );
+  assert( write(fds[1], "data", 4) == 4 );
+  close(fds[1]);
+  assert( run(cat_argv, fds[0], fds2[1]) == 0 );
+  close(fds[0]);
+  close(fds2[1]);
+  assert( read(fds2[0], buf, sizeof(buf)) == 4 );
+  assert( strncmp(buf, "data", 4) == 0 );
+  close(fds2[0]);
+}
+
+
+int main(int argc, char *argv[])
+{
+  assert( spawn_backend_from_name("bogus") == -1 );
+
+  for (int i=0; i < N_BACKENDS; i++)
+    test_spawn(i);
+
+  fprintf(stderr, "test_spawn: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
+
+
+
+/**********************************************************************
+ *
+ * Benchmark code below
+ *
+ **********************************************************************/
+#ifdef RUN_BENCH
+
+#include <time.h>
+
+#define BENCH_SPAWNS 500
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Returns the average time in microseconds to spawn /bin/true with
+ * the current backend and wait for it to exit
+ */
+static double bench_spawn()
+{
+  char *argv[] = {"/bin/true", NULL};
+
+  double start = now_ns();
+  for (int i=0; i < BENCH_SPAWNS; i++) {
+    pid_t pid = spawn_process(argv[0], argv, NULL, -1, -1);
+    assert( pid > 0 );
+    waitpid(pid, NULL, 0);
+  }
+  return (now_ns() - start) / BENCH_SPAWNS / 1000;
+}
+
+
+int main(int argc, char *argv[])
+{
+  // fork() cost grows with the size of the parent, so each backend is
+  // measured again after the heap has been grown and touched
+  size_t heap_mb[] = {0, 64, 256};
+
+  printf("%10s", "heap MB");
+  for (int b=0; b < N_BACKENDS; b++)
+    printf(" %10s us", backend_names[b]);
+  printf("\n");
+
+  for (int h=0; h < sizeof(heap_mb) / sizeof(heap_mb[0]); h++) {
+    char *ballast = NULL;
+    if (heap_mb[h] > 0) {
+      ballast = malloc(heap_mb[h] << 20);
+      assert( ballast );
+      memset(ballast, 1, heap_mb[h] << 20);
+    }
+
+    printf("%10zu", heap_mb[h]);
+    for (int b=0; b < N_BACKENDS; b++) {
+      spawn_set_backend(b);
+      printf(" %13.1f", bench_spawn());
+    }
+    printf("\n");
+
+    free(ballast);
+  }
+
+  return 0;
+}
+
+#endif   // RUN_BENCH
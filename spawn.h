@@ -0,0 +1,79 @@
+/*
+ * spawn.h
+ * 
+ * Launching of external commands as child processes
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+#include <sys/types.h>
+
+/*
+ * The ways a child process can be created. They differ only in cost:
+ * fork() copies the page tables of the whole shell, including the
+ * readline history, while vfork() and posix_spawn() borrow the
+ * shell's memory until the child execs.
+ */
+typedef enum {
+  SPAWN_POSIX,    // posix_spawn(); the default
+  SPAWN_VFORK,    // vfork(), then redirect and exec in the child
+  SPAWN_FORK,     // fork(), then redirect and exec in the child
+} spawn_backend_t;
+
+/*
+ * Select the backend used by spawn_process(). 
+ *
+ * Parameters:
+ *   backend   The backend to use from now on
+ */
+void spawn_set_backend(spawn_backend_t backend);
+
+/*
+ * Returns: The backend currently used by spawn_process()
+ */
+spawn_backend_t spawn_get_backend();
+
+/*
+ * Translate between backends and their names, which are "posix",
+ * "vfork" and "fork".
+ *
+ * Returns:
+ *   spawn_backend_from_name() returns the backend, or -1 if the name
+ *   is not recognized. spawn_backend_name() returns the name.
+ */
+int spawn_backend_from_name(const char *name);
+const char *spawn_backend_name(spawn_backend_t backend);
+
+/*
+ * Starts a child process running an executable, with its stdin and
+ * stdout optionally replaced. The caller is responsible for waiting
+ * for the child.
+ *
+ * Redirection files should be opened by the caller with O_CLOEXEC,
+ * so that the only copies the child keeps are its stdin and stdout.
+ * The child starts with no signals blocked, whatever the shell's
+ * signal mask.
+ *
+ * Parameters:
+ *   path      The path of the executable, as from pathcache_lookup(),
+ *               or NULL to search PATH for argv[0]
+ *   argv      The NULL-terminated argument vector
+ *   envp      The NULL-terminated environment of the child, as
+ *               "NAME=value" strings, or NULL for the shell's environ
+ *   in_fd     File descriptor to become the child's stdin, or -1 to
+ *               inherit the shell's stdin
+ *   out_fd    File descriptor to become the child's stdout, or -1 to
+ *               inherit the shell's stdout
+ *
+ * Returns:
+ *   The pid of the child on success. If the child could not be
+ *   created or argv[0] could not be executed, returns -1 and sets
+ *   errno; in particular, errno is ENOENT if the command was not
+ *   found. No child is left behind in that case.
+ */
+pid_t spawn_process(const char *path, char *const argv[], char *const envp[],
+                    int in_fd, int out_fd);
+
+#endif /* _SPAWN_H_ */
@@ -0,0 +1,372 @@
+/*
+ * subst.c
+ *
+ * Capturing the output of a command, for $(...) substitution
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE             // pipe2, F_SETPIPE_SZ
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <fcntl.h>              // fcntl
+#include <stdbool.h>            // bool
+#include <stdio.h>              // fflush
+#include <stdlib.h>             // realloc
+#include <string.h>             // strcmp
+#include <sys/wait.h>           // waitpid
+#include <unistd.h>             // fork, read
+
+#include "subst.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+//#define RUN_BENCH         // if defined, builds the substitution benchmark
+
+
+/*
+ * Makes sure out has at least SUBST_READ_MIN bytes free, plus one for
+ * the NUL, doubling it if not
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set to ENOMEM
+ */
+static int make_room(subst_buf_t *out)
+{
+  if (out->cap - out->len > SUBST_READ_MIN)
+    return 0;
+
+  size_t cap = out->cap ? out->cap : SUBST_READ_MIN;
+  while (cap - out->len <= SUBST_READ_MIN)
+    cap *= 2;
+
+  char *buf = realloc(out->buf, cap);
+  if (!buf) {
+    errno = ENOMEM;
+    return -1;
+  }
+  out->buf = buf;
+  out->cap = cap;
+  return 0;
+}
+
+
+/*
+ * Reads everything from fd into out, until EOF
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set
+ */
+static int read_all(int fd, subst_buf_t *out)
+{
+  bool grown = false;
+
+  while (1) {
+    if (make_room(out) == -1)
+      return -1;
+
+    ssize_t n = read(fd, out->buf + out->len, out->cap - out->len - 1);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+    if (n == 0)
+      return 0;
+    out->len += n;
+
+    // a read that emptied a full pipe means the writer is producing
+    // faster than it is read; a bigger pipe lets it run on for longer.
+    // A failure (such as a lower pipe-max-size) is harmless
+    if (!grown && n >= fcntl(fd, F_GETPIPE_SZ)) {
+      fcntl(fd, F_SETPIPE_SZ, SUBST_PIPE_SIZE);
+      grown = true;
+    }
+  }
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the subst calls.  All documentation is in the
+ * subst.h file.
+ *
+ **********************************************************************/
+
+int subst_capture(const char *line, int (*run)(const char *line), subst_buf_t *out)
+{
+  int fds[2];
+
+  out->len = 0;
+  if (make_room(out) == -1)
+    return -1;
+  out->buf[0] = '\0';
+
+  if (pipe2(fds, O_CLOEXEC) == -1)
+    return -1;
+
+  // the child must not write out what the shell has buffered
+  fflush(stdout);
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    int fork_errno = errno;
+    close(fds[0]);
+    close(fds[1]);
+    errno = fork_errno;
+    return -1;
+  }
+
+  if (pid == 0) {
+    // dup2() clears close-on-exec, so the commands run by line inherit
+    // only this copy of the write end
+    if (dup2(fds[1], STDOUT_FILENO) == -1)
+      _exit(126);
+    int status = run(line);
+    fflush(stdout);
+    _exit(status);
+  }
+
+  // the child holds the only write end, so EOF comes when it and
+  // everything it started are done
+  close(fds[1]);
+  int read_ret = read_all(fds[0], out);
+  int read_errno = errno;
+  close(fds[0]);
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1)
+    if (errno != EINTR)
+      return -1;
+
+  while (out->len > 0 && out->buf[out->len - 1] == '\n')
+    out->len--;
+  out->buf[out->len] = '\0';
+
+  if (read_ret == -1) {
+    errno = read_errno;
+    return -1;
+  }
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+
+void subst_buf_free(subst_buf_t *out)
+{
+  free(out->buf);
+  out->buf = NULL;
+  out->len = 0;
+  out->cap = 0;
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+// runs line as a /bin/sh command
+static int run_sh(const char *line)
+{
+  execl("/bin/sh", "sh", "-c", line, (char *)NULL);
+  return 127;
+}
+
+// writes line itself, without a shell
+static int run_echo(const char *line)
+{
+  printf("%s", line);
+  return 3;
+}
+
+void test_subst()
+{
+  subst_buf_t out = SUBST_BUF_INIT;
+
+  // trailing newlines are removed, others kept
+  assert( subst_capture("printf 'a\\n\\nb\\n\\n\\n'", run_sh, &out) == 0 );
+  assert( strcmp(out.buf, "a\n\nb") == 0 && out.len == 4 );
+
+  // no output at all
+  assert( subst_capture("true", run_sh, &out) == 0 );
+  assert( strcmp(out.buf, "") == 0 && out.len == 0 );
+  assert( subst_capture("printf '\\n\\n'", run_sh, &out) == 0 );
+  assert( out.len == 0 );
+
+  // the status is passed back, output or not
+  assert( subst_capture("echo x; exit 7", run_sh, &out) == 7 );
+  assert( strcmp(out.buf, "x") == 0 );
+  assert( subst_capture("kill -TERM $$", run_sh, &out) == 128 + 15 );
+
+  // the runner is called in the child, and what it buffered with
+  // stdio is flushed before the child exits
+  assert( subst_capture("from the child\n", run_echo, &out) == 3 );
+  assert( strcmp(out.buf, "from the child") == 0 );
+
+  // stderr is not captured
+  assert( subst_capture("exec 2>/dev/null; echo out; echo err >&2", run_sh, &out) == 0 );
+  assert( strcmp(out.buf, "out") == 0 );
+
+  // output far larger than a pipe, and than the first buffer, arrives
+  // whole; the buffer is reused, so it does not shrink afterwards
+  assert( subst_capture("head -c 5000000 /dev/zero | tr '\\0' x", run_sh, &out) == 0 );
+  assert( out.len == 5000000 && out.cap > 5000000 );
+  for (size_t i=0; i < out.len; i++)
+    assert( out.buf[i] == 'x' );
+  assert( out.buf[out.len] == '\0' );
+
+  size_t cap = out.cap;
+  assert( subst_capture("echo small", run_sh, &out) == 0 );
+  assert( strcmp(out.buf, "small") == 0 && out.cap == cap );
+
+  subst_buf_free(&out);
+  assert( out.buf == NULL && out.cap == 0 );
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_subst();
+  fprintf(stderr, "test_subst: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
+
+
+
+/**********************************************************************
+ *
+ * Benchmark code below
+ *
+ **********************************************************************/
+#ifdef RUN_BENCH
+
+#include <sys/stat.h>           // fstat
+#include <time.h>               // clock_gettime
+
+#define BENCH_BYTES_PER_SIZE (256UL << 20)   // output produced per row
+#define BENCH_MAX_RUNS 2000                  // captures per row, at most
+
+static char *bench_data;        // what the command writes
+static size_t bench_len;        // how much of it
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * The command being captured: writes bench_len bytes to stdout, in
+ * the same process, so that only the cost of getting the bytes back
+ * is measured
+ */
+static int produce(const char *line)
+{
+  size_t done = 0;
+  while (done < bench_len) {
+    ssize_t n = write(STDOUT_FILENO, bench_data + done, bench_len - done);
+    if (n <= 0)
+      return 1;
+    done += n;
+  }
+  return 0;
+}
+
+/*
+ * What a script without $(...) does: runs the command with its stdout
+ * redirected to a file, waits for it, then reads the file back and
+ * removes it
+ */
+static int capture_by_file(const char *path, subst_buf_t *out)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  assert( fd != -1 );
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(fd, STDOUT_FILENO);
+    _exit(produce(NULL));
+  }
+  close(fd);
+  int status;
+  waitpid(pid, &status, 0);
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  assert( fd != -1 );
+  struct stat st;
+  fstat(fd, &st);
+  if (out->cap < (size_t)st.st_size + 1) {
+    out->cap = st.st_size + 1;
+    out->buf = realloc(out->buf, out->cap);
+    assert( out->buf );
+  }
+  out->len = 0;
+  ssize_t n;
+  while ((n = read(fd, out->buf + out->len, out->cap - out->len - 1)) > 0)
+    out->len += n;
+  out->buf[out->len] = '\0';
+  close(fd);
+  unlink(path);
+
+  return WEXITSTATUS(status);
+}
+
+
+int main(int argc, char *argv[])
+{
+  size_t sizes[] = {0, 100, 4096, 65536, 1 << 20, 16 << 20, 128 << 20};
+  const char *dir = argc > 1 ? argv[1] : "/tmp";
+  char path[4096];
+  subst_buf_t out = SUBST_BUF_INIT;
+
+  snprintf(path, sizeof(path), "%s/bench_subst.%d", dir, (int)getpid());
+
+  printf("capturing output through $(...) against a file in %s\n", dir);
+  printf("%12s %8s %12s %12s %12s %12s %8s\n", "bytes", "runs",
+         "pipe us", "file us", "pipe MB/s", "file MB/s", "speedup");
+
+  for (int s=0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    // each row has only its own data mapped, so that fork() costs what
+    // it would in the shell
+    bench_len = sizes[s];
+    bench_data = malloc(bench_len + 1);
+    assert( bench_data );
+    memset(bench_data, 'x', bench_len);
+    int runs = bench_len ? BENCH_BYTES_PER_SIZE / bench_len : BENCH_MAX_RUNS;
+    if (runs > BENCH_MAX_RUNS)
+      runs = BENCH_MAX_RUNS;
+    if (runs < 3)
+      runs = 3;
+
+    double start = now_ns();
+    for (int r=0; r < runs; r++) {
+      assert( subst_capture(NULL, produce, &out) == 0 );
+      assert( out.len == bench_len );
+    }
+    double pipe_us = (now_ns() - start) / runs / 1000;
+
+    start = now_ns();
+    for (int r=0; r < runs; r++) {
+      assert( capture_by_file(path, &out) == 0 );
+      assert( out.len == bench_len );
+    }
+    double file_us = (now_ns() - start) / runs / 1000;
+
+    printf("%12zu %8d %12.1f %12.1f %12.1f %12.1f %7.2fx\n", bench_len, runs,
+           pipe_us, file_us, bench_len / pipe_us, bench_len / file_us, file_us / pipe_us);
+    free(bench_data);
+  }
+
+  subst_buf_free(&out);
+  return 0;
+}
+
+#endif   // RUN_BENCH
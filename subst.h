@@ -0,0 +1,60 @@
+/*
+ * subst.h
+ *
+ * Capturing the output of a command, for $(...) substitution
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SUBST_H_
+#define _SUBST_H_
+
+#include <stddef.h>
+
+#define SUBST_READ_MIN (64 * 1024)      // the smallest read asked for
+#define SUBST_PIPE_SIZE (1024 * 1024)   // a pipe that fills is grown to this
+
+/*
+ * The output of a command, in a buffer that is kept and reused from
+ * one capture to the next
+ */
+typedef struct {
+  char *buf;          // the output, NUL-terminated; NULL before the
+                      //   first capture
+  size_t len;         // bytes of output, without trailing newlines
+  size_t cap;         // bytes allocated
+} subst_buf_t;
+
+#define SUBST_BUF_INIT {NULL, 0, 0}
+
+/*
+ * Runs a command line in a forked copy of the shell whose stdout is a
+ * pipe, and reads all it writes into out. Reads are never smaller than
+ * SUBST_READ_MIN bytes: the buffer starts at twice that and doubles
+ * whenever less is free, and once the command fills a whole pipe, the
+ * pipe itself is enlarged so that it is stopped less often. Trailing
+ * newlines are removed, as a shell does for $(...).
+ *
+ * The shell's stdout is flushed first, so that the child does not
+ * write out a copy of it.
+ *
+ * Parameters:
+ *   line     The command line
+ *   run      Called in the child to run line, with stdout already
+ *              on the pipe; its return value becomes the child's exit
+ *              status. The child exits as soon as it returns, without
+ *              running atexit() handlers.
+ *   out      Filled in with the output
+ *
+ * Returns:
+ *   The exit status of the child (128 plus the signal, if it was
+ *   killed), or -1 with errno set if the command could not be run or
+ *   its output could not be read. What was read is in out either way.
+ */
+int subst_capture(const char *line, int (*run)(const char *line), subst_buf_t *out);
+
+/*
+ * Frees the buffer of out, leaving it empty
+ */
+void subst_buf_free(subst_buf_t *out);
+
+#endif /* _SUBST_H_ */
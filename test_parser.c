@@ -18,11 +18,24 @@
 #include <unistd.h>
 
 #include "command.h"
+#include "vars.h"
 #include "parser.h"
 
 #define MAX_ARGS 20
 
 
+/*
+ * Runs the command of a $(...) substitution with /bin/sh, in place
+ * of the shell that parse_input() is normally part of
+ */
+static int
+run_sh(const char *line)
+{
+  execl("/bin/sh", "sh", "-c", line, (char *)NULL);
+  return 127;
+}
+
+
 /*
  * Tests the read_word function
  *
@@ -38,7 +51,7 @@ ilse_test_read_word()
     const int exp_pos;
   } test_matrix_t;
 
-  setenv("TESTVAR", "Scotty Dog", 1);
+  vars_set("TESTVAR", "Scotty Dog");
   
   char word_buf[32];
   test_matrix_t tests[] =
@@ -121,6 +134,19 @@ ilse_test_read_word()
       {"\\$TESTVAR", "$TESTVAR", 9},
       {"\"\\$TESTVAR\"", "$TESTVAR", 11},
 
+      // command substitution
+      {"$(echo hi)", "hi", 10},
+      {"x$(printf 'a\\n\\n')y", "xay", 19},
+      {"\"$(echo a   b)\"", "a b", 15},
+      {"$(echo \"(x)\")", "(x)", 13},
+      {"$(echo \\))", ")", 10},
+      {"$(echo $(echo in))out more", "inout", 21},
+      {"$(false)x", "x", 9},
+      {"\\$(echo hi)", "$(echo", 7},
+      {"$(echo", "Unterminated $(", -1},
+      {"\"$(echo \")", "Unterminated $(", -1},
+      {"$(echo a very long output that overflows)", "Word too long", -1},
+
       // redirection
       {"< /path/to/file  $TESTVAR", "</path/to/file", 15},
       {"<    /path/to/file  $TESTVAR", "</path/to/file", 18},
@@ -141,12 +167,31 @@ ilse_test_read_word()
       {"\"<html>\"", "<html>", 8},
       {"\"5 < 7\"", "5 < 7", 7},
       {">>", "Redirection without filename", -1},
+      {">>file1 ", ">file1", 7},
+      {">> file1", ">file1", 8},
+      {">>>file1", "Redirection without filename", -1},
+      {"> >file1", "Redirection without filename", -1},
       {">   ", "Redirection without filename", -1},
       {">", "Redirection without filename", -1},
       {"<<", "Redirection without filename", -1},
       {"<   ", "Redirection without filename", -1},
       {"<", "Redirection without filename", -1},
-      {"\"<this isn't redirection>\"", "<this isn't redirection>", 26}
+      {"\"<this isn't redirection>\"", "<this isn't redirection>", 26},
+
+      // pipes
+      {"ls|wc", "ls", 2},
+      {"|wc", "|", 1},
+      {"  | wc", "|", 3},
+      {"||", "|", 1},
+      {"\"a|b\"", "a|b", 5},
+      {"a\\|b", "a|b", 4},
+      {"> |", "Redirection without filename", -1},
+
+      // background
+      {"sleep&", "sleep", 5},
+      {" & ", "&", 2},
+      {"\"a&b\"", "a&b", 5},
+      {"a\\&b", "a&b", 4},
     };
   const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
   int tests_passed = 0;
@@ -168,6 +213,85 @@ ilse_test_read_word()
 }
 
 
+/*
+ * Tests the read_token function
+ *
+ * Returns:
+ *   True if all test cases pass, false otherwise.
+ */
+static bool
+test_read_token()
+{
+  typedef struct {
+    const char *input;
+    const int exp_offset;
+    const int exp_length;
+    const unsigned exp_flags;
+    const int exp_pos;
+  } test_matrix_t;
+
+  char err_msg[64];
+  token_t tok;
+  test_matrix_t tests[] =
+    {
+      {"", 0, 0, 0, 0},
+      {"   ", 3, 0, 0, 3},
+      {"echo one", 0, 4, 0, 4},
+      {"   echo", 3, 4, 0, 7},
+      {" \"a b\" c", 1, 5, TOK_QUOTED, 6},
+      {"One\\ Two", 0, 8, TOK_ESCAPED, 8},
+      {"x$TESTVAR- ", 0, 10, TOK_VARIABLE, 10},
+      {"$UNDEFINED_IS_FINE", 0, 18, TOK_VARIABLE, 18},
+      {"*.c one", 0, 3, TOK_GLOB, 3},
+      {"one.[ch]", 0, 8, TOK_GLOB, 8},
+      {"~/tmp", 0, 5, TOK_TILDE, 5},
+      {"~/*.c", 0, 5, TOK_TILDE | TOK_GLOB, 5},
+      {"/foo/~/bar", 0, 10, 0, 10},
+      {"cat<foo", 0, 3, 0, 3},
+      {"< /from/file", 2, 10, TOK_REDIR_IN, 12},
+      {">\"a b\" c", 1, 5, TOK_REDIR_OUT | TOK_QUOTED, 6},
+      {"\"unterminated", 0, 0, 0, -1},
+      {"echo\\g", 0, 0, 0, -1},
+      {" | wc", 1, 1, TOK_PIPE, 2},
+      {"ls|wc", 0, 2, 0, 2},
+      {"  &", 2, 1, TOK_BACKGROUND, 3},
+      {">", 0, 0, 0, -1},
+      {"$(echo a b) c", 0, 11, TOK_VARIABLE, 11},
+      {"$(not run", 0, 0, 0, -1},
+    };
+  const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
+  int tests_passed = 0;
+
+  for(int i=0; i<num_tests; i++) {
+
+    int act_pos = read_token(tests[i].input, &tok, err_msg, sizeof(err_msg));
+    if (act_pos == tests[i].exp_pos && (act_pos == -1
+          || (tok.offset == tests[i].exp_offset && tok.length == tests[i].exp_length
+            && tok.flags == tests[i].exp_flags))) {
+      tests_passed++;
+    } else {
+      printf("  FAILED: read_token(\"%s\" ...) returned %d, offset %zu length %zu flags 0x%x\n",
+        tests[i].input, act_pos, tok.offset, tok.length, tok.flags);
+    }
+  }
+
+  // a translated token must match what read_word produces
+  const char *line = " x\"$TESTVAR\"x  next";
+  char exp_word[32], act_word[32];
+  int pos = read_token(line, &tok, err_msg, sizeof(err_msg));
+  int len = token_expand(line, &tok, act_word, sizeof(act_word));
+  if (pos == read_word(line, exp_word, sizeof(exp_word))
+      && len == strlen(exp_word) && strcmp(act_word, exp_word) == 0) {
+    tests_passed++;
+  } else {
+    printf("  FAILED: token_expand(\"%s\" ...) returned %d, \"%s\"\n", line, len, act_word);
+  }
+
+  printf("%s: PASSED %d/%d\n", __FUNCTION__, tests_passed, num_tests + 1);
+  return (tests_passed == num_tests + 1);
+}
+
+
 static int num_parser_tests=0;
 
 /*
@@ -242,6 +366,211 @@ test_parser_once(const char *teststring,
 }
 
 
+/*
+ * Tests one pipeline case of the parse_input function.
+ *
+ * Parameters:
+ *   teststring   The input line
+ *   exp_out_file Expected output file of the last stage, or NULL
+ *   ...          The expected arguments of each stage, each stage
+ *                  terminated by NULL, with a second NULL after the
+ *                  last stage
+ *
+ * Returns:
+ *   True if test passes, false otherwise.
+ */
+static bool
+test_pipeline_once(const char *teststring, const char *exp_out_file, ...)
+{
+  va_list valist;
+  char err_msg[128];
+  bool test_result = false;
+
+  num_parser_tests++;
+  va_start(valist, exp_out_file);
+
+  command_t *exp_cmd = command_new();
+  command_t *stage = exp_cmd;
+  const char *exp_arg;
+  while (1) {
+    while ((exp_arg = va_arg(valist, const char *)))
+      command_append_arg(stage, exp_arg);
+    if (!(exp_arg = va_arg(valist, const char *)))
+      break;
+    stage = command_append_stage(exp_cmd);
+    command_append_arg(stage, exp_arg);
+  }
+  command_set_output(stage, exp_out_file);
+  va_end(valist);
+
+  command_t *cmd = parse_input(teststring, err_msg, sizeof(err_msg));
+  if (cmd == NULL) {
+    printf("Error [%s]: got error %s but expected result\n", teststring, err_msg);
+  } else if (!command_compare(cmd, exp_cmd)) {
+    printf("Error [%s]: Command did not match expected result.\n", teststring);
+    printf("Actual result:\n");
+    command_dump(cmd);
+    printf("Expected result:\n");
+    command_dump(exp_cmd);
+  } else {
+    test_result = true;
+  }
+
+  command_free(cmd);
+  command_free(exp_cmd);
+  return test_result;
+}
+
+
+/*
+ * Tests one case of NAME=value assignments before a command.
+ *
+ * Parameters:
+ *   teststring   The input line
+ *   ...          The expected assignments, terminated by NULL, then
+ *                  the expected arguments, terminated by NULL
+ *
+ * Returns:
+ *   True if test passes, false otherwise.
+ */
+static bool
+test_assign_once(const char *teststring, ...)
+{
+  va_list valist;
+  char err_msg[128];
+  bool test_result = false;
+
+  num_parser_tests++;
+  va_start(valist, teststring);
+
+  command_t *exp_cmd = command_new();
+  const char *exp_arg;
+  while ((exp_arg = va_arg(valist, const char *)))
+    command_append_assign(exp_cmd, exp_arg, strlen(exp_arg));
+  while ((exp_arg = va_arg(valist, const char *)))
+    command_append_arg(exp_cmd, exp_arg);
+  va_end(valist);
+
+  command_t *cmd = parse_input(teststring, err_msg, sizeof(err_msg));
+  if (cmd == NULL) {
+    printf("Error [%s]: got error %s but expected result\n", teststring, err_msg);
+  } else if (!command_compare(cmd, exp_cmd)) {
+    printf("Error [%s]: Command did not match expected result.\n", teststring);
+    printf("Actual result:\n");
+    command_dump(cmd);
+    printf("Expected result:\n");
+    command_dump(exp_cmd);
+  } else {
+    test_result = true;
+  }
+
+  command_free(cmd);
+  command_free(exp_cmd);
+  return test_result;
+}
+
+
+/*
+ * Tests one background case of the parse_input function: the line
+ * must parse into a command with exp_argc arguments, marked to run in
+ * the background.
+ *
+ * Returns:
+ *   True if test passes, false otherwise.
+ */
+static bool
+test_background_once(const char *teststring, int exp_argc)
+{
+  char err_msg[128];
+  bool test_result = false;
+
+  num_parser_tests++;
+
+  command_t *cmd = parse_input(teststring, err_msg, sizeof(err_msg));
+  if (cmd == NULL)
+    printf("Error [%s]: got error %s but expected result\n", teststring, err_msg);
+  else if (!command_is_background(cmd) || command_get_argc(cmd) != exp_argc)
+    printf("Error [%s]: expected %d arguments in the background\n", teststring, exp_argc);
+  else
+    test_result = true;
+
+  command_free(cmd);
+  return test_result;
+}
+
+
+/*
+ * Tests one here-document or here-string case: the line is parsed,
+ * then parse_heredocs() reads its bodies from rest.
+ *
+ * Parameters:
+ *   teststring   The command line
+ *   rest         The input after the command line
+ *   final        Whether rest ends the input
+ *   exp_ret      The expected return value of parse_heredocs()
+ *   exp_used     The expected number of bytes of rest used
+ *   n_stages     The number of stages of the pipeline
+ *   ...          The expected input text of each stage, or NULL for
+ *                  a stage with none, or in case of error, the
+ *                  expected error message
+ *
+ * Returns:
+ *   True if test passes, false otherwise.
+ */
+static bool
+test_heredoc_once(const char *teststring, const char *rest, bool final,
+    int exp_ret, size_t exp_used, int n_stages, ...)
+{
+  va_list valist;
+  char err_msg[128];
+  bool test_result = false;
+  size_t used = 12345;
+
+  num_parser_tests++;
+  va_start(valist, n_stages);
+
+  command_t *cmd = parse_input(teststring, err_msg, sizeof(err_msg));
+  if (cmd == NULL) {
+    printf("Error [%s]: got error %s but expected result\n", teststring, err_msg);
+    goto end;
+  }
+
+  int ret = parse_heredocs(cmd, rest, strlen(rest), final, &used, err_msg, sizeof(err_msg));
+  if (ret != exp_ret || used != exp_used) {
+    printf("Error [%s]: parse_heredocs returned %d, used %zu; expected %d, %zu\n",
+        teststring, ret, used, exp_ret, exp_used);
+    goto end;
+  }
+
+  if (ret == -1) {
+    const char *exp_error = va_arg(valist, const char *);
+    if (strcmp(err_msg, exp_error) != 0)
+      printf("Error [%s]: Actual error msg did not match expected msg\n", teststring);
+    else
+      test_result = true;
+    goto end;
+  }
+
+  test_result = true;
+  command_t *stage = cmd;
+  for (int i = 0; i < n_stages; i++, stage = command_get_next(stage)) {
+    size_t len = 0;
+    const char *exp_data = va_arg(valist, const char *);
+    const char *data = command_get_input_data(stage, &len);
+    if (stage == NULL || (data == NULL) != (exp_data == NULL)
+        || (data && (len != strlen(exp_data) || memcmp(data, exp_data, len) != 0))) {
+      printf("Error [%s]: stage %d did not get the expected input\n", teststring, i);
+      test_result = false;
+    }
+  }
+
+ end:
+  va_end(valist);
+  command_free(cmd);
+  return test_result;
+}
+
+
 /*
  * Equivalent to the 'touch' command line utility: Creates the
  * specified file in the cwd. File is created with perms 600.
@@ -283,7 +612,7 @@ ilse_test_parse_input()
 
   // for all tests, the environment will have the variable FOO set to
   // "Carnegie Mellon"
-  setenv("FOO", "Carnegie Mellon", 1);
+  vars_set("FOO", "Carnegie Mellon");
 
   // empty command string
   passed += test_parser_once("", NULL, NULL, true, NULL);
@@ -322,6 +651,18 @@ ilse_test_parse_input()
   passed += test_parser_once("echo \"-$FOO-\"", NULL, NULL, true,
       "echo", "-Carnegie Mellon-", NULL);
 
+  // command substitution, whose output is not split into words
+  passed += test_parser_once("echo $(echo one   two) x$(printf '\\n')x", NULL, NULL, true,
+      "echo", "one two", "xx", NULL);
+  passed += test_parser_once("cat <$(echo /etc/passwd)", "/etc/passwd", NULL, true,
+      "cat", NULL);
+  passed += test_parser_once("$(echo wc) -l", NULL, NULL, true, "wc", "-l", NULL);
+  passed += test_parser_once("echo $(echo a | tr a b", NULL, NULL, false, "Unterminated $(");
+  parse_set_subst_runner(NULL);
+  passed += test_parser_once("echo $(echo a)", NULL, NULL, false,
+      "Command substitution not available");
+  parse_set_subst_runner(run_sh);
+
   // input/output redirection
   passed += test_parser_once("cat < /etc/passwd > /tmp/a_file", "/etc/passwd",
       "/tmp/a_file", true, "cat", NULL);
@@ -331,6 +672,8 @@ ilse_test_parse_input()
       true, "cat", NULL);
   passed += test_parser_once("cat \"</etc/passwd\" ", "/etc/passwd", NULL,
       true, "cat", NULL);
+  passed += test_parser_once("echo b >> out", NULL, "out", true, "echo", "b", NULL);
+  passed += test_parser_once("echo b>>out", NULL, "out", true, "echo", "b", NULL);
   passed += test_parser_once("cat >/tmp/afile   ", NULL, "/tmp/afile",
       true, "cat", NULL);
   passed += test_parser_once("cat \">/tmp/afile \"   ", NULL, "/tmp/afile ",
@@ -348,6 +691,38 @@ ilse_test_parse_input()
   passed += test_parser_once("echo $FOO\\< ", NULL, NULL, true,
       "echo", "Carnegie Mellon<", NULL);
 
+  // pipelines
+  passed += test_pipeline_once("ls | wc", NULL, "ls", NULL, "wc", NULL, NULL);
+  passed += test_pipeline_once("ls -l|grep $FOO|wc -l >/tmp/count", "/tmp/count",
+      "ls", "-l", NULL, "grep", "Carnegie Mellon", NULL, "wc", "-l", NULL, NULL);
+  passed += test_pipeline_once("echo \"a | b\" a\\|b", NULL,
+      "echo", "a | b", "a|b", NULL, NULL);
+  passed += test_parser_once("ls |", NULL, NULL, false, "Missing command");
+  passed += test_parser_once("| wc", NULL, NULL, false, "Missing command");
+  passed += test_parser_once("ls || wc", NULL, NULL, false, "Missing command");
+  passed += test_parser_once("ls | > foo", NULL, NULL, false, "Missing command");
+
+  // NAME=value before the command name, whose value is not globbed
+  passed += test_assign_once("LANG=C sort -r", "LANG=C", NULL, "sort", "-r", NULL);
+  passed += test_assign_once("A=1 _b2=\"$FOO\" env", "A=1", "_b2=Carnegie Mellon", NULL,
+      "env", NULL);
+  passed += test_assign_once("A=* B= ls A=1", "A=*", "B=", NULL, "ls", "A=1", NULL);
+  passed += test_assign_once("X=1", "X=1", NULL, NULL);
+  passed += test_parser_once("\"A=1\" ls", NULL, NULL, true, "A=1", "ls", NULL);
+  passed += test_parser_once("1A=x =y ls", NULL, NULL, true, "1A=x", "=y", "ls", NULL);
+  passed += test_parser_once("A=1 | wc", NULL, NULL, false, "Missing command");
+  passed += test_parser_once("A=1 > foo", NULL, NULL, false, "Missing command");
+
+  // background
+  passed += test_background_once("sleep 10 &", 2);
+  passed += test_background_once("sleep 10&  ", 2);
+  passed += test_background_once("ls | wc > /tmp/count &", 1);
+  passed += test_parser_once("echo a\\& \"b&\"", NULL, NULL, true, "echo", "a&", "b&", NULL);
+  passed += test_parser_once("&", NULL, NULL, false, "Missing command");
+  passed += test_parser_once("ls | &", NULL, NULL, false, "Missing command");
+  passed += test_parser_once("sleep 1 & ls", NULL, NULL, false, "& must end the command");
+  passed += test_parser_once("sleep 1 &&", NULL, NULL, false, "& must end the command");
+
   // ................. start of globbing tests .....................
   // to test globbing, we need to set up a test directory with some
   // known files in it
@@ -386,8 +761,11 @@ ilse_test_parse_input()
       "ls", "one.c", "two.c", NULL);
   passed += test_parser_once("ls {one,three}.[ch]", NULL, NULL, true,
       "ls", "one.c", "one.h", "three.c", "three.h", NULL);
+  // inside double quotes, glob characters are literal
+  passed += test_parser_once("ls \"*.c\" \"{one,two}.c\" x\"one.[ch]\"", NULL, NULL, true,
+      "ls", "*.c", "{one,two}.c", "xone.[ch]", NULL);
   passed += test_parser_once("ls ~ > file1", NULL, "file1", true,
-      "ls", getenv("HOME"), NULL);
+      "ls", vars_get("HOME"), NULL);
   passed += test_parser_once("~parmenin", NULL, NULL, true,
                              "/home/parmenin", NULL);
   passed += test_parser_once("~parmenin/tmp", NULL, NULL, true,
@@ -399,6 +777,39 @@ ilse_test_parse_input()
   passed += test_parser_once("~parmenin/tmp", NULL, NULL, true,
                              "/home/parmenin/tmp", NULL);
 
+  // ~ is expanded whether or not the file exists, and an unknown user
+  // or a pattern that matches nothing is left alone
+  char home_file[256];
+  snprintf(home_file, sizeof(home_file), "%s/no_such_file", vars_get("HOME"));
+  passed += test_parser_once("touch ~/no_such_file", NULL, NULL, true,
+                             "touch", home_file, NULL);
+  passed += test_parser_once("ls ~no_such_user/x", NULL, NULL, true,
+                             "ls", "~no_such_user/x", NULL);
+  passed += test_parser_once("ls {one,four}.c", NULL, NULL, true,
+                             "ls", "one.c", NULL);
+  passed += test_parser_once("ls **/*.h", NULL, NULL, true,
+                             "ls", "one.h", "three.h", NULL);
+
+  // a quoted glob character stays literal even where the word has an
+  // unquoted one too
+  char *quoted_files[] = {"xAy.c", "x*y.c", "a[1]/x.txt", NULL};
+  if (mkdir("a[1]", 0755) != 0) {
+    perror("mkdir");
+    return false;
+  }
+  for (int i=0; quoted_files[i]; i++)
+    if (!touch(quoted_files[i]))
+      return false;
+  passed += test_parser_once("echo \"x*\"*.c", NULL, NULL, true,
+                             "echo", "x*y.c", NULL);
+  passed += test_parser_once("echo \"a[1]\"/*.txt", NULL, NULL, true,
+                             "echo", "a[1]/x.txt", NULL);
+  passed += test_parser_once("echo \"a[1]\"/*.h", NULL, NULL, true,
+                             "echo", "a[1]/*.h", NULL);
+  for (int i=0; quoted_files[i]; i++)
+    unlink(quoted_files[i]);
+  rmdir("a[1]");
+
   // Delete the glob test files plus the tempdir
   for (int i=0; files[i]; i++) 
     if (unlink(files[i]) != 0) {
@@ -414,6 +825,53 @@ ilse_test_parse_input()
   // ................. end of globbing tests ......................
 
 
+  // words far longer than the parser's stack buffers, which grow to fit
+  {
+    size_t big = 1 << 20;
+    char *line = malloc(big + 64);
+    char *exp = malloc(big + 64);
+    char *exp2 = malloc(big + 64);
+    assert(line && exp && exp2);
+
+    // a quoted word with spaces, as a JSON payload would be
+    strcpy(line, "post \"");
+    for (size_t i = 0; i < big / 8; i++)
+      strcpy(line + 6 + i * 8, "{\\\"a\\\": 1}");
+    strcat(line, "\"");
+    exp[0] = '\0';
+    for (size_t i = 0; i < big / 8; i++)
+      strcpy(exp + i * 6, "{\"a\": 1}");
+    passed += test_parser_once(line, NULL, NULL, true, "post", exp, NULL);
+
+    // a variable whose value is longer than a buffer, expanded twice
+    memset(exp, 'v', 300000);
+    exp[300000] = '\0';
+    vars_set("LONGVAR", exp);
+    sprintf(exp2, "%s-%s", exp, exp);
+    passed += test_parser_once("echo $LONGVAR-$LONGVAR", NULL, NULL, true,
+        "echo", exp2, NULL);
+
+    // a long escaped filename to redirect to, and a long ~ path
+    memset(line, 0, big);
+    strcpy(line, "cat > out\\ ");
+    memset(line + strlen(line), 'f', 5000);
+    strcpy(exp, "out ");
+    memset(exp + 4, 'f', 5000);
+    exp[5004] = '\0';
+    passed += test_parser_once(line, NULL, exp, true, "cat", NULL);
+
+    memset(line, 0, big);
+    strcpy(line, "ls ~/");
+    memset(line + 5, 'd', 5000);
+    sprintf(exp2, "%s/%s", vars_get("HOME"), line + 5);
+    passed += test_parser_once(line, NULL, NULL, true, "ls", exp2, NULL);
+
+    vars_unset("LONGVAR");
+    free(line);
+    free(exp);
+    free(exp2);
+  }
+
   // error cases
   passed += test_parser_once("grep $FOO <    ", NULL, NULL, false,
       "Redirection without filename");
@@ -435,6 +893,39 @@ ilse_test_parse_input()
   passed += test_parser_once("  < foo", "foo", NULL, false, "Missing command");
   passed += test_parser_once(">  foo", NULL, "foo", false, "Missing command");
 
+  // here-documents, whose bodies come from the lines after the command
+  passed += test_heredoc_once("cat <<EOF", "a\nb\nEOF\nnext\n", true, 0, 8, 1, "a\nb\n");
+  passed += test_heredoc_once("cat <<EOF", "a\nb\n", false, PARSE_MORE_INPUT, 0, 1, NULL);
+  passed += test_heredoc_once("cat <<EOF", "a\nb\n", true, 0, 4, 1, "a\nb\n");
+  passed += test_heredoc_once("cat <<EOF", "EOFX\n EOF\nEOF", true, 0, 13, 1, "EOFX\n EOF\n");
+  passed += test_heredoc_once("cat <<EOF", "EOF\n", false, 0, 4, 1, "");
+  passed += test_heredoc_once("cat <<EOF", "$FOO \\$FOO \\\\ \\n \"*\" $\nEOF\n", true, 0, 27, 1,
+      "Carnegie Mellon $FOO \\ \\n \"*\" $\n");
+  passed += test_heredoc_once("cat <<\"EOF\"", "$FOO \\$\nEOF", true, 0, 11, 1, "$FOO \\$\n");
+  passed += test_heredoc_once("cat <<\\$EOF", "$FOO\n$EOF\n", true, 0, 10, 1, "$FOO\n");
+  passed += test_heredoc_once("cat <<A | sort | cat <<B >out", "1\nA\n2\nB\n3\n", true, 0, 8, 3,
+      "1\n", NULL, "2\n");
+  passed += test_heredoc_once("cat <<A | cat <<B", "1\nA\n2\n", false, PARSE_MORE_INPUT, 0, 2,
+      NULL, NULL);
+  passed += test_heredoc_once("cat <<EOF", "$NOT_A_VARIABLE_HERE\nEOF\nls\n", true, -1, 25, 1,
+      "Undefined variable: 'NOT_A_VARIABLE_HERE'");
+  passed += test_heredoc_once("echo no heredoc", "EOF\n", false, 0, 0, 1, NULL);
+
+  // here-strings, which are complete on the command line
+  passed += test_heredoc_once("cat <<<$FOO", "", false, 0, 0, 1, "Carnegie Mellon\n");
+  passed += test_heredoc_once("cat <<< \"a  b\" -n", "", false, 0, 0, 1, "a  b\n");
+  passed += test_heredoc_once("cat <<<\"\"", "", false, 0, 0, 1, "\n");
+  passed += test_heredoc_once("cat <<< *.c", "", false, 0, 0, 1, "*.c\n");
+
+  passed += test_parser_once("cat <<", NULL, NULL, false, "Redirection without filename");
+  passed += test_parser_once("cat < <x", NULL, NULL, false, "Redirection without filename");
+  passed += test_parser_once("cat <<<<x", NULL, NULL, false, "Redirection without filename");
+  passed += test_parser_once("cat <>x", NULL, NULL, false, "Redirection without filename");
+  passed += test_parser_once("cat <a <<EOF", NULL, NULL, false, "Multiple redirections not allowed");
+  passed += test_parser_once("cat <<EOF <<<x", NULL, NULL, false, "Multiple redirections not allowed");
+  passed += test_parser_once("cat <<<x <a", NULL, NULL, false, "Multiple redirections not allowed");
+  passed += test_parser_once("<<EOF", NULL, NULL, false, "Missing command");
+
   passed += test_parser_once("grep 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19",
       NULL, NULL, true, "grep", "1", "2", "3", "4", "5", "6", "7", "8",
       "9", "10", "11", "12", "13", "14", "15", "16", "17", "18", "19", NULL);
@@ -451,7 +942,9 @@ int main(int argc, char *argv[])
 {
   int success = 1;
 
+  parse_set_subst_runner(run_sh);
   success &= ilse_test_read_word();
+  success &= test_read_token();
   success &= ilse_test_parse_input();
 
   if (success) {
@@ -0,0 +1,525 @@
+/*
+ * vars.c
+ *
+ * The shell's table of variables, from which $NAME is expanded and
+ * the environment of each command is built
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+
+#include <assert.h>             // assert
+#include <errno.h>              // errno
+#include <stdbool.h>            // bool
+#include <stdio.h>              // printf
+#include <stdlib.h>             // malloc
+#include <string.h>             // strcmp
+
+#include "vars.h"
+
+//#define RUN_TESTS         // if defined, turns on all the testing code
+
+#define INIT_SLOTS 256      // Slots in the hash table when first used
+
+extern char **environ;
+
+/*
+ * One variable, stored the way exec wants it
+ */
+typedef struct {
+  char *entry;              // "NAME=value"
+  size_t name_len;          // length of NAME
+  bool exported;            // passed in the environment of commands
+} var_t;
+
+static var_t *vars = NULL;      // in the order they were first set
+static int n_vars = 0;
+static int vars_cap = 0;
+
+static int *slots = NULL;       // index into vars plus one, 0 if empty
+static size_t n_slots = 0;
+
+static unsigned long version = 1;
+static unsigned long export_version = 1;   // changes only with the envp
+static bool initialized = false;
+
+static char **envp = NULL;      // built from the exported vars for exec
+static int envp_len = 0;
+static int envp_cap = 0;
+static unsigned long envp_version = 0;
+
+static char **with_envp = NULL; // envp plus the assignments of one command
+static int with_cap = 0;
+
+
+/*
+ * FNV-1a hash of a name
+ */
+static size_t hash_name(const char *name, size_t len)
+{
+  size_t h = 14695981039346656037UL;
+  for (size_t i=0; i < len; i++)
+    h = (h ^ (unsigned char)name[i]) * 1099511628211UL;
+  return h;
+}
+
+
+/*
+ * Returns the slot for a name: the slot of its variable, or the empty
+ * slot where it belongs
+ */
+static int *find_slot(const char *name, size_t len)
+{
+  size_t i = hash_name(name, len) & (n_slots - 1);
+  while (slots[i]) {
+    const var_t *var = &vars[slots[i] - 1];
+    if (var->name_len == len && memcmp(var->entry, name, len) == 0)
+      break;
+    i = (i + 1) & (n_slots - 1);
+  }
+  return &slots[i];
+}
+
+
+/*
+ * Doubles the hash table, or creates it the first time
+ */
+static bool grow_slots()
+{
+  size_t new_slots = n_slots ? n_slots * 2 : INIT_SLOTS;
+  int *p = calloc(new_slots, sizeof(int));
+  if (!p)
+    return false;
+
+  free(slots);
+  slots = p;
+  n_slots = new_slots;
+  for (int i=0; i < n_vars; i++)
+    *find_slot(vars[i].entry, vars[i].name_len) = i + 1;
+  return true;
+}
+
+
+/*
+ * Sets a variable in the table. A new variable is not exported. If
+ * keep is set, a variable that is already there is left as it is.
+ * Returns the variable, or NULL if out of memory.
+ */
+static var_t *set_entry(const char *name, size_t len, const char *value, bool keep)
+{
+  if ((n_vars + 1) * 2 > n_slots && !grow_slots())
+    return NULL;
+
+  int *slot = find_slot(name, len);
+  if (*slot && keep)
+    return &vars[*slot - 1];
+
+  size_t value_len = strlen(value);
+  char *entry = malloc(len + value_len + 2);
+  if (!entry)
+    return NULL;
+  memcpy(entry, name, len);
+  entry[len] = '=';
+  memcpy(entry + len + 1, value, value_len + 1);
+
+  if (*slot) {
+    free(vars[*slot - 1].entry);
+    vars[*slot - 1].entry = entry;
+    return &vars[*slot - 1];
+  }
+
+  if (n_vars == vars_cap) {
+    int cap = vars_cap ? vars_cap * 2 : 64;
+    var_t *p = realloc(vars, cap * sizeof(var_t));
+    if (!p) {
+      free(entry);
+      return NULL;
+    }
+    vars = p;
+    vars_cap = cap;
+  }
+  vars[n_vars].entry = entry;
+  vars[n_vars].name_len = len;
+  vars[n_vars].exported = false;
+  *slot = ++n_vars;
+  return &vars[n_vars - 1];
+}
+
+
+/*
+ * Returns true if name is a valid name to set
+ */
+static bool valid_name(const char *name)
+{
+  return name && *name && !strchr(name, '=');
+}
+
+
+/*
+ * Returns true if two "NAME=value" strings have the same NAME
+ */
+static bool same_name(const char *a, const char *b)
+{
+  while (*a == *b && *a != '=' && *a)
+    a++, b++;
+  return *a == '=' && *b == '=';
+}
+
+
+/**********************************************************************
+ *
+ * Implementations for the vars calls.  All documentation is in the
+ * vars.h file.
+ *
+ **********************************************************************/
+
+int vars_init()
+{
+  if (initialized)
+    return 0;
+
+  // as with getenv(), the first of several entries for a name wins
+  for (char **e = environ; e && *e; e++) {
+    char *eq = strchr(*e, '=');
+    if (eq && eq != *e) {
+      var_t *var = set_entry(*e, eq - *e, eq + 1, true);
+      if (!var)
+        return -1;
+      var->exported = true;
+    }
+  }
+
+  initialized = true;
+  version++;
+  export_version++;
+  return 0;
+}
+
+
+const char *vars_getn(const char *name, size_t len)
+{
+  vars_init();
+
+  if (n_slots) {
+    int slot = *find_slot(name, len);
+    if (slot)
+      return vars[slot - 1].entry + len + 1;
+  }
+  return NULL;
+}
+
+
+const char *vars_get(const char *name)
+{
+  return vars_getn(name, strlen(name));
+}
+
+
+int vars_set(const char *name, const char *value)
+{
+  if (!valid_name(name) || !value) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  var_t *var = NULL;
+  if (vars_init() == 0)
+    var = set_entry(name, strlen(name), value, false);
+  if (!var) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  // a shell variable, such as PIPESTATUS after every pipeline, leaves
+  // the envp as it is
+  version++;
+  if (var->exported)
+    export_version++;
+  return 0;
+}
+
+
+int vars_export(const char *name, const char *value)
+{
+  if (!valid_name(name)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  var_t *var = NULL;
+  if (vars_init() == 0)
+    var = set_entry(name, strlen(name), value ? value : "", !value);
+  if (!var) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  var->exported = true;
+  version++;
+  export_version++;
+  return 0;
+}
+
+
+int vars_unset(const char *name)
+{
+  if (!valid_name(name)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (vars_init() == -1 || !n_slots)
+    return 0;
+
+  int slot = *find_slot(name, strlen(name));
+  if (!slot)
+    return 0;
+
+  if (vars[slot - 1].exported)
+    export_version++;
+
+  // keep the rest in order, and rebuild the slots around the gap,
+  // which is simpler than deleting from open addressing
+  free(vars[slot - 1].entry);
+  memmove(&vars[slot - 1], &vars[slot], (n_vars - slot) * sizeof(var_t));
+  n_vars--;
+  memset(slots, 0, n_slots * sizeof(int));
+  for (int i=0; i < n_vars; i++)
+    *find_slot(vars[i].entry, vars[i].name_len) = i + 1;
+
+  version++;
+  return 0;
+}
+
+
+char **vars_envp()
+{
+  if (vars_init() == -1)
+    return NULL;
+  if (envp_version == export_version)
+    return envp;
+
+  if (n_vars + 1 > envp_cap) {
+    int cap = vars_cap + 1;
+    char **p = realloc(envp, cap * sizeof(char *));
+    if (!p)
+      return NULL;
+    envp = p;
+    envp_cap = cap;
+  }
+
+  envp_len = 0;
+  for (int i=0; i < n_vars; i++)
+    if (vars[i].exported)
+      envp[envp_len++] = vars[i].entry;
+  envp[envp_len] = NULL;
+
+  envp_version = export_version;
+  return envp;
+}
+
+
+char **vars_envp_with(char *const assigns[])
+{
+  char **base = vars_envp();
+  if (!base || !assigns || !assigns[0])
+    return base;
+
+  int n = 0;
+  while (assigns[n])
+    n++;
+
+  if (envp_len + n + 1 > with_cap) {
+    int cap = envp_len + n + 1;
+    char **p = realloc(with_envp, cap * sizeof(char *));
+    if (!p)
+      return NULL;
+    with_envp = p;
+    with_cap = cap;
+  }
+
+  // the few assignments are checked against each variable, rather than
+  // hashing them, and a later assignment to a name wins
+  int len = 0;
+  for (int i=0; i < envp_len; i++) {
+    int j = 0;
+    while (j < n && !same_name(base[i], assigns[j]))
+      j++;
+    if (j == n)
+      with_envp[len++] = base[i];
+  }
+  for (int i=0; i < n; i++) {
+    int j = i + 1;
+    while (j < n && !same_name(assigns[i], assigns[j]))
+      j++;
+    if (j == n)
+      with_envp[len++] = assigns[i];
+  }
+  with_envp[len] = NULL;
+
+  return with_envp;
+}
+
+
+unsigned long vars_version()
+{
+  return version;
+}
+
+
+
+/**********************************************************************
+ *
+ * Test code below
+ *
+ **********************************************************************/
+#ifdef RUN_TESTS
+
+/*
+ * Returns the entry for name in a NULL-terminated envp, or NULL
+ */
+static const char *envp_find(char **env, const char *name)
+{
+  size_t len = strlen(name);
+  for (; *env; env++)
+    if (strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+      return *env;
+  return NULL;
+}
+
+void test_vars()
+{
+  char name[32], value[32];
+
+  // seeded from environ
+  setenv("VARS_TEST_SEED", "seed", 1);
+  assert( vars_init() == 0 );
+  assert( vars_init() == 0 );
+  assert( strcmp(vars_get("VARS_TEST_SEED"), "seed") == 0 );
+  assert( strcmp(vars_get("PATH"), getenv("PATH")) == 0 );
+  assert( vars_get("VARS_TEST_MISSING") == NULL );
+
+  // names given as spans of a longer string
+  const char *line = "VARS_TEST_SEED/rest";
+  assert( strcmp(vars_getn(line, 14), "seed") == 0 );
+  assert( vars_getn(line, 9) == NULL );
+
+  // setting adds to the table but not to environ, and changes the version
+  unsigned long v = vars_version();
+  assert( vars_set("VARS_TEST_NEW", "one") == 0 );
+  assert( vars_version() != v );
+  assert( strcmp(vars_get("VARS_TEST_NEW"), "one") == 0 );
+  assert( getenv("VARS_TEST_NEW") == NULL );
+  assert( vars_set("VARS_TEST_NEW", "two") == 0 );
+  assert( strcmp(vars_get("VARS_TEST_NEW"), "two") == 0 );
+  assert( vars_set("VARS_TEST_EMPTY", "") == 0 );
+  assert( strcmp(vars_get("VARS_TEST_EMPTY"), "") == 0 );
+
+  // bad names
+  assert( vars_set("", "x") == -1 && errno == EINVAL );
+  assert( vars_set("A=B", "x") == -1 && errno == EINVAL );
+  assert( vars_export("A=B", NULL) == -1 && errno == EINVAL );
+  assert( vars_unset("") == -1 && errno == EINVAL );
+
+  // variables set behind the table's back are not seen
+  setenv("VARS_TEST_BEHIND", "behind", 1);
+  assert( vars_get("VARS_TEST_BEHIND") == NULL );
+
+  // the envp only has exported variables, and is rebuilt only after a
+  // change
+  char **env = vars_envp();
+  assert( env && vars_envp() == env );
+  v = vars_version();
+  assert( vars_envp() == env && vars_version() == v );
+  assert( envp_find(env, "VARS_TEST_NEW") == NULL );
+  assert( strcmp(envp_find(env, "VARS_TEST_SEED"), "VARS_TEST_SEED=seed") == 0 );
+  assert( envp_find(env, "VARS_TEST_BEHIND") == NULL );
+
+  // setting or unsetting a variable that is not exported is not a
+  // change to it, so the marker put in its place survives
+  char *first = env[0];
+  env[0] = "VARS_TEST_MARKER=1";
+  assert( vars_set("VARS_TEST_NEW", "two") == 0 && vars_version() != v );
+  assert( vars_set("VARS_TEST_LOCAL", "x") == 0 && vars_unset("VARS_TEST_LOCAL") == 0 );
+  assert( vars_envp() == env && strcmp(env[0], "VARS_TEST_MARKER=1") == 0 );
+  env[0] = first;
+
+  // exporting keeps the value, or sets a new one, and setting an
+  // exported variable leaves it exported
+  assert( vars_export("VARS_TEST_NEW", NULL) == 0 );
+  assert( vars_version() != v );
+  env = vars_envp();
+  assert( strcmp(envp_find(env, "VARS_TEST_NEW"), "VARS_TEST_NEW=two") == 0 );
+  assert( vars_set("VARS_TEST_NEW", "three") == 0 );
+  env = vars_envp();
+  assert( strcmp(envp_find(env, "VARS_TEST_NEW"), "VARS_TEST_NEW=three") == 0 );
+  assert( vars_export("VARS_TEST_EXP", "exp") == 0 );
+  assert( vars_export("VARS_TEST_BARE", NULL) == 0 );
+  env = vars_envp();
+  assert( strcmp(envp_find(env, "VARS_TEST_EXP"), "VARS_TEST_EXP=exp") == 0 );
+  assert( strcmp(envp_find(env, "VARS_TEST_BARE"), "VARS_TEST_BARE=") == 0 );
+  assert( getenv("VARS_TEST_EXP") == NULL );
+
+  // assignments for one command replace or add to the exported
+  // variables, the last of several for a name winning, and leave the
+  // table alone
+  char *assigns[] = {"VARS_TEST_NEW=cmd", "VARS_TEST_ONLY=x",
+                     "VARS_TEST_ONLY=y", NULL};
+  char *none[] = {NULL};
+  v = vars_version();
+  assert( vars_envp_with(none) == vars_envp() );
+  char **with = vars_envp_with(assigns);
+  assert( with && with != vars_envp() && vars_version() == v );
+  assert( strcmp(envp_find(with, "VARS_TEST_NEW"), "VARS_TEST_NEW=cmd") == 0 );
+  assert( strcmp(envp_find(with, "VARS_TEST_ONLY"), "VARS_TEST_ONLY=y") == 0 );
+  assert( strcmp(envp_find(with, "VARS_TEST_SEED"), "VARS_TEST_SEED=seed") == 0 );
+  int n_with = 0, n_env = 0;
+  while (with[n_with])
+    n_with++;
+  for (env = vars_envp(); env[n_env]; n_env++)
+    ;
+  assert( n_with == n_env + 1 );
+  assert( strcmp(vars_get("VARS_TEST_NEW"), "three") == 0 );
+  assert( vars_get("VARS_TEST_ONLY") == NULL );
+
+  // unsetting removes a variable, and keeps the rest findable
+  assert( vars_unset("VARS_TEST_EXP") == 0 );
+  assert( vars_unset("VARS_TEST_EXP") == 0 );
+  assert( vars_get("VARS_TEST_EXP") == NULL );
+  assert( envp_find(vars_envp(), "VARS_TEST_EXP") == NULL );
+  assert( strcmp(vars_get("VARS_TEST_BARE"), "") == 0 );
+  assert( strcmp(vars_get("VARS_TEST_SEED"), "seed") == 0 );
+
+  // enough variables to grow the table several times
+  for (int i=0; i < 4 * INIT_SLOTS; i++) {
+    snprintf(name, sizeof(name), "VARS_TEST_%d", i);
+    snprintf(value, sizeof(value), "value %d", i);
+    assert( vars_set(name, value) == 0 );
+  }
+  for (int i=0; i < 4 * INIT_SLOTS; i++) {
+    snprintf(name, sizeof(name), "VARS_TEST_%d", i);
+    snprintf(value, sizeof(value), "value %d", i);
+    assert( strcmp(vars_get(name), value) == 0 );
+  }
+  for (n_env = 0, env = vars_envp(); env[n_env]; n_env++)
+    ;
+  assert( vars_export("VARS_TEST_1000", NULL) == 0 );
+  env = vars_envp();
+  assert( env );
+  int n = 0;
+  while (env[n])
+    n++;
+  assert( n == n_env + 1 );
+  assert( strcmp(envp_find(env, "VARS_TEST_1000"), "VARS_TEST_1000=value 1000") == 0 );
+  assert( vars_unset("VARS_TEST_5") == 0 && vars_get("VARS_TEST_5") == NULL );
+  assert( strcmp(vars_get("VARS_TEST_6"), "value 6") == 0 );
+  printf("%d variables in %zu slots\n", n_vars, n_slots);
+}
+
+
+int main(int argc, char *argv[])
+{
+  test_vars();
+  fprintf(stderr, "test_vars: All tests succeeded!\n");
+  return 0;
+}
+
+#endif   // RUN_TESTS
@@ -0,0 +1,122 @@
+/*
+ * vars.h
+ *
+ * The shell's table of variables, from which $NAME is expanded and
+ * the environment of each command is built
+ *
+ * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
+ */
+#ifndef _VARS_H_
+#define _VARS_H_
+
+#include <stddef.h>
+
+/*
+ * Fills the table from environ, marking every variable exported.
+ * Called by the other vars functions the first time any of them is
+ * used; calling it again does nothing. After that the table is the
+ * only record of the shell's variables: environ is never changed.
+ *
+ * Returns:
+ *   0 on success, -1 if out of memory
+ */
+int vars_init();
+
+/*
+ * Looks up a variable, exported or not, by a name that need not be
+ * NUL-terminated, without allocating. The table is a hash map, so the
+ * cost does not grow with the size of the environment.
+ *
+ * Parameters:
+ *   name     The start of the name
+ *   len      The length of the name
+ *
+ * Returns:
+ *   The value, valid until the variable is next set, or NULL if there
+ *   is no such variable
+ */
+const char *vars_getn(const char *name, size_t len);
+
+/*
+ * Looks up a variable, as vars_getn() does, by a NUL-terminated name.
+ */
+const char *vars_get(const char *name);
+
+/*
+ * Sets a variable, adding it if needed. A new variable is local to
+ * the shell until it is exported; one that was exported stays so.
+ *
+ * Parameters:
+ *   name     The name, which must not be empty or contain '='
+ *   value    The new value
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on an invalid name or if out of
+ *   memory
+ */
+int vars_set(const char *name, const char *value);
+
+/*
+ * Marks a variable exported, so that it is in the environment of
+ * every later command, optionally setting it too.
+ *
+ * Parameters:
+ *   name     The name, which must not be empty or contain '='
+ *   value    The new value, or NULL to keep the current one (a
+ *              variable that is not set is set to "")
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on an invalid name or if out of
+ *   memory
+ */
+int vars_export(const char *name, const char *value);
+
+/*
+ * Removes a variable, if it is set.
+ *
+ * Parameters:
+ *   name     The name, which must not be empty or contain '='
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on an invalid name
+ */
+int vars_unset(const char *name);
+
+/*
+ * Returns the environment to pass to an exec: a NULL-terminated vector
+ * of "NAME=value" strings, one per exported variable, in the order
+ * they were first set. The vector is only rebuilt when an exported
+ * variable has been set or unset, or a variable exported, since the
+ * last call; shell variables that are not exported do not count. It
+ * is valid until the next such change or call to vars_envp().
+ *
+ * Returns:
+ *   The vector, or NULL if out of memory
+ */
+char **vars_envp();
+
+/*
+ * Returns the environment for one command run as "NAME=value cmd":
+ * vars_envp() with each assignment added, or replacing the exported
+ * variable of the same name. The shell's own variables are not
+ * changed. The strings are not copied, and the vector is reused by
+ * the next call, so it must be handed to exec (or to a spawn that has
+ * exec'd by the time it returns) before then.
+ *
+ * Parameters:
+ *   assigns  A NULL-terminated vector of "NAME=value" strings, or NULL
+ *
+ * Returns:
+ *   The vector, which is vars_envp() itself when there are no
+ *   assignments, or NULL if out of memory
+ */
+char **vars_envp_with(char *const assigns[]);
+
+/*
+ * Returns:
+ *   A number that changes whenever a variable is set, exported or
+ *   unset
+ */
+unsigned long vars_version();
+
+#endif /* _VARS_H_ */